@@ -0,0 +1,483 @@
+/*
+    Codec microbenchmarks.
+
+    Times the functions every frame from the car goes through, over the
+    frames a session after the start is mostly made of, pre MY18 (no key)
+    and MY18 (every byte XORed with the session key), and reports per frame
+
+        ns/op       wall time, per frame, so frames per second is 1e9 / ns/op
+        allocs/op   calls to malloc, calloc and realloc
+        bytes/op    bytes asked for by those calls
+
+    Allocations are counted by wrapping the glibc allocator, elsewhere the
+    two columns are reported as -1.
+
+    Usage: bench_codec [-j] [-s] [-t ms] [filter]
+
+        -j      one JSON object per line instead of the table, for tracking
+                regressions between builds
+        -s      after each benchmark one more pass through the tracking
+                allocator, allocations per site and anything left live,
+                only what the library allocates through phev_alloc is seen
+        -t      time to spend on each benchmark, 200ms by default
+        filter  only run benchmarks whose name contains it
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phev_core.h"
+#include "phev_pipe.h"
+#include "phev_service.h"
+#include "phev_alloc.h"
+#include "msg_utils.h"
+
+#define BENCH_DEFAULT_MS 200
+#define BENCH_MAX_FRAMES 16
+// What the car sends in one segment after KO_WF_EV_UPDATE_SP
+#define BENCH_BURST_FRAMES 50
+
+typedef struct benchFrame_t {
+    uint8_t data[64];
+    size_t length;
+} benchFrame_t;
+
+typedef struct benchSet_t {
+    const char * name;
+    benchFrame_t frames[BENCH_MAX_FRAMES];
+    size_t numberOfFrames;
+    // Whole set back to back, as one read from the socket
+    message_t * burst;
+    // The set repeated to BENCH_BURST_FRAMES frames, as one read
+    message_t * longBurst;
+    // Decoded and parsed once up front for the benchmarks that start from them
+    phevMessage_t messages[BENCH_MAX_FRAMES];
+    message_t * decoded[BENCH_MAX_FRAMES];
+} benchSet_t;
+
+typedef size_t (* benchFunction_t)(benchSet_t * set);
+
+typedef struct benchResult_t {
+    uint64_t ops;
+    uint64_t ns;
+    uint64_t allocs;
+    uint64_t bytes;
+} benchResult_t;
+
+// Register updates, the VIN, a ping response and an ack as the car sends them, checksums are filled in
+static const uint8_t preMy18Frames[][32] = {
+    {0x6f, 0x0a, 0x00, 0x12, 0x00, 0x06, 0x06, 0x13, 0x05, 0x13, 0x01, 0x00},
+    {0x6f, 0x04, 0x00, 0x1d, 0x50, 0x00},
+    {0x6f, 0x04, 0x00, 0x1f, 0x01, 0x00},
+    {0x6f, 0x04, 0x00, 0x18, 0x01, 0x00},
+    {0x3f, 0x04, 0x01, 0x0a, 0x00, 0x00},
+    {0x6f, 0x04, 0x01, 0x0a, 0x00, 0x00},
+    {0x6f, 0x0a, 0x00, 0x13, 0x00, 0x05, 0x16, 0x15, 0x03, 0x0d, 0x01, 0x00},
+    {0x6f, 0x17, 0x00, 0x15, 0x01, 'J', 'M', 'A', 'X', 'D', 'G', 'G', '2', 'W', 'G', 'Z', '0', '0', '2', '0', '3', 0x01, 0x00, 0x00},
+};
+
+// The same traffic from an MY18 car with the key the session ran under
+static const uint8_t my18Key = 0x21;
+
+static const char * benchCommands[] = {
+    "{ \"updateRegister\" : { \"register\" : 10, \"value\" : 1 } }",
+    "{ \"updateRegister\" : { \"register\" : 4, \"value\" : 2 } }",
+    "{ \"operation\" : { \"airCon\" : \"on\" } }",
+    "{ \"operation\" : { \"headLights\" : \"off\" } }",
+};
+
+static volatile size_t benchSink = 0;
+
+#ifdef __GLIBC__
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t number, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+static int benchCounting = 0;
+static uint64_t benchAllocs = 0;
+static uint64_t benchBytes = 0;
+
+void * malloc(size_t size)
+{
+    if(benchCounting)
+    {
+        benchAllocs++;
+        benchBytes += size;
+    }
+    return __libc_malloc(size);
+}
+void * calloc(size_t number, size_t size)
+{
+    if(benchCounting)
+    {
+        benchAllocs++;
+        benchBytes += number * size;
+    }
+    return __libc_calloc(number, size);
+}
+void * realloc(void * ptr, size_t size)
+{
+    if(benchCounting)
+    {
+        benchAllocs++;
+        benchBytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+#define BENCH_COUNT_ALLOCS 1
+#else
+static int benchCounting = 0;
+static uint64_t benchAllocs = 0;
+static uint64_t benchBytes = 0;
+#define BENCH_COUNT_ALLOCS 0
+#endif
+
+static void bench_fixChecksum(uint8_t * frame)
+{
+    size_t length = frame[1] + 2;
+
+    frame[length - 1] = phev_core_checksum(frame);
+}
+static void bench_addFrame(benchSet_t * set, const uint8_t * plain, uint8_t key)
+{
+    benchFrame_t * frame = &set->frames[set->numberOfFrames++];
+
+    frame->length = plain[1] + 2;
+    memcpy(frame->data, plain, frame->length);
+    bench_fixChecksum(frame->data);
+
+    for(size_t i = 0; key && i < frame->length; i++)
+    {
+        frame->data[i] ^= key;
+    }
+}
+static bool bench_prepare(benchSet_t * set)
+{
+    size_t total = 0;
+    uint8_t burst[BENCH_BURST_FRAMES * 64];
+
+    for(size_t i = 0; i < set->numberOfFrames; i++)
+    {
+        memcpy(burst + total, set->frames[i].data, set->frames[i].length);
+        total += set->frames[i].length;
+
+        set->decoded[i] = phev_core_extractAndDecodeIncomingMessageAndXOR(set->frames[i].data, set->frames[i].length);
+
+        message_t * extracted = phev_core_extractIncomingMessageAndXOR(set->frames[i].data, set->frames[i].length);
+
+        if(extracted)
+        {
+            msg_utils_destroyMsg(extracted);
+        }
+        if(set->decoded[i] == NULL || extracted == NULL || !phev_core_decodeMessage(set->frames[i].data, set->frames[i].length, &set->messages[i]))
+        {
+            fprintf(stderr, "%s frame %zu does not decode\n", set->name, i);
+            return false;
+        }
+    }
+    set->burst = msg_utils_createMsg(burst, total);
+
+    for(size_t i = set->numberOfFrames; i < BENCH_BURST_FRAMES; i++)
+    {
+        const benchFrame_t * frame = &set->frames[i % set->numberOfFrames];
+
+        memcpy(burst + total, frame->data, frame->length);
+        total += frame->length;
+    }
+    set->longBurst = msg_utils_createMsg(burst, total);
+
+    return set->burst != NULL && set->longBurst != NULL;
+}
+static size_t bench_checksum(benchSet_t * set)
+{
+    for(size_t i = 0; i < set->numberOfFrames; i++)
+    {
+        benchSink += phev_core_checksum(set->decoded[i]->data);
+    }
+    return set->numberOfFrames;
+}
+static size_t bench_decodeMessage(benchSet_t * set)
+{
+    phevMessage_t message;
+
+    for(size_t i = 0; i < set->numberOfFrames; i++)
+    {
+        benchSink += phev_core_decodeMessage(set->frames[i].data, set->frames[i].length, &message);
+        phev_free(message.data);
+    }
+    return set->numberOfFrames;
+}
+static size_t bench_encodeMessage(benchSet_t * set)
+{
+    uint8_t * out = NULL;
+
+    for(size_t i = 0; i < set->numberOfFrames; i++)
+    {
+        benchSink += phev_core_encodeMessage(&set->messages[i], &out);
+        phev_free(out);
+    }
+    return set->numberOfFrames;
+}
+static size_t bench_extractIncoming(benchSet_t * set)
+{
+    for(size_t i = 0; i < set->numberOfFrames; i++)
+    {
+        message_t * message = phev_core_extractIncomingMessageAndXOR(set->frames[i].data, set->frames[i].length);
+
+        benchSink += message->length;
+        msg_utils_destroyMsg(message);
+    }
+    return set->numberOfFrames;
+}
+// What the splitter does once it knows the car's key, the set is all under one key
+static size_t bench_extractIncomingExpect(benchSet_t * set)
+{
+    const uint8_t xor = phev_core_getMessageXOR(set->decoded[0]);
+
+    for(size_t i = 0; i < set->numberOfFrames; i++)
+    {
+        message_t * message = phev_core_extractIncomingMessageExpectXOR(set->frames[i].data, set->frames[i].length, xor, NULL);
+
+        benchSink += message->length;
+        msg_utils_destroyMsg(message);
+    }
+    return set->numberOfFrames;
+}
+static size_t bench_outputSplitter(benchSet_t * set)
+{
+    static phev_pipe_ctx_t pipe;
+    messageBundle_t * bundle = phev_pipe_outputSplitter(&pipe, set->burst);
+
+    for(int i = 0; i < bundle->numMessages; i++)
+    {
+        msg_utils_destroyMsg(bundle->messages[i]);
+    }
+    free(bundle);
+
+    return set->numberOfFrames;
+}
+static size_t bench_scanFrames(benchSet_t * set)
+{
+    phevFrame_t frames[BENCH_BURST_FRAMES];
+    uint8_t xor = 0;
+    size_t used = 0;
+    size_t numberOfFrames = phev_core_scanIncomingFrames(set->longBurst->data, set->longBurst->length, &xor, frames, BENCH_BURST_FRAMES, &used, NULL);
+
+    benchSink += used;
+
+    return numberOfFrames;
+}
+static size_t bench_outputSplitterBurst(benchSet_t * set)
+{
+    static phev_pipe_ctx_t pipe;
+    messageBundle_t * bundle = phev_pipe_outputSplitter(&pipe, set->longBurst);
+    size_t numberOfMessages = bundle->numMessages;
+
+    for(int i = 0; i < bundle->numMessages; i++)
+    {
+        msg_utils_destroyMsg(bundle->messages[i]);
+    }
+    free(bundle);
+
+    return numberOfMessages;
+}
+static size_t bench_jsonOutputTransformer(benchSet_t * set)
+{
+    for(size_t i = 0; i < set->numberOfFrames; i++)
+    {
+        message_t * json = phev_service_jsonOutputTransformer(NULL, set->decoded[i]);
+
+        if(json)
+        {
+            benchSink += json->length;
+            msg_utils_destroyMsg(json);
+        }
+    }
+    return set->numberOfFrames;
+}
+static size_t bench_jsonCommand(benchSet_t * set)
+{
+    const size_t numberOfCommands = sizeof(benchCommands) / sizeof(benchCommands[0]);
+
+    for(size_t i = 0; i < numberOfCommands; i++)
+    {
+        phevMessage_t * message = phev_service_jsonCommandToPhevMessage(benchCommands[i]);
+
+        if(message)
+        {
+            benchSink += message->reg;
+            phev_core_destroyMessage(message);
+        }
+    }
+    return numberOfCommands;
+}
+static benchResult_t bench_measure(benchFunction_t function, benchSet_t * set, uint64_t budgetNs)
+{
+    benchResult_t result = {0};
+    uint64_t rounds = 1;
+
+    // Warm up, then grow the batch until one takes a tenth of the budget
+    function(set);
+
+    for(;;)
+    {
+        uint64_t start = phev_core_monotonicNs();
+
+        for(uint64_t i = 0; i < rounds; i++)
+        {
+            function(set);
+        }
+        if(phev_core_monotonicNs() - start >= budgetNs / 10 || rounds >= (1ULL << 30))
+        {
+            break;
+        }
+        rounds *= 2;
+    }
+
+    benchAllocs = 0;
+    benchBytes = 0;
+    benchCounting = 1;
+
+    uint64_t start = phev_core_monotonicNs();
+
+    while(result.ns < budgetNs)
+    {
+        for(uint64_t i = 0; i < rounds; i++)
+        {
+            result.ops += function(set);
+        }
+        result.ns = phev_core_monotonicNs() - start;
+    }
+    benchCounting = 0;
+    result.allocs = benchAllocs;
+    result.bytes = benchBytes;
+
+    return result;
+}
+static void bench_report(const char * name, const char * setName, benchResult_t result, bool json)
+{
+    double ns = (double) result.ns / (double) result.ops;
+    double allocs = (BENCH_COUNT_ALLOCS ? (double) result.allocs / (double) result.ops : -1);
+    double bytes = (BENCH_COUNT_ALLOCS ? (double) result.bytes / (double) result.ops : -1);
+
+    if(json)
+    {
+        printf("{\"benchmark\":\"%s\",\"frames\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}\n",
+            name, setName, (unsigned long long) result.ops, ns, allocs, bytes);
+    }
+    else
+    {
+        printf("%-24s %-9s %10.1f %10.2f %10.1f\n", name, setName, ns, allocs, bytes);
+    }
+}
+static void bench_sites(benchFunction_t function, benchSet_t * set)
+{
+    phevAllocTracker_t * tracker = phev_alloc_createTracker(NULL, 0);
+    phevAllocator_t allocator = phev_alloc_trackerAllocator(tracker);
+    phevAllocSite_t site;
+
+    phev_alloc_setAllocator(&allocator);
+    size_t ops = function(set);
+    phev_alloc_setAllocator(NULL);
+
+    for(int i = phev_alloc_nextSite(tracker, 0, &site); i > 0 && ops; i = phev_alloc_nextSite(tracker, i, &site))
+    {
+        const char * name = strrchr(site.site, '/');
+
+        printf("    %-38s %10.2f %10.1f\n", (name ? name + 1 : site.site), (double) site.allocations / (double) ops, (double) site.bytes / (double) ops);
+    }
+    phevAllocStats_t stats = phev_alloc_trackerStats(tracker);
+
+    if(stats.liveBlocks)
+    {
+        printf("    left live %zu bytes in %zu blocks\n", stats.liveBytes, stats.liveBlocks);
+    }
+    phev_alloc_destroyTracker(tracker);
+}
+int main(int argc, char * argv[])
+{
+    static benchSet_t sets[2] = {
+        { .name = "pre-my18" },
+        { .name = "my18" },
+    };
+    const struct {
+        const char * name;
+        benchFunction_t function;
+        bool perSet;
+    } benchmarks[] = {
+        { "checksum", bench_checksum, true },
+        { "decodeMessage", bench_decodeMessage, true },
+        { "encodeMessage", bench_encodeMessage, true },
+        { "extractIncomingAndXOR", bench_extractIncoming, true },
+        { "extractIncomingExpectXOR", bench_extractIncomingExpect, true },
+        { "outputSplitter", bench_outputSplitter, true },
+        { "scanFrames50", bench_scanFrames, true },
+        { "outputSplitter50", bench_outputSplitterBurst, true },
+        { "jsonOutputTransformer", bench_jsonOutputTransformer, true },
+        { "jsonCommandToMessage", bench_jsonCommand, false },
+    };
+    bool json = false;
+    bool sites = false;
+    uint64_t budgetMs = BENCH_DEFAULT_MS;
+    const char * filter = NULL;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0)
+        {
+            json = true;
+        }
+        else if(strcmp(argv[i], "-s") == 0)
+        {
+            sites = true;
+        }
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            budgetMs = strtoull(argv[++i], NULL, 10);
+        }
+        else
+        {
+            filter = argv[i];
+        }
+    }
+
+    if(sites)
+    {
+        phev_service_useAllocator();
+    }
+    for(size_t i = 0; i < sizeof(preMy18Frames) / sizeof(preMy18Frames[0]); i++)
+    {
+        bench_addFrame(&sets[0], preMy18Frames[i], 0);
+        bench_addFrame(&sets[1], preMy18Frames[i], my18Key);
+    }
+    for(size_t i = 0; i < 2; i++)
+    {
+        if(!bench_prepare(&sets[i]))
+        {
+            return 1;
+        }
+    }
+
+    if(!json)
+    {
+        printf("%-24s %-9s %10s %10s %10s\n", "benchmark", "frames", "ns/op", "allocs/op", "bytes/op");
+    }
+    for(size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++)
+    {
+        if(filter && strstr(benchmarks[b].name, filter) == NULL)
+        {
+            continue;
+        }
+        for(size_t s = 0; s < (benchmarks[b].perSet ? 2 : 1); s++)
+        {
+            benchResult_t result = bench_measure(benchmarks[b].function, &sets[s], budgetMs * 1000000ULL);
+
+            bench_report(benchmarks[b].name, (benchmarks[b].perSet ? sets[s].name : "-"), result, json);
+
+            if(sites && !json)
+            {
+                bench_sites(benchmarks[b].function, &sets[s]);
+            }
+        }
+    }
+    return 0;
+}
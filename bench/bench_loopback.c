@@ -0,0 +1,100 @@
+/*
+    Protocol stack benchmark over the in memory loopback transport.
+
+    phev_init and phev_start run as they would against a car, but the
+    transport is a loopback whose responder plays the car on the pipe's own
+    thread: every time the pipe reads with nothing buffered it gets a burst
+    of register updates, each value changed from the last burst so the model
+    reports every one. There are no system calls on the data path, so the
+    time per frame is the CPU cost of the pipe, service and model.
+
+    Usage: bench_loopback [bursts]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phev.h"
+#include "phev_core.h"
+#include "phev_transport.h"
+
+#define BENCH_DEFAULT_BURSTS 20000
+#define BENCH_FRAMES_PER_BURST 20
+#define BENCH_FIRST_REGISTER 0x40
+
+typedef struct benchCar_t {
+    phevCtx_t * phev;
+    int bursts;
+    int sent;
+    uint64_t writes;
+    uint64_t updates;
+} benchCar_t;
+
+static benchCar_t car;
+
+static void bench_frame(uint8_t * frame, uint8_t reg, uint8_t value)
+{
+    frame[0] = RESP_CMD;
+    frame[1] = DEFAULT_CMD_LENGTH;
+    frame[2] = REQUEST_TYPE;
+    frame[3] = reg;
+    frame[4] = value;
+    frame[5] = phev_core_checksum(frame);
+}
+static void bench_responder(phevTransport_t * transport, const uint8_t * data, size_t length, void * ctx)
+{
+    uint8_t burst[BENCH_FRAMES_PER_BURST * 6];
+
+    if(data)
+    {
+        car.writes++;
+        return;
+    }
+    if(car.sent == car.bursts)
+    {
+        phev_exit(car.phev);
+        return;
+    }
+    for(int i = 0; i < BENCH_FRAMES_PER_BURST; i++)
+    {
+        bench_frame(burst + i * 6, (uint8_t) (BENCH_FIRST_REGISTER + i), (uint8_t) car.sent);
+    }
+    phev_transport_loopbackInject(transport, burst, sizeof(burst));
+    car.sent++;
+}
+static int bench_eventHandler(phevEvent_t * event)
+{
+    if(event->type == PHEV_REGISTER_UPDATE)
+    {
+        car.updates++;
+    }
+    return 0;
+}
+int main(int argc, char * argv[])
+{
+    uint8_t mac[MAC_ADDR_SIZE] = {0};
+
+    car.bursts = (argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_BURSTS);
+
+    phevTransport_t * transport = phev_transport_loopback(bench_responder, &car);
+    phevSettings_t settings = {
+        .host = "loopback",
+        .mac = mac,
+        .handler = bench_eventHandler,
+        .transport = transport,
+    };
+
+    car.phev = phev_init(settings);
+
+    uint64_t start = phev_core_monotonicNs();
+
+    phev_start(car.phev);
+
+    uint64_t elapsed = phev_core_monotonicNs() - start;
+    uint64_t frames = (uint64_t) car.sent * BENCH_FRAMES_PER_BURST;
+
+    printf("%d bursts of %d frames, %llu updates, %llu writes\n", car.sent, BENCH_FRAMES_PER_BURST,
+        (unsigned long long) car.updates, (unsigned long long) car.writes);
+    printf("%.1f ns/frame\n", (frames ? (double) elapsed / frames : 0));
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+    Read path benchmark.
+
+    Sends bursts of frames over a loopback TCP connection and times how long
+    the transport takes to hand them over, per frame:
+
+        baseline   select and read per call and an XOR decode of every read,
+                   which is what phev_tcpClientRead did before for the
+                   hexdump. It skipped reads of 256 bytes or more, a whole
+                   burst, here every read is decoded so the row has the
+                   cost it claims
+        no sink    phev_tcpClientRead with no log sink attached, it frames
+                   and checks the checksum of every frame
+        ring sink  phev_tcpClientRead with every frame handed to a sink
+                   behind the background ring
+
+    Frame logging is compiled out of the library below PHEV_LOG_DEBUG. The
+    ring sink row then hands each frame to phev_log_frame itself, as a debug
+    build of phev_tcpClientTakeFrames does, so it measures the ring either way.
+
+    Usage: bench_read_path [bursts]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "phev_core.h"
+#include "phev_tcpip.h"
+#include "phev_log.h"
+
+#define BENCH_FRAMES_PER_BURST 50
+#define BENCH_DEFAULT_BURSTS 2000
+
+typedef enum {
+    BENCH_BASELINE,
+    BENCH_NO_SINK,
+    BENCH_RING_SINK,
+} benchMode_t;
+
+static const uint8_t benchFrame[] = {0x6f, 0x0a, 0x00, 0x12, 0x00, 0x06, 0x06, 0x13, 0x05, 0x13, 0x01, 0xc3};
+
+static volatile size_t sinkBytes = 0;
+
+static void bench_sink(const char * tag, const uint8_t * data, const uint8_t * decoded, size_t length)
+{
+    sinkBytes += length;
+}
+static int bench_baselineRead(int soc, uint8_t * buf, size_t len)
+{
+    static uint8_t decoded[1024];
+    fd_set readset;
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+
+    FD_ZERO(&readset);
+    FD_SET(soc, &readset);
+    if (select(soc + 1, &readset, NULL, NULL, &timeout) <= 0)
+    {
+        return -1;
+    }
+
+    int num = read(soc, buf, len);
+
+    if (num > 2 && (size_t) num <= sizeof(decoded))
+    {
+        phev_core_decodeFrame(buf, (size_t) num, decoded);
+    }
+    return num;
+}
+static int bench_ringRead(int soc, uint8_t * buf, size_t len)
+{
+    int num = phev_tcpClientRead(soc, buf, len);
+
+#if PHEV_LOG_LEVEL < PHEV_LOG_DEBUG
+    for (int offset = 0; offset < num; )
+    {
+        int length = phev_core_frameLength(buf + offset, (size_t) (num - offset));
+
+        if (length <= 0)
+        {
+            break;
+        }
+        if (phev_log_hasSink())
+        {
+            phev_log_frame("READ", buf + offset, (size_t) length);
+        }
+        offset += length;
+    }
+#endif
+    return num;
+}
+static double bench_run(const char * name, int client, int server, int bursts, benchMode_t mode)
+{
+    uint8_t burst[sizeof(benchFrame) * BENCH_FRAMES_PER_BURST];
+    uint8_t buf[1024];
+
+    for (int i = 0; i < BENCH_FRAMES_PER_BURST; i++)
+    {
+        memcpy(burst + i * sizeof(benchFrame), benchFrame, sizeof(benchFrame));
+    }
+
+    uint64_t total = 0;
+
+    for (int b = 0; b < bursts; b++)
+    {
+        if (write(server, burst, sizeof(burst)) != (ssize_t) sizeof(burst))
+        {
+            fprintf(stderr, "write failed\n");
+            return 0;
+        }
+
+        size_t received = 0;
+        uint64_t start = phev_core_monotonicNs();
+
+        while (received < sizeof(burst))
+        {
+            int num;
+
+            switch (mode)
+            {
+            case BENCH_BASELINE:
+                num = bench_baselineRead(client, buf, sizeof(buf));
+                break;
+            case BENCH_RING_SINK:
+                num = bench_ringRead(client, buf, sizeof(buf));
+                break;
+            default:
+                num = phev_tcpClientRead(client, buf, sizeof(buf));
+                break;
+            }
+
+            if (num < 0)
+            {
+                fprintf(stderr, "read failed\n");
+                return 0;
+            }
+            received += (size_t) num;
+        }
+        total += phev_core_monotonicNs() - start;
+
+        // The car pauses between bursts, give the consumer the same chance to empty the ring, untimed
+        while (mode == BENCH_RING_SINK && sinkBytes + phev_log_dropped() * sizeof(benchFrame) < (size_t) (b + 1) * sizeof(burst))
+        {
+            usleep(100);
+        }
+    }
+
+    double perFrame = (double) total / ((double) bursts * BENCH_FRAMES_PER_BURST);
+
+    printf("%-10s %8.1f ns/frame\n", name, perFrame);
+
+    return perFrame;
+}
+int main(int argc, char * argv[])
+{
+    int bursts = (argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_BURSTS);
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 1) != 0)
+    {
+        fprintf(stderr, "cannot listen on loopback\n");
+        return 1;
+    }
+    getsockname(listener, (struct sockaddr *) &addr, &addrLength);
+
+    int client = phev_tcpClientConnectSocket("127.0.0.1", ntohs(addr.sin_port));
+    int server = accept(listener, NULL, NULL);
+
+    if (client < 0 || server < 0)
+    {
+        fprintf(stderr, "cannot connect on loopback\n");
+        return 1;
+    }
+
+    printf("%d bursts of %d frames\n", bursts, BENCH_FRAMES_PER_BURST);
+
+    bench_run("baseline", client, server, bursts, BENCH_BASELINE);
+    bench_run("no sink", client, server, bursts, BENCH_NO_SINK);
+
+    phev_log_setSink(bench_sink);
+    phev_log_start();
+    bench_run("ring sink", client, server, bursts, BENCH_RING_SINK);
+    phev_log_stop();
+    phev_log_setSink(NULL);
+
+    printf("sink got %zu of %zu bytes, dropped %u\n", (size_t) sinkBytes,
+           (size_t) bursts * BENCH_FRAMES_PER_BURST * sizeof(benchFrame), phev_log_dropped());
+
+    phev_tcpClientDisconnectSocket(client);
+    close(server);
+    close(listener);
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+    Command round trip benchmark.
+
+    A loopback car answers every request frame with a response and ignores
+    responses, like the car does with the acks the pipe sends for register
+    updates. Each iteration writes an ack and then a command as two writes,
+    the way the pipe does when a command follows an update, and times until
+    the car's response arrives. It runs once with the default socket options
+    and once with the low latency ones.
+
+    Usage: bench_roundtrip [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "phev_core.h"
+#include "phev_tcpip.h"
+#include "phev_transport.h"
+
+#define BENCH_DEFAULT_ITERATIONS 200
+#define BENCH_REGISTER KO_WF_H_LAMP_CONT_SP
+
+typedef struct benchCar_t {
+    int listener;
+    int soc;
+} benchCar_t;
+
+static void bench_frame(uint8_t * frame, uint8_t command, uint8_t type, uint8_t reg, uint8_t value)
+{
+    frame[0] = command;
+    frame[1] = DEFAULT_CMD_LENGTH;
+    frame[2] = type;
+    frame[3] = reg;
+    frame[4] = value;
+    frame[5] = phev_core_checksum(frame);
+}
+static void * bench_car(void * arg)
+{
+    benchCar_t * car = (benchCar_t *) arg;
+    uint8_t buf[1024];
+    size_t end = 0;
+
+    car->soc = accept(car->listener, NULL, NULL);
+
+    while (car->soc >= 0)
+    {
+        ssize_t num = read(car->soc, buf + end, sizeof(buf) - end);
+
+        if (num <= 0)
+        {
+            break;
+        }
+        end += (size_t) num;
+
+        size_t start = 0;
+        int length;
+
+        while ((length = phev_core_frameLength(buf + start, end - start)) != 0)
+        {
+            if (length < 0)
+            {
+                start++;
+                continue;
+            }
+            if (buf[start + 2] == REQUEST_TYPE)
+            {
+                uint8_t response[6];
+
+                bench_frame(response, RESP_CMD, RESPONSE_TYPE, buf[start + 3], 0);
+                if (write(car->soc, response, sizeof(response)) != (ssize_t) sizeof(response))
+                {
+                    return NULL;
+                }
+            }
+            start += (size_t) length;
+        }
+        memmove(buf, buf + start, end - start);
+        end -= start;
+    }
+    return NULL;
+}
+static int bench_compare(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+static int bench_run(const char * name, const phevTcpOptions_t * options, int iterations)
+{
+    benchCar_t car = { .listener = socket(AF_INET, SOCK_STREAM, 0), .soc = -1 };
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    pthread_t thread;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if (car.listener < 0 || bind(car.listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(car.listener, 1) != 0)
+    {
+        fprintf(stderr, "cannot listen on loopback\n");
+        return -1;
+    }
+    getsockname(car.listener, (struct sockaddr *) &addr, &addrLength);
+    pthread_create(&thread, NULL, bench_car, &car);
+
+    phevTransport_t * transport = phev_transport_tcp("127.0.0.1", ntohs(addr.sin_port));
+    int ret = -1;
+
+    phev_transport_tcpSetOptions(transport, options);
+
+    while (transport && (ret = phev_transport_connect(transport)) == PHEV_TRANSPORT_CONNECTING)
+    {
+    }
+    if (ret != 0)
+    {
+        fprintf(stderr, "cannot connect on loopback\n");
+        return -1;
+    }
+
+    uint64_t * samples = malloc(sizeof(uint64_t) * (size_t) iterations);
+    uint64_t total = 0;
+    uint8_t ack[6];
+    uint8_t command[6];
+    uint8_t buf[1024];
+
+    bench_frame(ack, SEND_CMD, RESPONSE_TYPE, KO_WF_BATT_LEVEL_INFO_REP_EVR, 0);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        bench_frame(command, SEND_CMD, REQUEST_TYPE, BENCH_REGISTER, (uint8_t) (i & 1) + 1);
+
+        uint64_t start = phev_core_monotonicNs();
+
+        phev_transport_write(transport, ack, sizeof(ack));
+        phev_transport_write(transport, command, sizeof(command));
+
+        int num = phev_transport_read(transport, buf, sizeof(buf));
+
+        samples[i] = phev_core_monotonicNs() - start;
+        total += samples[i];
+
+        if (num <= 0)
+        {
+            fprintf(stderr, "no response from the car\n");
+            break;
+        }
+    }
+
+    qsort(samples, (size_t) iterations, sizeof(uint64_t), bench_compare);
+
+    printf("%-10s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", name,
+           (double) total / iterations / 1000.0,
+           (double) samples[iterations / 2] / 1000.0,
+           (double) samples[(iterations * 99) / 100] / 1000.0);
+
+    free(samples);
+    phev_transport_destroy(transport);
+    pthread_join(thread, NULL);
+    close(car.soc);
+    close(car.listener);
+
+    return 0;
+}
+int main(int argc, char * argv[])
+{
+    int iterations = (argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_ITERATIONS);
+    const phevTcpOptions_t defaults = { 0 };
+    const phevTcpOptions_t tuned = {
+        .noDelay = true,
+        .quickAck = true,
+        .keepAliveIdle = 30,
+        .keepAliveInterval = 10,
+        .keepAliveCount = 3,
+        .userTimeoutMs = 10000,
+    };
+
+    if (iterations <= 0)
+    {
+        iterations = BENCH_DEFAULT_ITERATIONS;
+    }
+
+    printf("%d command round trips\n", iterations);
+
+    bench_run("defaults", &defaults, iterations);
+    bench_run("tuned", &tuned, iterations);
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+    Gateway transport benchmark.
+
+    Opens a few hundred loopback connections, each one a simulated car. Every
+    round each car sends a burst of frames, then the client side reads every
+    connection until its burst has arrived, and in the second run of each
+    backend also writes an ack the way a pipe loop would. It runs with the
+    read and write hooks and with the io_uring ones, and reports the client
+    side time per frame.
+
+    Usage: bench_uring [connections] [rounds]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "phev_core.h"
+#include "phev_tcpip.h"
+#include "phev_uring.h"
+
+#define BENCH_DEFAULT_CONNECTIONS 200
+#define BENCH_DEFAULT_ROUNDS 200
+#define BENCH_FRAMES_PER_BURST 20
+
+typedef struct benchHooks_t {
+    const char * name;
+    int (* connect)(const char *, uint16_t);
+    int (* disconnect)(int);
+    int (* read)(int, uint8_t *, size_t);
+    int (* write)(int, uint8_t *, size_t);
+} benchHooks_t;
+
+static const uint8_t benchFrame[] = {0x6f, 0x0a, 0x00, 0x12, 0x00, 0x06, 0x06, 0x13, 0x05, 0x13, 0x01, 0xc3};
+
+static uint8_t benchAck[] = {0xf6, 0x04, 0x01, 0x12, 0x00, 0x0d};
+
+static double bench_run(const benchHooks_t * hooks, int connections, int rounds, int ack)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int * clients = calloc((size_t) connections, sizeof(int));
+    int * cars = calloc((size_t) connections, sizeof(int));
+    uint8_t burst[sizeof(benchFrame) * BENCH_FRAMES_PER_BURST];
+    uint8_t buf[1024];
+    uint64_t total = 0;
+
+    for (int i = 0; i < BENCH_FRAMES_PER_BURST; i++)
+    {
+        memcpy(burst + i * sizeof(benchFrame), benchFrame, sizeof(benchFrame));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, connections) != 0)
+    {
+        fprintf(stderr, "cannot listen on loopback\n");
+        return 0;
+    }
+    getsockname(listener, (struct sockaddr *) &addr, &addrLength);
+
+    for (int c = 0; c < connections; c++)
+    {
+        clients[c] = hooks->connect("127.0.0.1", ntohs(addr.sin_port));
+        cars[c] = accept(listener, NULL, NULL);
+
+        if (clients[c] < 0 || cars[c] < 0)
+        {
+            fprintf(stderr, "cannot open connection %d\n", c);
+            return 0;
+        }
+        // The cars never read, acks are drained between rounds
+        fcntl(cars[c], F_SETFL, fcntl(cars[c], F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int c = 0; c < connections; c++)
+        {
+            if (write(cars[c], burst, sizeof(burst)) != (ssize_t) sizeof(burst))
+            {
+                fprintf(stderr, "car %d cannot send\n", c);
+                return 0;
+            }
+        }
+
+        uint64_t start = phev_core_monotonicNs();
+
+        for (int c = 0; c < connections; c++)
+        {
+            size_t received = 0;
+
+            while (received < sizeof(burst))
+            {
+                int num = hooks->read(clients[c], buf, sizeof(buf));
+
+                if (num < 0)
+                {
+                    fprintf(stderr, "connection %d read failed\n", c);
+                    return 0;
+                }
+                received += (size_t) num;
+            }
+            if (ack)
+            {
+                hooks->write(clients[c], benchAck, sizeof(benchAck));
+            }
+        }
+        total += phev_core_monotonicNs() - start;
+
+        for (int c = 0; c < connections; c++)
+        {
+            while (read(cars[c], buf, sizeof(buf)) > 0);
+        }
+    }
+
+    for (int c = 0; c < connections; c++)
+    {
+        hooks->disconnect(clients[c]);
+        close(cars[c]);
+    }
+    close(listener);
+    free(clients);
+    free(cars);
+
+    double perFrame = (double) total / ((double) rounds * connections * BENCH_FRAMES_PER_BURST);
+
+    printf("%-10s %-8s %8.1f ns/frame\n", hooks->name, (ack ? "acked" : "read"), perFrame);
+
+    return perFrame;
+}
+int main(int argc, char * argv[])
+{
+    int connections = (argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_CONNECTIONS);
+    int rounds = (argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_ROUNDS);
+    const benchHooks_t tcp = {
+        .name = "tcp",
+        .connect = phev_tcpClientConnectSocket,
+        .disconnect = phev_tcpClientDisconnectSocket,
+        .read = phev_tcpClientRead,
+        .write = phev_tcpClientWrite,
+    };
+    const benchHooks_t uring = {
+        .name = "io_uring",
+        .connect = phev_uringConnect,
+        .disconnect = phev_uringDisconnect,
+        .read = phev_uringRead,
+        .write = phev_uringWrite,
+    };
+    struct rlimit files;
+
+    // Both ends of every connection are in this process
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max)
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    printf("%d connections, %d rounds of %d frames\n", connections, rounds, BENCH_FRAMES_PER_BURST);
+
+    bench_run(&tcp, connections, rounds, 0);
+    bench_run(&tcp, connections, rounds, 1);
+
+    if (!phev_uringAvailable())
+    {
+        printf("io_uring not available\n");
+        return 0;
+    }
+    bench_run(&uring, connections, rounds, 0);
+    bench_run(&uring, connections, rounds, 1);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef _PHEV_FUZZ_BUDGET_H_
+#define _PHEV_FUZZ_BUDGET_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "phev_alloc.h"
+#include "phev_service.h"
+
+/*
+    Per input budgets for the fuzz targets.
+
+    libFuzzer only stops an input after -timeout seconds or -rss_limit_mb,
+    far too late to catch a frame that makes the read loop go quadratic. Each
+    target brackets its work with fuzz_budget_begin and fuzz_budget_end,
+    which abort, so the input is kept as a crash, when it took longer than
+    the time budget or made more allocations, or asked for more bytes, than
+    a fixed base plus an amount per input byte. Library allocations and cJSON
+    are both counted, the messaging library's own malloc is not.
+
+    PHEV_FUZZ_TIME_US, PHEV_FUZZ_ALLOCS_PER_BYTE and PHEV_FUZZ_BYTES_PER_BYTE
+    in the environment override the defaults below, the first run under a
+    sanitizer can need a looser time budget.
+*/
+#define PHEV_FUZZ_TIME_US 20000
+#define PHEV_FUZZ_ALLOCS_BASE 256
+#define PHEV_FUZZ_ALLOCS_PER_BYTE 2
+#define PHEV_FUZZ_BYTES_BASE (64 * 1024)
+#define PHEV_FUZZ_BYTES_PER_BYTE 64
+
+typedef struct fuzzBudget_t {
+    uint64_t timeUs;
+    uint64_t allocsPerByte;
+    uint64_t bytesPerByte;
+    uint64_t start;
+    uint64_t allocs;
+    uint64_t bytes;
+} fuzzBudget_t;
+
+static fuzzBudget_t fuzzBudget;
+
+// No header on the blocks, anything allocated here can be released with plain free and the other way round.
+static void * fuzz_budget_malloc(size_t size, const char * site, void * ctx)
+{
+    fuzzBudget.allocs++;
+    fuzzBudget.bytes += size;
+
+    return malloc(size);
+}
+static void * fuzz_budget_realloc(void * ptr, size_t size, const char * site, void * ctx)
+{
+    fuzzBudget.allocs++;
+    fuzzBudget.bytes += size;
+
+    return realloc(ptr, size);
+}
+static void fuzz_budget_free(void * ptr, void * ctx)
+{
+    free(ptr);
+}
+static uint64_t fuzz_budget_env(const char * name, uint64_t value)
+{
+    const char * env = getenv(name);
+
+    return (env && *env ? strtoull(env, NULL, 10) : value);
+}
+static void fuzz_budget_init(void)
+{
+    static const phevAllocator_t allocator = {
+        .malloc = fuzz_budget_malloc,
+        .realloc = fuzz_budget_realloc,
+        .free = fuzz_budget_free,
+    };
+    phev_alloc_setAllocator(&allocator);
+    phev_service_useAllocator();
+
+    fuzzBudget.timeUs = fuzz_budget_env("PHEV_FUZZ_TIME_US", PHEV_FUZZ_TIME_US);
+    fuzzBudget.allocsPerByte = fuzz_budget_env("PHEV_FUZZ_ALLOCS_PER_BYTE", PHEV_FUZZ_ALLOCS_PER_BYTE);
+    fuzzBudget.bytesPerByte = fuzz_budget_env("PHEV_FUZZ_BYTES_PER_BYTE", PHEV_FUZZ_BYTES_PER_BYTE);
+}
+static uint64_t fuzz_budget_nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000;
+}
+static void fuzz_budget_begin(void)
+{
+    fuzzBudget.allocs = 0;
+    fuzzBudget.bytes = 0;
+    fuzzBudget.start = fuzz_budget_nowUs();
+}
+static void fuzz_budget_end(size_t size)
+{
+    uint64_t elapsed = fuzz_budget_nowUs() - fuzzBudget.start;
+    uint64_t maxAllocs = PHEV_FUZZ_ALLOCS_BASE + fuzzBudget.allocsPerByte * size;
+    uint64_t maxBytes = PHEV_FUZZ_BYTES_BASE + fuzzBudget.bytesPerByte * size;
+
+    if(elapsed > fuzzBudget.timeUs)
+    {
+        fprintf(stderr, "%zu byte input took %llu us, budget %llu us\n", size,
+            (unsigned long long) elapsed, (unsigned long long) fuzzBudget.timeUs);
+        abort();
+    }
+    if(fuzzBudget.allocs > maxAllocs || fuzzBudget.bytes > maxBytes)
+    {
+        fprintf(stderr, "%zu byte input made %llu allocations of %llu bytes, budget %llu of %llu bytes\n", size,
+            (unsigned long long) fuzzBudget.allocs, (unsigned long long) fuzzBudget.bytes,
+            (unsigned long long) maxAllocs, (unsigned long long) maxBytes);
+        abort();
+    }
+}
+
+#endif
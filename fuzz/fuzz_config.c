@@ -0,0 +1,39 @@
+/*
+    Fuzz target for the device configuration parser.
+
+    Each input is a configuration document as the device fetches it, parsed,
+    formatted for the log and released.
+*/
+#include <stdint.h>
+#include <string.h>
+#include "phev_config.h"
+#include "fuzz_budget.h"
+
+int LLVMFuzzerInitialize(int * argc, char *** argv)
+{
+    fuzz_budget_init();
+
+    return 0;
+}
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    char * text = malloc(size + 1);
+
+    memcpy(text, data, size);
+    text[size] = '\0';
+
+    fuzz_budget_begin();
+
+    phevConfig_t * config = phev_config_parseConfig(text);
+
+    if(config)
+    {
+        free(phev_config_displayConfig(config));
+        phev_config_destroyConfig(config);
+    }
+    fuzz_budget_end(size);
+
+    free(text);
+
+    return 0;
+}
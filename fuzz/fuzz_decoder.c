@@ -0,0 +1,63 @@
+/*
+    Fuzz target for the frame decoder.
+
+    Runs one buffer through everything that reads a frame header, the
+    transport's frame length scan, the logging decoder, extraction and the
+    full decode, then encodes whatever decoded back to check the round trip
+    does not read past the decoded data either.
+*/
+#include <stdint.h>
+#include <string.h>
+#include "phev_core.h"
+#include "msg_utils.h"
+#include "fuzz_budget.h"
+
+int LLVMFuzzerInitialize(int * argc, char *** argv)
+{
+    fuzz_budget_init();
+
+    return 0;
+}
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    fuzz_budget_begin();
+
+    int length = phev_core_frameLength(data, size);
+
+    if(length > (int) size)
+    {
+        abort();
+    }
+    if(size > 0)
+    {
+        uint8_t * out = malloc(size);
+
+        phev_core_decodeFrame(data, size, out);
+        free(out);
+    }
+
+    message_t * message = phev_core_extractIncomingMessageAndXOR(data, size);
+
+    if(message)
+    {
+        if(message->length > size)
+        {
+            abort();
+        }
+        msg_utils_destroyMsg(message);
+    }
+
+    phevMessage_t phevMessage;
+
+    if(phev_core_decodeMessage(data, size, &phevMessage))
+    {
+        uint8_t * encoded = NULL;
+
+        phev_core_encodeMessage(&phevMessage, &encoded);
+        phev_free(encoded);
+        phev_free(phevMessage.data);
+    }
+    fuzz_budget_end(size);
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+    Fuzz target for JSON commands.
+
+    Each input is a request document as a client sends it to the service,
+    split into requests and each one validated and turned into a register
+    update, the path phev_service_jsonInputTransformer takes before anything
+    is sent to the car.
+*/
+#include <stdint.h>
+#include <string.h>
+#include "phev_service.h"
+#include "msg_utils.h"
+#include "fuzz_budget.h"
+
+int LLVMFuzzerInitialize(int * argc, char *** argv)
+{
+    fuzz_budget_init();
+
+    return 0;
+}
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    // The service gets NUL terminated strings from its transport
+    char * text = malloc(size + 1);
+
+    memcpy(text, data, size);
+    text[size] = '\0';
+
+    message_t message = {
+        .data = (uint8_t *) text,
+        .length = size + 1,
+    };
+
+    fuzz_budget_begin();
+
+    messageBundle_t * messages = phev_service_inputSplitter(NULL, &message);
+
+    if(messages)
+    {
+        for(int i = 0; i < messages->numMessages; i++)
+        {
+            phevMessage_t * phevMessage = phev_service_jsonCommandToPhevMessage((char *) messages->messages[i]->data);
+
+            if(phevMessage)
+            {
+                if(phevMessage->length == 0 || phevMessage->length > PHEV_CORE_MAX_DATA)
+                {
+                    abort();
+                }
+                phev_core_destroyMessage(phevMessage);
+            }
+            msg_utils_destroyMsg(messages->messages[i]);
+        }
+        free(messages);
+    }
+    phevMessage_t * phevMessage = phev_service_jsonCommandToPhevMessage(text);
+
+    if(phevMessage)
+    {
+        phev_core_destroyMessage(phevMessage);
+    }
+    fuzz_budget_end(size);
+
+    free(text);
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+    Corpus runner for compilers without libFuzzer.
+
+    Usage: fuzz_<target> [-flag...] file|directory...
+
+    Calls the target once for each file, directories are read one level
+    deep, libFuzzer flags are skipped so the same command line works for
+    both, so the seed corpus and any crash files libFuzzer saved elsewhere
+    can be checked under gcc and the sanitizers it has. Budgets and sanitizer
+    reports abort the run as they would under libFuzzer.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+int LLVMFuzzerInitialize(int * argc, char *** argv);
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size);
+
+static int fuzz_runFile(const char * path)
+{
+    FILE * file = fopen(path, "rb");
+
+    if(file == NULL)
+    {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // Exactly size bytes so the sanitizers see any read past the end
+    uint8_t * data = malloc(size > 0 ? (size_t) size : 1);
+    size_t num = (size > 0 ? fread(data, 1, (size_t) size, file) : 0);
+
+    fclose(file);
+    LLVMFuzzerTestOneInput(data, num);
+    free(data);
+
+    return 0;
+}
+int main(int argc, char * argv[])
+{
+    int inputs = 0;
+    int failed = 0;
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    for(int i = 1; i < argc; i++)
+    {
+        struct stat st;
+
+        if(argv[i][0] == '-')
+        {
+            continue;
+        }
+        if(stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            DIR * dir = opendir(argv[i]);
+            struct dirent * entry;
+
+            while(dir && (entry = readdir(dir)) != NULL)
+            {
+                char path[4096];
+
+                if(entry->d_name[0] == '.')
+                {
+                    continue;
+                }
+                snprintf(path, sizeof(path), "%s/%s", argv[i], entry->d_name);
+                failed += fuzz_runFile(path);
+                inputs++;
+            }
+            if(dir)
+            {
+                closedir(dir);
+            }
+        }
+        else
+        {
+            failed += fuzz_runFile(argv[i]);
+            inputs++;
+        }
+    }
+    printf("%d inputs run, %d could not be read\n", inputs, failed);
+
+    return (failed ? 1 : 0);
+}
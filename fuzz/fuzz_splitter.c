@@ -0,0 +1,53 @@
+/*
+    Fuzz target for the read side splitter.
+
+    Each input is one read from the car, as phev_pipe_outputSplitter gets it
+    from the transport, split into frames against a pipe context that is
+    kept across inputs the way a session keeps it, so XOR changes carry over.
+*/
+#include <stdint.h>
+#include <string.h>
+#include "phev_pipe.h"
+#include "msg_utils.h"
+#include "fuzz_budget.h"
+
+static phev_pipe_ctx_t pipeCtx;
+
+int LLVMFuzzerInitialize(int * argc, char *** argv)
+{
+    fuzz_budget_init();
+    memset(&pipeCtx, 0, sizeof(pipeCtx));
+    phev_metrics_init(&pipeCtx.metrics);
+
+    return 0;
+}
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    message_t message = {
+        .data = (uint8_t *) data,
+        .length = size,
+    };
+
+    fuzz_budget_begin();
+
+    messageBundle_t * messages = phev_pipe_outputSplitter(&pipeCtx, &message);
+
+    if(messages)
+    {
+        size_t total = 0;
+
+        for(int i = 0; i < messages->numMessages; i++)
+        {
+            total += messages->messages[i]->length;
+            msg_utils_destroyMsg(messages->messages[i]);
+        }
+        if(total > size)
+        {
+            abort();
+        }
+        free(messages);
+    }
+    fuzz_budget_end(size);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+    Seeds the fuzz corpus from captures.
+
+    Usage: phev_fuzz_seed corpus capture...
+
+    Writes every read the car side of each capture recorded to
+    corpus/splitter, and every whole frame in those reads to corpus/decoder,
+    one file per input, so the fuzzers start from what cars actually send
+    rather than from the handful of frames in the checked in seeds. Both
+    directories have to exist. Files are named after the capture and the
+    record, seeding from the same capture again overwrites them.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phev_core.h"
+#include "phev_capture.h"
+
+static bool seed_write(const char * corpus, const char * target, const char * name, size_t index, const uint8_t * data, size_t length)
+{
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%s/%s-%06zu.bin", corpus, target, name, index);
+
+    FILE * file = fopen(path, "wb");
+
+    if(file == NULL)
+    {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return false;
+    }
+    bool written = (fwrite(data, 1, length, file) == length);
+
+    fclose(file);
+
+    return written;
+}
+static const char * seed_baseName(const char * path)
+{
+    const char * slash = strrchr(path, '/');
+
+    return (slash ? slash + 1 : path);
+}
+int main(int argc, char * argv[])
+{
+    if(argc < 3)
+    {
+        fprintf(stderr, "Usage: %s corpus capture...\n", argv[0]);
+        return 1;
+    }
+
+    const char * corpus = argv[1];
+    phevCaptureRecord_t * record = malloc(sizeof(phevCaptureRecord_t));
+
+    for(int i = 2; i < argc; i++)
+    {
+        phevCaptureReader_t * reader = phev_capture_openReader(argv[i]);
+        const char * name = seed_baseName(argv[i]);
+        size_t reads = 0;
+        size_t frames = 0;
+
+        if(reader == NULL)
+        {
+            fprintf(stderr, "Cannot read capture %s\n", argv[i]);
+            free(record);
+            return 1;
+        }
+        while(phev_capture_next(reader, record))
+        {
+            if(record->direction != PHEV_CAPTURE_IN)
+            {
+                continue;
+            }
+            if(!seed_write(corpus, "splitter", name, reads++, record->data, record->length))
+            {
+                phev_capture_closeReader(reader);
+                free(record);
+                return 1;
+            }
+            for(size_t offset = 0; offset < record->length;)
+            {
+                int length = phev_core_frameLength(record->data + offset, record->length - offset);
+
+                if(length <= 0)
+                {
+                    break;
+                }
+                seed_write(corpus, "decoder", name, frames++, record->data + offset, (size_t) length);
+                offset += (size_t) length;
+            }
+        }
+        phev_capture_closeReader(reader);
+        printf("%s: %zu reads, %zu frames\n", argv[i], reads, frames);
+    }
+    free(record);
+
+    return 0;
+}
@@ -9,6 +9,11 @@
 #include "msg_core.h"
 #include "phev_service.h"
 #include "phev_pipe.h"
+#include "phev_tcpip.h"
+#include "phev_capture.h"
+#include "phev_transport.h"
+#include "phev_queue.h"
+#include "phev_alloc.h"
 
 #define KO_WF_CONNECT_INFO_GS_SP 1
 #define KO_WF_REG_DISP_SP 16
@@ -25,6 +30,11 @@
 #define KO_WF_BATT_LEVEL_INFO_REP_EVR 29
 #define KO_WF_DATE_INFO_SYNC_EVR 18
 
+// Commands from other threads waiting for the pipe thread
+#ifndef PHEV_MAX_COMMANDS
+#define PHEV_MAX_COMMANDS 16
+#endif
+
 typedef struct phevCtx_t phevCtx_t;
 
 typedef enum {
@@ -53,10 +63,15 @@ typedef struct phevEvent_t {
 
 typedef int (* phevEventHandler_t)(phevEvent_t *);
 
+typedef struct phevCommands_t phevCommands_t;
+
 typedef struct phevCtx_t {
     phevServiceCtx_t * serviceCtx;
     phevEventHandler_t eventHandler;
     void * ctx;
+    phevCapture_t * capture;
+    phevQueue_t * events;
+    phevCommands_t * commands;
 } phevCtx_t;
 
 typedef struct phev_pipe_ctx_t phev_pipe_ctx_t;
@@ -81,6 +96,25 @@ typedef struct phevSettings_t {
     phevEventHandler_t handler;
     void * ctx;
     bool my18;
+    phevProfileId_t profile;
+    size_t historyDepth;
+    const uint8_t * historyRegisters;
+    size_t historyNumberOfRegisters;
+    const char * snapshotPath;
+    const char * snapshotVin;
+    int64_t snapshotMaxAge;
+    const char * journalPath;
+    int connectTimeoutMs;
+    uint32_t connectBackoffMin;
+    uint32_t connectBackoffMax;
+    phevTcpOptions_t tcpOptions;
+    bool ioUring;
+    const char * capturePath;
+    const char * brokerPath;
+    phevQueueSettings_t eventQueue;
+    const phevAllocator_t * allocator;
+    size_t traceDepth;
+    phevTransport_t * transport;
     messagingClient_t * in;
     messagingClient_t * out;
 } phevSettings_t;
@@ -100,10 +134,12 @@ typedef enum phevAirConTime_t {
 
 phevCtx_t * phev_init(phevSettings_t settings);
 void * phev_getUserCtx(phevCtx_t * ctx);
+// Runs the session until phev_exit, then closes the files and sockets it opened before returning.
 void phev_start(phevCtx_t * ctx);
 phevCtx_t * phev_registerDevice(phevSettings_t settings);
 void phev_updateRegister(uint8_t reg, uint8_t * data, size_t length);
 void phev_exit(phevCtx_t * ctx);
+// Commands can be made from any thread. Off the pipe thread they are queued, up to PHEV_MAX_COMMANDS, and sent by the pipe thread between loops, where their callbacks run too.
 void phev_headLights(phevCtx_t * ctx, bool on, phevCallBack_t callback);
 void phev_parkingLights(phevCtx_t * ctx, bool on, phevCallBack_t callback);
 void phev_airCon(phevCtx_t * ctx, bool on, phevCallBack_t callback);
@@ -114,14 +150,25 @@ void phev_removeACError(phevCtx_t * ctx, phevCallBack_t callback);
 void phev_airConMY19(phevCtx_t * ctx, phevAirConMode_t mode, phevAirConTime_t time,phevCallBack_t callback);
 void phev_airConMode(phevCtx_t * ctx, phevAirConMode_t mode, phevAirConTime_t time,phevCallBack_t callback);
 bool phev_running(phevCtx_t * ctx);
+phevQueueStats_t phev_eventStats(phevCtx_t * ctx);
+char * phev_latencyAsJson(phevCtx_t * ctx);
+void phev_metricsSnapshot(phevCtx_t * ctx, phevMetricsSnapshot_t * snapshot);
+// Prometheus text for scraping, session is an optional label, the caller frees the string.
+char * phev_metricsAsPrometheus(phevCtx_t * ctx, const char * session);
+// Writes the frame trace for the phev_trace tool, false when traceDepth was not set.
+bool phev_traceSave(phevCtx_t * ctx, const char * path);
 int phev_batteryLevel(phevCtx_t * ctx);
 int phev_batteryWarning(phevCtx_t * ctx);
 int phev_chargingStatus(phevCtx_t * ctx);
 int phev_remainingChargeTime(phevCtx_t * ctx);
 phevServiceHVAC_t *  phev_HVACStatus(phevCtx_t * ctx);
+void phev_vehicleState(phevCtx_t * ctx, phevVehicleState_t * state);
+uint32_t phev_vehicleStateChanged(const phevVehicleState_t * previous, const phevVehicleState_t * current);
 phevData_t * phev_getRegister(phevCtx_t * ctx, uint8_t reg);
 char * phev_statusAsJson(phevCtx_t * ctx);
 messagingClient_t * phev_createIncomingMessageClient(void);
 void phev_disconnect(phevCtx_t * ctx);
 void phev_disconnectCar(phevCtx_t * ctx);
+// Call when the network to the car comes up so the next loop reconnects without waiting out the backoff.
+void phev_linkUp(phevCtx_t * ctx);
 #endif
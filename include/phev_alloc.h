@@ -0,0 +1,100 @@
+#ifndef _PHEV_ALLOC_H_
+#define _PHEV_ALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Allocator the library allocates through.
+
+    One allocator per process, set it before the first session is created
+    (phevSettings_t.allocator does that in phev_init) and do not change it
+    while anything allocated through the old one is still live. Every call
+    carries the "file:line" site it was made from.
+
+    Every module allocates through here except for memory the messaging
+    library releases itself with its own free: message contexts, pipe
+    chains and message bundles. Those use plain malloc, so a custom
+    allocator has to give out memory that free can release, and the other
+    way round. The log ring is also plain malloc, it is allocated once and
+    kept for the life of the process, past any allocator. Anything the
+    library hands back to be freed, JSON strings, register copies, goes to
+    phev_free.
+*/
+typedef struct phevAllocator_t {
+    void * (* malloc)(size_t size, const char * site, void * ctx);
+    void * (* realloc)(void * ptr, size_t size, const char * site, void * ctx);
+    void (* free)(void * ptr, void * ctx);
+    void * ctx;
+} phevAllocator_t;
+
+// NULL goes back to malloc and free.
+void phev_alloc_setAllocator(const phevAllocator_t * allocator);
+
+void * phev_alloc_malloc(size_t size, const char * site);
+void * phev_alloc_calloc(size_t count, size_t size, const char * site);
+void * phev_alloc_realloc(void * ptr, size_t size, const char * site);
+void phev_alloc_free(void * ptr);
+char * phev_alloc_strdup(const char * str, const char * site);
+
+// asprintf through the allocator, NULL on failure.
+char * phev_alloc_printf(const char * site, const char * format, ...);
+
+#define PHEV_ALLOC_STR2(x) #x
+#define PHEV_ALLOC_STR(x) PHEV_ALLOC_STR2(x)
+#define PHEV_ALLOC_SITE __FILE__ ":" PHEV_ALLOC_STR(__LINE__)
+
+#define phev_malloc(size) phev_alloc_malloc((size), PHEV_ALLOC_SITE)
+#define phev_calloc(count, size) phev_alloc_calloc((count), (size), PHEV_ALLOC_SITE)
+#define phev_realloc(ptr, size) phev_alloc_realloc((ptr), (size), PHEV_ALLOC_SITE)
+#define phev_strdup(str) phev_alloc_strdup((str), PHEV_ALLOC_SITE)
+#define phev_asprintf(...) phev_alloc_printf(PHEV_ALLOC_SITE, __VA_ARGS__)
+#define phev_free(ptr) phev_alloc_free(ptr)
+
+/*
+    Tracking allocator.
+
+    Sits in front of another allocator (NULL for malloc and free) and keeps
+    live bytes, the high water mark and counts per site, without adding a
+    header to the blocks, so a block freed with plain free is only left
+    behind in the counts. Up to maxLive blocks (0 for 4096) are tracked,
+    allocations past that are passed through and counted as untracked. It
+    takes a spin lock per call, it is for sizing heaps and finding leaks,
+    not for production.
+*/
+typedef struct phevAllocTracker_t phevAllocTracker_t;
+
+typedef struct phevAllocStats_t {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t failures;
+    uint64_t untracked;
+    size_t liveBytes;
+    size_t liveBlocks;
+    size_t peakBytes;
+} phevAllocStats_t;
+
+typedef struct phevAllocSite_t {
+    const char * site;
+    uint64_t allocations;
+    uint64_t bytes;
+    size_t liveBytes;
+    size_t liveBlocks;
+} phevAllocSite_t;
+
+phevAllocTracker_t * phev_alloc_createTracker(const phevAllocator_t * backing, size_t maxLive);
+void phev_alloc_destroyTracker(phevAllocTracker_t * tracker);
+
+// The allocator to pass to phev_alloc_setAllocator, good for as long as the tracker.
+phevAllocator_t phev_alloc_trackerAllocator(phevAllocTracker_t * tracker);
+
+phevAllocStats_t phev_alloc_trackerStats(phevAllocTracker_t * tracker);
+
+// Walks the sites seen so far. Returns the next index to pass, -1 when done.
+int phev_alloc_nextSite(phevAllocTracker_t * tracker, int index, phevAllocSite_t * site);
+
+// Text report with allocations per frame when frames is not zero and a line per site. Returns the length needed like snprintf.
+size_t phev_alloc_formatReport(phevAllocTracker_t * tracker, uint64_t frames, char * buffer, size_t size);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef _PHEV_BROKER_H_
+#define _PHEV_BROKER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PHEV_BROKER_DEFAULT_MAX_CLIENTS 8
+#define PHEV_BROKER_DEFAULT_QUEUE_DEPTH 256
+#define PHEV_BROKER_MAX_LINE 600
+#define PHEV_BROKER_MAX_COMMANDS 64
+#define PHEV_BROKER_DEFAULT_MODE 0600
+
+/*
+    Local fan out of one car connection.
+
+    The service that owns the car connection listens on a Unix domain socket
+    and any number of local clients, up to maxClients, attach to it. Clients
+    speak lines of text:
+
+        subscribe all | <reg> ...       ok, then the current value of each
+        unsubscribe all | <reg> ...     ok
+        set <reg> <hex>                 ok, the register is written to the car
+        { "operation" : ... }           ok, a service JSON command
+
+    and receive
+
+        update <reg> <hex>              a register the client subscribes to changed
+        dropped <count>                 updates lost because the client fell behind
+        error <reason>
+
+    Each update is formatted once into a reference counted buffer that every
+    subscribed client's queue points at. Queues are bounded, when a client's
+    queue is full its update is dropped and counted, the car session never
+    waits on a client. The broker thread does all the socket work, commands
+    and the snapshots sent on subscribe run on the service thread from
+    phev_broker_poll.
+
+    The socket is created with mode, owner only unless set otherwise, since
+    any client that can connect can write registers. A path that exists and
+    is not a socket is left alone and the broker is not created.
+*/
+typedef struct phevServiceCtx_t phevServiceCtx_t;
+
+typedef struct phevBrokerSettings_t {
+    const char * path;
+    size_t maxClients;
+    size_t queueDepth;
+    unsigned int mode;
+} phevBrokerSettings_t;
+
+typedef struct phevBrokerStats_t {
+    uint32_t clients;
+    uint32_t published;
+    uint32_t delivered;
+    uint32_t dropped;
+    uint32_t commands;
+} phevBrokerStats_t;
+
+typedef struct phevBroker_t phevBroker_t;
+
+// NULL where there are no Unix domain sockets.
+phevBroker_t * phev_broker_create(phevServiceCtx_t * service, phevBrokerSettings_t settings);
+void phev_broker_destroy(phevBroker_t * broker);
+
+// Runs queued client commands, call from the thread that runs the pipe.
+void phev_broker_poll(phevBroker_t * broker);
+
+phevBrokerStats_t phev_broker_stats(const phevBroker_t * broker);
+
+#endif
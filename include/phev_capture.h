@@ -0,0 +1,65 @@
+#ifndef _PHEV_CAPTURE_H_
+#define _PHEV_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PHEV_CAPTURE_MAGIC 0x50485643
+#define PHEV_CAPTURE_VERSION 1
+#define PHEV_CAPTURE_MAX_RECORD 4096
+
+#define PHEV_CAPTURE_IN 0
+#define PHEV_CAPTURE_OUT 1
+
+#define PHEV_CAPTURE_FLUSH_MS 1000
+
+/*
+    Raw session capture.
+
+    Records every chunk the transport reads or writes, before any framing or
+    decoding, so a session can be fed back through the stack exactly as the
+    car sent it, bytes the framer drops included. The file starts with a 16 byte header
+
+        uint32_t magic
+        uint32_t version
+        uint64_t start       monotonic nanoseconds when the capture opened
+
+    followed by records of
+
+        uint8_t  direction   PHEV_CAPTURE_IN or PHEV_CAPTURE_OUT
+        varint   delta       nanoseconds since the previous record
+        varint   length
+        uint8_t  data[length]
+
+    with little endian fixed fields and LEB128 varints, a typical frame costs
+    three or four bytes on top of its data. Chunks longer than
+    PHEV_CAPTURE_MAX_RECORD are split.
+
+    Writes are buffered and flushed at most every PHEV_CAPTURE_FLUSH_MS and on
+    close. A file cut short by a crash reads up to its last complete record.
+    Each capture has its own lock, recording from several threads is safe but
+    closing is not until they have stopped.
+*/
+typedef struct phevCaptureRecord_t {
+    uint64_t timestamp;
+    uint8_t direction;
+    size_t length;
+    uint8_t data[PHEV_CAPTURE_MAX_RECORD];
+} phevCaptureRecord_t;
+
+typedef struct phevCapture_t phevCapture_t;
+
+typedef struct phevCaptureReader_t phevCaptureReader_t;
+
+phevCapture_t * phev_capture_open(const char * path);
+void phev_capture_close(phevCapture_t * capture);
+bool phev_capture_record(phevCapture_t * capture, uint8_t direction, const uint8_t * data, size_t length);
+void phev_capture_flush(phevCapture_t * capture);
+
+phevCaptureReader_t * phev_capture_openReader(const char * path);
+void phev_capture_closeReader(phevCaptureReader_t * reader);
+// Timestamps are nanoseconds from the start of the capture. Returns false at the end of the file or at a truncated record.
+bool phev_capture_next(phevCaptureReader_t * reader, phevCaptureRecord_t * record);
+
+#endif
@@ -88,6 +88,7 @@ typedef struct phevConfig_t
 } phevConfig_t;
 
 phevConfig_t * phev_config_parseConfig(const char * config);
+void phev_config_destroyConfig(phevConfig_t * config);
 bool phev_config_checkForFirmwareUpdate(const phevUpdateConfig_t * config);
 bool phev_config_checkForConnection(const phevState_t * state);
 bool phev_config_checkForHeadLightsOn(const phevState_t * state);
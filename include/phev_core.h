@@ -13,6 +13,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "msg_core.h"
+#include "phev_profile.h"
 #define PHEV_OK 0
 
 #define REQUEST_TYPE 0
@@ -34,6 +35,11 @@
 #define START_RESP_MY18 0x2f
 
 #define VIN_LEN 17
+
+// Command, length, type, register and checksum, a frame with no data.
+#define PHEV_CORE_MIN_FRAME 5
+// The length byte counts type, register and checksum as well as the data.
+#define PHEV_CORE_MAX_DATA (0xff - 3)
 #define MAC_ADDR_SIZE 6
 
 #define KO_WF_CONNECT_INFO_GS_SP 1
@@ -81,7 +87,20 @@ typedef struct phevMessage_t
     uint8_t XOR;
 } phevMessage_t;
 
-static bool phev_core_my18 = false;
+/*
+    A frame found by phev_core_scanIncomingFrames: where it sits in the
+    buffer, the key it was sent under and its header with the key removed.
+    Nothing is copied, so a descriptor is only good while the buffer is.
+*/
+typedef struct phevFrame_t
+{
+    size_t offset;
+    uint8_t length;
+    uint8_t xor;
+    uint8_t command;
+    uint8_t type;
+    uint8_t reg;
+} phevFrame_t;
 
 const static uint8_t allowedCommands[] = {START_SEND, START_RESP, SEND_CMD, RESP_CMD, PING_SEND_CMD, PING_RESP_CMD, START_RESP_MY18, START_SEND_MY18, PING_SEND_CMD_MY18, PING_RESP_CMD_MY18,0x5e,0xcd,0xba,0x6e,0xcc,0xbb,0x3e,0x4f,0x4e,0xe4};
 
@@ -119,6 +138,13 @@ message_t *phev_core_startMessageEncoded(const uint8_t *mac);
 
 phevMessage_t *phev_core_pingMessage(const uint8_t number);
 
+// As above with the command bytes of the session's profile, the ones without a profile send the MY18 bytes.
+phevMessage_t *phev_core_profileStartMessage(const phevProfile_t *profile, const uint8_t *mac);
+
+message_t *phev_core_profileStartMessageEncoded(const phevProfile_t *profile, const uint8_t *mac);
+
+phevMessage_t *phev_core_profilePingMessage(const phevProfile_t *profile, const uint8_t number);
+
 phevMessage_t *phev_core_responseHandler(phevMessage_t * message);
 
 uint8_t phev_core_checksum(const uint8_t * data);
@@ -137,6 +163,14 @@ uint8_t phev_core_getMessageLength(const uint8_t * data);
 
 uint8_t phev_core_getActualLength(const uint8_t *data);
 
+bool phev_core_checkIncomingCommand(const uint8_t command);
+
+// Length of the frame at the start of data without copying or allocating, 0 when more bytes are needed and -1 when data does not start with a frame.
+int phev_core_frameLength(const uint8_t *data, size_t len);
+
+// Writes the len bytes of a frame to out with the key derived from its header removed, for logging. Returns 0 when len is too short to hold a header.
+size_t phev_core_decodeFrame(const uint8_t *data, size_t len, uint8_t *out);
+
 uint8_t * phev_core_xorData(const uint8_t * data);
 
 uint8_t * phev_core_xorDataWithValue(const uint8_t * data,uint8_t xor);
@@ -147,11 +181,22 @@ uint8_t phev_core_getType(const uint8_t *data);
 
 bool phev_core_validateChecksum(const uint8_t *data);
 
-message_t * phev_core_extractIncomingMessageAndXOR(const uint8_t * data);
+// Both read no more than len bytes and return NULL unless data starts with a whole frame of at least PHEV_CORE_MIN_FRAME bytes.
+message_t * phev_core_extractIncomingMessageAndXOR(const uint8_t * data, const size_t len);
+
+// As above but tries the key the caller expects first, checking command, bounds and checksum in one pass over the
+// bytes without a copy. Falls back to guessing the key from the header, and sets fallback, only when it does not fit.
+message_t * phev_core_extractIncomingMessageExpectXOR(const uint8_t * data, const size_t len, const uint8_t xor, bool * fallback);
+
+// Walks the back to back frames from the car in data once, filling at most max descriptors and stopping at the first
+// bytes that are not a whole frame. Each frame is tried under xor first as above, and xor is left at the key the next
+// one is expected under. Returns the number found and sets used to the bytes they cover, fallbacks (may be NULL) to
+// how many the key did not fit.
+size_t phev_core_scanIncomingFrames(const uint8_t * data, const size_t len, uint8_t * xor, phevFrame_t * frames, const size_t max, size_t * used, size_t * fallbacks);
 
 message_t * phev_core_extractOutgoingMessageAndXOR(const uint8_t * data);
 
-message_t * phev_core_extractAndDecodeIncomingMessageAndXOR(const uint8_t *data);
+message_t * phev_core_extractAndDecodeIncomingMessageAndXOR(const uint8_t *data, const size_t len);
 
 message_t * phev_core_extractAndDecodeOutgoingMessageAndXOR(const uint8_t *data);
 
@@ -159,6 +204,10 @@ message_t * phev_core_createMsgXOR(const uint8_t * data, const size_t length, co
 
 uint8_t phev_core_getMessageXOR(const message_t * message);
 
+uint64_t phev_core_monotonicNs(void);
+
+uint64_t phev_core_monotonicMs(void);
+
 #define phev_core_strdup(...) strdup(...)
 
 #endif
@@ -0,0 +1,46 @@
+#ifndef _PHEV_HISTOGRAM_H_
+#define _PHEV_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PHEV_HISTOGRAM_SUB_BITS 5
+#define PHEV_HISTOGRAM_SUB_BUCKETS (1 << PHEV_HISTOGRAM_SUB_BITS)
+#define PHEV_HISTOGRAM_MAX_BITS 38
+#define PHEV_HISTOGRAM_BUCKETS (PHEV_HISTOGRAM_SUB_BUCKETS * (PHEV_HISTOGRAM_MAX_BITS - PHEV_HISTOGRAM_SUB_BITS + 1))
+
+/*
+    Log linear (HDR style) histogram of microsecond values.
+
+    Below 32us every value has its own bucket, above that each power of two
+    is split into 32 buckets, so any value is held to within about 3% up to
+    2^38us, a few days, and larger values are clamped to that. The size is
+    fixed, recording is a handful of instructions and never allocates.
+
+    One thread records, any thread can read. Reads taken while recording
+    goes on are consistent per bucket, not across buckets.
+*/
+typedef struct phevHistogram_t phevHistogram_t;
+
+phevHistogram_t * phev_histogram_create(void);
+void phev_histogram_destroy(phevHistogram_t * histogram);
+void phev_histogram_reset(phevHistogram_t * histogram);
+
+void phev_histogram_record(phevHistogram_t * histogram, uint64_t value);
+
+// Adds the counts of from into into, for percentiles across sessions. Called on the thread that records into into.
+void phev_histogram_merge(phevHistogram_t * into, const phevHistogram_t * from);
+
+uint64_t phev_histogram_count(const phevHistogram_t * histogram);
+uint64_t phev_histogram_min(const phevHistogram_t * histogram);
+uint64_t phev_histogram_max(const phevHistogram_t * histogram);
+double phev_histogram_mean(const phevHistogram_t * histogram);
+
+// Highest value in the bucket the percentile (0 to 100) falls in, 0 when empty.
+uint64_t phev_histogram_percentile(const phevHistogram_t * histogram, double percentile);
+
+// Walks the buckets that hold values, lowest first, for dumping. Returns the next index to pass, -1 when done.
+int phev_histogram_nextBucket(const phevHistogram_t * histogram, int index, uint64_t * highest, uint32_t * count);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _PHEV_HISTORY_H_
+#define _PHEV_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "phev_model.h"
+
+#ifndef PHEV_HISTORY_MAX_DATA
+#define PHEV_HISTORY_MAX_DATA 32
+#endif
+
+/*
+    Per register history.
+
+    Every tracked register gets a fixed capacity ring of timestamped values.
+    All rings are allocated in one block when the history is created and are
+    never resized, so memory use is depth * registers * entry size. Values
+    longer than PHEV_HISTORY_MAX_DATA are truncated. A value identical to the
+    newest entry for the register is not recorded again.
+
+    Timestamps are milliseconds from the monotonic clock.
+
+    Values are recorded on the pipe thread and read from any thread. Each
+    ring has a sequence that is odd while a value goes in, as the model's
+    version is, and the readers copy out and retry when it moved.
+*/
+typedef struct phevHistoryEntry_t {
+    uint64_t timestamp;
+    uint8_t length;
+    uint8_t data[PHEV_HISTORY_MAX_DATA];
+} phevHistoryEntry_t;
+
+typedef struct phevHistoryRing_t {
+    phevHistoryEntry_t * entries;
+    size_t head;
+    size_t count;
+    atomic_uint sequence;
+} phevHistoryRing_t;
+
+typedef struct phevHistorySettings_t {
+    size_t depth;
+    const uint8_t * registers;
+    size_t numberOfRegisters;
+} phevHistorySettings_t;
+
+typedef struct phevHistory_t {
+    size_t depth;
+    phevHistoryRing_t * rings[256];
+    phevHistoryRing_t * ringStorage;
+    phevHistoryEntry_t * entryStorage;
+} phevHistory_t;
+
+phevHistory_t * phev_history_create(phevHistorySettings_t settings);
+void phev_history_destroy(phevHistory_t * history);
+bool phev_history_isTracked(const phevHistory_t * history, uint8_t reg);
+bool phev_history_record(phevHistory_t * history, uint8_t reg, const uint8_t * data, size_t length, uint64_t timestamp);
+size_t phev_history_count(const phevHistory_t * history, uint8_t reg);
+size_t phev_history_latest(const phevHistory_t * history, uint8_t reg, size_t n, phevHistoryEntry_t * out);
+size_t phev_history_range(const phevHistory_t * history, uint8_t reg, uint64_t from, uint64_t to, phevHistoryEntry_t * out, size_t max);
+size_t phev_history_downsample(const phevHistory_t * history, uint8_t reg, uint64_t from, uint64_t to, uint64_t interval, phevHistoryEntry_t * out, size_t max);
+void phev_history_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _PHEV_JOURNAL_H_
+#define _PHEV_JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "phev_model.h"
+
+#define PHEV_JOURNAL_MAGIC 0x5048564a
+#define PHEV_JOURNAL_VERSION 1
+#define PHEV_JOURNAL_MAX_DATA 32
+
+#ifndef PHEV_JOURNAL_QUEUE_SIZE
+#define PHEV_JOURNAL_QUEUE_SIZE 256
+#endif
+
+#define PHEV_JOURNAL_DEFAULT_FLUSH_MS 100
+#define PHEV_JOURNAL_DEFAULT_COMPACT_BYTES (1024 * 1024)
+
+/*
+    Append only register change journal.
+
+    The file starts with an 8 byte header (magic, version) followed by
+    records of
+
+        uint64_t timestamp   wall clock milliseconds, little endian
+        uint8_t  register
+        uint8_t  length
+        uint8_t  data[length]
+
+    The model listener only copies the change into a single producer single
+    consumer queue, a writer thread drains it and appends in batches so the
+    pipe loop never waits on the file. When the queue is full the change is
+    dropped and counted rather than blocking.
+
+    Once the file grows past compactBytes the writer rewrites it as one record
+    per register holding its latest value, keeping the original timestamps, and
+    carries on appending after that. State at a time before the last
+    compaction is therefore only as detailed as that snapshot.
+*/
+typedef struct phevJournalRecord_t {
+    uint64_t timestamp;
+    uint8_t reg;
+    uint8_t length;
+    uint8_t data[PHEV_JOURNAL_MAX_DATA];
+} phevJournalRecord_t;
+
+typedef struct phevJournalSettings_t {
+    const char * path;
+    uint32_t flushIntervalMs;
+    size_t compactBytes;
+} phevJournalSettings_t;
+
+typedef struct phevJournal_t phevJournal_t;
+
+phevJournal_t * phev_journal_open(phevJournalSettings_t settings);
+// Stops the writer thread after it has written everything queued.
+void phev_journal_close(phevJournal_t * journal);
+bool phev_journal_append(phevJournal_t * journal, uint8_t reg, const uint8_t * data, size_t length, uint64_t timestamp);
+// Waits until the writer has written everything queued before the call, or has stopped.
+void phev_journal_flush(phevJournal_t * journal);
+uint32_t phev_journal_dropped(const phevJournal_t * journal);
+uint32_t phev_journal_compactions(const phevJournal_t * journal);
+// Applies every record at or before the timestamp to the model, returns the number applied or -1 when the file cannot be read.
+int phev_journal_replay(const char * path, uint64_t until, phevModel_t * model);
+void phev_journal_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx);
+
+#endif
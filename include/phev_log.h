@@ -0,0 +1,96 @@
+#ifndef _PHEV_LOG_H_
+#define _PHEV_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+#define PHEV_LOG_NONE 0
+#define PHEV_LOG_ERROR 1
+#define PHEV_LOG_WARN 2
+#define PHEV_LOG_INFO 3
+#define PHEV_LOG_DEBUG 4
+#define PHEV_LOG_VERBOSE 5
+
+/*
+    Compile time log level.
+
+    Levels above PHEV_LOG_LEVEL compile to a call in a dead branch, so the
+    START/END traces on every core, pipe and service function cost nothing
+    in a release build while their arguments still count as used. Builds
+    with LOGGING_ON keep every level and leave filtering to the logger as
+    before.
+*/
+#ifndef PHEV_LOG_LEVEL
+#ifdef LOGGING_ON
+#define PHEV_LOG_LEVEL PHEV_LOG_VERBOSE
+#else
+#define PHEV_LOG_LEVEL PHEV_LOG_INFO
+#endif
+#endif
+
+static inline void phev_log_noop(const void * tag, ...)
+{
+}
+#define PHEV_LOG_NOOP(tag, ...) do { if (0) { phev_log_noop(tag, __VA_ARGS__); } } while (0)
+
+#if PHEV_LOG_LEVEL < PHEV_LOG_VERBOSE
+#undef LOG_V
+#define LOG_V(tag, ...) PHEV_LOG_NOOP(tag, __VA_ARGS__)
+#endif
+
+#if PHEV_LOG_LEVEL < PHEV_LOG_DEBUG
+#undef LOG_D
+#define LOG_D(tag, ...) PHEV_LOG_NOOP(tag, __VA_ARGS__)
+#undef LOG_BUFFER_HEXDUMP
+#define LOG_BUFFER_HEXDUMP(tag, buffer, length, level) PHEV_LOG_NOOP(tag, buffer, length, level)
+#endif
+
+#if PHEV_LOG_LEVEL < PHEV_LOG_INFO
+#undef LOG_I
+#define LOG_I(tag, ...) PHEV_LOG_NOOP(tag, __VA_ARGS__)
+#endif
+
+#if PHEV_LOG_LEVEL < PHEV_LOG_WARN
+#undef LOG_W
+#define LOG_W(tag, ...) PHEV_LOG_NOOP(tag, __VA_ARGS__)
+#endif
+
+#if PHEV_LOG_LEVEL < PHEV_LOG_ERROR
+#undef LOG_E
+#define LOG_E(tag, ...) PHEV_LOG_NOOP(tag, __VA_ARGS__)
+#endif
+
+#ifndef PHEV_LOG_RING_SIZE
+#define PHEV_LOG_RING_SIZE 64
+#endif
+
+#define PHEV_LOG_MAX_FRAME 257
+
+/*
+    Deferred frame hexdumps.
+
+    Frames are only copied when a sink is attached. The copy goes into a
+    lock free ring and a background thread decodes and hands it to the sink,
+    so the transport never formats or prints. When the ring is full the frame
+    is dropped and counted. Without phev_log_start the sink is called inline.
+*/
+typedef void (* phevLogSink_t)(const char * tag, const uint8_t * data, const uint8_t * decoded, size_t length);
+
+void phev_log_setSink(phevLogSink_t sink);
+bool phev_log_hasSink(void);
+bool phev_log_start(void);
+void phev_log_stop(void);
+void phev_log_frame(const char * tag, const uint8_t * data, size_t length);
+uint32_t phev_log_dropped(void);
+void phev_log_stdoutSink(const char * tag, const uint8_t * data, const uint8_t * decoded, size_t length);
+
+#if PHEV_LOG_LEVEL >= PHEV_LOG_DEBUG
+#define PHEV_LOG_FRAME(tag, data, length) \
+    do { if (phev_log_hasSink()) { phev_log_frame(tag, data, length); } } while (0)
+#else
+#define PHEV_LOG_FRAME(tag, data, length) PHEV_LOG_NOOP(tag, data, length)
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _PHEV_METRICS_H_
+#define _PHEV_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define PHEV_METRICS_COMMANDS 256
+
+/*
+    Per session counters.
+
+    The pipe thread bumps them with relaxed atomic adds, no locks and no
+    ordering, so they cost next to nothing on the hot path and any thread
+    can take a snapshot at any time. A snapshot is exact per counter, not
+    across counters.
+
+        BYTES_IN            bytes read from the car
+        BYTES_OUT           bytes handed to the pipe to send
+        DECODE_FAILURES     frames that could not be split out or decoded
+        CHECKSUM_FAILURES   frames with a known command and a bad checksum
+        XOR_RESYNCS         key changes from the car, bb and cc
+        XOR_FALLBACKS       frames the tracked key did not fit, decoded by guessing
+        FILTERED            register updates dropped as unchanged
+        RETRIES             commands resent after a key change
+        DROPPED_COMMANDS    commands not sent as every callback slot was taken
+        RECONNECTS          connections back up after being lost
+*/
+typedef enum phevMetric_t {
+    PHEV_METRIC_BYTES_IN,
+    PHEV_METRIC_BYTES_OUT,
+    PHEV_METRIC_DECODE_FAILURES,
+    PHEV_METRIC_CHECKSUM_FAILURES,
+    PHEV_METRIC_XOR_RESYNCS,
+    PHEV_METRIC_XOR_FALLBACKS,
+    PHEV_METRIC_FILTERED,
+    PHEV_METRIC_RETRIES,
+    PHEV_METRIC_DROPPED_COMMANDS,
+    PHEV_METRIC_RECONNECTS,
+    PHEV_METRIC_MAX,
+} phevMetric_t;
+
+typedef struct phevMetrics_t {
+    atomic_uint framesIn[PHEV_METRICS_COMMANDS];
+    atomic_uint framesOut[PHEV_METRICS_COMMANDS];
+    _Atomic uint64_t counters[PHEV_METRIC_MAX];
+} phevMetrics_t;
+
+typedef struct phevMetricsSnapshot_t {
+    uint32_t framesIn[PHEV_METRICS_COMMANDS];
+    uint32_t framesOut[PHEV_METRICS_COMMANDS];
+    uint64_t counters[PHEV_METRIC_MAX];
+} phevMetricsSnapshot_t;
+
+void phev_metrics_init(phevMetrics_t * metrics);
+
+void phev_metrics_add(phevMetrics_t * metrics, phevMetric_t metric, uint64_t value);
+
+// Counts a decoded frame by command, length is only counted going out, incoming bytes are counted per read.
+void phev_metrics_frameIn(phevMetrics_t * metrics, uint8_t command);
+void phev_metrics_frameOut(phevMetrics_t * metrics, uint8_t command, size_t length);
+
+void phev_metrics_snapshot(const phevMetrics_t * metrics, phevMetricsSnapshot_t * snapshot);
+
+// Prometheus text format, session is an optional label. Returns the length needed without the terminator, like snprintf.
+size_t phev_metrics_formatPrometheus(const phevMetricsSnapshot_t * snapshot, const char * session, char * buffer, size_t size);
+
+#endif
@@ -5,7 +5,9 @@
 #define _PHEV_MODEL_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <stdatomic.h>
 
 typedef struct phevRegister_t
 {
@@ -13,15 +15,73 @@ typedef struct phevRegister_t
     uint8_t data[]; 
 } phevRegister_t;
 
+#define PHEV_MODEL_MAX_LISTENERS 4
+
+typedef struct phevModel_t phevModel_t;
+
+typedef void (* phevModelListener_t)(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx);
+
+typedef struct phevModelRetired_t
+{
+    phevRegister_t ** registers;
+    size_t count;
+    size_t size;
+} phevModelRetired_t;
+
 typedef struct phevModel_t
 {
     phevRegister_t * registers[256];
-
+    phevModelRetired_t retired[2];
+    atomic_uint epoch;
+    atomic_uint readers[2];
+    atomic_uint version;
+    phevModelListener_t listeners[PHEV_MODEL_MAX_LISTENERS];
+    void * listenerCtx[PHEV_MODEL_MAX_LISTENERS];
+    int numberOfListeners;
 } phevModel_t;
 
 
 phevModel_t * phev_model_create(void);
+void phev_model_destroy(phevModel_t *);
+
+/*
+    A replaced register is freed straight away when no reader is inside
+    phev_model_enterRead. Otherwise it is retired with the current epoch,
+    the epoch moves on once the readers of the other one have left, and the
+    register is freed once the readers that could have seen it have left
+    too. Only one thread sets registers.
+*/
 int phev_model_setRegister(phevModel_t *, uint8_t, const uint8_t *, size_t);
+
+// A copy the caller frees with phev_free, safe from any thread.
 phevRegister_t * phev_model_getRegister(phevModel_t *, uint8_t);
+
+/*
+    No copy. The pointer is only good on the thread that sets the registers,
+    or on another thread between phev_model_enterRead and
+    phev_model_exitRead.
+*/
+const phevRegister_t * phev_model_peekRegister(const phevModel_t *, uint8_t);
+// Drops the register from the model, retired like a replaced one. Listeners are not called.
+int phev_model_clearRegister(phevModel_t *, uint8_t);
 int phev_model_compareRegister(phevModel_t *, uint8_t, const uint8_t *);
+int phev_model_addListener(phevModel_t *, phevModelListener_t, void *);
+int phev_model_removeListener(phevModel_t *, phevModelListener_t, void *);
+
+/*
+    Lock free consistent reads of the model.
+
+    The version is odd while a register is being replaced. Readers take the
+    version with phev_model_beginRead, read what they need and retry when
+    phev_model_endRead reports that a writer ran in between. Off the thread
+    that sets registers, hold phev_model_enterRead around the whole loop so
+    the registers it peeks are not freed under it.
+*/
+uint32_t phev_model_getVersion(const phevModel_t *);
+uint32_t phev_model_beginRead(const phevModel_t *);
+bool phev_model_endRead(const phevModel_t *, uint32_t);
+
+// Keeps every register peeked until the matching exit, calls nest. Pass what enter returned to exit.
+uint32_t phev_model_enterRead(const phevModel_t *);
+void phev_model_exitRead(const phevModel_t *, uint32_t);
 #endif
\ No newline at end of file
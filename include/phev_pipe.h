@@ -6,9 +6,13 @@
 #include <time.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "msg_core.h"
 #include "msg_pipe.h"
 #include "phev_core.h"
+#include "phev_histogram.h"
+#include "phev_metrics.h"
+#include "phev_trace.h"
 #define PHEV_PIPE_MAX_EVENT_HANDLERS 10
 #define PHEV_PIPE_MAX_UPDATE_CALLBACKS 10
 #ifndef PHEV_CONNECT_WAIT_TIME
@@ -19,6 +23,24 @@
 #define PHEV_CONNECT_MAX_RETRIES (5)
 #endif
 
+#ifndef PHEV_CONNECT_BACKOFF_MIN
+#define PHEV_CONNECT_BACKOFF_MIN (250)
+#endif
+
+#ifndef PHEV_CONNECT_BACKOFF_MAX
+#define PHEV_CONNECT_BACKOFF_MAX (30000)
+#endif
+
+// Longest a connect is polled before the attempt counts as failed
+#ifndef PHEV_CONNECT_TIMEOUT
+#define PHEV_CONNECT_TIMEOUT (3000)
+#endif
+
+// Longest the loop sleeps while disconnected so a link up is acted on quickly
+#ifndef PHEV_CONNECT_IDLE_TIME
+#define PHEV_CONNECT_IDLE_TIME (50)
+#endif
+
 #define PHEV_PIPE_ECU_VERSION_SIZE 11
 #define PHEV_PIPE_DATE_INFO_SIZE 6
 
@@ -38,7 +60,7 @@
     {                                     \
         struct timespec ts;               \
         ts.tv_sec = msecs / 1000;         \
-        ts.tv_nsec = msecs % 1000 * 1000; \
+        ts.tv_nsec = msecs % 1000 * 1000000L; \
         nanosleep(&ts, NULL);             \
     } while (0)
 #elif __XTENSA__
@@ -88,11 +110,32 @@ typedef struct phevError_t
     char * message;
 } phevError_t;
 
+/*
+    Latencies the pipe keeps, in microseconds
+
+        COMMAND_ACK     a register update sent to the car until the car
+                        acks it, resends after a key change included
+        REQUEST_ACK     a read holding a car request until the ack for it
+                        is handed to the pipe to send
+        PING_RTT        a ping sent until its response
+        RECONNECT       the connection dropping until it is back
+*/
+typedef enum phevPipeLatency_t
+{
+    PHEV_PIPE_LATENCY_COMMAND_ACK,
+    PHEV_PIPE_LATENCY_REQUEST_ACK,
+    PHEV_PIPE_LATENCY_PING_RTT,
+    PHEV_PIPE_LATENCY_RECONNECT,
+    PHEV_PIPE_LATENCY_MAX,
+} phevPipeLatency_t;
+
 typedef struct phev_pipe_ctx_t phev_pipe_ctx_t;
 typedef int (* phevPipeEventHandler_t)(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event);
 typedef void (* phevErrorHandler_t)(phevError_t *error);
 typedef void (* phev_pipe_updateRegisterCallback_t)(phev_pipe_ctx_t *ctx, uint8_t reg, void *customCtx);
 typedef void (* phevRegistrationComplete_t)(phev_pipe_ctx_t *ctx);
+// True while the out client is still waiting on the car to answer a connect
+typedef bool (* phevConnecting_t)(messagingClient_t *client);
 
 typedef struct phev_pipe_updateRegisterCtx_t
 {
@@ -119,9 +162,28 @@ typedef struct phev_pipe_ctx_t
     uint8_t currentXOR;
     uint8_t pingXOR;
     uint8_t commandXOR;
+    // Key the next frame from the car is expected under, the last frame's or the one a bb announced
+    uint8_t inboundXOR;
     bool encrypt;
     bool registerDevice;
     phevRegistrationComplete_t registrationCompleteCallback;
+    uint64_t nextConnectAttempt;
+    uint32_t connectAttempts;
+    uint32_t connectBackoffMin;
+    uint32_t connectBackoffMax;
+    uint32_t connectTimeout;
+    uint64_t connectStartedAt;
+    phevConnecting_t outConnecting;
+    uint32_t random;
+    atomic_bool linkUp;
+    phevHistogram_t * latency[PHEV_PIPE_LATENCY_MAX];
+    uint64_t commandSentAt[256];
+    uint64_t pingSentAt[256];
+    uint64_t readAt;
+    uint64_t disconnectedAt;
+    phevMetrics_t metrics;
+    phevTrace_t * trace;
+    const phevProfile_t * profile;
     void *ctx;
 } phev_pipe_ctx_t;
 
@@ -145,12 +207,20 @@ typedef struct phev_pipe_settings_t
     phevErrorHandler_t errorHandler;
     bool registerDevice;
     phevRegistrationComplete_t registrationCompleteCallback;
+    uint32_t connectBackoffMin;
+    uint32_t connectBackoffMax;
+    uint32_t connectTimeout;
+    phevConnecting_t outConnecting;
+    phevProfileId_t profile;
     void *ctx;
 } phev_pipe_settings_t;
 
 void phev_pipe_loop(phev_pipe_ctx_t *);
 phev_pipe_ctx_t *phev_pipe_createPipe(phev_pipe_settings_t);
 void phev_pipe_waitForConnection(phev_pipe_ctx_t *ctx);
+bool phev_pipe_tryConnect(phev_pipe_ctx_t *ctx);
+void phev_pipe_linkUp(phev_pipe_ctx_t *ctx);
+uint32_t phev_pipe_connectBackoff(uint32_t attempts, uint32_t min, uint32_t max, uint32_t random);
 message_t *phev_pipe_outputChainInputTransformer(void *, message_t *);
 message_t *phev_pipe_outputEventTransformer(void *, message_t *);
 void phev_pipe_registerEventHandler(phev_pipe_ctx_t *, phevPipeEventHandler_t);
@@ -164,6 +234,9 @@ void phev_pipe_sendMac(phev_pipe_ctx_t *ctx, uint8_t *mac);
 void phev_pipe_updateRegister(phev_pipe_ctx_t *, const uint8_t, const uint8_t);
 void phev_pipe_updateComplexRegister(phev_pipe_ctx_t *, const uint8_t, const uint8_t *, size_t);
 void phev_pipe_updateComplexRegisterWithCallback(phev_pipe_ctx_t *ctx, const uint8_t reg, const uint8_t * data, size_t length, phev_pipe_updateRegisterCallback_t callback, void * customCtx);
+const phevHistogram_t * phev_pipe_getLatency(const phev_pipe_ctx_t *ctx, phevPipeLatency_t latency);
+void phev_pipe_resetLatency(phev_pipe_ctx_t *ctx);
+void phev_pipe_getMetrics(const phev_pipe_ctx_t *ctx, phevMetricsSnapshot_t *snapshot);
 void phev_pipe_updateRegisterWithCallback(phev_pipe_ctx_t *ctx, const uint8_t reg, const uint8_t value, phev_pipe_updateRegisterCallback_t callback, void * customCtx);
 phevPipeEvent_t *phev_pipe_createRegisterEvent(phev_pipe_ctx_t *phevCtx, phevMessage_t *phevMessage);
 void phev_pipe_outboundPublish(phev_pipe_ctx_t * ctx, message_t * message);
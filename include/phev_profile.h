@@ -0,0 +1,63 @@
+#ifndef _PHEV_PROFILE_H_
+#define _PHEV_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+    Protocol profiles, one per model year family.
+
+    A profile holds everything that differs between model years as constants:
+    the command bytes we send, the registers that moved, the schema model bit
+    and a table of what each incoming command byte means. Each session points
+    at one profile, so sessions for cars of different years can run in one
+    process, and the decode, ack and dispatch paths ask the table instead of
+    comparing against every year's byte.
+
+    The incoming table is shared for now. Cars of both families have been
+    seen answering with the other family's response bytes and the pipe has
+    always taken either, a profile can narrow it without touching the pipe.
+
+        RESPONSE        command responses and register updates from the car
+        PING_RESPONSE   answers to our pings
+        START_RESPONSE  answer to the start frame
+        KEY_CHANGE      the car moving to a new key, bb and cc
+        PLAIN_ACK       acked without the key, the security handshake
+        NO_ACK          never acked
+*/
+#define PHEV_PROFILE_RESPONSE 0x01
+#define PHEV_PROFILE_PING_RESPONSE 0x02
+#define PHEV_PROFILE_START_RESPONSE 0x04
+#define PHEV_PROFILE_KEY_CHANGE 0x08
+#define PHEV_PROFILE_PLAIN_ACK 0x10
+#define PHEV_PROFILE_NO_ACK 0x20
+
+typedef enum phevProfileId_t {
+    PHEV_PROFILE_DEFAULT,
+    PHEV_PROFILE_PRE_MY18,
+    PHEV_PROFILE_MY18,
+    PHEV_PROFILE_MY19,
+    PHEV_PROFILE_MAX,
+} phevProfileId_t;
+
+typedef struct phevProfile_t {
+    phevProfileId_t id;
+    const char * name;
+    uint8_t models;
+    uint8_t pingSend;
+    uint8_t startSend;
+    uint8_t acScheduleReg;
+    const uint8_t * incoming;
+} phevProfile_t;
+
+// DEFAULT and anything out of range give MY18, the bytes sessions sent before there were profiles.
+const phevProfile_t * phev_profile_get(phevProfileId_t id);
+
+// The id for a name as phev_profile_get gives it ("pre-my18", "my18", "my19"), PHEV_PROFILE_MAX when not known.
+phevProfileId_t phev_profile_fromName(const char * name);
+
+// One load and a mask, for the per frame paths.
+#define PHEV_PROFILE_IS(profile, command, flags) (((profile)->incoming[(uint8_t) (command)] & (flags)) != 0)
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _PHEV_QUEUE_H_
+#define _PHEV_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PHEV_QUEUE_DEFAULT_BLOCK_MS 1000
+
+/*
+    Bounded single producer single consumer event queue.
+
+    The pipe thread pushes, a dispatcher thread (phev_queue_start) or the
+    owner (phev_queue_drain) delivers, so a slow consumer never holds up the
+    pipe loop and its acks and pings. Pushing copies the data, the pointer a
+    consumer is handed is only good for the length of the call.
+
+    What happens when the consumer falls behind is the policy:
+
+        PHEV_QUEUE_COALESCE_OR_DROP_NEW
+                                everything is queued in order while there is
+                                room, once the queue is full a register update
+                                replaces the older value of that register still
+                                waiting and any other event is dropped, the
+                                events already queued are kept
+        PHEV_QUEUE_COALESCE     a register update always replaces the older
+                                value of that register still waiting, the
+                                consumer only ever sees the latest
+        PHEV_QUEUE_BLOCK        the pipe waits for room, up to blockTimeoutMs,
+                                then drops. Lossless while the consumer keeps
+                                up, but a stuck consumer stalls the session
+
+    Nothing evicts the oldest queued event, the head belongs to the consumer
+    and the producer never moves it.
+
+    Register updates are never delivered older than one already delivered
+    for the same register, a stale value is dropped and counted instead.
+*/
+typedef enum phevQueuePolicy_t {
+    PHEV_QUEUE_COALESCE_OR_DROP_NEW,
+    PHEV_QUEUE_COALESCE,
+    PHEV_QUEUE_BLOCK,
+} phevQueuePolicy_t;
+
+typedef struct phevQueueSettings_t {
+    size_t depth;
+    phevQueuePolicy_t policy;
+    uint32_t blockTimeoutMs;
+} phevQueueSettings_t;
+
+typedef struct phevQueueItem_t {
+    int type;
+    bool isRegister;
+    uint8_t reg;
+    const uint8_t * data;
+    size_t length;
+} phevQueueItem_t;
+
+typedef struct phevQueueStats_t {
+    uint32_t queued;
+    uint32_t delivered;
+    uint32_t dropped;
+    uint32_t coalesced;
+    uint32_t blocked;
+    uint32_t depth;
+    uint32_t highWater;
+} phevQueueStats_t;
+
+typedef void (* phevQueueDeliver_t)(const phevQueueItem_t * item, void * ctx);
+
+typedef struct phevQueue_t phevQueue_t;
+
+phevQueue_t * phev_queue_create(phevQueueSettings_t settings, phevQueueDeliver_t deliver, void * ctx);
+
+// Stops the dispatcher thread after it has delivered what is queued.
+void phev_queue_destroy(phevQueue_t * queue);
+
+// Producer side, returns false when the item was dropped.
+bool phev_queue_push(phevQueue_t * queue, const phevQueueItem_t * item);
+
+// Delivers on a thread of its own, false where there are no threads.
+bool phev_queue_start(phevQueue_t * queue);
+void phev_queue_stop(phevQueue_t * queue);
+
+// Consumer side when there is no dispatcher thread, returns how many were delivered.
+size_t phev_queue_drain(phevQueue_t * queue);
+
+phevQueueStats_t phev_queue_stats(const phevQueue_t * queue);
+
+#endif
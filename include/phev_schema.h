@@ -0,0 +1,105 @@
+#ifndef _PHEV_SCHEMA_H_
+#define _PHEV_SCHEMA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "phev_core.h"
+#include "phev_model.h"
+#ifdef __XTENSA__
+#include "cJSON.h"
+#else
+#include <cjson/cJSON.h>
+#endif
+
+#define KO_WF_AC_ERR_INFO_EVR 16
+
+#define PHEV_SCHEMA_MODEL_PRE_MY18 0x01
+#define PHEV_SCHEMA_MODEL_MY18 0x02
+#define PHEV_SCHEMA_MODEL_MY19 0x04
+#define PHEV_SCHEMA_MODEL_ANY (PHEV_SCHEMA_MODEL_PRE_MY18 | PHEV_SCHEMA_MODEL_MY18 | PHEV_SCHEMA_MODEL_MY19)
+// The nibble packed air con schedule, MY19 moved it to a register of its own
+#define PHEV_SCHEMA_MODEL_PRE_MY19 (PHEV_SCHEMA_MODEL_PRE_MY18 | PHEV_SCHEMA_MODEL_MY18)
+
+#define PHEV_SCHEMA_NO_INVALID 0
+
+typedef enum phevSchemaEndian_t {
+    PHEV_SCHEMA_LE,
+    PHEV_SCHEMA_BE,
+} phevSchemaEndian_t;
+
+typedef enum phevSchemaType_t {
+    PHEV_SCHEMA_INT,
+    PHEV_SCHEMA_BOOL,
+    PHEV_SCHEMA_ENUM,
+} phevSchemaType_t;
+
+/*
+    Register field schema.
+
+    Each entry describes one named field inside a register: the byte offset and
+    width, the byte order when the field spans more than one byte, a mask and
+    shift applied to the raw value, a linear scale, how it is presented (int,
+    bool or enum) and the model years it applies to. When every bit of the
+    invalid mask is set in the raw value the car has not reported the field.
+    The json group is the object the field sits in under status, NULL for
+    status itself.
+
+    X(ID, accessor, json name, json group, register, offset, width, endian, mask, shift, scale, type, enum names, models, invalid mask)
+
+    The table, the field ids and one typed accessor per field are generated from
+    this list so adding a field is a single line here.
+*/
+#define PHEV_SCHEMA_FIELDS(X) \
+    X(BATTERY_SOC,          batterySoc,         "soc",                  "battery",  KO_WF_BATT_LEVEL_INFO_REP_EVR,  0, 1, PHEV_SCHEMA_LE, 0xffffffff, 0, 1, PHEV_SCHEMA_INT,  NULL,                    PHEV_SCHEMA_MODEL_ANY,      PHEV_SCHEMA_NO_INVALID) \
+    X(BATTERY_WARNING,      batteryWarning,     "warning",              "battery",  KO_WF_CHG_GUN_STATUS_EVR,       2, 1, PHEV_SCHEMA_LE, 0xffffffff, 0, 1, PHEV_SCHEMA_INT,  NULL,                    PHEV_SCHEMA_MODEL_ANY,      PHEV_SCHEMA_NO_INVALID) \
+    X(AC_ERROR,             acError,            "acError",              NULL,       KO_WF_AC_ERR_INFO_EVR,          0, 1, PHEV_SCHEMA_LE, 0xffffffff, 0, 1, PHEV_SCHEMA_INT,  NULL,                    PHEV_SCHEMA_MODEL_ANY,      PHEV_SCHEMA_NO_INVALID) \
+    X(DOOR_LOCK,            doorLock,           "doorLock",             NULL,       KO_WF_DOOR_STATUS_INFO_REP_EVR, 0, 1, PHEV_SCHEMA_LE, 0xffffffff, 0, 1, PHEV_SCHEMA_ENUM, phev_schema_doorLockNames, PHEV_SCHEMA_MODEL_ANY,      PHEV_SCHEMA_NO_INVALID) \
+    X(CHARGING,             charging,           "charging",             "battery",  KO_WF_OBCHG_OK_ON_INFO_REP_EVR, 0, 1, PHEV_SCHEMA_LE, 0xffffffff, 0, 1, PHEV_SCHEMA_BOOL, NULL,                    PHEV_SCHEMA_MODEL_ANY,      PHEV_SCHEMA_NO_INVALID) \
+    X(CHARGE_REMAINING,     chargeRemaining,    "chargeTimeRemaining",  "battery",  KO_WF_OBCHG_OK_ON_INFO_REP_EVR, 1, 2, PHEV_SCHEMA_LE, 0xffffffff, 0, 1, PHEV_SCHEMA_INT,  NULL,                    PHEV_SCHEMA_MODEL_ANY,      0xff00) \
+    X(HVAC_OPERATING,       hvacOperating,      "operating",            "hvac",     KO_AC_MANUAL_SW_EVR,            1, 1, PHEV_SCHEMA_LE, 0xffffffff, 0, 1, PHEV_SCHEMA_BOOL, NULL,                    PHEV_SCHEMA_MODEL_ANY,      PHEV_SCHEMA_NO_INVALID) \
+    X(HVAC_MODE,            hvacMode,           "mode",                 "hvac",     KO_WF_TM_AC_STAT_INFO_REP_EVR,  0, 1, PHEV_SCHEMA_LE, 0x0f,       0, 1, PHEV_SCHEMA_INT,  NULL,                    PHEV_SCHEMA_MODEL_PRE_MY19, PHEV_SCHEMA_NO_INVALID) \
+    X(HVAC_TIME,            hvacTime,           "time",                 "hvac",     KO_WF_TM_AC_STAT_INFO_REP_EVR,  0, 1, PHEV_SCHEMA_LE, 0xf0,       4, 1, PHEV_SCHEMA_INT,  NULL,                    PHEV_SCHEMA_MODEL_PRE_MY19, PHEV_SCHEMA_NO_INVALID)
+
+#define PHEV_SCHEMA_FIELD_ID(ID, ...) PHEV_FIELD_##ID,
+typedef enum phevSchemaFieldId_t {
+    PHEV_SCHEMA_FIELDS(PHEV_SCHEMA_FIELD_ID)
+    PHEV_FIELD_MAX
+} phevSchemaFieldId_t;
+#undef PHEV_SCHEMA_FIELD_ID
+
+typedef struct phevSchemaField_t {
+    phevSchemaFieldId_t id;
+    const char * name;
+    const char * group;
+    uint8_t reg;
+    uint8_t offset;
+    uint8_t width;
+    phevSchemaEndian_t endian;
+    uint32_t mask;
+    uint8_t shift;
+    int32_t scale;
+    phevSchemaType_t type;
+    const char * const * enumNames;
+    uint8_t models;
+    uint32_t invalidMask;
+} phevSchemaField_t;
+
+extern const char * const phev_schema_doorLockNames[];
+
+extern const phevSchemaField_t phev_schema_fields[PHEV_FIELD_MAX];
+
+const phevSchemaField_t * phev_schema_getFieldSchema(phevSchemaFieldId_t id);
+bool phev_schema_decodeField(const phevSchemaField_t * field, const uint8_t * data, size_t length, int32_t * value);
+bool phev_schema_getField(const phevModel_t * model, phevSchemaFieldId_t id, uint8_t models, int32_t * value);
+// Every field reported for the model years in models, under its group. This is the status object of phev_service_statusAsJson.
+cJSON * phev_schema_toJson(const phevModel_t * model, uint8_t models);
+// Packs every reported field as a one byte field id followed by the value as a little endian int32.
+size_t phev_schema_encode(const phevModel_t * model, uint8_t models, uint8_t * buffer, size_t length);
+
+// One per field, false when the field is not reported for the model years in models.
+#define PHEV_SCHEMA_ACCESSOR(ID, accessor, ...) bool phev_schema_##accessor(const phevModel_t * model, uint8_t models, int32_t * value);
+PHEV_SCHEMA_FIELDS(PHEV_SCHEMA_ACCESSOR)
+#undef PHEV_SCHEMA_ACCESSOR
+
+#endif
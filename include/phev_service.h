@@ -7,6 +7,10 @@
 #include "phev_core.h"
 #include "phev_pipe.h"
 #include "phev_model.h"
+#include "phev_history.h"
+#include "phev_snapshot.h"
+#include "phev_journal.h"
+#include "phev_broker.h"
 #include "phev_register.h"
 
 
@@ -30,6 +34,7 @@
 #define PHEV_SERVICE_STATUS_JSON "status"
 #define PHEV_SERVICE_BATTERY_JSON "battery"
 #define PHEV_SERVICE_BATTERY_SOC_JSON "soc"
+#define PHEV_SERVICE_STALE_JSON "stale"
 
 #define PHEV_SERVICE_REGISTER_JSON "register"
 #define PHEV_SERVICE_REGISTER_DATA_JSON "data"
@@ -44,9 +49,16 @@
 #define PHEV_SERVICE_HVAC_MODE_JSON "mode"
 #define PHEV_SERVICE_HVAC_TIME_JSON "time"
 
+#define PHEV_SERVICE_SNAPSHOT_MAX_AGE 3600
+
 #define PHEV_SERVICE_START_MESSAGE_JSON "startMessage"
 #define PHEV_SERVICE_START_MESSAGE_DATA_JSON "data"
 
+#define PHEV_SERVICE_LATENCY_COMMAND_ACK_JSON "commandAck"
+#define PHEV_SERVICE_LATENCY_REQUEST_ACK_JSON "requestAck"
+#define PHEV_SERVICE_LATENCY_PING_RTT_JSON "pingRtt"
+#define PHEV_SERVICE_LATENCY_RECONNECT_JSON "reconnect"
+
 
 typedef struct phevServiceCtx_t phevServiceCtx_t;
 
@@ -61,6 +73,18 @@ typedef struct phevServiceSettings_t {
     bool registerDevice;
     phevServiceYieldHandler_t yieldHandler;
     bool my18;
+    phevProfileId_t profile;
+    phevHistorySettings_t history;
+    const char * snapshotPath;
+    const char * snapshotVin;
+    int64_t snapshotMaxAge;
+    phevJournalSettings_t journal;
+    phevBrokerSettings_t broker;
+    uint32_t connectBackoffMin;
+    uint32_t connectBackoffMax;
+    uint32_t connectTimeout;
+    phevConnecting_t outConnecting;
+    size_t traceDepth;
     void * ctx;
 
 } phevServiceSettings_t;
@@ -74,6 +98,11 @@ typedef struct phevServiceCtx_t {
     bool exit;
     phevRegisterCtx_t * registrationCtx;
     bool registerDevice;
+    phevHistory_t * history;
+    phevSnapshot_t * snapshot;
+    int64_t snapshotMaxAge;
+    phevJournal_t * journal;
+    phevBroker_t * broker;
     void * ctx;
 } phevServiceCtx_t;
 
@@ -82,8 +111,43 @@ typedef struct phevServiceHVAC_t {
     uint8_t mode;
 } phevServiceHVAC_t;
 
+#define PHEV_VEHICLE_STATE_VERSION 1
+
+#define PHEV_STATE_BATTERY_LEVEL (1 << 0)
+#define PHEV_STATE_BATTERY_WARNING (1 << 1)
+#define PHEV_STATE_CHARGING (1 << 2)
+#define PHEV_STATE_CHARGE_REMAINING (1 << 3)
+#define PHEV_STATE_LOCKED (1 << 4)
+#define PHEV_STATE_HVAC_OPERATING (1 << 5)
+#define PHEV_STATE_HVAC_MODE (1 << 6)
+#define PHEV_STATE_HVAC_TIME (1 << 7)
+#define PHEV_STATE_AC_ERROR (1 << 8)
+#define PHEV_STATE_ALL (0x1ff)
+
+/*
+    Plain data snapshot of the whole vehicle taken from one consistent version
+    of the model. Fields the car has not reported are cleared from "present"
+    and keep the same defaults as the single value getters.
+*/
+typedef struct phevVehicleState_t {
+    uint32_t structVersion;
+    uint32_t modelVersion;
+    uint32_t present;
+    int batteryLevel;
+    int batteryWarning;
+    bool charging;
+    int remainingChargeTime;
+    int locked;
+    bool hvacOperating;
+    uint8_t hvacMode;
+    uint8_t hvacTime;
+    int acError;
+} phevVehicleState_t;
+
 phevServiceCtx_t * phev_service_create(phevServiceSettings_t settings);
 void phev_service_start(phevServiceCtx_t * ctx);
+// Closes what the service opened to persist the model. Called on the loop thread once phev_service_start returns.
+void phev_service_close(phevServiceCtx_t * ctx);
 phevServiceCtx_t * phev_service_init(messagingClient_t *in, messagingClient_t *out,bool registerDevice);
 phevServiceCtx_t * phev_service_initForRegistration(messagingClient_t *in, messagingClient_t *out);
 void phev_service_register(const char * mac, phevServiceCtx_t * ctx, phevRegistrationComplete_t complete);
@@ -99,6 +163,10 @@ int phev_service_getBatteryWarning(phevServiceCtx_t * ctx);
 int phev_service_getACError(phevServiceCtx_t * ctx);
 int phev_service_doorIsLocked(phevServiceCtx_t * ctx);
 char * phev_service_statusAsJson(phevServiceCtx_t * ctx);
+char * phev_service_latencyAsJson(phevServiceCtx_t * ctx);
+
+// Routes cJSON through the library allocator, so the JSON it builds is counted too.
+void phev_service_useAllocator(void);
 bool phev_service_outputFilter(void *ctx, message_t * message);
 messageBundle_t * phev_service_inputSplitter(void * ctx, message_t * message);
 void phev_service_loop(phevServiceCtx_t * ctx);
@@ -110,6 +178,11 @@ char * phev_service_getDateSync(const phevServiceCtx_t * ctx);
 bool phev_service_getChargingStatus(const phevServiceCtx_t * ctx);
 int phev_service_getRemainingChargeTime(const phevServiceCtx_t * ctx);
 phevServiceHVAC_t * phev_service_getHVACStatus(const phevServiceCtx_t * ctx);
+void phev_service_getVehicleState(const phevServiceCtx_t * ctx, phevVehicleState_t * state);
+uint32_t phev_service_compareVehicleState(const phevVehicleState_t * previous, const phevVehicleState_t * current);
+const phevHistory_t * phev_service_getHistory(const phevServiceCtx_t * ctx);
+int64_t phev_service_getRegisterAge(const phevServiceCtx_t * ctx, uint8_t reg);
+bool phev_service_isStale(const phevServiceCtx_t * ctx, uint8_t reg);
 int phev_service_eventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event);
 void phev_service_disconnectInput(phevServiceCtx_t * ctx);
 void phev_service_disconnectOutput(phevServiceCtx_t * ctx);
@@ -0,0 +1,74 @@
+#ifndef _PHEV_SNAPSHOT_H_
+#define _PHEV_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "phev_core.h"
+#include "phev_model.h"
+
+#define PHEV_SNAPSHOT_MAGIC 0x50484556
+#define PHEV_SNAPSHOT_VERSION 1
+#define PHEV_SNAPSHOT_MAX_DATA 32
+#define PHEV_SNAPSHOT_REGISTERS 256
+
+/*
+    Memory mapped model snapshot.
+
+    The file has a fixed layout: a header holding the magic, layout version,
+    the VIN the snapshot belongs to and a checksum over those, followed by one
+    slot per register. Every slot carries the wall clock time it was written
+    and its own checksum so a slot torn by a crash is ignored on load rather
+    than restored.
+
+    Writes go straight into the shared mapping so the state is persisted as the
+    car reports it, the kernel flushes the pages. A header that does not match,
+    or a different VIN, resets the file. The snapshot remembers which registers
+    it restored so phev_snapshot_unload can take them back out of the model
+    when the car turns out to be another one.
+
+    Only available where mmap is, elsewhere phev_snapshot_open returns NULL.
+*/
+typedef struct phevSnapshotHeader_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotSize;
+    char vin[VIN_LEN + 1];
+    uint32_t checksum;
+} phevSnapshotHeader_t;
+
+typedef struct phevSnapshotSlot_t {
+    int64_t updated;
+    uint8_t length;
+    uint8_t data[PHEV_SNAPSHOT_MAX_DATA];
+    uint32_t checksum;
+} phevSnapshotSlot_t;
+
+typedef struct phevSnapshotFile_t {
+    phevSnapshotHeader_t header;
+    phevSnapshotSlot_t slots[PHEV_SNAPSHOT_REGISTERS];
+} phevSnapshotFile_t;
+
+typedef struct phevSnapshot_t {
+    int fd;
+    phevSnapshotFile_t * file;
+    bool restored[PHEV_SNAPSHOT_REGISTERS];
+} phevSnapshot_t;
+
+phevSnapshot_t * phev_snapshot_open(const char * path, const char * vin);
+void phev_snapshot_close(phevSnapshot_t * snapshot);
+// Resets the snapshot when it belongs to another VIN, returns true when it did. One not yet bound to a VIN takes this one and keeps its values.
+bool phev_snapshot_setVin(phevSnapshot_t * snapshot, const char * vin);
+int phev_snapshot_load(phevSnapshot_t * snapshot, phevModel_t * model);
+// Clears the registers load restored that the car has not reported since, returns how many.
+int phev_snapshot_unload(phevSnapshot_t * snapshot, phevModel_t * model);
+bool phev_snapshot_store(phevSnapshot_t * snapshot, uint8_t reg, const uint8_t * data, size_t length, time_t now);
+// Marks the value held for the register as current, for a resend the model filtered out as unchanged.
+bool phev_snapshot_touch(phevSnapshot_t * snapshot, uint8_t reg, time_t now);
+// Seconds since the register was last written, -1 when the snapshot has no valid value for it.
+int64_t phev_snapshot_age(const phevSnapshot_t * snapshot, uint8_t reg, time_t now);
+bool phev_snapshot_isStale(const phevSnapshot_t * snapshot, uint8_t reg, time_t now, int64_t maxAge);
+void phev_snapshot_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx);
+
+#endif
@@ -4,15 +4,111 @@
 #ifndef _PHEV_TCPIP_H_
 #define _PHEV_TCPIP_H_
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "phev_capture.h"
 
 #define TCP_READ_TIMEOUT 1000
 
+// Longest phev_tcpClientOpenSocket waits for the car to answer a connect
+#ifndef PHEV_TCP_CONNECT_TIMEOUT
+#define PHEV_TCP_CONNECT_TIMEOUT 3000
+#endif
+
+// Holds the whole burst the car sends after KO_WF_EV_UPDATE_SP
+#ifndef PHEV_TCP_RX_BUFFER_SIZE
+#define PHEV_TCP_RX_BUFFER_SIZE 4096
+#endif
+
+// Descriptors below this can have a receive buffer from phev_tcpClientConnectSocket
+#ifndef PHEV_TCP_MAX_SOCKETS
+#define PHEV_TCP_MAX_SOCKETS 4096
+#endif
+
+#define PHEV_TCP_MAX_FRAME 257
+
+/*
+    Per connection receive buffer.
+
+    Each connected socket gets its own buffer, filled with one recv of
+    whatever is available. Unread bytes are always contiguous so
+    phev_tcpClientNextFrame can return a pointer to a complete frame inside
+    the buffer, valid until the next fill or consume.
+
+    A capture on the buffer records every fill as it arrives, before the
+    framer drops anything.
+
+    Transports embed one in their own state. A socket from
+    phev_tcpClientConnectSocket has one kept by its descriptor for the
+    phev_tcpClientRead hook, the connect fails if it cannot get one.
+*/
+typedef struct phevTcpRxBuffer_t {
+    int soc;
+    bool quickAck;
+    phevCapture_t *capture;
+    size_t start;
+    size_t end;
+    uint8_t data[PHEV_TCP_RX_BUFFER_SIZE];
+} phevTcpRxBuffer_t;
+
+/*
+    Socket options for one connection, given to phev_tcpClientConnectStart.
+    Zero leaves the system default in place.
+
+    The car's command frames are only 6 to 20 bytes, with Nagle on a second
+    frame written before the first is acknowledged waits for the car's
+    delayed ack, noDelay sends it straight away. TCP_QUICKACK is not sticky
+    on Linux so phev_tcpClientFill sets it again after every read into a
+    buffer with quickAck set. Keepalive and
+    userTimeoutMs let a dead link be noticed without waiting for a write to
+    fail. Options the platform does not have are skipped.
+*/
+typedef struct phevTcpOptions_t {
+    bool noDelay;
+    bool quickAck;
+    int keepAliveIdle;
+    int keepAliveInterval;
+    int keepAliveCount;
+    int receiveBuffer;
+    int sendBuffer;
+    int userTimeoutMs;
+} phevTcpOptions_t;
+
 int phev_tcpClientConnectSocket(const char *host, uint16_t port);
 
+// Connects like phev_tcpClientConnectSocket but without a receive buffer, for backends that buffer themselves.
+int phev_tcpClientOpenSocket(const char *host, uint16_t port);
+
+// Returns the number of options that could not be set.
+int phev_tcpClientApplyOptions(int soc, const phevTcpOptions_t *options);
+
+// Starts a non blocking connect with options, which may be NULL, and returns the socket, or -1. inProgress is set while the connect has not finished, phev_tcpClientConnectPoll finishes it.
+int phev_tcpClientConnectStart(const char *host, uint16_t port, const phevTcpOptions_t *options, bool *inProgress);
+
+// Waits at most timeout_ms for a started connect. Returns 1 once connected, 0 while still connecting and -1 when it failed.
+int phev_tcpClientConnectPoll(int soc, int timeout_ms);
+
 int phev_tcpClientDisconnectSocket(int soc);
 
 int phev_tcpClientRead(int soc, uint8_t *buf, size_t len);
 
 int phev_tcpClientWrite(int soc, uint8_t *buf, size_t len);
 
+phevTcpRxBuffer_t *phev_tcpClientRxBuffer(int soc);
+
+int phev_tcpClientFill(phevTcpRxBuffer_t *rx, int timeout_ms);
+
+int phev_tcpClientNextFrame(phevTcpRxBuffer_t *rx, const uint8_t **frame);
+
+void phev_tcpClientConsume(phevTcpRxBuffer_t *rx, size_t length);
+
+// Copies in bytes received elsewhere, returns how many fitted.
+size_t phev_tcpClientAppend(phevTcpRxBuffer_t *rx, const uint8_t *data, size_t length);
+
+// Moves every complete frame that fits into buf, returns the bytes copied.
+size_t phev_tcpClientTakeFrames(phevTcpRxBuffer_t *rx, uint8_t *buf, size_t len);
+
+// Takes the buffered frames, filling from rx->soc first when there is no whole one. Works on any stream descriptor.
+int phev_tcpClientReadFrames(phevTcpRxBuffer_t *rx, uint8_t *buf, size_t len);
+
 #endif
\ No newline at end of file
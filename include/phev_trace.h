@@ -0,0 +1,110 @@
+#ifndef _PHEV_TRACE_H_
+#define _PHEV_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PHEV_TRACE_MAGIC 0x50485654
+#define PHEV_TRACE_VERSION 1
+
+/*
+    Binary trace of the frame lifecycle.
+
+    Each trace point writes a 16 byte record with a monotonic nanosecond
+    timestamp into a per session ring, no formatting, no locks and no
+    allocation, so tracing does not move the timing it is there to show.
+    The ring keeps the most recent depth records, older ones are
+    overwritten. phev_trace_save writes them to a file, which the
+    phev_trace tool turns into Chrome trace JSON.
+
+        FRAME_RECEIVED      a read from the car, arg is its length
+        FRAME_SPLIT         a frame split out of a read, arg is its length
+        FRAME_DECODED       a frame decoded, arg is its type
+        FRAME_FILTERED      a register update dropped as unchanged
+        FRAME_ACKED         our ack to a car request handed to the pipe
+        EVENT_DISPATCHED    a pipe event sent to the handlers, arg is the event
+        COMMAND_QUEUED      a register update put in the callback table, arg is its length
+        COMMAND_SENT        a register update sent, arg is 1 for a resend
+        COMMAND_ACKED       the car's ack to a register update
+        XOR_CHANGED         a key changed, xor is the new key, arg which keys
+
+    Records go in from any thread, each claims its slot with one atomic add
+    and publishes it with a sequence number, a reader skips a slot that is
+    being written.
+*/
+typedef enum phevTracePoint_t {
+    PHEV_TRACE_FRAME_RECEIVED,
+    PHEV_TRACE_FRAME_SPLIT,
+    PHEV_TRACE_FRAME_DECODED,
+    PHEV_TRACE_FRAME_FILTERED,
+    PHEV_TRACE_FRAME_ACKED,
+    PHEV_TRACE_EVENT_DISPATCHED,
+    PHEV_TRACE_COMMAND_QUEUED,
+    PHEV_TRACE_COMMAND_SENT,
+    PHEV_TRACE_COMMAND_ACKED,
+    PHEV_TRACE_XOR_CHANGED,
+    PHEV_TRACE_MAX,
+} phevTracePoint_t;
+
+// Which keys an XOR_CHANGED record is for.
+#define PHEV_TRACE_XOR_CURRENT 1
+#define PHEV_TRACE_XOR_PING 2
+#define PHEV_TRACE_XOR_COMMAND 4
+
+typedef struct phevTraceRecord_t {
+    uint64_t timestamp;
+    uint8_t point;
+    uint8_t command;
+    uint8_t reg;
+    uint8_t xor;
+    uint32_t arg;
+} phevTraceRecord_t;
+
+typedef struct phevTrace_t phevTrace_t;
+
+typedef struct phevTraceReader_t phevTraceReader_t;
+
+// Depth is rounded up to a power of two.
+phevTrace_t * phev_trace_create(size_t depth);
+void phev_trace_destroy(phevTrace_t * trace);
+
+void phev_trace_record(phevTrace_t * trace, phevTracePoint_t point, uint8_t command, uint8_t reg, uint8_t xor, uint32_t arg);
+
+// Copies out up to max of the most recent records, oldest first. Returns how many were copied.
+size_t phev_trace_snapshot(const phevTrace_t * trace, phevTraceRecord_t * records, size_t max);
+
+/*
+    The file is a 16 byte header
+
+        uint32_t magic
+        uint32_t version
+        uint64_t count
+
+    followed by count records of 16 bytes, timestamp, point, command, reg,
+    xor and arg, little endian.
+*/
+bool phev_trace_save(const phevTrace_t * trace, const char * path);
+
+phevTraceReader_t * phev_trace_openReader(const char * path);
+void phev_trace_closeReader(phevTraceReader_t * reader);
+// Returns false at the end of the file or at a truncated record.
+bool phev_trace_next(phevTraceReader_t * reader, phevTraceRecord_t * record);
+
+const char * phev_trace_pointName(uint8_t point);
+
+// Trace points compile out with PHEV_NO_TRACE and cost one test while no trace is attached.
+#ifndef PHEV_NO_TRACE
+#define PHEV_TRACE(trace, ...) \
+    do                                           \
+    {                                            \
+        if (trace)                               \
+        {                                        \
+            phev_trace_record(trace, __VA_ARGS__); \
+        }                                        \
+    } while (0)
+#else
+#define PHEV_TRACE(trace, ...) do { } while (0)
+#endif
+
+#endif
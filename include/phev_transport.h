@@ -0,0 +1,112 @@
+#ifndef _PHEV_TRANSPORT_H_
+#define _PHEV_TRANSPORT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "msg_core.h"
+#include "phev_capture.h"
+#include "phev_tcpip.h"
+
+// Returned by connect while the connect is still in flight, call connect again to carry on
+#define PHEV_TRANSPORT_CONNECTING 1
+
+// Longest one tcp connect call waits for the car to answer
+#ifndef PHEV_TRANSPORT_CONNECT_POLL_TIME
+#define PHEV_TRANSPORT_CONNECT_POLL_TIME 50
+#endif
+
+/*
+    Pluggable transport for the outgoing messaging client.
+
+    A transport is an ops table and its own state. Reads hand back whole
+    frames only, 0 when nothing arrived within the read timeout and -1 when
+    the connection has gone. Writes take a list of buffers so a caller with a
+    frame in pieces does not have to join it first. fd gives a descriptor to
+    poll, or -1 when there is nothing to poll.
+
+    tcp connects without blocking. A connect waits at most
+    PHEV_TRANSPORT_CONNECT_POLL_TIME for the car and returns
+    PHEV_TRANSPORT_CONNECTING until it has an answer, it is up to the caller
+    how long to keep asking. Closing abandons the connect.
+
+        tcp         the phev_tcpClient hooks, with its own socket options
+        uring       tcp, then reads and writes through io_uring when it is there
+        unix        a stream Unix domain socket, for a local relay daemon
+        loopback    in memory, no system calls, a responder plays the car
+
+    A capture set on a transport records what it writes, and what it reads
+    as it comes off the socket before framing. Set it before connecting.
+
+    phev_transport_createMessagingClient wraps any of them in a
+    messagingClient_t for phevSettings_t.out, or set phevSettings_t.transport
+    and phev_init does it.
+*/
+typedef struct phevTransport_t phevTransport_t;
+
+typedef struct phevTransportBuffer_t {
+    const uint8_t * data;
+    size_t length;
+} phevTransportBuffer_t;
+
+typedef struct phevTransportOps_t {
+    const char * name;
+    int (* connect)(phevTransport_t * transport);
+    int (* read)(phevTransport_t * transport, uint8_t * buf, size_t len);
+    int (* writev)(phevTransport_t * transport, const phevTransportBuffer_t * buffers, size_t count);
+    void (* close)(phevTransport_t * transport);
+    int (* fd)(const phevTransport_t * transport);
+    void (* destroy)(phevTransport_t * transport);
+} phevTransportOps_t;
+
+struct phevTransport_t {
+    const phevTransportOps_t * ops;
+    bool connected;
+    bool connecting;
+    phevCapture_t * capture;
+    void * ctx;
+};
+
+/*
+    Called with every write the client makes, and with no data when the
+    client reads and nothing is buffered. It answers with
+    phev_transport_loopbackInject, on the calling thread. A loopback with no
+    responder keeps what is written for phev_transport_loopbackDrain.
+*/
+typedef void (* phevLoopbackResponder_t)(phevTransport_t * transport, const uint8_t * data, size_t length, void * ctx);
+
+phevTransport_t * phev_transport_tcp(const char * host, uint16_t port);
+
+phevTransport_t * phev_transport_uring(const char * host, uint16_t port);
+
+// Socket options for the next tcp or uring connect, NULL for the system defaults.
+void phev_transport_tcpSetOptions(phevTransport_t * transport, const phevTcpOptions_t * options);
+
+// NULL where there are no Unix domain sockets.
+phevTransport_t * phev_transport_unix(const char * path);
+
+phevTransport_t * phev_transport_loopback(phevLoopbackResponder_t responder, void * ctx);
+
+// Bytes from the car, returns how many fitted.
+size_t phev_transport_loopbackInject(phevTransport_t * transport, const uint8_t * data, size_t length);
+
+// Bytes the client wrote, for a loopback with no responder.
+size_t phev_transport_loopbackDrain(phevTransport_t * transport, uint8_t * buf, size_t len);
+
+int phev_transport_connect(phevTransport_t * transport);
+int phev_transport_read(phevTransport_t * transport, uint8_t * buf, size_t len);
+int phev_transport_write(phevTransport_t * transport, const uint8_t * data, size_t length);
+int phev_transport_writev(phevTransport_t * transport, const phevTransportBuffer_t * buffers, size_t count);
+void phev_transport_close(phevTransport_t * transport);
+int phev_transport_fd(const phevTransport_t * transport);
+void phev_transport_destroy(phevTransport_t * transport);
+
+// The capture stays the caller's to close, after the transport is done with it.
+void phev_transport_setCapture(phevTransport_t * transport, phevCapture_t * capture);
+
+messagingClient_t * phev_transport_createMessagingClient(phevTransport_t * transport);
+
+// True while the client's transport has a connect in flight.
+bool phev_transport_clientConnecting(messagingClient_t * client);
+
+#endif
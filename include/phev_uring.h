@@ -0,0 +1,49 @@
+#ifndef _PHEV_URING_H_
+#define _PHEV_URING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "phev_capture.h"
+
+#ifndef PHEV_URING_MAX_SOCKETS
+#define PHEV_URING_MAX_SOCKETS 4096
+#endif
+
+#define PHEV_URING_ENTRIES 32
+#define PHEV_URING_RECV_BUFFERS 8
+#define PHEV_URING_RECV_BUFFER_SIZE 512
+#define PHEV_URING_SEND_BUFFER_SIZE 2048
+
+/*
+    io_uring transport, a drop in for the phev_tcpClient read, write, connect
+    and disconnect hooks.
+
+    Each connection gets its own ring with a multishot receive into a ring of
+    provided buffers, so the kernel keeps delivering data without a recv per
+    read. Completions are copied into the connection's receive buffer and a
+    read only enters the kernel when no whole frame is buffered.
+
+    A write to an idle socket goes straight out with a non blocking send, on
+    loopback that is cheaper than a send SQE. Whatever cannot go out at once is
+    copied into a send buffer and sent through the ring, writes made while that
+    send is in flight are coalesced into the next one.
+
+    Built with PHEV_IO_URING (Linux, liburing). Without it, or when the kernel
+    has no io_uring or provided buffer rings, phev_uringAvailable returns
+    false and every hook falls through to the phev_tcpClient one.
+*/
+bool phev_uringAvailable(void);
+
+int phev_uringConnect(const char *host, uint16_t port);
+
+// Moves a connected socket onto its own ring, recording receives to capture when it is not NULL. False when it stays on plain read and write.
+bool phev_uringAttach(int soc, phevCapture_t *capture);
+
+int phev_uringDisconnect(int soc);
+
+int phev_uringRead(int soc, uint8_t *buf, size_t len);
+
+int phev_uringWrite(int soc, uint8_t *buf, size_t len);
+
+#endif
@@ -1,16 +1,41 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "phev.h"
 #include "phev_pipe.h"
 #include "phev_tcpip.h"
+#include "phev_uring.h"
+#include "phev_transport.h"
 #include "phev_service.h"
 #include "phev_register.h"
 
-#include "msg_tcpip.h"
-#include "logger.h"
+#include "phev_log.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define PHEV_COMMAND_THREADS
+#endif
 
 const static char *TAG = "PHEV";
 
+#ifdef PHEV_COMMAND_THREADS
+typedef struct phevCommand_t {
+    uint8_t reg;
+    size_t length;
+    uint8_t data[UINT8_MAX];
+    phevCallBackCtx_t * cbCtx;
+} phevCommand_t;
+
+// Commands made off the pipe thread, run by it between loops.
+struct phevCommands_t {
+    pthread_mutex_t lock;
+    pthread_t pipeThread;
+    bool started;
+    phevCommand_t commands[PHEV_MAX_COMMANDS];
+    size_t head;
+    size_t count;
+};
+#endif
+
 void * phev_getUserCtx(phevCtx_t * ctx)
 {
     if(ctx) return ctx->ctx;
@@ -18,6 +43,37 @@ void * phev_getUserCtx(phevCtx_t * ctx)
     return NULL;
 }
 
+static void phev_deliverEvent(const phevQueueItem_t * item, void * ctx)
+{
+    phevCtx_t * phevCtx = (phevCtx_t *) ctx;
+    phevEvent_t ev = {
+        .type = (phevEventTypes_t) item->type,
+        .reg = item->reg,
+        .data = (uint8_t *) item->data,
+        .length = item->length,
+        .ctx = phevCtx,
+    };
+
+    phevCtx->eventHandler(&ev);
+}
+// With an event queue the handler runs on the dispatcher thread and the pipe never waits for it.
+static int phev_dispatchEvent(phevCtx_t * phevCtx, phevEvent_t * ev)
+{
+    if(phevCtx->events)
+    {
+        phevQueueItem_t item = {
+            .type = ev->type,
+            .isRegister = (ev->type == PHEV_REGISTER_UPDATE),
+            .reg = ev->reg,
+            .data = ev->data,
+            .length = ev->length,
+        };
+        phev_queue_push(phevCtx->events, &item);
+
+        return 0;
+    }
+    return phevCtx->eventHandler(ev);
+}
 int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
 {
     LOG_V(TAG,"START - pipeEventHandler");
@@ -36,14 +92,14 @@ int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
                 .ctx =  phevCtx,
             };
 
-            return phevCtx->eventHandler(&ev);
+            return phev_dispatchEvent(phevCtx, &ev);
         }
         case PHEV_PIPE_START_ACK: {
             phevEvent_t ev = {
                 .type = PHEV_STARTED,
                 .ctx =phevCtx,
             };
-            return phevCtx->eventHandler(&ev);
+            return phev_dispatchEvent(phevCtx, &ev);
         }
         case PHEV_PIPE_REG_UPDATE: {
             phevEvent_t ev = {
@@ -53,15 +109,21 @@ int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
                 .length = ((phevMessage_t *) event->data)->length,
                 .ctx =  phevCtx,
             };
-            return phevCtx->eventHandler(&ev);
+            return phev_dispatchEvent(phevCtx, &ev);
         }
         case PHEV_PIPE_GOT_VIN:
         {
             phevVinEvent_t * vinEv = (phevVinEvent_t *) event->data;
-            char * vin = malloc(19);
+            char * vin = phev_malloc(19);
 
             strncpy(vin,vinEv->vin,18);
 
+            if(phev_snapshot_setVin(phevCtx->serviceCtx->snapshot, vin))
+            {
+                // What was restored belongs to another car
+                phev_snapshot_unload(phevCtx->serviceCtx->snapshot, phevCtx->serviceCtx->model);
+            }
+
             phevEvent_t ev = {
                 .type = PHEV_VIN,
                 .data = (unsigned char *) vin,
@@ -69,11 +131,18 @@ int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
                 .ctx =  phevCtx,
 
             };
-            return phevCtx->eventHandler(&ev);
+            if(phevCtx->events)
+            {
+                int ret = phev_dispatchEvent(phevCtx, &ev);
+
+                phev_free(vin);
+                return ret;
+            }
+            return phev_dispatchEvent(phevCtx, &ev);
         }
         case PHEV_PIPE_ECU_VERSION2:
         {
-            char * version = malloc(11);
+            char * version = phev_malloc(11);
 
             strncpy(version,event->data,10);
             phevEvent_t ev = {
@@ -82,7 +151,14 @@ int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
                 .length = strlen(version),
                 .ctx =  phevCtx,
             };
-            return phevCtx->eventHandler(&ev);
+            if(phevCtx->events)
+            {
+                int ret = phev_dispatchEvent(phevCtx, &ev);
+
+                phev_free(version);
+                return ret;
+            }
+            return phev_dispatchEvent(phevCtx, &ev);
         }
         case PHEV_PIPE_DATE_INFO:
         {
@@ -92,7 +168,7 @@ int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
                 .length = event->length,
                 .ctx = phevCtx,
             };
-            return phevCtx->eventHandler(&ev);
+            return phev_dispatchEvent(phevCtx, &ev);
         }
         case PHEV_PIPE_BB:
         {
@@ -107,7 +183,7 @@ int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
                 .length = event->length,
                 .ctx = phevCtx,
             };
-            return phevCtx->eventHandler(&ev);
+            return phev_dispatchEvent(phevCtx, &ev);
         }
         case PHEV_PIPE_FILTERED_MESSAGE:
         {
@@ -117,7 +193,7 @@ int phev_pipeEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
                 .length = event->length,
                 .ctx = phevCtx,
             };
-            return phevCtx->eventHandler(&ev);
+            return phev_dispatchEvent(phevCtx, &ev);
         }
     }
 
@@ -155,34 +231,61 @@ messagingClient_t * phev_createIncomingMessageClient(void)
     return in;
 }
 
-messagingClient_t * phev_createOutgoingMessageClient(const char * host, const uint16_t port)
+// A transport rather than msg_tcpip so the connect does not block the pipe loop
+messagingClient_t * phev_createOutgoingMessageClient(const char * host, const uint16_t port, bool ioUring, const phevTcpOptions_t * options, phevCapture_t * capture)
 {
     LOG_V(TAG,"START - createOutgoingMessageClient");
 
-    tcpIpSettings_t outSettings = {
-        .connect = phev_tcpClientConnectSocket,
-        .disconnect = phev_tcpClientDisconnectSocket,
-        .read = phev_tcpClientRead,
-        .write = phev_tcpClientWrite,
-        .host = strdup(host),
-        .port = port,
-    };
-    messagingClient_t *out = msg_tcpip_createTcpIpClient(outSettings);
+    phevTransport_t * transport = (ioUring && phev_uringAvailable() ? phev_transport_uring(host, port) : phev_transport_tcp(host, port));
+
+    if(transport == NULL)
+    {
+        LOG_E(TAG,"Cannot create transport");
+        return NULL;
+    }
+    phev_transport_tcpSetOptions(transport, options);
+    phev_transport_setCapture(transport, capture);
+
+    messagingClient_t *out = phev_transport_createMessagingClient(transport);
 
     LOG_V(TAG,"END - createOutgoingMessageClient");
 
     return out;
 }
 
+static void phev_runCommands(phevServiceCtx_t * serviceCtx);
+
 phevCtx_t * phev_init(phevSettings_t settings)
 {
     LOG_V(TAG,"START - init");
 
-    phevCtx_t * ctx = malloc(sizeof(phevCtx_t));
+    if(settings.allocator)
+    {
+        phev_alloc_setAllocator(settings.allocator);
+        phev_service_useAllocator();
+    }
+
+    phevCtx_t * ctx = phev_malloc(sizeof(phevCtx_t));
     phevServiceCtx_t * srvCtx = NULL;
     phevServiceSettings_t * serviceSettings;
     messagingClient_t * in = NULL;
     messagingClient_t * out = NULL;
+    phevConnecting_t outConnecting = NULL;
+
+    ctx->capture = NULL;
+    ctx->events = NULL;
+    ctx->commands = NULL;
+#ifdef PHEV_COMMAND_THREADS
+    ctx->commands = phev_malloc(sizeof(phevCommands_t));
+
+    if(ctx->commands)
+    {
+        pthread_mutex_init(&ctx->commands->lock, NULL);
+        ctx->commands->started = false;
+        ctx->commands->head = 0;
+        ctx->commands->count = 0;
+    }
+#endif
 
     if(settings.in)
     {
@@ -200,16 +303,39 @@ phevCtx_t * phev_init(phevSettings_t settings)
         LOG_D(TAG,"Using passed in messaging client");
 
         out = settings.out;
+    } else if(settings.transport) {
+        LOG_D(TAG,"Using %s transport",settings.transport->ops->name);
+
+        out = phev_transport_createMessagingClient(settings.transport);
+        outConnecting = phev_transport_clientConnecting;
     } else {
         LOG_D(TAG,"Using default outgoing messaging client");
 
-        out = phev_createOutgoingMessageClient(settings.host,settings.port);
+        if(settings.capturePath)
+        {
+            ctx->capture = phev_capture_open(settings.capturePath);
+        }
+
+        out = phev_createOutgoingMessageClient(settings.host,settings.port,settings.ioUring,&settings.tcpOptions,ctx->capture);
+        outConnecting = phev_transport_clientConnecting;
     }
 
     LOG_D(TAG,"Settings event handler %p", phev_pipeEventHandler);
     ctx->eventHandler = settings.handler;
     ctx->ctx = settings.ctx;
 
+    if(settings.handler && settings.eventQueue.depth > 0)
+    {
+        LOG_D(TAG,"Delivering events through a queue of %zu",settings.eventQueue.depth);
+        ctx->events = phev_queue_create(settings.eventQueue, phev_deliverEvent, ctx);
+
+        if(ctx->events && !phev_queue_start(ctx->events))
+        {
+            phev_queue_destroy(ctx->events);
+            ctx->events = NULL;
+        }
+    }
+
     phevServiceSettings_t s = {
         .in = in,
         .out = out,
@@ -217,8 +343,28 @@ phevCtx_t * phev_init(phevSettings_t settings)
         .registerDevice = settings.registerDevice,
         .eventHandler = phev_pipeEventHandler,
         .errorHandler = NULL,
-        .yieldHandler = NULL,
+        .yieldHandler = phev_runCommands,
         .my18 = settings.my18,
+        .profile = settings.profile,
+        .history = {
+            .depth = settings.historyDepth,
+            .registers = settings.historyRegisters,
+            .numberOfRegisters = settings.historyNumberOfRegisters,
+        },
+        .snapshotPath = settings.snapshotPath,
+        .snapshotVin = settings.snapshotVin,
+        .snapshotMaxAge = settings.snapshotMaxAge,
+        .journal = {
+            .path = settings.journalPath,
+        },
+        .broker = {
+            .path = settings.brokerPath,
+        },
+        .connectBackoffMin = settings.connectBackoffMin,
+        .connectBackoffMax = settings.connectBackoffMax,
+        .connectTimeout = (settings.connectTimeoutMs > 0 ? (uint32_t) settings.connectTimeoutMs : 0),
+        .outConnecting = outConnecting,
+        .traceDepth = settings.traceDepth,
         .ctx = ctx,
     };
     ctx->serviceCtx = phev_service_create(s);
@@ -237,7 +383,7 @@ void phev_registrationComplete(phev_pipe_ctx_t * ctx)
     phevEvent_t ev = {
         .type = PHEV_REGISTRATION_COMPLETE,
     };
-    phevCtx->eventHandler(&ev);
+    phev_dispatchEvent(phevCtx, &ev);
 
 }
 phevCtx_t * phev_registerDevice(phevSettings_t settings)
@@ -257,7 +403,39 @@ phevCtx_t * phev_registerDevice(phevSettings_t settings)
 void phev_start(phevCtx_t * ctx)
 {
     LOG_V(TAG,"START - start");
+#ifdef PHEV_COMMAND_THREADS
+    if(ctx->commands)
+    {
+        pthread_mutex_lock(&ctx->commands->lock);
+        ctx->commands->pipeThread = pthread_self();
+        ctx->commands->started = true;
+        pthread_mutex_unlock(&ctx->commands->lock);
+    }
+#endif
     phev_service_start(ctx->serviceCtx);
+    phev_queue_stop(ctx->events);
+    phev_service_close(ctx->serviceCtx);
+#ifdef PHEV_COMMAND_THREADS
+    // Commands still waiting are never sent, nor are their callbacks called
+    if(ctx->commands)
+    {
+        pthread_mutex_lock(&ctx->commands->lock);
+        ctx->commands->started = false;
+
+        for(; ctx->commands->count > 0; ctx->commands->count--)
+        {
+            phev_free(ctx->commands->commands[ctx->commands->head].cbCtx);
+            ctx->commands->head = (ctx->commands->head + 1) % PHEV_MAX_COMMANDS;
+        }
+        pthread_mutex_unlock(&ctx->commands->lock);
+    }
+#endif
+
+    // The pipe is done with the transport, nothing records to the capture any more
+    phevCapture_t * capture = ctx->capture;
+
+    ctx->capture = NULL;
+    phev_capture_close(capture);
     LOG_V(TAG,"END - start");
 }
 void phev_exit(phevCtx_t * ctx)
@@ -265,6 +443,7 @@ void phev_exit(phevCtx_t * ctx)
     LOG_V(TAG,"START - exit");
 
     ctx->serviceCtx->exit = true;
+    phev_capture_flush(ctx->capture);
 
     LOG_V(TAG,"START - exit");
 
@@ -274,28 +453,149 @@ bool phev_running(phevCtx_t * ctx)
 {
     return !ctx->serviceCtx->exit;
 }
+phevQueueStats_t phev_eventStats(phevCtx_t * ctx)
+{
+    return phev_queue_stats(ctx->events);
+}
+char * phev_latencyAsJson(phevCtx_t * ctx)
+{
+    return phev_service_latencyAsJson(ctx->serviceCtx);
+}
+void phev_metricsSnapshot(phevCtx_t * ctx, phevMetricsSnapshot_t * snapshot)
+{
+    phev_pipe_getMetrics(ctx->serviceCtx->pipe, snapshot);
+}
+char * phev_metricsAsPrometheus(phevCtx_t * ctx, const char * session)
+{
+    phevMetricsSnapshot_t * snapshot = phev_malloc(sizeof(phevMetricsSnapshot_t));
+
+    if(snapshot == NULL)
+    {
+        return NULL;
+    }
+    phev_metricsSnapshot(ctx, snapshot);
+
+    size_t length = phev_metrics_formatPrometheus(snapshot, session, NULL, 0);
+    char * out = phev_malloc(length + 1);
+
+    if(out)
+    {
+        phev_metrics_formatPrometheus(snapshot, session, out, length + 1);
+    }
+    phev_free(snapshot);
+
+    return out;
+}
+bool phev_traceSave(phevCtx_t * ctx, const char * path)
+{
+    return phev_trace_save(ctx->serviceCtx->pipe->trace, path);
+}
 
 static void phev_registerUpdateCallback(phev_pipe_ctx_t *ctx, uint8_t reg, void * customCtx)
 {
     phevCallBackCtx_t * cbCtx = (phevCallBackCtx_t *) customCtx;
 
     cbCtx->callback(cbCtx->ctx, NULL);
-    free(cbCtx);
+    phev_free(cbCtx);
+}
+static void phev_runCommand(phevCtx_t * ctx, uint8_t reg, const uint8_t * data, size_t length, phevCallBackCtx_t * cbCtx)
+{
+    if (cbCtx) {
+        phev_pipe_updateComplexRegisterWithCallback(ctx->serviceCtx->pipe, reg, data, length, phev_registerUpdateCallback, cbCtx);
+    } else {
+        phev_pipe_updateComplexRegister(ctx->serviceCtx->pipe, reg, data, length);
+    }
+}
+// The pipe is not locked, a command from any other thread waits for the pipe thread's next loop.
+static void phev_command(phevCtx_t * ctx, uint8_t reg, const uint8_t * data, size_t length, phevCallBackCtx_t * cbCtx)
+{
+#ifdef PHEV_COMMAND_THREADS
+    phevCommands_t * commands = ctx->commands;
+
+    if(commands)
+    {
+        pthread_mutex_lock(&commands->lock);
+
+        if(!commands->started || !pthread_equal(commands->pipeThread, pthread_self()))
+        {
+            bool queued = (commands->count < PHEV_MAX_COMMANDS && length <= UINT8_MAX);
+
+            if(queued)
+            {
+                phevCommand_t * command = &commands->commands[(commands->head + commands->count) % PHEV_MAX_COMMANDS];
+
+                command->reg = reg;
+                command->length = length;
+                memcpy(command->data, data, length);
+                command->cbCtx = cbCtx;
+                commands->count++;
+            }
+            pthread_mutex_unlock(&commands->lock);
+
+            if(!queued)
+            {
+                LOG_W(TAG,"Command queue full, dropping the update of register %d",reg);
+                phev_free(cbCtx);
+            }
+            return;
+        }
+        pthread_mutex_unlock(&commands->lock);
+    }
+#endif
+    phev_runCommand(ctx, reg, data, length, cbCtx);
+}
+static void phev_commandValue(phevCtx_t * ctx, uint8_t reg, uint8_t value, phevCallBackCtx_t * cbCtx)
+{
+    phev_command(ctx, reg, &value, 1, cbCtx);
+}
+// The service's yield handler, on the pipe thread after every loop.
+static void phev_runCommands(phevServiceCtx_t * serviceCtx)
+{
+#ifdef PHEV_COMMAND_THREADS
+    phevCtx_t * ctx = (phevCtx_t *) serviceCtx->ctx;
+    phevCommands_t * commands = ctx->commands;
+    phevCommand_t command;
+
+    if(commands == NULL)
+    {
+        return;
+    }
+    for(;;)
+    {
+        pthread_mutex_lock(&commands->lock);
+
+        bool pending = commands->count > 0;
+
+        if(pending)
+        {
+            command = commands->commands[commands->head];
+            commands->head = (commands->head + 1) % PHEV_MAX_COMMANDS;
+            commands->count--;
+        }
+        pthread_mutex_unlock(&commands->lock);
+
+        if(!pending)
+        {
+            return;
+        }
+        phev_runCommand(ctx, command.reg, command.data, command.length, command.cbCtx);
+    }
+#endif
 }
 
 void phev_headLights(phevCtx_t * ctx, bool on, phevCallBack_t callback)
 {
     LOG_V(TAG,"START - headLights");
-    phevCallBackCtx_t * cbCtx = malloc(sizeof(phevCallBackCtx_t));
+    phevCallBackCtx_t * cbCtx = phev_malloc(sizeof(phevCallBackCtx_t));
 
     cbCtx->callback = callback;
     cbCtx->ctx = ctx;
 
     LOG_D(TAG,"Switching %s head lights", on ? "ON" : "OFF");
     if (callback) {
-        phev_pipe_updateRegisterWithCallback(ctx->serviceCtx->pipe, KO_WF_H_LAMP_CONT_SP, (on ? 1 : 2), phev_registerUpdateCallback, cbCtx);
+        phev_commandValue(ctx, KO_WF_H_LAMP_CONT_SP, (on ? 1 : 2), cbCtx);
     } else {
-        phev_pipe_updateRegister(ctx->serviceCtx->pipe, KO_WF_H_LAMP_CONT_SP, (on ? 1 : 2));
+        phev_commandValue(ctx, KO_WF_H_LAMP_CONT_SP, (on ? 1 : 2), NULL);
     }
 
     LOG_V(TAG,"END - headLights");
@@ -304,16 +604,16 @@ void phev_headLights(phevCtx_t * ctx, bool on, phevCallBack_t callback)
 void phev_parkingLights(phevCtx_t * ctx, bool on, phevCallBack_t callback)
 {
     LOG_V(TAG,"START - parkingLights");
-    phevCallBackCtx_t * cbCtx = malloc(sizeof(phevCallBackCtx_t));
+    phevCallBackCtx_t * cbCtx = phev_malloc(sizeof(phevCallBackCtx_t));
 
     cbCtx->callback = callback;
     cbCtx->ctx = ctx;
 
     LOG_D(TAG,"Switching %s parking lights", on ? "ON" : "OFF");
     if (callback) {
-        phev_pipe_updateRegisterWithCallback(ctx->serviceCtx->pipe, KO_WF_P_LAMP_CONT_SP, (on ? 1 : 2), phev_registerUpdateCallback, cbCtx);
+        phev_commandValue(ctx, KO_WF_P_LAMP_CONT_SP, (on ? 1 : 2), cbCtx);
     } else {
-        phev_pipe_updateRegister(ctx->serviceCtx->pipe, KO_WF_P_LAMP_CONT_SP, (on ? 1 : 2));
+        phev_commandValue(ctx, KO_WF_P_LAMP_CONT_SP, (on ? 1 : 2), NULL);
     }
 
     LOG_V(TAG,"END - parkingLights");
@@ -322,7 +622,7 @@ void phev_parkingLights(phevCtx_t * ctx, bool on, phevCallBack_t callback)
 void phev_airCon(phevCtx_t * ctx, bool on, phevCallBack_t callback)
 {
     LOG_V(TAG,"START - airCon");
-    phevCallBackCtx_t * cbCtx = malloc(sizeof(phevCallBackCtx_t));
+    phevCallBackCtx_t * cbCtx = phev_malloc(sizeof(phevCallBackCtx_t));
 
     cbCtx->callback = callback;
     cbCtx->ctx = ctx;
@@ -330,9 +630,9 @@ void phev_airCon(phevCtx_t * ctx, bool on, phevCallBack_t callback)
     LOG_D(TAG,"Switching %s air conditioning", on ? "ON" : "OFF");
 
     if (callback) {
-        phev_pipe_updateRegisterWithCallback(ctx->serviceCtx->pipe,KO_WF_MANUAL_AC_ON_RQ_SP, (on ? 2 : 1), phev_registerUpdateCallback, cbCtx);
+        phev_commandValue(ctx, KO_WF_MANUAL_AC_ON_RQ_SP, (on ? 2 : 1), cbCtx);
     } else {
-        phev_pipe_updateRegister(ctx->serviceCtx->pipe,KO_WF_MANUAL_AC_ON_RQ_SP, (on ? 1 : 2));
+        phev_commandValue(ctx, KO_WF_MANUAL_AC_ON_RQ_SP, (on ? 1 : 2), NULL);
     }
     LOG_V(TAG,"END - airCon");
 
@@ -341,7 +641,7 @@ void phev_airCon(phevCtx_t * ctx, bool on, phevCallBack_t callback)
 void phev_updateAll(phevCtx_t * ctx, phevCallBack_t callback)
 {
     LOG_V(TAG,"START - updateAll");
-    phevCallBackCtx_t * cbCtx = malloc(sizeof(phevCallBackCtx_t));
+    phevCallBackCtx_t * cbCtx = phev_malloc(sizeof(phevCallBackCtx_t));
 
     cbCtx->callback = callback;
     cbCtx->ctx = ctx;
@@ -349,9 +649,9 @@ void phev_updateAll(phevCtx_t * ctx, phevCallBack_t callback)
     LOG_D(TAG,"Start Update All");
 
     if (callback) {
-        phev_pipe_updateRegisterWithCallback(ctx->serviceCtx->pipe,KO_WF_EV_UPDATE_SP, 3, phev_registerUpdateCallback, cbCtx);
+        phev_commandValue(ctx, KO_WF_EV_UPDATE_SP, 3, cbCtx);
     } else {
-        phev_pipe_updateRegister(ctx->serviceCtx->pipe,KO_WF_EV_UPDATE_SP, 3);
+        phev_commandValue(ctx, KO_WF_EV_UPDATE_SP, 3, NULL);
     }
     LOG_V(TAG,"END - updateAll");
 
@@ -360,16 +660,16 @@ void phev_updateAll(phevCtx_t * ctx, phevCallBack_t callback)
 void phev_removeACError(phevCtx_t * ctx, phevCallBack_t callback)
 {
     LOG_V(TAG,"START - remove ACError");
-    phevCallBackCtx_t * cbCtx = malloc(sizeof(phevCallBackCtx_t));
+    phevCallBackCtx_t * cbCtx = phev_malloc(sizeof(phevCallBackCtx_t));
 
     cbCtx->callback = callback;
     cbCtx->ctx = ctx;
 
 
     if (callback) {
-        phev_pipe_updateRegisterWithCallback(ctx->serviceCtx->pipe,19, 1, phev_registerUpdateCallback, cbCtx);
+        phev_commandValue(ctx, 19, 1, cbCtx);
     } else {
-        phev_pipe_updateRegister(ctx->serviceCtx->pipe,19, 1);
+        phev_commandValue(ctx, 19, 1, NULL);
     }
     LOG_V(TAG,"END - remove ACError");
 
@@ -395,7 +695,7 @@ void phev_airConMY19(phevCtx_t * ctx, phevAirConMode_t mode, phevAirConTime_t ti
 
     uint8_t data[] = {02, val, val0, 00};
 
-    phevCallBackCtx_t * cbCtx = malloc(sizeof(phevCallBackCtx_t));
+    phevCallBackCtx_t * cbCtx = phev_malloc(sizeof(phevCallBackCtx_t));
 
     cbCtx->callback = callback;
     cbCtx->ctx = ctx;
@@ -403,9 +703,9 @@ void phev_airConMY19(phevCtx_t * ctx, phevAirConMode_t mode, phevAirConTime_t ti
     LOG_D(TAG,"Switching air conditioning mode %d", val);
 
     if (callback) {
-        phev_pipe_updateComplexRegisterWithCallback(ctx->serviceCtx->pipe,KO_WF_AC_SCH_SP_MY19, data, sizeof(data), phev_registerUpdateCallback, cbCtx);
+        phev_command(ctx, KO_WF_AC_SCH_SP_MY19, data, sizeof(data), cbCtx);
     } else {
-        phev_pipe_updateComplexRegister(ctx->serviceCtx->pipe,KO_WF_AC_SCH_SP_MY19, data, sizeof(data));
+        phev_command(ctx, KO_WF_AC_SCH_SP_MY19, data, sizeof(data), NULL);
     }
 
     LOG_V(TAG,"END - airConMY19");
@@ -415,6 +715,14 @@ void phev_airConMode(phevCtx_t * ctx, phevAirConMode_t mode, phevAirConTime_t ti
 {
     LOG_V(TAG,"START - airConMode");
 
+    // MY19 moved the schedule to its own register with a different layout
+    if (ctx->serviceCtx->pipe->profile->acScheduleReg == KO_WF_AC_SCH_SP_MY19)
+    {
+        phev_airConMY19(ctx, mode, time, callback);
+        LOG_V(TAG,"END - airConMode");
+        return;
+    }
+
     uint8_t val = mode;
 
     switch(time)
@@ -426,7 +734,7 @@ void phev_airConMode(phevCtx_t * ctx, phevAirConMode_t mode, phevAirConTime_t ti
 
     uint8_t data[] = {0, 0, 255, 255, 255, 255, val, 255, 255, 255, 255, 255, 255, 255, 255};
 
-    phevCallBackCtx_t * cbCtx = malloc(sizeof(phevCallBackCtx_t));
+    phevCallBackCtx_t * cbCtx = phev_malloc(sizeof(phevCallBackCtx_t));
 
     cbCtx->callback = callback;
     cbCtx->ctx = ctx;
@@ -434,9 +742,9 @@ void phev_airConMode(phevCtx_t * ctx, phevAirConMode_t mode, phevAirConTime_t ti
     LOG_D(TAG,"Switching air conditioning mode %d", val);
 
     if (callback) {
-        phev_pipe_updateComplexRegisterWithCallback(ctx->serviceCtx->pipe,KO_WF_AC_SCH_SP, data, sizeof(data), phev_registerUpdateCallback, cbCtx);
+        phev_command(ctx, ctx->serviceCtx->pipe->profile->acScheduleReg, data, sizeof(data), cbCtx);
     } else {
-        phev_pipe_updateComplexRegister(ctx->serviceCtx->pipe,KO_WF_AC_SCH_SP, data, sizeof(data));
+        phev_command(ctx, ctx->serviceCtx->pipe->profile->acScheduleReg, data, sizeof(data), NULL);
     }
 
     LOG_V(TAG,"END - airConMode");
@@ -527,6 +835,20 @@ phevServiceHVAC_t* phev_HVACStatus(phevCtx_t * ctx)
     return ph;
 }
 
+void phev_vehicleState(phevCtx_t * ctx, phevVehicleState_t * state)
+{
+    LOG_V(TAG,"START - vehicleState");
+
+    phev_service_getVehicleState(ctx->serviceCtx, state);
+
+    LOG_V(TAG,"END - vehicleState");
+}
+
+uint32_t phev_vehicleStateChanged(const phevVehicleState_t * previous, const phevVehicleState_t * current)
+{
+    return phev_service_compareVehicleState(previous, current);
+}
+
 phevData_t * phev_getRegister(phevCtx_t * ctx, uint8_t reg)
 {
     return (phevData_t *) phev_service_getRegister(ctx->serviceCtx, reg);
@@ -550,3 +872,7 @@ void phev_disconnect(phevCtx_t * ctx)
     phev_service_disconnect(ctx->serviceCtx);
     LOG_V(TAG,"END - disconnect");
 }
+void phev_linkUp(phevCtx_t * ctx)
+{
+    phev_pipe_linkUp(ctx->serviceCtx->pipe);
+}
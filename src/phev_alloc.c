@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include "phev_alloc.h"
+
+#define PHEV_ALLOC_MAX_SITES 256
+#define PHEV_ALLOC_DEFAULT_LIVE 4096
+
+static void * phev_alloc_systemMalloc(size_t size, const char * site, void * ctx)
+{
+    return malloc(size);
+}
+static void * phev_alloc_systemRealloc(void * ptr, size_t size, const char * site, void * ctx)
+{
+    return realloc(ptr, size);
+}
+static void phev_alloc_systemFree(void * ptr, void * ctx)
+{
+    free(ptr);
+}
+
+static const phevAllocator_t phev_alloc_system = {
+    .malloc = phev_alloc_systemMalloc,
+    .realloc = phev_alloc_systemRealloc,
+    .free = phev_alloc_systemFree,
+    .ctx = NULL,
+};
+static phevAllocator_t phev_alloc_current = {
+    .malloc = phev_alloc_systemMalloc,
+    .realloc = phev_alloc_systemRealloc,
+    .free = phev_alloc_systemFree,
+    .ctx = NULL,
+};
+
+void phev_alloc_setAllocator(const phevAllocator_t * allocator)
+{
+    phev_alloc_current = (allocator ? *allocator : phev_alloc_system);
+}
+void * phev_alloc_malloc(size_t size, const char * site)
+{
+    return phev_alloc_current.malloc(size, site, phev_alloc_current.ctx);
+}
+void * phev_alloc_calloc(size_t count, size_t size, const char * site)
+{
+    if(size && count > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+    void * ptr = phev_alloc_current.malloc(count * size, site, phev_alloc_current.ctx);
+
+    if(ptr)
+    {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+void * phev_alloc_realloc(void * ptr, size_t size, const char * site)
+{
+    return phev_alloc_current.realloc(ptr, size, site, phev_alloc_current.ctx);
+}
+void phev_alloc_free(void * ptr)
+{
+    if(ptr)
+    {
+        phev_alloc_current.free(ptr, phev_alloc_current.ctx);
+    }
+}
+char * phev_alloc_strdup(const char * str, const char * site)
+{
+    if(str == NULL)
+    {
+        return NULL;
+    }
+    size_t length = strlen(str) + 1;
+    char * out = phev_alloc_malloc(length, site);
+
+    if(out)
+    {
+        memcpy(out, str, length);
+    }
+    return out;
+}
+char * phev_alloc_printf(const char * site, const char * format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if(length < 0)
+    {
+        return NULL;
+    }
+    char * out = phev_alloc_malloc((size_t) length + 1, site);
+
+    if(out)
+    {
+        va_start(args, format);
+        vsnprintf(out, (size_t) length + 1, format, args);
+        va_end(args);
+    }
+    return out;
+}
+
+typedef struct phevAllocBlock_t {
+    void * ptr;
+    size_t size;
+    int site;
+} phevAllocBlock_t;
+
+struct phevAllocTracker_t {
+    phevAllocator_t backing;
+    atomic_flag lock;
+    phevAllocBlock_t * blocks;
+    size_t mask;
+    size_t maxLive;
+    phevAllocSite_t sites[PHEV_ALLOC_MAX_SITES];
+    int numberOfSites;
+    phevAllocStats_t stats;
+};
+
+static void phev_alloc_lock(phevAllocTracker_t * tracker)
+{
+    while(atomic_flag_test_and_set_explicit(&tracker->lock, memory_order_acquire));
+}
+static void phev_alloc_unlock(phevAllocTracker_t * tracker)
+{
+    atomic_flag_clear_explicit(&tracker->lock, memory_order_release);
+}
+static size_t phev_alloc_hash(const phevAllocTracker_t * tracker, const void * ptr)
+{
+    uint64_t key = (uint64_t) (uintptr_t) ptr;
+
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return (size_t) key & tracker->mask;
+}
+static int phev_alloc_findSite(phevAllocTracker_t * tracker, const char * site)
+{
+    // Sites are string literals, the same call site always hands over the same pointer
+    for(int i = 0; i < tracker->numberOfSites; i++)
+    {
+        if(tracker->sites[i].site == site)
+        {
+            return i;
+        }
+    }
+    if(tracker->numberOfSites == PHEV_ALLOC_MAX_SITES)
+    {
+        return PHEV_ALLOC_MAX_SITES - 1;
+    }
+    phevAllocSite_t * entry = &tracker->sites[tracker->numberOfSites];
+
+    memset(entry, 0, sizeof(phevAllocSite_t));
+    entry->site = (tracker->numberOfSites == PHEV_ALLOC_MAX_SITES - 1 ? "other" : (site ? site : "unknown"));
+
+    return tracker->numberOfSites++;
+}
+// Called with the lock held.
+static void phev_alloc_track(phevAllocTracker_t * tracker, void * ptr, size_t size, const char * site)
+{
+    int index = phev_alloc_findSite(tracker, site);
+    phevAllocSite_t * entry = &tracker->sites[index];
+
+    tracker->stats.allocations++;
+    entry->allocations++;
+    entry->bytes += size;
+
+    if(tracker->stats.liveBlocks == tracker->maxLive)
+    {
+        tracker->stats.untracked++;
+        return;
+    }
+    size_t slot = phev_alloc_hash(tracker, ptr);
+
+    while(tracker->blocks[slot].ptr)
+    {
+        slot = (slot + 1) & tracker->mask;
+    }
+    tracker->blocks[slot].ptr = ptr;
+    tracker->blocks[slot].size = size;
+    tracker->blocks[slot].site = index;
+
+    entry->liveBytes += size;
+    entry->liveBlocks++;
+    tracker->stats.liveBytes += size;
+    tracker->stats.liveBlocks++;
+
+    if(tracker->stats.liveBytes > tracker->stats.peakBytes)
+    {
+        tracker->stats.peakBytes = tracker->stats.liveBytes;
+    }
+}
+// Called with the lock held, removes with backward shifting so lookups never need tombstones.
+static void phev_alloc_untrack(phevAllocTracker_t * tracker, void * ptr)
+{
+    size_t slot = phev_alloc_hash(tracker, ptr);
+
+    while(tracker->blocks[slot].ptr != ptr)
+    {
+        if(tracker->blocks[slot].ptr == NULL)
+        {
+            return;
+        }
+        slot = (slot + 1) & tracker->mask;
+    }
+    phevAllocBlock_t * block = &tracker->blocks[slot];
+    phevAllocSite_t * entry = &tracker->sites[block->site];
+
+    entry->liveBytes -= block->size;
+    entry->liveBlocks--;
+    tracker->stats.liveBytes -= block->size;
+    tracker->stats.liveBlocks--;
+
+    size_t hole = slot;
+
+    for(size_t next = (hole + 1) & tracker->mask; tracker->blocks[next].ptr; next = (next + 1) & tracker->mask)
+    {
+        size_t home = phev_alloc_hash(tracker, tracker->blocks[next].ptr);
+
+        if(((next - home) & tracker->mask) >= ((next - hole) & tracker->mask))
+        {
+            tracker->blocks[hole] = tracker->blocks[next];
+            hole = next;
+        }
+    }
+    tracker->blocks[hole].ptr = NULL;
+}
+static void * phev_alloc_trackerMalloc(size_t size, const char * site, void * ctx)
+{
+    phevAllocTracker_t * tracker = ctx;
+    void * ptr = tracker->backing.malloc(size, site, tracker->backing.ctx);
+
+    phev_alloc_lock(tracker);
+    if(ptr)
+    {
+        phev_alloc_track(tracker, ptr, size, site);
+    }
+    else
+    {
+        tracker->stats.failures++;
+    }
+    phev_alloc_unlock(tracker);
+
+    return ptr;
+}
+static void phev_alloc_trackerFree(void * ptr, void * ctx)
+{
+    phevAllocTracker_t * tracker = ctx;
+
+    phev_alloc_lock(tracker);
+    tracker->stats.frees++;
+    phev_alloc_untrack(tracker, ptr);
+    phev_alloc_unlock(tracker);
+
+    tracker->backing.free(ptr, tracker->backing.ctx);
+}
+static void * phev_alloc_trackerRealloc(void * ptr, size_t size, const char * site, void * ctx)
+{
+    phevAllocTracker_t * tracker = ctx;
+    void * out = tracker->backing.realloc(ptr, size, site, tracker->backing.ctx);
+
+    phev_alloc_lock(tracker);
+    if(out == NULL && size)
+    {
+        tracker->stats.failures++;
+    }
+    else
+    {
+        if(ptr)
+        {
+            tracker->stats.frees++;
+            phev_alloc_untrack(tracker, ptr);
+        }
+        if(out)
+        {
+            phev_alloc_track(tracker, out, size, site);
+        }
+    }
+    phev_alloc_unlock(tracker);
+
+    return out;
+}
+phevAllocTracker_t * phev_alloc_createTracker(const phevAllocator_t * backing, size_t maxLive)
+{
+    const phevAllocator_t * with = (backing ? backing : &phev_alloc_system);
+    phevAllocTracker_t * tracker = with->malloc(sizeof(phevAllocTracker_t), PHEV_ALLOC_SITE, with->ctx);
+
+    if(tracker == NULL)
+    {
+        return NULL;
+    }
+    memset(tracker, 0, sizeof(phevAllocTracker_t));
+    tracker->backing = *with;
+    atomic_flag_clear(&tracker->lock);
+
+    if(maxLive == 0)
+    {
+        maxLive = PHEV_ALLOC_DEFAULT_LIVE;
+    }
+    // Twice as many slots as blocks keeps the probes short
+    size_t slots = 16;
+
+    while(slots < maxLive * 2)
+    {
+        slots <<= 1;
+    }
+    tracker->blocks = with->malloc(slots * sizeof(phevAllocBlock_t), PHEV_ALLOC_SITE, with->ctx);
+
+    if(tracker->blocks == NULL)
+    {
+        with->free(tracker, with->ctx);
+        return NULL;
+    }
+    memset(tracker->blocks, 0, slots * sizeof(phevAllocBlock_t));
+    tracker->mask = slots - 1;
+    tracker->maxLive = maxLive;
+
+    return tracker;
+}
+void phev_alloc_destroyTracker(phevAllocTracker_t * tracker)
+{
+    if(tracker)
+    {
+        phevAllocator_t backing = tracker->backing;
+
+        backing.free(tracker->blocks, backing.ctx);
+        backing.free(tracker, backing.ctx);
+    }
+}
+phevAllocator_t phev_alloc_trackerAllocator(phevAllocTracker_t * tracker)
+{
+    phevAllocator_t allocator = {
+        .malloc = phev_alloc_trackerMalloc,
+        .realloc = phev_alloc_trackerRealloc,
+        .free = phev_alloc_trackerFree,
+        .ctx = tracker,
+    };
+    return allocator;
+}
+phevAllocStats_t phev_alloc_trackerStats(phevAllocTracker_t * tracker)
+{
+    phev_alloc_lock(tracker);
+    phevAllocStats_t stats = tracker->stats;
+    phev_alloc_unlock(tracker);
+
+    return stats;
+}
+int phev_alloc_nextSite(phevAllocTracker_t * tracker, int index, phevAllocSite_t * site)
+{
+    int next = -1;
+
+    phev_alloc_lock(tracker);
+    if(index >= 0 && index < tracker->numberOfSites)
+    {
+        *site = tracker->sites[index];
+        next = index + 1;
+    }
+    phev_alloc_unlock(tracker);
+
+    return next;
+}
+size_t phev_alloc_formatReport(phevAllocTracker_t * tracker, uint64_t frames, char * buffer, size_t size)
+{
+    size_t length = 0;
+    phevAllocStats_t stats = phev_alloc_trackerStats(tracker);
+    phevAllocSite_t site;
+    int written;
+
+#define PHEV_ALLOC_REPORT(...) \
+    written = snprintf((length < size ? buffer + length : NULL), (length < size ? size - length : 0), __VA_ARGS__); \
+    length += (written > 0 ? (size_t) written : 0)
+
+    if(buffer && size)
+    {
+        buffer[0] = 0;
+    }
+    PHEV_ALLOC_REPORT("live %zu bytes in %zu blocks, peak %zu bytes\n", stats.liveBytes, stats.liveBlocks, stats.peakBytes);
+    PHEV_ALLOC_REPORT("allocations %llu frees %llu failures %llu untracked %llu\n",
+        (unsigned long long) stats.allocations, (unsigned long long) stats.frees,
+        (unsigned long long) stats.failures, (unsigned long long) stats.untracked);
+
+    if(frames)
+    {
+        PHEV_ALLOC_REPORT("allocations per frame %.2f\n", (double) stats.allocations / (double) frames);
+    }
+    for(int i = phev_alloc_nextSite(tracker, 0, &site); i > 0; i = phev_alloc_nextSite(tracker, i, &site))
+    {
+        PHEV_ALLOC_REPORT("%s allocations %llu bytes %llu live %zu bytes in %zu blocks\n", site.site,
+            (unsigned long long) site.allocations, (unsigned long long) site.bytes, site.liveBytes, site.liveBlocks);
+    }
+#undef PHEV_ALLOC_REPORT
+
+    return length;
+}
@@ -0,0 +1,836 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "phev_broker.h"
+#include "phev_alloc.h"
+#include "phev_service.h"
+#include "phev_log.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#define PHEV_BROKER_POSIX
+#endif
+
+const static char *TAG = "PHEV_BROKER";
+
+#ifdef PHEV_BROKER_POSIX
+
+#define PHEV_BROKER_POLL_MS 100
+#define PHEV_BROKER_MAX_UPDATE (PHEV_BROKER_MAX_LINE)
+
+typedef enum phevBrokerCommandType_t {
+    PHEV_BROKER_COMMAND_UPDATE,
+    PHEV_BROKER_COMMAND_SNAPSHOT,
+} phevBrokerCommandType_t;
+
+typedef struct phevBrokerCommand_t {
+    phevBrokerCommandType_t type;
+    size_t client;
+    uint32_t generation;
+    uint8_t reg;
+    uint8_t length;
+    uint8_t data[UINT8_MAX];
+    uint8_t subscriptions[32];
+} phevBrokerCommand_t;
+
+// Written once and then only read, freed by whoever drops the last reference.
+typedef struct phevBrokerBuffer_t {
+    atomic_uint refs;
+    size_t length;
+    char data[];
+} phevBrokerBuffer_t;
+
+typedef struct phevBrokerClient_t {
+    pthread_mutex_t lock;
+    int soc;
+    uint32_t generation;
+    uint8_t subscriptions[32];
+    phevBrokerBuffer_t ** queue;
+    size_t head;
+    size_t count;
+    size_t offset;
+    uint32_t dropped;
+    char line[PHEV_BROKER_MAX_LINE];
+    size_t lineLength;
+    bool discarding;
+} phevBrokerClient_t;
+
+struct phevBroker_t {
+    phevServiceCtx_t * service;
+    phevBrokerSettings_t settings;
+    char * path;
+    int listener;
+    bool bound;
+    int wake[2];
+    atomic_bool wakePending;
+    atomic_bool running;
+    pthread_t thread;
+    phevBrokerClient_t * clients;
+
+    pthread_mutex_t commandLock;
+    phevBrokerCommand_t commands[PHEV_BROKER_MAX_COMMANDS];
+    size_t commandHead;
+    size_t commandCount;
+
+    atomic_uint connected;
+    atomic_uint published;
+    atomic_uint delivered;
+    atomic_uint dropped;
+    atomic_uint commandsRun;
+};
+
+static phevBrokerBuffer_t * phev_broker_createBuffer(const char * data, size_t length, unsigned int refs)
+{
+    phevBrokerBuffer_t * buffer = phev_malloc(sizeof(phevBrokerBuffer_t) + length);
+
+    if(buffer == NULL)
+    {
+        return NULL;
+    }
+    atomic_init(&buffer->refs, refs);
+    buffer->length = length;
+    memcpy(buffer->data, data, length);
+
+    return buffer;
+}
+static void phev_broker_releaseBuffer(phevBrokerBuffer_t * buffer)
+{
+    if(atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) == 1)
+    {
+        phev_free(buffer);
+    }
+}
+static bool phev_broker_isSubscribed(const uint8_t * subscriptions, uint8_t reg)
+{
+    return (subscriptions[reg / 8] & (1 << (reg % 8))) != 0;
+}
+static void phev_broker_wake(phevBroker_t * broker)
+{
+    if(!atomic_exchange(&broker->wakePending, true))
+    {
+        const uint8_t byte = 1;
+
+        if(write(broker->wake[1], &byte, 1) < 0)
+        {
+            LOG_W(TAG,"Cannot wake broker thread");
+        }
+    }
+}
+// Takes a reference when the buffer is queued, counts a drop when the queue is full.
+static bool phev_broker_pushLocked(phevBroker_t * broker, phevBrokerClient_t * client, phevBrokerBuffer_t * buffer)
+{
+    if(client->count == broker->settings.queueDepth)
+    {
+        client->dropped++;
+        atomic_fetch_add_explicit(&broker->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    atomic_fetch_add_explicit(&buffer->refs, 1, memory_order_relaxed);
+    client->queue[(client->head + client->count) % broker->settings.queueDepth] = buffer;
+    client->count++;
+
+    return true;
+}
+static void phev_broker_reply(phevBroker_t * broker, phevBrokerClient_t * client, const char * text)
+{
+    phevBrokerBuffer_t * buffer = phev_broker_createBuffer(text, strlen(text), 1);
+
+    if(buffer == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&client->lock);
+    phev_broker_pushLocked(broker, client, buffer);
+    pthread_mutex_unlock(&client->lock);
+
+    phev_broker_releaseBuffer(buffer);
+}
+static size_t phev_broker_formatUpdate(char * out, uint8_t reg, const uint8_t * data, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t num = (size_t) sprintf(out, "update %d ", reg);
+
+    for(size_t i = 0; i < length; i++)
+    {
+        out[num++] = hex[data[i] >> 4];
+        out[num++] = hex[data[i] & 0x0f];
+    }
+    out[num++] = '\n';
+
+    return num;
+}
+// Model listener, on the service thread. One buffer whatever the number of subscribers.
+static void phev_broker_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx)
+{
+    phevBroker_t * broker = (phevBroker_t *) ctx;
+    char line[PHEV_BROKER_MAX_UPDATE];
+    phevBrokerBuffer_t * buffer = NULL;
+    bool queued = false;
+
+    if(length > UINT8_MAX)
+    {
+        return;
+    }
+    for(size_t i = 0; i < broker->settings.maxClients; i++)
+    {
+        phevBrokerClient_t * client = &broker->clients[i];
+
+        pthread_mutex_lock(&client->lock);
+
+        if(client->soc >= 0 && phev_broker_isSubscribed(client->subscriptions, reg))
+        {
+            if(buffer == NULL)
+            {
+                buffer = phev_broker_createBuffer(line, phev_broker_formatUpdate(line, reg, data, length), 1);
+            }
+            if(buffer)
+            {
+                queued |= phev_broker_pushLocked(broker, client, buffer);
+            }
+        }
+        pthread_mutex_unlock(&client->lock);
+    }
+    if(buffer)
+    {
+        atomic_fetch_add_explicit(&broker->published, 1, memory_order_relaxed);
+        phev_broker_releaseBuffer(buffer);
+    }
+    if(queued)
+    {
+        phev_broker_wake(broker);
+    }
+}
+static bool phev_broker_queueCommand(phevBroker_t * broker, const phevBrokerCommand_t * command)
+{
+    bool queued = false;
+
+    pthread_mutex_lock(&broker->commandLock);
+
+    if(broker->commandCount < PHEV_BROKER_MAX_COMMANDS)
+    {
+        broker->commands[(broker->commandHead + broker->commandCount) % PHEV_BROKER_MAX_COMMANDS] = *command;
+        broker->commandCount++;
+        queued = true;
+    }
+    pthread_mutex_unlock(&broker->commandLock);
+
+    return queued;
+}
+static bool phev_broker_parseHex(const char * text, uint8_t * data, uint8_t * length)
+{
+    size_t num = 0;
+
+    while(*text)
+    {
+        if(isspace((unsigned char) *text))
+        {
+            text++;
+            continue;
+        }
+        if(!isxdigit((unsigned char) text[0]) || !isxdigit((unsigned char) text[1]) || num == UINT8_MAX)
+        {
+            return false;
+        }
+
+        char byte[3] = { text[0], text[1], '\0' };
+
+        data[num++] = (uint8_t) strtoul(byte, NULL, 16);
+        text += 2;
+    }
+    *length = (uint8_t) num;
+
+    return num > 0;
+}
+static bool phev_broker_parseRegister(const char * token, uint8_t * reg)
+{
+    char * end = NULL;
+    unsigned long value = strtoul(token, &end, 0);
+
+    if(end == token || *end != '\0' || value > UINT8_MAX)
+    {
+        return false;
+    }
+    *reg = (uint8_t) value;
+
+    return true;
+}
+static const char * phev_broker_subscribe(phevBroker_t * broker, size_t index, char * args, bool subscribe)
+{
+    phevBrokerClient_t * client = &broker->clients[index];
+    phevBrokerCommand_t command = {
+        .type = PHEV_BROKER_COMMAND_SNAPSHOT,
+        .client = index,
+    };
+    uint8_t changed[32] = {0};
+    char * saveptr = NULL;
+    uint8_t reg = 0;
+
+    for(char * token = strtok_r(args, " \t", &saveptr); token; token = strtok_r(NULL, " \t", &saveptr))
+    {
+        if(strcmp(token, "all") == 0)
+        {
+            memset(changed, 0xff, sizeof(changed));
+        }
+        else if(phev_broker_parseRegister(token, &reg))
+        {
+            changed[reg / 8] |= (uint8_t) (1 << (reg % 8));
+        }
+        else
+        {
+            return "error bad register\n";
+        }
+    }
+
+    pthread_mutex_lock(&client->lock);
+
+    for(size_t i = 0; i < sizeof(changed); i++)
+    {
+        if(subscribe)
+        {
+            command.subscriptions[i] = changed[i] & ~client->subscriptions[i];
+            client->subscriptions[i] |= changed[i];
+        }
+        else
+        {
+            client->subscriptions[i] &= (uint8_t) ~changed[i];
+        }
+    }
+    command.generation = client->generation;
+
+    pthread_mutex_unlock(&client->lock);
+
+    if(subscribe && !phev_broker_queueCommand(broker, &command))
+    {
+        return "error busy\n";
+    }
+    return "ok\n";
+}
+static const char * phev_broker_command(phevBroker_t * broker, size_t index, char * line)
+{
+    phevBrokerCommand_t command = {
+        .type = PHEV_BROKER_COMMAND_UPDATE,
+        .client = index,
+    };
+    char * saveptr = NULL;
+    char * keyword = NULL;
+
+    if(line[0] == '{')
+    {
+        phevMessage_t * message = phev_service_jsonCommandToPhevMessage(line);
+
+        if(message == NULL)
+        {
+            return "error invalid command\n";
+        }
+        command.reg = message->reg;
+        command.length = message->length;
+        memcpy(command.data, message->data, command.length);
+        phev_core_destroyMessage(message);
+
+        return (phev_broker_queueCommand(broker, &command) ? "ok\n" : "error busy\n");
+    }
+
+    keyword = strtok_r(line, " \t", &saveptr);
+
+    if(keyword == NULL)
+    {
+        return NULL;
+    }
+    if(strcmp(keyword, "subscribe") == 0 || strcmp(keyword, "unsubscribe") == 0)
+    {
+        return phev_broker_subscribe(broker, index, saveptr, keyword[0] == 's');
+    }
+    if(strcmp(keyword, "set") == 0)
+    {
+        char * reg = strtok_r(NULL, " \t", &saveptr);
+
+        if(reg == NULL || !phev_broker_parseRegister(reg, &command.reg) || !phev_broker_parseHex(saveptr, command.data, &command.length))
+        {
+            return "error usage set <reg> <hex>\n";
+        }
+        return (phev_broker_queueCommand(broker, &command) ? "ok\n" : "error busy\n");
+    }
+    return "error unknown command\n";
+}
+static void phev_broker_closeClient(phevBroker_t * broker, size_t index)
+{
+    phevBrokerClient_t * client = &broker->clients[index];
+
+    pthread_mutex_lock(&client->lock);
+
+    close(client->soc);
+    client->soc = -1;
+    client->generation++;
+    memset(client->subscriptions, 0, sizeof(client->subscriptions));
+
+    while(client->count > 0)
+    {
+        phev_broker_releaseBuffer(client->queue[client->head]);
+        client->head = (client->head + 1) % broker->settings.queueDepth;
+        client->count--;
+    }
+    client->offset = 0;
+    client->dropped = 0;
+    client->lineLength = 0;
+    client->discarding = false;
+
+    pthread_mutex_unlock(&client->lock);
+
+    atomic_fetch_sub_explicit(&broker->connected, 1, memory_order_relaxed);
+    LOG_I(TAG,"Client %zu disconnected",index);
+}
+static void phev_broker_accept(phevBroker_t * broker)
+{
+    int soc = accept(broker->listener, NULL, NULL);
+
+    if(soc < 0)
+    {
+        return;
+    }
+    for(size_t i = 0; i < broker->settings.maxClients; i++)
+    {
+        phevBrokerClient_t * client = &broker->clients[i];
+
+        if(client->soc < 0)
+        {
+            fcntl(soc, F_SETFL, fcntl(soc, F_GETFL, 0) | O_NONBLOCK);
+
+            pthread_mutex_lock(&client->lock);
+            client->soc = soc;
+            pthread_mutex_unlock(&client->lock);
+
+            atomic_fetch_add_explicit(&broker->connected, 1, memory_order_relaxed);
+            LOG_I(TAG,"Client %zu connected",i);
+            return;
+        }
+    }
+    LOG_W(TAG,"Too many clients, refusing one");
+    close(soc);
+}
+static bool phev_broker_readClient(phevBroker_t * broker, size_t index)
+{
+    phevBrokerClient_t * client = &broker->clients[index];
+    char buf[PHEV_BROKER_MAX_LINE];
+    ssize_t num = recv(client->soc, buf, sizeof(buf), 0);
+
+    if(num < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return true;
+    }
+    if(num <= 0)
+    {
+        return false;
+    }
+    for(ssize_t i = 0; i < num; i++)
+    {
+        if(buf[i] == '\r')
+        {
+            continue;
+        }
+        // The rest of an overlong line is dropped, it must not run as a command of its own
+        if(client->discarding)
+        {
+            client->discarding = (buf[i] != '\n');
+            continue;
+        }
+        if(buf[i] != '\n')
+        {
+            if(client->lineLength == sizeof(client->line) - 1)
+            {
+                phev_broker_reply(broker, client, "error line too long\n");
+                client->lineLength = 0;
+                client->discarding = true;
+                continue;
+            }
+            client->line[client->lineLength++] = buf[i];
+            continue;
+        }
+        client->line[client->lineLength] = '\0';
+        client->lineLength = 0;
+
+        const char * reply = phev_broker_command(broker, index, client->line);
+
+        if(reply)
+        {
+            phev_broker_reply(broker, client, reply);
+        }
+    }
+    return true;
+}
+// Sends what it can without blocking, returns false when the client has gone.
+static bool phev_broker_writeClient(phevBroker_t * broker, size_t index)
+{
+    phevBrokerClient_t * client = &broker->clients[index];
+    bool ok = true;
+
+    pthread_mutex_lock(&client->lock);
+
+    while(client->count > 0)
+    {
+        phevBrokerBuffer_t * buffer = client->queue[client->head];
+        ssize_t num = send(client->soc, buffer->data + client->offset, buffer->length - client->offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if(num < 0)
+        {
+            ok = (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+            break;
+        }
+        client->offset += (size_t) num;
+
+        if(client->offset < buffer->length)
+        {
+            break;
+        }
+        client->offset = 0;
+        client->head = (client->head + 1) % broker->settings.queueDepth;
+        client->count--;
+        phev_broker_releaseBuffer(buffer);
+        atomic_fetch_add_explicit(&broker->delivered, 1, memory_order_relaxed);
+    }
+
+    // Tell a client that fell behind once it has caught up
+    if(ok && client->count == 0 && client->dropped > 0)
+    {
+        char line[32];
+        int length = snprintf(line, sizeof(line), "dropped %u\n", client->dropped);
+        phevBrokerBuffer_t * buffer = phev_broker_createBuffer(line, (size_t) length, 1);
+
+        if(buffer)
+        {
+            client->dropped = 0;
+            phev_broker_pushLocked(broker, client, buffer);
+            phev_broker_releaseBuffer(buffer);
+        }
+    }
+    pthread_mutex_unlock(&client->lock);
+
+    return ok;
+}
+static void * phev_broker_thread(void * arg)
+{
+    phevBroker_t * broker = (phevBroker_t *) arg;
+    size_t maxClients = broker->settings.maxClients;
+    struct pollfd * fds = phev_calloc(maxClients + 2, sizeof(struct pollfd));
+
+    if(fds == NULL)
+    {
+        return NULL;
+    }
+    while(atomic_load(&broker->running))
+    {
+        fds[0].fd = broker->listener;
+        fds[0].events = POLLIN;
+        fds[1].fd = broker->wake[0];
+        fds[1].events = POLLIN;
+
+        for(size_t i = 0; i < maxClients; i++)
+        {
+            phevBrokerClient_t * client = &broker->clients[i];
+
+            pthread_mutex_lock(&client->lock);
+            fds[i + 2].fd = client->soc;
+            fds[i + 2].events = (short) (POLLIN | (client->count > 0 || client->dropped > 0 ? POLLOUT : 0));
+            fds[i + 2].revents = 0;
+            pthread_mutex_unlock(&client->lock);
+        }
+        if(poll(fds, (nfds_t) (maxClients + 2), PHEV_BROKER_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        if(fds[1].revents & POLLIN)
+        {
+            uint8_t drain[64];
+
+            atomic_store(&broker->wakePending, false);
+            while(read(broker->wake[0], drain, sizeof(drain)) == (ssize_t) sizeof(drain));
+        }
+        for(size_t i = 0; i < maxClients; i++)
+        {
+            short revents = fds[i + 2].revents;
+
+            if(fds[i + 2].fd < 0 || revents == 0)
+            {
+                continue;
+            }
+            if((revents & (POLLERR | POLLNVAL)) || ((revents & (POLLIN | POLLHUP)) && !phev_broker_readClient(broker, i)))
+            {
+                phev_broker_closeClient(broker, i);
+                continue;
+            }
+        }
+        // Replies and updates queued since the poll go out now rather than after the next one
+        for(size_t i = 0; i < maxClients; i++)
+        {
+            if(broker->clients[i].soc >= 0 && !phev_broker_writeClient(broker, i))
+            {
+                phev_broker_closeClient(broker, i);
+            }
+        }
+        if(fds[0].revents & POLLIN)
+        {
+            phev_broker_accept(broker);
+        }
+    }
+    phev_free(fds);
+
+    return NULL;
+}
+static void phev_broker_snapshot(phevBroker_t * broker, const phevBrokerCommand_t * command)
+{
+    phevBrokerClient_t * client = &broker->clients[command->client];
+    char line[PHEV_BROKER_MAX_UPDATE];
+
+    pthread_mutex_lock(&client->lock);
+
+    if(client->soc >= 0 && client->generation == command->generation)
+    {
+        for(int reg = 0; reg <= UINT8_MAX; reg++)
+        {
+            const phevRegister_t * value = phev_model_peekRegister(broker->service->model, (uint8_t) reg);
+
+            if(value == NULL || value->length == 0 || value->length > UINT8_MAX || !phev_broker_isSubscribed(command->subscriptions, (uint8_t) reg))
+            {
+                continue;
+            }
+
+            phevBrokerBuffer_t * buffer = phev_broker_createBuffer(line, phev_broker_formatUpdate(line, (uint8_t) reg, value->data, value->length), 1);
+
+            if(buffer)
+            {
+                phev_broker_pushLocked(broker, client, buffer);
+                phev_broker_releaseBuffer(buffer);
+            }
+        }
+    }
+    pthread_mutex_unlock(&client->lock);
+}
+void phev_broker_poll(phevBroker_t * broker)
+{
+    phevBrokerCommand_t command;
+
+    if(broker == NULL)
+    {
+        return;
+    }
+    for(;;)
+    {
+        pthread_mutex_lock(&broker->commandLock);
+
+        bool pending = broker->commandCount > 0;
+
+        if(pending)
+        {
+            command = broker->commands[broker->commandHead];
+            broker->commandHead = (broker->commandHead + 1) % PHEV_BROKER_MAX_COMMANDS;
+            broker->commandCount--;
+        }
+        pthread_mutex_unlock(&broker->commandLock);
+
+        if(!pending)
+        {
+            return;
+        }
+        atomic_fetch_add_explicit(&broker->commandsRun, 1, memory_order_relaxed);
+
+        if(command.type == PHEV_BROKER_COMMAND_SNAPSHOT)
+        {
+            phev_broker_snapshot(broker, &command);
+            phev_broker_wake(broker);
+        }
+        else if(broker->service->pipe)
+        {
+            LOG_D(TAG,"Client %zu updates register %d",command.client,command.reg);
+            phev_pipe_updateComplexRegister(broker->service->pipe, command.reg, command.data, command.length);
+        }
+    }
+}
+phevBroker_t * phev_broker_create(phevServiceCtx_t * service, phevBrokerSettings_t settings)
+{
+    LOG_V(TAG,"START - create");
+
+    struct sockaddr_un addr;
+    struct stat st;
+    phevBroker_t * broker = NULL;
+
+    if(service == NULL || settings.path == NULL || strlen(settings.path) >= sizeof(addr.sun_path))
+    {
+        LOG_E(TAG,"Broker needs a service and a socket path");
+        return NULL;
+    }
+    if(settings.maxClients == 0)
+    {
+        settings.maxClients = PHEV_BROKER_DEFAULT_MAX_CLIENTS;
+    }
+    if(settings.queueDepth == 0)
+    {
+        settings.queueDepth = PHEV_BROKER_DEFAULT_QUEUE_DEPTH;
+    }
+    if(settings.mode == 0)
+    {
+        settings.mode = PHEV_BROKER_DEFAULT_MODE;
+    }
+    if(lstat(settings.path, &st) == 0 && !S_ISSOCK(st.st_mode))
+    {
+        LOG_E(TAG,"%s exists and is not a socket",settings.path);
+        return NULL;
+    }
+
+    broker = phev_calloc(1, sizeof(phevBroker_t));
+
+    if(broker == NULL)
+    {
+        return NULL;
+    }
+    broker->service = service;
+    broker->settings = settings;
+    broker->path = phev_strdup(settings.path);
+    broker->settings.path = broker->path;
+    broker->clients = phev_calloc(settings.maxClients, sizeof(phevBrokerClient_t));
+    broker->listener = -1;
+    broker->wake[0] = -1;
+    broker->wake[1] = -1;
+    pthread_mutex_init(&broker->commandLock, NULL);
+    atomic_init(&broker->running, true);
+
+    // Every slot is made safe to destroy before any queue can fail to allocate
+    for(size_t i = 0; broker->clients && i < settings.maxClients; i++)
+    {
+        broker->clients[i].soc = -1;
+        pthread_mutex_init(&broker->clients[i].lock, NULL);
+    }
+    bool queues = broker->clients != NULL;
+
+    for(size_t i = 0; queues && i < settings.maxClients; i++)
+    {
+        broker->clients[i].queue = phev_calloc(settings.queueDepth, sizeof(phevBrokerBuffer_t *));
+        queues = broker->clients[i].queue != NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, settings.path);
+
+    // A socket left behind by a broker that did not shut down would fail the bind
+    if(queues && lstat(settings.path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(settings.path);
+    }
+    if(queues)
+    {
+        broker->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+    broker->bound = broker->listener >= 0 && bind(broker->listener, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+
+    // Nobody can connect before listen, so there is no window with the default mode
+    if(!broker->bound
+        || chmod(settings.path, (mode_t) settings.mode) != 0
+        || listen(broker->listener, (int) settings.maxClients) != 0
+        || pipe(broker->wake) != 0)
+    {
+        LOG_E(TAG,"Cannot listen on %s",settings.path);
+        atomic_store(&broker->running, false);
+        phev_broker_destroy(broker);
+        return NULL;
+    }
+    fcntl(broker->wake[0], F_SETFL, fcntl(broker->wake[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(broker->wake[1], F_SETFL, fcntl(broker->wake[1], F_GETFL, 0) | O_NONBLOCK);
+
+    if(pthread_create(&broker->thread, NULL, phev_broker_thread, broker) != 0)
+    {
+        LOG_E(TAG,"Cannot start broker thread");
+        atomic_store(&broker->running, false);
+        phev_broker_destroy(broker);
+        return NULL;
+    }
+    if(!phev_model_addListener(service->model, phev_broker_modelListener, broker))
+    {
+        LOG_E(TAG,"Cannot listen for register updates, no room for another model listener");
+        phev_broker_destroy(broker);
+        return NULL;
+    }
+
+    LOG_I(TAG,"Broker listening on %s",settings.path);
+    LOG_V(TAG,"END - create");
+
+    return broker;
+}
+void phev_broker_destroy(phevBroker_t * broker)
+{
+    if(broker == NULL)
+    {
+        return;
+    }
+    phev_model_removeListener(broker->service->model, phev_broker_modelListener, broker);
+
+    if(atomic_exchange(&broker->running, false))
+    {
+        pthread_join(broker->thread, NULL);
+    }
+    for(size_t i = 0; broker->clients && i < broker->settings.maxClients; i++)
+    {
+        if(broker->clients[i].soc >= 0)
+        {
+            phev_broker_closeClient(broker, i);
+        }
+        pthread_mutex_destroy(&broker->clients[i].lock);
+        phev_free(broker->clients[i].queue);
+    }
+    if(broker->listener >= 0)
+    {
+        close(broker->listener);
+    }
+    if(broker->bound)
+    {
+        unlink(broker->path);
+    }
+    if(broker->wake[0] >= 0)
+    {
+        close(broker->wake[0]);
+        close(broker->wake[1]);
+    }
+    pthread_mutex_destroy(&broker->commandLock);
+    phev_free(broker->clients);
+    phev_free(broker->path);
+    phev_free(broker);
+}
+phevBrokerStats_t phev_broker_stats(const phevBroker_t * broker)
+{
+    phevBrokerStats_t stats = {
+        .clients = atomic_load_explicit((atomic_uint *) &broker->connected, memory_order_relaxed),
+        .published = atomic_load_explicit((atomic_uint *) &broker->published, memory_order_relaxed),
+        .delivered = atomic_load_explicit((atomic_uint *) &broker->delivered, memory_order_relaxed),
+        .dropped = atomic_load_explicit((atomic_uint *) &broker->dropped, memory_order_relaxed),
+        .commands = atomic_load_explicit((atomic_uint *) &broker->commandsRun, memory_order_relaxed),
+    };
+    return stats;
+}
+
+#else
+
+phevBroker_t * phev_broker_create(phevServiceCtx_t * service, phevBrokerSettings_t settings)
+{
+    LOG_W(TAG,"Broker is not supported on this platform");
+    return NULL;
+}
+void phev_broker_destroy(phevBroker_t * broker)
+{
+}
+void phev_broker_poll(phevBroker_t * broker)
+{
+}
+phevBrokerStats_t phev_broker_stats(const phevBroker_t * broker)
+{
+    phevBrokerStats_t stats = {0};
+
+    return stats;
+}
+
+#endif
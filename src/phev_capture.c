@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phev_capture.h"
+#include "phev_alloc.h"
+#include "phev_core.h"
+#include "phev_log.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define PHEV_CAPTURE_THREADS
+#endif
+
+const static char *TAG = "PHEV_CAPTURE";
+
+#define PHEV_CAPTURE_HEADER_SIZE 16
+#define PHEV_CAPTURE_MAX_VARINT 10
+#define PHEV_CAPTURE_FILE_BUFFER (64 * 1024)
+
+struct phevCapture_t {
+#ifdef PHEV_CAPTURE_THREADS
+    pthread_mutex_t lock;
+#endif
+    FILE * file;
+    uint64_t start;
+    uint64_t last;
+    uint64_t lastFlush;
+};
+
+struct phevCaptureReader_t {
+    FILE * file;
+    uint64_t timestamp;
+};
+
+// Reads and writes can come from different threads
+#ifdef PHEV_CAPTURE_THREADS
+#define PHEV_CAPTURE_LOCK(capture) pthread_mutex_lock(&(capture)->lock)
+#define PHEV_CAPTURE_UNLOCK(capture) pthread_mutex_unlock(&(capture)->lock)
+#else
+#define PHEV_CAPTURE_LOCK(capture)
+#define PHEV_CAPTURE_UNLOCK(capture)
+#endif
+
+static size_t phev_capture_putVarint(uint8_t * out, uint64_t value)
+{
+    size_t length = 0;
+
+    do
+    {
+        uint8_t byte = value & 0x7f;
+
+        value >>= 7;
+        out[length++] = byte | (value ? 0x80 : 0);
+    } while(value);
+
+    return length;
+}
+static bool phev_capture_getVarint(FILE * file, uint64_t * value)
+{
+    *value = 0;
+
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(file);
+
+        if(byte == EOF)
+        {
+            return false;
+        }
+        *value |= ((uint64_t) (byte & 0x7f)) << shift;
+
+        if((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+static void phev_capture_putUint(uint8_t * out, uint64_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++)
+    {
+        out[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+static uint64_t phev_capture_getUint(const uint8_t * in, int bytes)
+{
+    uint64_t value = 0;
+
+    for(int i = 0; i < bytes; i++)
+    {
+        value |= ((uint64_t) in[i]) << (i * 8);
+    }
+    return value;
+}
+phevCapture_t * phev_capture_open(const char * path)
+{
+    LOG_V(TAG,"START - open");
+
+    uint8_t header[PHEV_CAPTURE_HEADER_SIZE];
+    phevCapture_t * capture = phev_malloc(sizeof(phevCapture_t));
+
+    if(capture == NULL)
+    {
+        return NULL;
+    }
+    capture->file = fopen(path, "wb");
+
+    if(capture->file == NULL)
+    {
+        LOG_E(TAG,"Cannot open capture %s",path);
+        phev_free(capture);
+        return NULL;
+    }
+    setvbuf(capture->file, NULL, _IOFBF, PHEV_CAPTURE_FILE_BUFFER);
+#ifdef PHEV_CAPTURE_THREADS
+    pthread_mutex_init(&capture->lock, NULL);
+#endif
+
+    capture->start = phev_core_monotonicNs();
+    capture->last = capture->start;
+    capture->lastFlush = capture->start;
+
+    phev_capture_putUint(header, PHEV_CAPTURE_MAGIC, 4);
+    phev_capture_putUint(header + 4, PHEV_CAPTURE_VERSION, 4);
+    phev_capture_putUint(header + 8, capture->start, 8);
+
+    if(fwrite(header, 1, sizeof(header), capture->file) != sizeof(header))
+    {
+        LOG_E(TAG,"Cannot write capture header to %s",path);
+        phev_capture_close(capture);
+        return NULL;
+    }
+
+    LOG_I(TAG,"Capturing to %s",path);
+    LOG_V(TAG,"END - open");
+
+    return capture;
+}
+void phev_capture_close(phevCapture_t * capture)
+{
+    if(capture == NULL)
+    {
+        return;
+    }
+    fclose(capture->file);
+#ifdef PHEV_CAPTURE_THREADS
+    pthread_mutex_destroy(&capture->lock);
+#endif
+    phev_free(capture);
+}
+static bool phev_capture_recordLocked(phevCapture_t * capture, uint8_t direction, const uint8_t * data, size_t length)
+{
+    uint64_t now = phev_core_monotonicNs();
+
+    while(length > 0)
+    {
+        uint8_t header[1 + 2 * PHEV_CAPTURE_MAX_VARINT];
+        size_t chunk = (length > PHEV_CAPTURE_MAX_RECORD ? PHEV_CAPTURE_MAX_RECORD : length);
+        size_t headerLength = 0;
+
+        header[headerLength++] = direction;
+        headerLength += phev_capture_putVarint(header + headerLength, now - capture->last);
+        headerLength += phev_capture_putVarint(header + headerLength, chunk);
+        capture->last = now;
+
+        if(fwrite(header, 1, headerLength, capture->file) != headerLength
+            || fwrite(data, 1, chunk, capture->file) != chunk)
+        {
+            LOG_E(TAG,"Capture write failed");
+            return false;
+        }
+        data += chunk;
+        length -= chunk;
+    }
+    if(now - capture->lastFlush >= PHEV_CAPTURE_FLUSH_MS * 1000000ULL)
+    {
+        fflush(capture->file);
+        capture->lastFlush = now;
+    }
+    return true;
+}
+bool phev_capture_record(phevCapture_t * capture, uint8_t direction, const uint8_t * data, size_t length)
+{
+    if(capture == NULL || data == NULL)
+    {
+        return false;
+    }
+    PHEV_CAPTURE_LOCK(capture);
+
+    bool ok = phev_capture_recordLocked(capture, direction, data, length);
+
+    PHEV_CAPTURE_UNLOCK(capture);
+
+    return ok;
+}
+void phev_capture_flush(phevCapture_t * capture)
+{
+    if(capture == NULL)
+    {
+        return;
+    }
+    PHEV_CAPTURE_LOCK(capture);
+
+    fflush(capture->file);
+    capture->lastFlush = phev_core_monotonicNs();
+
+    PHEV_CAPTURE_UNLOCK(capture);
+}
+phevCaptureReader_t * phev_capture_openReader(const char * path)
+{
+    uint8_t header[PHEV_CAPTURE_HEADER_SIZE];
+    phevCaptureReader_t * reader = phev_malloc(sizeof(phevCaptureReader_t));
+
+    if(reader == NULL)
+    {
+        return NULL;
+    }
+    reader->file = fopen(path, "rb");
+    reader->timestamp = 0;
+
+    if(reader->file == NULL)
+    {
+        LOG_E(TAG,"Cannot open capture %s",path);
+        phev_free(reader);
+        return NULL;
+    }
+    // Before the first read, setvbuf on a stream already used is undefined
+    setvbuf(reader->file, NULL, _IOFBF, PHEV_CAPTURE_FILE_BUFFER);
+
+    if(fread(header, 1, sizeof(header), reader->file) != sizeof(header)
+        || phev_capture_getUint(header, 4) != PHEV_CAPTURE_MAGIC
+        || phev_capture_getUint(header + 4, 4) != PHEV_CAPTURE_VERSION)
+    {
+        LOG_E(TAG,"%s is not a capture",path);
+        fclose(reader->file);
+        phev_free(reader);
+        return NULL;
+    }
+    return reader;
+}
+void phev_capture_closeReader(phevCaptureReader_t * reader)
+{
+    if(reader == NULL)
+    {
+        return;
+    }
+    fclose(reader->file);
+    phev_free(reader);
+}
+bool phev_capture_next(phevCaptureReader_t * reader, phevCaptureRecord_t * record)
+{
+    int direction = fgetc(reader->file);
+    uint64_t delta = 0;
+    uint64_t length = 0;
+
+    if(direction == EOF)
+    {
+        return false;
+    }
+    if((direction != PHEV_CAPTURE_IN && direction != PHEV_CAPTURE_OUT)
+        || !phev_capture_getVarint(reader->file, &delta)
+        || !phev_capture_getVarint(reader->file, &length)
+        || length > PHEV_CAPTURE_MAX_RECORD
+        || fread(record->data, 1, (size_t) length, reader->file) != (size_t) length)
+    {
+        LOG_W(TAG,"Capture ends with a truncated record");
+        return false;
+    }
+    reader->timestamp += delta;
+
+    record->timestamp = reader->timestamp;
+    record->direction = (uint8_t) direction;
+    record->length = (size_t) length;
+
+    return true;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "phev_config.h"
 #ifdef __XTENSA__
 #include "cJSON.h"
@@ -14,13 +15,17 @@ bool phev_config_checkForOption(const cJSON * json, const char * option)
 char * phev_config_getConfigString(cJSON * json, char * option) 
 {
     cJSON * value = cJSON_GetObjectItemCaseSensitive(json, option);
-    
+    if(!cJSON_IsString(value) || value->valuestring == NULL) {
+        return "";
+    }
     return value->valuestring;
 }
 uint16_t phev_config_getConfigInt(cJSON * json, char * option) 
 {
     cJSON * value = cJSON_GetObjectItemCaseSensitive(json, option);
-    
+    if(value == NULL) {
+        return 0;
+    }
     return value->valueint;
 }
 
@@ -59,21 +64,17 @@ void phev_config_setUpdateConfig(phevUpdateConfig_t * config, const char * ssid,
                                         bool forceUpdate
                                         )
 {
-    strcpy(config->updateWifi.ssid,ssid);
-    config->updateWifi.ssid[strlen(ssid)] = '\0';
-    
-    strcpy(config->updateWifi.password,password);
+    // Longer values are cut to fit rather than run into the next field
+    snprintf(config->updateWifi.ssid, sizeof(config->updateWifi.ssid), "%s", ssid);
+    snprintf(config->updateWifi.password, sizeof(config->updateWifi.password), "%s", password);
 
-    config->updateWifi.password[strlen(password)] = '\0';
-    
-    config->updateHost = malloc(strlen(host));
-    strcpy(config->updateHost,host);    
-    
-    config->updatePath = malloc(strlen(path));
-    strcpy(config->updatePath,path);
+    config->updateHost = strdup(host);
+    config->updatePath = strdup(path);
     
-    const char * buildPath = NULL;     
-    asprintf(&buildPath,"%s%s%010llu.bin", config->updatePath,IMAGE_PREFIX,build);
+    char * buildPath = NULL;     
+    if(asprintf(&buildPath,"%s%s%010llu.bin", path,IMAGE_PREFIX,build) < 0) {
+        buildPath = NULL;
+    }
     
     config->updateImageFullPath = buildPath;
 
@@ -109,8 +110,8 @@ void phev_config_parseConnectionConfig(phevConfig_t * config, cJSON * connection
     config->connectionConfig.host = strdup(phev_config_getConfigString(connection, CONNECTION_CONFIG_HOST));
     config->connectionConfig.port = phev_config_getConfigInt(connection, CONNECTION_CONFIG_PORT);
 
-    strcpy(config->connectionConfig.carConnectionWifi.ssid, phev_config_getConfigString(connection, CONNECTION_CONFIG_SSID)); 
-    strcpy(config->connectionConfig.carConnectionWifi.password, phev_config_getConfigString(connection, CONNECTION_CONFIG_PASSWORD)); 
+    snprintf(config->connectionConfig.carConnectionWifi.ssid, sizeof(config->connectionConfig.carConnectionWifi.ssid), "%s", phev_config_getConfigString(connection, CONNECTION_CONFIG_SSID)); 
+    snprintf(config->connectionConfig.carConnectionWifi.password, sizeof(config->connectionConfig.carConnectionWifi.password), "%s", phev_config_getConfigString(connection, CONNECTION_CONFIG_PASSWORD)); 
 }
 
 void phev_config_parseStateConfig(phevConfig_t * config, cJSON * state)
@@ -130,8 +131,10 @@ char * phev_config_displayConfig(const phevConfig_t * config)
 }
 phevConfig_t * phev_config_parseConfig(const char * config)
 {
-    phevConfig_t * phevConfig = malloc(sizeof(phevConfig_t));
-
+    if(config == NULL)
+    {
+        return NULL;
+    }
     cJSON * json = cJSON_Parse((const char *) config);
 
     //char * string = cJSON_Print(json);
@@ -145,6 +148,13 @@ phevConfig_t * phev_config_parseConfig(const char * config)
         }
         return NULL;
     } 
+    phevConfig_t * phevConfig = calloc(1, sizeof(phevConfig_t));
+
+    if(phevConfig == NULL)
+    {
+        cJSON_Delete(json);
+        return NULL;
+    }
     cJSON * update = cJSON_GetObjectItemCaseSensitive(json, UPDATE_CONFIG_JSON);
 
     if(update != NULL)
@@ -156,6 +166,8 @@ phevConfig_t * phev_config_parseConfig(const char * config)
         {
             printf("Error before: %s\n", error_ptr);
         }
+        cJSON_Delete(json);
+        free(phevConfig);
         return NULL;
     }
 
@@ -177,6 +189,18 @@ phevConfig_t * phev_config_parseConfig(const char * config)
 
     return phevConfig;
 }
+void phev_config_destroyConfig(phevConfig_t * config)
+{
+    if(config == NULL)
+    {
+        return;
+    }
+    free(config->connectionConfig.host);
+    free(config->updateConfig.updateHost);
+    free(config->updateConfig.updatePath);
+    free(config->updateConfig.updateImageFullPath);
+    free(config);
+}
 bool phev_config_checkForFirmwareUpdate(const phevUpdateConfig_t * config)
 {
 #ifndef NO_OTA
@@ -1,10 +1,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef __XTENSA__
+#include "esp_timer.h"
+#endif
 #include "phev_core.h"
+#include "phev_alloc.h"
 #include "msg_core.h"
 #include "msg_utils.h"
-#include "logger.h"
+#include "phev_log.h"
 
 const static char *APP_TAG = "PHEV_CORE";
 
@@ -14,7 +22,7 @@ uint8_t *phev_core_xorDataWithValue(const uint8_t *data, const uint8_t xor)
 
     size_t length = (data[1] ^ xor) + 2;
 
-    uint8_t *decoded = malloc(length);
+    uint8_t *decoded = phev_malloc(length);
 
     LOG_D(APP_TAG, "Decoding data with length %d with XOR %02X", length, xor);
 
@@ -93,61 +101,56 @@ bool phev_core_validateChecksum(const uint8_t *data)
         return false;
     }
 }
+// Checksum of the frame with the key applied as it is summed, no decoded copy is made.
+static bool phev_core_checksumMatchesXOR(const uint8_t *data, size_t length, uint8_t xor)
+{
+    uint8_t b = 0;
+
+    for (size_t i = 0; i < length - 1; i++)
+    {
+        b = (uint8_t)((data[i] ^ xor) + b);
+    }
+    return b == (data[length - 1] ^ xor);
+}
 bool phev_core_validateChecksumXOR(const uint8_t *data, const uint8_t xor)
 {
-    uint8_t *decodedData = phev_core_xorDataWithValue(data, xor);
+    uint8_t length = (data[1] ^ xor) + 2;
 
-    bool valid = phev_core_validateChecksum(decodedData);
+    return length >= 2 && phev_core_checksumMatchesXOR(data, length, xor);
+}
+// Length of the frame at data with the key applied, 0 when it runs past len, is too short to hold a register
+// or is longer than a message length can say.
+static size_t phev_core_boundedLength(const uint8_t *data, size_t len, uint8_t xor)
+{
+    if (len < PHEV_CORE_MIN_FRAME)
+    {
+        return 0;
+    }
+    size_t length = (size_t)(data[1] ^ xor) + 2;
 
-    free(decodedData);
+    return (length >= PHEV_CORE_MIN_FRAME && length <= len && length <= 0xff ? length : 0);
+}
+// Length of the incoming frame at data under key xor, 0 unless the command, the bounds and the checksum all hold.
+static size_t phev_core_incomingLengthXOR(const uint8_t *data, size_t len, uint8_t xor)
+{
+    size_t length = phev_core_boundedLength(data, len, xor);
 
-    return valid;
+    if (length && phev_core_checkIncomingCommand(data[0] ^ xor) && phev_core_checksumMatchesXOR(data, length, xor))
+    {
+        return length;
+    }
+    return 0;
 }
 message_t *phev_core_unencodedIncomingMessage(const uint8_t *data)
 {
     uint8_t command = data[0];
     uint8_t length = data[1] + 2;
 
-    if(phev_core_validateChecksum(data))
+    // The same commands incomingLengthXOR takes, so the frame scan and the extract paths agree on what is a frame
+    if(phev_core_checkIncomingCommand(command) && phev_core_validateChecksum(data))
     {
-        switch (data[0])
-        {
-        case 0x4e:
-        {
-            LOG_D(APP_TAG, "Start (4E) unencoded");
-            return msg_utils_createMsg(data, length);
-        }
-        case 0x5e:
-        {
-            LOG_D(APP_TAG, "Start (5E) unencoded");
-            return msg_utils_createMsg(data, length);
-        }
-        case 0x3f:
-        {
-            LOG_D(APP_TAG, "Ping response unencoded");
-            return msg_utils_createMsg(data, length);
-        }
-        case 0x6f:
-        {
-            LOG_D(APP_TAG, "Command unencoded");
-            return msg_utils_createMsg(data, length);
-        }
-        case 0xbb:
-        {
-            LOG_D(APP_TAG, "BB Command unencoded");
-            return msg_utils_createMsg(data, length);
-        }
-        case 0xcc:
-        {
-            LOG_D(APP_TAG, "CC Command unencoded");
-            return msg_utils_createMsg(data, length);
-        }
-        case 0x2e:
-        {
-            LOG_D(APP_TAG, "2E Command unencoded");
-            return msg_utils_createMsg(data, length);
-        }
-        }
+        LOG_D(APP_TAG, "%02X unencoded", command);
+        return msg_utils_createMsg(data, length);
     }
     LOG_E(APP_TAG,"Unknown unencoded command %02X", command);
     return NULL;
@@ -187,28 +190,26 @@ message_t *phev_core_unencodedOutgoingMessage(const uint8_t *data)
     return NULL;
 }
 
-message_t *phev_core_encodedIncomingMessage(const uint8_t *data)
+message_t *phev_core_encodedIncomingMessage(const uint8_t *data, const size_t len)
 {
     uint8_t xor = data[2];
-    uint8_t command = data[0] ^ xor;
-    uint8_t length = (data[1] ^ xor) + 2;
+    size_t length = phev_core_incomingLengthXOR(data, len, xor);
 
-    if (phev_core_checkIncomingCommand(command) && phev_core_validateChecksumXOR(data, xor))
+    if (length)
     {
         message_t * message = phev_core_createMsgXOR(data,length,xor);
         return message;
     }
 
     xor ^= 1;
-    command = data[0] ^ xor;
-    length = (data[1] ^ xor) + 2;
+    length = phev_core_incomingLengthXOR(data, len, xor);
 
-    if (phev_core_checkIncomingCommand(command) && phev_core_validateChecksumXOR(data, xor))
+    if (length)
     {
         return phev_core_createMsgXOR(data, length, xor);
     }
 
-    LOG_E(APP_TAG,"Unknown encoded command %02X or %02X", command, command ^ 1);
+    LOG_E(APP_TAG,"Unknown encoded command %02X or %02X", data[0] ^ data[2], data[0] ^ data[2] ^ 1);
 
     return NULL;
 }
@@ -237,25 +238,113 @@ message_t *phev_core_encodedOutgoingMessage(const uint8_t *data)
 
     return NULL;
 }
-message_t * phev_core_extractIncomingMessageAndXOR(const uint8_t *data)
+message_t * phev_core_extractIncomingMessageAndXOR(const uint8_t *data, const size_t len)
 {
     LOG_V(APP_TAG, "START - extractIncomingMessageAndXOR");
 
     message_t *message = NULL;
 
-    if (phev_core_checkIncomingCommand(data[0]) && phev_core_validateChecksumXOR(data, 0))
+    if (data == NULL || len < PHEV_CORE_MIN_FRAME)
+    {
+        return NULL;
+    }
+    if (phev_core_incomingLengthXOR(data, len, 0))
     {
         message = phev_core_unencodedIncomingMessage(data);
     }
     else
     {
-        message = phev_core_encodedIncomingMessage(data);
+        message = phev_core_encodedIncomingMessage(data, len);
     }
 
     LOG_V(APP_TAG, "END - extractIncomingMessageAndXOR");
 
     return message;
 }
+message_t * phev_core_extractIncomingMessageExpectXOR(const uint8_t *data, const size_t len, const uint8_t xor, bool *fallback)
+{
+    if (fallback)
+    {
+        *fallback = false;
+    }
+    if (data == NULL || len < PHEV_CORE_MIN_FRAME)
+    {
+        return NULL;
+    }
+
+    size_t length = phev_core_incomingLengthXOR(data, len, xor);
+
+    if (length)
+    {
+        return (xor ? phev_core_createMsgXOR(data, length, xor) : phev_core_unencodedIncomingMessage(data));
+    }
+    if (fallback)
+    {
+        *fallback = true;
+    }
+    return phev_core_extractIncomingMessageAndXOR(data, len);
+}
+// Key and length of the incoming frame at data, trying xor and then the keys the header suggests in the order
+// phev_core_extractIncomingMessageAndXOR does. Returns 0 when it is not a frame under any of them.
+static size_t phev_core_findIncomingFrame(const uint8_t *data, size_t len, uint8_t xor, uint8_t *key, bool *fallback)
+{
+    size_t length = phev_core_incomingLengthXOR(data, len, xor);
+
+    *fallback = (length == 0);
+
+    if (length == 0)
+    {
+        const uint8_t candidates[] = {0, data[2], data[2] ^ 1};
+
+        for (int i = 0; i < 3 && length == 0; i++)
+        {
+            xor = candidates[i];
+            length = phev_core_incomingLengthXOR(data, len, xor);
+        }
+    }
+    *key = xor;
+
+    return length;
+}
+size_t phev_core_scanIncomingFrames(const uint8_t *data, const size_t len, uint8_t *xor, phevFrame_t *frames, const size_t max, size_t *used, size_t *fallbacks)
+{
+    size_t numberOfFrames = 0;
+    size_t offset = 0;
+    size_t misses = 0;
+
+    while (data && numberOfFrames < max && len - offset >= PHEV_CORE_MIN_FRAME)
+    {
+        const uint8_t *frame = data + offset;
+        uint8_t key = 0;
+        bool fallback = false;
+        size_t length = phev_core_findIncomingFrame(frame, len - offset, *xor, &key, &fallback);
+
+        misses += fallback;
+
+        if (length == 0)
+        {
+            break;
+        }
+        frames[numberOfFrames].offset = offset;
+        frames[numberOfFrames].length = (uint8_t) length;
+        frames[numberOfFrames].xor = key;
+        frames[numberOfFrames].command = frame[0] ^ key;
+        frames[numberOfFrames].type = frame[2] ^ key;
+        frames[numberOfFrames].reg = frame[3] ^ key;
+        numberOfFrames++;
+
+        // The car keeps its key until a bb announces the next one, sent under the old key
+        *xor = ((frame[0] ^ key) == 0xbb && length > 5 ? frame[4] ^ key : key);
+        offset += length;
+    }
+    *used = offset;
+
+    if (fallbacks)
+    {
+        *fallbacks = misses;
+    }
+    return numberOfFrames;
+}
 message_t * phev_core_extractOutgoingMessageAndXOR(const uint8_t *data)
 {
     LOG_V(APP_TAG, "START - extractOutgoingMessageAndXOR");
@@ -287,6 +376,7 @@ uint8_t phev_core_getMessageXOR(const message_t * message)
 }
 message_t * phev_core_createMsgXOR(const uint8_t * data, const size_t length, const uint8_t xor)
 {
+    // Freed with the message by msg_utils_destroyMsg, not through the allocator
     uint8_t * ctx = malloc(1);
 
     ctx[0] = xor;
@@ -295,11 +385,11 @@ message_t * phev_core_createMsgXOR(const uint8_t * data, const size_t length, co
 
     return message;
 }
-message_t * phev_core_extractAndDecodeIncomingMessageAndXOR(const uint8_t *data)
+message_t * phev_core_extractAndDecodeIncomingMessageAndXOR(const uint8_t *data, const size_t len)
 {
     LOG_V(APP_TAG, "START - extractAndDecodeIncomingMessageAndXOR");
 
-    message_t * message = phev_core_extractIncomingMessageAndXOR(data);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(data, len);
 
     if(message == NULL)
     {
@@ -314,7 +404,7 @@ message_t * phev_core_extractAndDecodeIncomingMessageAndXOR(const uint8_t *data)
 
     message_t * decoded = phev_core_createMsgXOR(decodedData,message->length,xor);
 
-    free(decodedData);
+    phev_free(decodedData);
 
     msg_utils_destroyMsg(message);
 
@@ -340,7 +430,7 @@ message_t * phev_core_extractAndDecodeOutgoingMessageAndXOR(const uint8_t *data)
 
     message_t * decoded = phev_core_createMsgXOR(decodedData,message->length,xor);
 
-    free(decodedData);
+    phev_free(decodedData);
     //msg_utils_destroyMsg(message);
 
     LOG_V(APP_TAG, "END - extractAndDecodeOutgoingMessageAndXOR");
@@ -418,14 +508,14 @@ uint8_t phev_core_validateCommand(const uint8_t command)
 }
 uint8_t * phev_core_getData(const uint8_t *data)
 {
-    uint8_t length = data[1] - 3;
-
-    if(length == 0)
+    // A length below 3 would wrap round to a copy of up to 255 bytes
+    if(data[1] <= 3)
     {
         LOG_D(APP_TAG,"No data in message");
         return NULL;
     }
-    uint8_t * messageData = malloc(length);
+    uint8_t length = data[1] - 3;
+    uint8_t * messageData = phev_malloc(length);
 
     memcpy(messageData, data + 4, length);
 
@@ -444,6 +534,77 @@ uint8_t phev_core_checksum(const uint8_t *data)
         b = (uint8_t)(data[i] + b);
     }
 }
+int phev_core_frameLength(const uint8_t *data, size_t len)
+{
+    if (len < 3)
+    {
+        return 0;
+    }
+
+    const uint8_t candidates[] = {0, data[2], data[2] ^ 1};
+    bool needMore = false;
+
+    for (int i = 0; i < 3; i++)
+    {
+        uint8_t xor = candidates[i];
+        uint8_t command = data[0] ^ xor;
+
+        if (!phev_core_checkIncomingCommand(command) && !phev_core_checkOutgoingCommand(command))
+        {
+            continue;
+        }
+
+        size_t length = (size_t)(data[1] ^ xor) + 2;
+
+        if (length < PHEV_CORE_MIN_FRAME)
+        {
+            continue;
+        }
+        if (length > len)
+        {
+            needMore = true;
+            continue;
+        }
+        if (phev_core_checksumMatchesXOR(data, length, xor))
+        {
+            return (int) length;
+        }
+    }
+
+    return (needMore ? 0 : -1);
+}
+size_t phev_core_decodeFrame(const uint8_t *data, size_t len, uint8_t *out)
+{
+    if (len < 3)
+    {
+        return 0;
+    }
+
+    uint8_t xor = data[2];
+    uint8_t mask = ((data[0] ^ xor) & 0x01);
+
+    if (xor < 2)
+    {
+        xor = 0;
+    }
+    else if ((data[0] ^ xor) > 0xe0)
+    {
+        if ((data[0] ^ xor) != 0xf3)
+        {
+            xor ^= mask;
+        }
+    }
+    else
+    {
+        xor = (data[2] & 0xfe) ^ ((data[0] & 0x01) ^ 1);
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        out[i] = data[i] ^ xor;
+    }
+    return len;
+}
 uint8_t phev_core_getChecksum(const uint8_t *data)
 {
     uint8_t checksum = data[data[1] + 1];
@@ -454,13 +615,13 @@ phevMessage_t *phev_core_createMessage(const uint8_t command, const uint8_t type
 {
     LOG_V(APP_TAG, "START - createMessage");
     LOG_D(APP_TAG, "Data %d Length %d", data[0], length);
-    phevMessage_t *message = malloc(sizeof(phevMessage_t));
+    phevMessage_t *message = phev_malloc(sizeof(phevMessage_t));
 
     message->command = command;
     message->type = type;
     message->reg = reg;
     message->length = length;
-    message->data = malloc(message->length);
+    message->data = phev_malloc(message->length);
     memcpy(message->data, data, length);
     message->XOR = 0;
     LOG_D(APP_TAG, "Message Data %d", message->data[0]);
@@ -479,10 +640,10 @@ void phev_core_destroyMessage(phevMessage_t *message)
 
     if (message->data != NULL)
     {
-        free(message->data);
+        phev_free(message->data);
     }
 
-    free(message);
+    phev_free(message);
     LOG_V(APP_TAG, "END - destroyMessage");
 }
 int phev_core_validate_buffer(const uint8_t *msg, const size_t len)
@@ -518,7 +679,7 @@ int phev_core_validate_buffer(const uint8_t *msg, const size_t len)
 uint8_t *phev_core_unscramble(const uint8_t *data, const size_t len)
 {
     LOG_V(APP_TAG, "START - unscramble");
-    uint8_t *decodedData = malloc(len);
+    uint8_t *decodedData = phev_malloc(len);
 
     if (data[2] < 2)
     {
@@ -554,7 +715,7 @@ int phev_core_decodeMessage(const uint8_t *data, const size_t len, phevMessage_t
         return 0;
     }
 
-    message_t * message = phev_core_extractAndDecodeIncomingMessageAndXOR(data);
+    message_t * message = phev_core_extractAndDecodeIncomingMessageAndXOR(data, len);
 
     if (message)
     {
@@ -592,7 +753,7 @@ message_t *phev_core_extractMessage(const uint8_t *data, const size_t len, uint8
 
     LOG_BUFFER_HEXDUMP("DECODED", decoded->data, decoded->data[1] + 2, LOG_DEBUG);
 
-    free(encoded);
+    phev_free(encoded);
 
     return decoded;
 }
@@ -603,7 +764,7 @@ int phev_core_encodeMessage(phevMessage_t *message, uint8_t **data)
 
     LOG_D(APP_TAG, "encode XOR %02x", message->XOR);
 
-    uint8_t *d = malloc(message->length + 5);
+    uint8_t *d = phev_malloc(message->length + 5);
 
     d[0] = message->command;
     d[1] = (message->length + 3);
@@ -660,17 +821,25 @@ phevMessage_t *phev_core_ackMessage(const uint8_t command, const uint8_t reg)
     const uint8_t data = 0;
     return phev_core_responseMessage(command, reg, &data, 1);
 }
-phevMessage_t *phev_core_startMessage(const uint8_t *mac)
+phevMessage_t *phev_core_profileStartMessage(const phevProfile_t *profile, const uint8_t *mac)
 {
-    uint8_t *data = malloc(7);
+    uint8_t *data = phev_malloc(7);
     memcpy(data, mac, 6);
     data[6] = 0;
 
-    return phev_core_requestMessage(START_SEND_MY18, 0x01, data, 7);
+    return phev_core_requestMessage(profile->startSend, 0x01, data, 7);
+}
+phevMessage_t *phev_core_startMessage(const uint8_t *mac)
+{
+    return phev_core_profileStartMessage(phev_profile_get(PHEV_PROFILE_MY18), mac);
 }
 message_t *phev_core_startMessageEncoded(const uint8_t *mac)
 {
-    phevMessage_t *start = phev_core_startMessage(mac);
+    return phev_core_profileStartMessageEncoded(phev_profile_get(PHEV_PROFILE_MY18), mac);
+}
+message_t *phev_core_profileStartMessageEncoded(const phevProfile_t *profile, const uint8_t *mac)
+{
+    phevMessage_t *start = phev_core_profileStartMessage(profile, mac);
     phevMessage_t *startaa = phev_core_simpleRequestCommandMessage(0xaa, 0);
     message_t *message = msg_utils_concatMessages(
         phev_core_convertToMessage(start),
@@ -680,10 +849,14 @@ message_t *phev_core_startMessageEncoded(const uint8_t *mac)
     return message;
 }
 phevMessage_t *phev_core_pingMessage(const uint8_t number)
+{
+    return phev_core_profilePingMessage(phev_profile_get(PHEV_PROFILE_MY18), number);
+}
+phevMessage_t *phev_core_profilePingMessage(const phevProfile_t *profile, const uint8_t number)
 {
     const uint8_t data = 0;
 
-    return phev_core_requestMessage(PING_SEND_CMD_MY18, number, &data, 1);
+    return phev_core_requestMessage(profile->pingSend, number, &data, 1);
 }
 phevMessage_t *phev_core_responseHandler(phevMessage_t *message)
 {
@@ -702,7 +875,7 @@ message_t *phev_core_convertToMessage(phevMessage_t *message)
 
     message_t *out = phev_core_createMsgXOR(data, length,message->XOR);
 
-    free(data);
+    phev_free(data);
 
     phev_core_destroyMessage(message);
 
@@ -713,8 +886,8 @@ message_t *phev_core_convertToMessage(phevMessage_t *message)
 
 phevMessage_t *phev_core_copyMessage(phevMessage_t *message)
 {
-    phevMessage_t *out = malloc(sizeof(phevMessage_t));
-    out->data = malloc(message->length);
+    phevMessage_t *out = phev_malloc(sizeof(phevMessage_t));
+    out->data = phev_malloc(message->length);
     out->command = message->command;
     out->reg = message->reg;
     out->type = message->type;
@@ -728,7 +901,7 @@ uint8_t *phev_core_xorDataOutbound(const uint8_t *data, uint8_t xor)
 {
     uint8_t length = data[1] + 2;
 
-    uint8_t *decoded = malloc(length);
+    uint8_t *decoded = phev_malloc(length);
 
     for (int i = 0; i < length; i++)
     {
@@ -744,7 +917,7 @@ message_t *phev_core_XOROutboundMessage(const message_t *message, const uint8_t
 
     message_t * encoded = msg_utils_createMsg(data,message->data[1] + 2);
 
-    free(data);
+    phev_free(data);
 
     LOG_V(APP_TAG, "END - XOROutboundMessage");
     return encoded;
@@ -760,3 +933,27 @@ message_t *phev_core_XORInboundMessage(const message_t *message, const uint8_t x
     return out;
 
 }
+uint64_t phev_core_monotonicNs(void)
+{
+#if defined(__XTENSA__)
+    return (uint64_t) esp_timer_get_time() * 1000;
+#elif defined(_WIN32)
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (uint64_t) ((counter.QuadPart / frequency.QuadPart) * 1000000000ULL + ((counter.QuadPart % frequency.QuadPart) * 1000000000ULL) / frequency.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+}
+uint64_t phev_core_monotonicMs(void)
+{
+    return phev_core_monotonicNs() / 1000000ULL;
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "phev_histogram.h"
+#include "phev_alloc.h"
+
+#define PHEV_HISTOGRAM_MAX_VALUE ((1ULL << PHEV_HISTOGRAM_MAX_BITS) - 1)
+
+struct phevHistogram_t {
+    atomic_uint counts[PHEV_HISTOGRAM_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t min;
+    _Atomic uint64_t max;
+};
+
+static int phev_histogram_index(uint64_t value)
+{
+    if(value < PHEV_HISTOGRAM_SUB_BUCKETS)
+    {
+        return (int) value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - PHEV_HISTOGRAM_SUB_BITS;
+
+    return PHEV_HISTOGRAM_SUB_BUCKETS * (shift + 1) + (int) ((value >> shift) - PHEV_HISTOGRAM_SUB_BUCKETS);
+}
+static uint64_t phev_histogram_highest(int index)
+{
+    if(index < PHEV_HISTOGRAM_SUB_BUCKETS)
+    {
+        return (uint64_t) index;
+    }
+    int shift = index / PHEV_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t) (index % PHEV_HISTOGRAM_SUB_BUCKETS + PHEV_HISTOGRAM_SUB_BUCKETS);
+
+    return ((sub + 1) << shift) - 1;
+}
+phevHistogram_t * phev_histogram_create(void)
+{
+    phevHistogram_t * histogram = phev_malloc(sizeof(phevHistogram_t));
+
+    if(histogram)
+    {
+        phev_histogram_reset(histogram);
+    }
+    return histogram;
+}
+void phev_histogram_destroy(phevHistogram_t * histogram)
+{
+    phev_free(histogram);
+}
+void phev_histogram_reset(phevHistogram_t * histogram)
+{
+    if(histogram == NULL)
+    {
+        return;
+    }
+    for(int i = 0; i < PHEV_HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_init(&histogram->counts[i], 0);
+    }
+    atomic_init(&histogram->total, 0);
+    atomic_init(&histogram->sum, 0);
+    atomic_init(&histogram->min, UINT64_MAX);
+    atomic_init(&histogram->max, 0);
+}
+void phev_histogram_record(phevHistogram_t * histogram, uint64_t value)
+{
+    if(histogram == NULL)
+    {
+        return;
+    }
+    if(value > PHEV_HISTOGRAM_MAX_VALUE)
+    {
+        value = PHEV_HISTOGRAM_MAX_VALUE;
+    }
+    atomic_fetch_add_explicit(&histogram->counts[phev_histogram_index(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+    // Only one thread records so a plain compare is enough
+    if(value < atomic_load_explicit(&histogram->min, memory_order_relaxed))
+    {
+        atomic_store_explicit(&histogram->min, value, memory_order_relaxed);
+    }
+    if(value > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+    }
+}
+void phev_histogram_merge(phevHistogram_t * into, const phevHistogram_t * from)
+{
+    uint64_t count = phev_histogram_count(from);
+
+    if(into == NULL || count == 0)
+    {
+        return;
+    }
+    for(int i = 0; i < PHEV_HISTOGRAM_BUCKETS; i++)
+    {
+        uint32_t num = atomic_load_explicit((atomic_uint *) &from->counts[i], memory_order_relaxed);
+
+        if(num)
+        {
+            atomic_fetch_add_explicit(&into->counts[i], num, memory_order_relaxed);
+        }
+    }
+    atomic_fetch_add_explicit(&into->total, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&into->sum, atomic_load_explicit((_Atomic uint64_t *) &from->sum, memory_order_relaxed), memory_order_relaxed);
+
+    uint64_t min = phev_histogram_min(from);
+    uint64_t max = phev_histogram_max(from);
+
+    if(min < atomic_load_explicit(&into->min, memory_order_relaxed))
+    {
+        atomic_store_explicit(&into->min, min, memory_order_relaxed);
+    }
+    if(max > atomic_load_explicit(&into->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&into->max, max, memory_order_relaxed);
+    }
+}
+uint64_t phev_histogram_count(const phevHistogram_t * histogram)
+{
+    return (histogram ? atomic_load_explicit((_Atomic uint64_t *) &histogram->total, memory_order_relaxed) : 0);
+}
+uint64_t phev_histogram_min(const phevHistogram_t * histogram)
+{
+    if(phev_histogram_count(histogram) == 0)
+    {
+        return 0;
+    }
+    return atomic_load_explicit((_Atomic uint64_t *) &histogram->min, memory_order_relaxed);
+}
+uint64_t phev_histogram_max(const phevHistogram_t * histogram)
+{
+    return (histogram ? atomic_load_explicit((_Atomic uint64_t *) &histogram->max, memory_order_relaxed) : 0);
+}
+double phev_histogram_mean(const phevHistogram_t * histogram)
+{
+    uint64_t count = phev_histogram_count(histogram);
+
+    if(count == 0)
+    {
+        return 0;
+    }
+    return (double) atomic_load_explicit((_Atomic uint64_t *) &histogram->sum, memory_order_relaxed) / (double) count;
+}
+uint64_t phev_histogram_percentile(const phevHistogram_t * histogram, double percentile)
+{
+    uint64_t count = phev_histogram_count(histogram);
+
+    if(count == 0)
+    {
+        return 0;
+    }
+    if(percentile > 100)
+    {
+        percentile = 100;
+    }
+
+    uint64_t target = (uint64_t) ((percentile / 100.0) * (double) count + 0.5);
+    uint64_t seen = 0;
+
+    if(target == 0)
+    {
+        target = 1;
+    }
+    for(int i = 0; i < PHEV_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit((atomic_uint *) &histogram->counts[i], memory_order_relaxed);
+
+        if(seen >= target)
+        {
+            uint64_t highest = phev_histogram_highest(i);
+            uint64_t max = phev_histogram_max(histogram);
+
+            return (highest < max ? highest : max);
+        }
+    }
+    return phev_histogram_max(histogram);
+}
+int phev_histogram_nextBucket(const phevHistogram_t * histogram, int index, uint64_t * highest, uint32_t * count)
+{
+    if(histogram == NULL || index < 0)
+    {
+        return -1;
+    }
+    for(int i = index; i < PHEV_HISTOGRAM_BUCKETS; i++)
+    {
+        uint32_t num = atomic_load_explicit((atomic_uint *) &histogram->counts[i], memory_order_relaxed);
+
+        if(num)
+        {
+            *highest = phev_histogram_highest(i);
+            *count = num;
+            return i + 1;
+        }
+    }
+    return -1;
+}
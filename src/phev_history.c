@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <string.h>
+#include "phev_history.h"
+#include "phev_alloc.h"
+#include "phev_core.h"
+#include "phev_log.h"
+
+const static char *TAG = "PHEV_HISTORY";
+
+phevHistory_t * phev_history_create(phevHistorySettings_t settings)
+{
+    LOG_V(TAG, "START - create");
+
+    size_t numberOfRings = (settings.registers ? settings.numberOfRegisters : 256);
+
+    if(settings.depth == 0 || numberOfRings == 0)
+    {
+        LOG_W(TAG,"History depth or registers not set");
+        return NULL;
+    }
+
+    phevHistory_t * history = phev_malloc(sizeof(phevHistory_t));
+
+    if(history == NULL)
+    {
+        LOG_E(TAG,"Cannot allocate history");
+        return NULL;
+    }
+
+    history->depth = settings.depth;
+    history->ringStorage = phev_calloc(numberOfRings, sizeof(phevHistoryRing_t));
+    history->entryStorage = phev_calloc(numberOfRings * settings.depth, sizeof(phevHistoryEntry_t));
+
+    if(history->ringStorage == NULL || history->entryStorage == NULL)
+    {
+        LOG_E(TAG,"Cannot allocate history for %zu registers depth %zu",numberOfRings,settings.depth);
+        phev_free(history->ringStorage);
+        phev_free(history->entryStorage);
+        phev_free(history);
+        return NULL;
+    }
+
+    for(int i = 0; i < 256; i++)
+    {
+        history->rings[i] = NULL;
+    }
+
+    for(size_t i = 0; i < numberOfRings; i++)
+    {
+        uint8_t reg = (settings.registers ? settings.registers[i] : (uint8_t) i);
+        phevHistoryRing_t * ring = &history->ringStorage[i];
+
+        ring->entries = &history->entryStorage[i * settings.depth];
+        ring->head = 0;
+        ring->count = 0;
+        atomic_init(&ring->sequence, 0);
+
+        history->rings[reg] = ring;
+    }
+
+    LOG_I(TAG,"History created for %zu registers depth %zu",numberOfRings,settings.depth);
+    LOG_V(TAG, "END - create");
+
+    return history;
+}
+void phev_history_destroy(phevHistory_t * history)
+{
+    if(history)
+    {
+        phev_free(history->entryStorage);
+        phev_free(history->ringStorage);
+        phev_free(history);
+    }
+}
+bool phev_history_isTracked(const phevHistory_t * history, uint8_t reg)
+{
+    return history != NULL && history->rings[reg] != NULL;
+}
+static const phevHistoryEntry_t * phev_history_entry(const phevHistory_t * history, const phevHistoryRing_t * ring, size_t index)
+{
+    // index 0 is the oldest entry still held
+    size_t start = (ring->head + history->depth - ring->count) % history->depth;
+
+    return &ring->entries[(start + index) % history->depth];
+}
+static uint32_t phev_history_beginRead(const phevHistoryRing_t * ring)
+{
+    uint32_t sequence;
+
+    do
+    {
+        sequence = atomic_load_explicit((atomic_uint *) &ring->sequence, memory_order_acquire);
+    } while(sequence & 1);
+
+    return sequence;
+}
+static bool phev_history_endRead(const phevHistoryRing_t * ring, uint32_t sequence)
+{
+    atomic_thread_fence(memory_order_acquire);
+
+    return atomic_load_explicit((atomic_uint *) &ring->sequence, memory_order_relaxed) == sequence;
+}
+bool phev_history_record(phevHistory_t * history, uint8_t reg, const uint8_t * data, size_t length, uint64_t timestamp)
+{
+    LOG_V(TAG, "START - record");
+
+    if(!phev_history_isTracked(history, reg) || data == NULL)
+    {
+        return false;
+    }
+
+    phevHistoryRing_t * ring = history->rings[reg];
+    size_t stored = (length > PHEV_HISTORY_MAX_DATA ? PHEV_HISTORY_MAX_DATA : length);
+
+    if(ring->count > 0)
+    {
+        const phevHistoryEntry_t * newest = phev_history_entry(history, ring, ring->count - 1);
+
+        if(newest->length == stored && memcmp(newest->data, data, stored) == 0)
+        {
+            LOG_D(TAG,"Register %02X not changed",reg);
+            return false;
+        }
+    }
+
+    phevHistoryEntry_t * entry = &ring->entries[ring->head];
+
+    atomic_fetch_add_explicit(&ring->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    entry->timestamp = timestamp;
+    entry->length = (uint8_t) stored;
+    memcpy(entry->data, data, stored);
+
+    ring->head = (ring->head + 1) % history->depth;
+    if(ring->count < history->depth)
+    {
+        ring->count++;
+    }
+    atomic_fetch_add_explicit(&ring->sequence, 1, memory_order_release);
+
+    LOG_V(TAG, "END - record");
+
+    return true;
+}
+size_t phev_history_count(const phevHistory_t * history, uint8_t reg)
+{
+    if(!phev_history_isTracked(history, reg))
+    {
+        return 0;
+    }
+
+    const phevHistoryRing_t * ring = history->rings[reg];
+    uint32_t sequence;
+    size_t count;
+
+    do
+    {
+        sequence = phev_history_beginRead(ring);
+        count = ring->count;
+    } while(!phev_history_endRead(ring, sequence));
+
+    return count;
+}
+size_t phev_history_latest(const phevHistory_t * history, uint8_t reg, size_t n, phevHistoryEntry_t * out)
+{
+    if(!phev_history_isTracked(history, reg) || out == NULL)
+    {
+        return 0;
+    }
+
+    const phevHistoryRing_t * ring = history->rings[reg];
+    uint32_t sequence;
+    size_t num;
+
+    do
+    {
+        sequence = phev_history_beginRead(ring);
+        num = (n < ring->count ? n : ring->count);
+
+        size_t first = ring->count - num;
+
+        for(size_t i = 0; i < num; i++)
+        {
+            out[i] = *phev_history_entry(history, ring, first + i);
+        }
+    } while(!phev_history_endRead(ring, sequence));
+
+    return num;
+}
+size_t phev_history_range(const phevHistory_t * history, uint8_t reg, uint64_t from, uint64_t to, phevHistoryEntry_t * out, size_t max)
+{
+    if(!phev_history_isTracked(history, reg) || out == NULL)
+    {
+        return 0;
+    }
+
+    const phevHistoryRing_t * ring = history->rings[reg];
+    uint32_t sequence;
+    size_t num;
+
+    do
+    {
+        sequence = phev_history_beginRead(ring);
+        num = 0;
+
+        for(size_t i = 0; i < ring->count && num < max; i++)
+        {
+            const phevHistoryEntry_t * entry = phev_history_entry(history, ring, i);
+
+            if(entry->timestamp > to)
+            {
+                break;
+            }
+            if(entry->timestamp >= from)
+            {
+                out[num++] = *entry;
+            }
+        }
+    } while(!phev_history_endRead(ring, sequence));
+
+    return num;
+}
+size_t phev_history_downsample(const phevHistory_t * history, uint8_t reg, uint64_t from, uint64_t to, uint64_t interval, phevHistoryEntry_t * out, size_t max)
+{
+    if(interval == 0)
+    {
+        return phev_history_range(history, reg, from, to, out, max);
+    }
+    if(!phev_history_isTracked(history, reg) || out == NULL)
+    {
+        return 0;
+    }
+
+    const phevHistoryRing_t * ring = history->rings[reg];
+    uint32_t sequence;
+    size_t num;
+
+    do
+    {
+        sequence = phev_history_beginRead(ring);
+        num = 0;
+
+        uint64_t bucket = 0;
+
+        // Keeps the last value seen in each interval wide bucket
+        for(size_t i = 0; i < ring->count; i++)
+        {
+            const phevHistoryEntry_t * entry = phev_history_entry(history, ring, i);
+
+            if(entry->timestamp > to)
+            {
+                break;
+            }
+            if(entry->timestamp < from)
+            {
+                continue;
+            }
+
+            uint64_t entryBucket = (entry->timestamp - from) / interval;
+
+            if(num > 0 && entryBucket == bucket)
+            {
+                out[num - 1] = *entry;
+                continue;
+            }
+            if(num == max)
+            {
+                break;
+            }
+            out[num++] = *entry;
+            bucket = entryBucket;
+        }
+    } while(!phev_history_endRead(ring, sequence));
+
+    return num;
+}
+void phev_history_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx)
+{
+    phev_history_record((phevHistory_t *) ctx, reg, data, length, phev_core_monotonicMs());
+}
@@ -0,0 +1,494 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phev_journal.h"
+#include "phev_alloc.h"
+#include "phev_log.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#define PHEV_JOURNAL_THREADS
+#endif
+
+const static char *TAG = "PHEV_JOURNAL";
+
+#define PHEV_JOURNAL_HEADER_SIZE 8
+#define PHEV_JOURNAL_RECORD_HEADER_SIZE 10
+#define PHEV_JOURNAL_BATCH_SIZE (PHEV_JOURNAL_QUEUE_SIZE * (PHEV_JOURNAL_RECORD_HEADER_SIZE + PHEV_JOURNAL_MAX_DATA))
+
+typedef void (* phevJournalRecordHandler_t)(const phevJournalRecord_t * record, void * ctx);
+
+static void phev_journal_putUint32(uint8_t * out, uint32_t value)
+{
+    for(int i = 0; i < 4; i++)
+    {
+        out[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+static uint32_t phev_journal_getUint32(const uint8_t * in)
+{
+    uint32_t value = 0;
+
+    for(int i = 0; i < 4; i++)
+    {
+        value |= ((uint32_t) in[i]) << (i * 8);
+    }
+    return value;
+}
+static size_t phev_journal_encode(const phevJournalRecord_t * record, uint8_t * out)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        out[i] = (record->timestamp >> (i * 8)) & 0xff;
+    }
+    out[8] = record->reg;
+    out[9] = record->length;
+    memcpy(out + PHEV_JOURNAL_RECORD_HEADER_SIZE, record->data, record->length);
+
+    return PHEV_JOURNAL_RECORD_HEADER_SIZE + record->length;
+}
+// Returns the offset just past the last complete record, or -1 when the file has no valid header.
+static long phev_journal_read(FILE * file, phevJournalRecordHandler_t handler, void * ctx)
+{
+    uint8_t header[PHEV_JOURNAL_HEADER_SIZE];
+    uint8_t recordHeader[PHEV_JOURNAL_RECORD_HEADER_SIZE];
+    phevJournalRecord_t record;
+    long end = PHEV_JOURNAL_HEADER_SIZE;
+
+    if(fread(header, 1, sizeof(header), file) != sizeof(header)
+        || phev_journal_getUint32(header) != PHEV_JOURNAL_MAGIC
+        || phev_journal_getUint32(header + 4) != PHEV_JOURNAL_VERSION)
+    {
+        return -1;
+    }
+
+    while(fread(recordHeader, 1, sizeof(recordHeader), file) == sizeof(recordHeader))
+    {
+        record.timestamp = 0;
+        for(int i = 0; i < 8; i++)
+        {
+            record.timestamp |= ((uint64_t) recordHeader[i]) << (i * 8);
+        }
+        record.reg = recordHeader[8];
+        record.length = recordHeader[9];
+
+        if(record.length > PHEV_JOURNAL_MAX_DATA || fread(record.data, 1, record.length, file) != record.length)
+        {
+            LOG_W(TAG,"Journal ends with an incomplete record at %ld",end);
+            break;
+        }
+        handler(&record, ctx);
+        end += PHEV_JOURNAL_RECORD_HEADER_SIZE + record.length;
+    }
+    return end;
+}
+typedef struct phevJournalReplay_t {
+    uint64_t until;
+    phevModel_t * model;
+    int applied;
+} phevJournalReplay_t;
+
+static void phev_journal_replayRecord(const phevJournalRecord_t * record, void * ctx)
+{
+    phevJournalReplay_t * replay = ctx;
+
+    if(record->timestamp <= replay->until && record->length > 0)
+    {
+        phev_model_setRegister(replay->model, record->reg, record->data, record->length);
+        replay->applied++;
+    }
+}
+int phev_journal_replay(const char * path, uint64_t until, phevModel_t * model)
+{
+    LOG_V(TAG,"START - replay");
+
+    FILE * file = fopen(path, "rb");
+
+    if(file == NULL)
+    {
+        LOG_E(TAG,"Cannot open journal %s",path);
+        return -1;
+    }
+
+    phevJournalReplay_t replay = {
+        .until = until,
+        .model = model,
+        .applied = 0,
+    };
+
+    long end = phev_journal_read(file, phev_journal_replayRecord, &replay);
+
+    fclose(file);
+
+    if(end < 0)
+    {
+        LOG_E(TAG,"Journal %s has no valid header",path);
+        return -1;
+    }
+
+    LOG_V(TAG,"END - replay");
+
+    return replay.applied;
+}
+
+#ifdef PHEV_JOURNAL_THREADS
+
+struct phevJournal_t {
+    char * path;
+    int fd;
+    uint32_t flushIntervalMs;
+    size_t compactBytes;
+    size_t fileSize;
+    phevJournalRecord_t queue[PHEV_JOURNAL_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_uint written;
+    atomic_uint dropped;
+    atomic_uint compactions;
+    atomic_bool running;
+    // Writer thread only
+    phevJournalRecord_t latest[256];
+    uint8_t batch[PHEV_JOURNAL_BATCH_SIZE];
+    pthread_t writer;
+};
+
+static void phev_journal_sleepMs(uint32_t ms)
+{
+    struct timespec ts = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (long) (ms % 1000) * 1000000L,
+    };
+    nanosleep(&ts, NULL);
+}
+static uint64_t phev_journal_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000ULL + (uint64_t) ts.tv_nsec / 1000000ULL;
+}
+static bool phev_journal_writeAll(int fd, const uint8_t * data, size_t length)
+{
+    while(length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+
+        if(n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        length -= (size_t) n;
+    }
+    return true;
+}
+static int phev_journal_create(const char * path)
+{
+    uint8_t header[PHEV_JOURNAL_HEADER_SIZE];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    if(fd < 0)
+    {
+        return -1;
+    }
+    phev_journal_putUint32(header, PHEV_JOURNAL_MAGIC);
+    phev_journal_putUint32(header + 4, PHEV_JOURNAL_VERSION);
+
+    if(!phev_journal_writeAll(fd, header, sizeof(header)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+static void phev_journal_compact(phevJournal_t * journal)
+{
+    LOG_V(TAG,"START - compact");
+
+    size_t length = strlen(journal->path) + sizeof(".compact");
+    char * tmpPath = phev_malloc(length);
+
+    snprintf(tmpPath, length, "%s.compact", journal->path);
+
+    int fd = phev_journal_create(tmpPath);
+
+    if(fd < 0)
+    {
+        LOG_E(TAG,"Cannot create %s",tmpPath);
+        phev_free(tmpPath);
+        return;
+    }
+
+    size_t size = PHEV_JOURNAL_HEADER_SIZE;
+    size_t pos = 0;
+    bool ok = true;
+
+    for(int reg = 0; reg < 256 && ok; reg++)
+    {
+        if(journal->latest[reg].length == 0)
+        {
+            continue;
+        }
+        if(pos + PHEV_JOURNAL_RECORD_HEADER_SIZE + PHEV_JOURNAL_MAX_DATA > sizeof(journal->batch))
+        {
+            ok = phev_journal_writeAll(fd, journal->batch, pos);
+            size += pos;
+            pos = 0;
+        }
+        pos += phev_journal_encode(&journal->latest[reg], journal->batch + pos);
+    }
+    ok = ok && phev_journal_writeAll(fd, journal->batch, pos) && fsync(fd) == 0;
+    size += pos;
+
+    if(!ok || rename(tmpPath, journal->path) != 0)
+    {
+        LOG_E(TAG,"Journal compaction failed, keeping %s",journal->path);
+        close(fd);
+        unlink(tmpPath);
+        phev_free(tmpPath);
+        return;
+    }
+
+    close(journal->fd);
+    journal->fd = fd;
+    journal->fileSize = size;
+    atomic_fetch_add_explicit(&journal->compactions, 1, memory_order_relaxed);
+    phev_free(tmpPath);
+
+    LOG_I(TAG,"Journal compacted to %zu bytes",size);
+    LOG_V(TAG,"END - compact");
+}
+static bool phev_journal_drain(phevJournal_t * journal)
+{
+    unsigned int head = atomic_load_explicit(&journal->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&journal->tail, memory_order_acquire);
+    size_t pos = 0;
+
+    if(head == tail)
+    {
+        return false;
+    }
+
+    while(head != tail)
+    {
+        const phevJournalRecord_t * record = &journal->queue[head % PHEV_JOURNAL_QUEUE_SIZE];
+
+        journal->latest[record->reg] = *record;
+        pos += phev_journal_encode(record, journal->batch + pos);
+        head++;
+    }
+    atomic_store_explicit(&journal->head, head, memory_order_release);
+
+    if(phev_journal_writeAll(journal->fd, journal->batch, pos))
+    {
+        journal->fileSize += pos;
+    }
+    else
+    {
+        LOG_E(TAG,"Cannot write %zu bytes to journal",pos);
+    }
+
+    if(journal->compactBytes > 0 && journal->fileSize > journal->compactBytes)
+    {
+        phev_journal_compact(journal);
+    }
+    atomic_store_explicit(&journal->written, head, memory_order_release);
+
+    return true;
+}
+static void * phev_journal_writer(void * arg)
+{
+    phevJournal_t * journal = arg;
+
+    while(atomic_load_explicit(&journal->running, memory_order_acquire))
+    {
+        phev_journal_drain(journal);
+        phev_journal_sleepMs(journal->flushIntervalMs);
+    }
+    phev_journal_drain(journal);
+
+    return NULL;
+}
+static void phev_journal_loadLatest(const phevJournalRecord_t * record, void * ctx)
+{
+    phevJournal_t * journal = ctx;
+
+    journal->latest[record->reg] = *record;
+}
+phevJournal_t * phev_journal_open(phevJournalSettings_t settings)
+{
+    LOG_V(TAG,"START - open");
+
+    if(settings.path == NULL)
+    {
+        LOG_E(TAG,"No journal path");
+        return NULL;
+    }
+
+    phevJournal_t * journal = phev_calloc(1, sizeof(phevJournal_t));
+
+    if(journal == NULL)
+    {
+        LOG_E(TAG,"Cannot allocate journal");
+        return NULL;
+    }
+
+    journal->path = phev_strdup(settings.path);
+    journal->flushIntervalMs = (settings.flushIntervalMs ? settings.flushIntervalMs : PHEV_JOURNAL_DEFAULT_FLUSH_MS);
+    journal->compactBytes = (settings.compactBytes ? settings.compactBytes : PHEV_JOURNAL_DEFAULT_COMPACT_BYTES);
+    atomic_init(&journal->head, 0);
+    atomic_init(&journal->tail, 0);
+    atomic_init(&journal->written, 0);
+    atomic_init(&journal->dropped, 0);
+    atomic_init(&journal->compactions, 0);
+    atomic_init(&journal->running, true);
+
+    FILE * existing = fopen(settings.path, "rb");
+    long end = -1;
+
+    if(existing)
+    {
+        end = phev_journal_read(existing, phev_journal_loadLatest, journal);
+        fclose(existing);
+    }
+
+    if(end < 0)
+    {
+        journal->fd = phev_journal_create(settings.path);
+        journal->fileSize = PHEV_JOURNAL_HEADER_SIZE;
+    }
+    else
+    {
+        // Drop a torn record left by a crash so new records follow a complete one
+        journal->fd = open(settings.path, O_WRONLY | O_APPEND);
+        if(journal->fd >= 0 && ftruncate(journal->fd, end) != 0)
+        {
+            LOG_W(TAG,"Cannot truncate journal %s to %ld",settings.path,end);
+        }
+        journal->fileSize = (size_t) end;
+    }
+
+    if(journal->fd < 0)
+    {
+        LOG_E(TAG,"Cannot open journal %s",settings.path);
+        phev_free(journal->path);
+        phev_free(journal);
+        return NULL;
+    }
+
+    if(pthread_create(&journal->writer, NULL, phev_journal_writer, journal) != 0)
+    {
+        LOG_E(TAG,"Cannot start journal writer");
+        close(journal->fd);
+        phev_free(journal->path);
+        phev_free(journal);
+        return NULL;
+    }
+
+    LOG_I(TAG,"Journal %s opened at %zu bytes",settings.path,journal->fileSize);
+    LOG_V(TAG,"END - open");
+
+    return journal;
+}
+void phev_journal_close(phevJournal_t * journal)
+{
+    if(journal == NULL)
+    {
+        return;
+    }
+    atomic_store_explicit(&journal->running, false, memory_order_release);
+    pthread_join(journal->writer, NULL);
+    fsync(journal->fd);
+    close(journal->fd);
+    phev_free(journal->path);
+    phev_free(journal);
+}
+bool phev_journal_append(phevJournal_t * journal, uint8_t reg, const uint8_t * data, size_t length, uint64_t timestamp)
+{
+    if(journal == NULL || data == NULL)
+    {
+        return false;
+    }
+
+    unsigned int tail = atomic_load_explicit(&journal->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&journal->head, memory_order_acquire);
+
+    if(tail - head >= PHEV_JOURNAL_QUEUE_SIZE || length > PHEV_JOURNAL_MAX_DATA)
+    {
+        atomic_fetch_add_explicit(&journal->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    phevJournalRecord_t * record = &journal->queue[tail % PHEV_JOURNAL_QUEUE_SIZE];
+
+    record->timestamp = timestamp;
+    record->reg = reg;
+    record->length = (uint8_t) length;
+    memcpy(record->data, data, length);
+
+    atomic_store_explicit(&journal->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+void phev_journal_flush(phevJournal_t * journal)
+{
+    if(journal == NULL)
+    {
+        return;
+    }
+
+    unsigned int tail = atomic_load_explicit(&journal->tail, memory_order_acquire);
+
+    // Once the writer has stopped nothing more will be written, so there is nothing to wait for
+    while((int) (atomic_load_explicit(&journal->written, memory_order_acquire) - tail) < 0
+        && atomic_load_explicit(&journal->running, memory_order_acquire))
+    {
+        phev_journal_sleepMs(1);
+    }
+}
+uint32_t phev_journal_dropped(const phevJournal_t * journal)
+{
+    return atomic_load_explicit((atomic_uint *) &journal->dropped, memory_order_relaxed);
+}
+uint32_t phev_journal_compactions(const phevJournal_t * journal)
+{
+    return atomic_load_explicit((atomic_uint *) &journal->compactions, memory_order_relaxed);
+}
+void phev_journal_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx)
+{
+    phev_journal_append((phevJournal_t *) ctx, reg, data, length, phev_journal_now());
+}
+
+#else
+
+phevJournal_t * phev_journal_open(phevJournalSettings_t settings)
+{
+    LOG_W(TAG,"Journal is not supported on this platform");
+    return NULL;
+}
+void phev_journal_close(phevJournal_t * journal)
+{
+}
+bool phev_journal_append(phevJournal_t * journal, uint8_t reg, const uint8_t * data, size_t length, uint64_t timestamp)
+{
+    return false;
+}
+void phev_journal_flush(phevJournal_t * journal)
+{
+}
+uint32_t phev_journal_dropped(const phevJournal_t * journal)
+{
+    return 0;
+}
+uint32_t phev_journal_compactions(const phevJournal_t * journal)
+{
+    return 0;
+}
+void phev_journal_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx)
+{
+}
+
+#endif
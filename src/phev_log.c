@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include "phev_log.h"
+#include "phev_core.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#include <pthread.h>
+#define PHEV_LOG_THREADS
+#endif
+
+typedef struct phevLogSlot_t {
+    atomic_size_t sequence;
+    const char * tag;
+    uint16_t length;
+    uint8_t data[PHEV_LOG_MAX_FRAME];
+} phevLogSlot_t;
+
+static _Atomic(phevLogSink_t) logSink = NULL;
+static atomic_uint logDropped = 0;
+static atomic_bool logRunning = false;
+static phevLogSlot_t * logRing = NULL;
+static atomic_size_t logEnqueue = 0;
+static atomic_size_t logDequeue = 0;
+#ifdef PHEV_LOG_THREADS
+static pthread_t logThread;
+#endif
+
+static void phev_log_deliver(phevLogSink_t sink, const char * tag, const uint8_t * data, size_t length)
+{
+    uint8_t decoded[PHEV_LOG_MAX_FRAME];
+    size_t decodedLength = phev_core_decodeFrame(data, length, decoded);
+
+    sink(tag, data, (decodedLength > 0 ? decoded : NULL), length);
+}
+void phev_log_setSink(phevLogSink_t sink)
+{
+    atomic_store(&logSink, sink);
+}
+bool phev_log_hasSink(void)
+{
+    return atomic_load_explicit(&logSink, memory_order_relaxed) != NULL;
+}
+uint32_t phev_log_dropped(void)
+{
+    return atomic_load_explicit(&logDropped, memory_order_relaxed);
+}
+// Bounded multi producer queue, each slot's sequence says whose turn it is
+static bool phev_log_push(const char * tag, const uint8_t * data, size_t length)
+{
+    size_t pos = atomic_load_explicit(&logEnqueue, memory_order_relaxed);
+
+    for (;;)
+    {
+        phevLogSlot_t * slot = &logRing[pos % PHEV_LOG_RING_SIZE];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&logEnqueue, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                slot->tag = tag;
+                slot->length = (uint16_t) length;
+                memcpy(slot->data, data, length);
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&logEnqueue, memory_order_relaxed);
+        }
+    }
+}
+static bool phev_log_pop(phevLogSink_t sink)
+{
+    size_t pos = atomic_load_explicit(&logDequeue, memory_order_relaxed);
+    phevLogSlot_t * slot = &logRing[pos % PHEV_LOG_RING_SIZE];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+    if ((intptr_t) sequence - (intptr_t) (pos + 1) < 0)
+    {
+        return false;
+    }
+
+    if (sink)
+    {
+        phev_log_deliver(sink, slot->tag, slot->data, slot->length);
+    }
+    atomic_store_explicit(&logDequeue, pos + 1, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, pos + PHEV_LOG_RING_SIZE, memory_order_release);
+
+    return true;
+}
+void phev_log_frame(const char * tag, const uint8_t * data, size_t length)
+{
+    phevLogSink_t sink = atomic_load(&logSink);
+
+    if (sink == NULL || data == NULL || length == 0)
+    {
+        return;
+    }
+    if (length > PHEV_LOG_MAX_FRAME)
+    {
+        length = PHEV_LOG_MAX_FRAME;
+    }
+    if (!atomic_load_explicit(&logRunning, memory_order_acquire))
+    {
+        phev_log_deliver(sink, tag, data, length);
+        return;
+    }
+    if (!phev_log_push(tag, data, length))
+    {
+        atomic_fetch_add_explicit(&logDropped, 1, memory_order_relaxed);
+    }
+}
+#ifdef PHEV_LOG_THREADS
+static void * phev_log_consumer(void * arg)
+{
+    const struct timespec idle = {
+        .tv_sec = 0,
+        .tv_nsec = 1000000L,
+    };
+
+    while (atomic_load_explicit(&logRunning, memory_order_acquire))
+    {
+        if (!phev_log_pop(atomic_load(&logSink)))
+        {
+            nanosleep(&idle, NULL);
+        }
+    }
+    while (phev_log_pop(atomic_load(&logSink)));
+
+    return NULL;
+}
+bool phev_log_start(void)
+{
+    if (atomic_load(&logRunning))
+    {
+        return true;
+    }
+    if (logRing == NULL)
+    {
+        // Kept for the life of the process, so not through an allocator that can be swapped
+        logRing = malloc(sizeof(phevLogSlot_t) * PHEV_LOG_RING_SIZE);
+        if (logRing == NULL)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < PHEV_LOG_RING_SIZE; i++)
+        {
+            atomic_init(&logRing[i].sequence, i);
+        }
+        atomic_store(&logEnqueue, 0);
+        atomic_store(&logDequeue, 0);
+    }
+    atomic_store(&logRunning, true);
+
+    if (pthread_create(&logThread, NULL, phev_log_consumer, NULL) != 0)
+    {
+        atomic_store(&logRunning, false);
+        return false;
+    }
+    return true;
+}
+void phev_log_stop(void)
+{
+    if (atomic_exchange(&logRunning, false))
+    {
+        pthread_join(logThread, NULL);
+    }
+}
+#else
+bool phev_log_start(void)
+{
+    return false;
+}
+void phev_log_stop(void)
+{
+}
+#endif
+static void phev_log_hexdump(const char * tag, const uint8_t * buffer, size_t length)
+{
+    char out[17];
+    size_t i;
+
+    printf("%s: ", tag);
+    for (i = 0; i < length; i++)
+    {
+        printf("%02x ", buffer[i]);
+        out[i % 16] = (isprint(buffer[i]) ? buffer[i] : '.');
+        if ((i + 1) % 8 == 0)
+        {
+            printf(" ");
+        }
+        if ((i + 1) % 16 == 0)
+        {
+            out[16] = '\0';
+            printf(" | %s |\n%s: ", out, tag);
+        }
+    }
+    if (i % 16 != 0)
+    {
+        out[i % 16] = '\0';
+        printf("%*s | %s |", (int) ((16 - (i % 16)) * 3 + ((i % 16) < 8 ? 1 : 0)), "", out);
+    }
+    printf("\n");
+}
+void phev_log_stdoutSink(const char * tag, const uint8_t * data, const uint8_t * decoded, size_t length)
+{
+    phev_log_hexdump(tag, data, length);
+    if (decoded)
+    {
+        printf("%s DECODED\n", tag);
+        phev_log_hexdump(tag, decoded, length);
+    }
+}
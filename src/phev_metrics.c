@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include "phev_metrics.h"
+
+typedef struct phevMetricsInfo_t {
+    const char * name;
+    const char * help;
+} phevMetricsInfo_t;
+
+static const phevMetricsInfo_t phev_metrics_info[PHEV_METRIC_MAX] = {
+    [PHEV_METRIC_BYTES_IN] = {"phev_bytes_in_total", "Bytes read from the car"},
+    [PHEV_METRIC_BYTES_OUT] = {"phev_bytes_out_total", "Bytes sent to the car"},
+    [PHEV_METRIC_DECODE_FAILURES] = {"phev_decode_failures_total", "Frames that could not be decoded"},
+    [PHEV_METRIC_CHECKSUM_FAILURES] = {"phev_checksum_failures_total", "Frames with a bad checksum"},
+    [PHEV_METRIC_XOR_RESYNCS] = {"phev_xor_resyncs_total", "Key changes sent by the car"},
+    [PHEV_METRIC_XOR_FALLBACKS] = {"phev_xor_fallbacks_total", "Frames the tracked key did not fit"},
+    [PHEV_METRIC_FILTERED] = {"phev_filtered_duplicates_total", "Register updates dropped as unchanged"},
+    [PHEV_METRIC_RETRIES] = {"phev_command_retries_total", "Commands resent after a key change"},
+    [PHEV_METRIC_DROPPED_COMMANDS] = {"phev_dropped_commands_total", "Commands dropped as the callback table was full"},
+    [PHEV_METRIC_RECONNECTS] = {"phev_reconnects_total", "Connections restored after being lost"},
+};
+
+typedef struct phevMetricsWriter_t {
+    char * buffer;
+    size_t size;
+    size_t length;
+} phevMetricsWriter_t;
+
+void phev_metrics_init(phevMetrics_t * metrics)
+{
+    for(int i = 0; i < PHEV_METRICS_COMMANDS; i++)
+    {
+        atomic_init(&metrics->framesIn[i], 0);
+        atomic_init(&metrics->framesOut[i], 0);
+    }
+    for(int i = 0; i < PHEV_METRIC_MAX; i++)
+    {
+        atomic_init(&metrics->counters[i], 0);
+    }
+}
+void phev_metrics_add(phevMetrics_t * metrics, phevMetric_t metric, uint64_t value)
+{
+    atomic_fetch_add_explicit(&metrics->counters[metric], value, memory_order_relaxed);
+}
+void phev_metrics_frameIn(phevMetrics_t * metrics, uint8_t command)
+{
+    atomic_fetch_add_explicit(&metrics->framesIn[command], 1, memory_order_relaxed);
+}
+void phev_metrics_frameOut(phevMetrics_t * metrics, uint8_t command, size_t length)
+{
+    atomic_fetch_add_explicit(&metrics->framesOut[command], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics->counters[PHEV_METRIC_BYTES_OUT], length, memory_order_relaxed);
+}
+void phev_metrics_snapshot(const phevMetrics_t * metrics, phevMetricsSnapshot_t * snapshot)
+{
+    phevMetrics_t * m = (phevMetrics_t *) metrics;
+
+    for(int i = 0; i < PHEV_METRICS_COMMANDS; i++)
+    {
+        snapshot->framesIn[i] = atomic_load_explicit(&m->framesIn[i], memory_order_relaxed);
+        snapshot->framesOut[i] = atomic_load_explicit(&m->framesOut[i], memory_order_relaxed);
+    }
+    for(int i = 0; i < PHEV_METRIC_MAX; i++)
+    {
+        snapshot->counters[i] = atomic_load_explicit(&m->counters[i], memory_order_relaxed);
+    }
+}
+static void phev_metrics_write(phevMetricsWriter_t * writer, const char * format, ...)
+{
+    va_list args;
+    size_t room = (writer->length < writer->size ? writer->size - writer->length : 0);
+
+    va_start(args, format);
+    int written = vsnprintf(room ? writer->buffer + writer->length : NULL, room, format, args);
+    va_end(args);
+
+    if(written > 0)
+    {
+        writer->length += (size_t) written;
+    }
+}
+// Label values escape backslash, quote and newline.
+static void phev_metrics_writeLabels(phevMetricsWriter_t * writer, const char * session, int command)
+{
+    bool first = true;
+
+    if(session == NULL && command < 0)
+    {
+        return;
+    }
+    phev_metrics_write(writer, "{");
+
+    if(session)
+    {
+        phev_metrics_write(writer, "session=\"");
+
+        for(const char * c = session; *c; c++)
+        {
+            switch(*c)
+            {
+                case '\\': phev_metrics_write(writer, "\\\\"); break;
+                case '"': phev_metrics_write(writer, "\\\""); break;
+                case '\n': phev_metrics_write(writer, "\\n"); break;
+                default: phev_metrics_write(writer, "%c", *c);
+            }
+        }
+        phev_metrics_write(writer, "\"");
+        first = false;
+    }
+    if(command >= 0)
+    {
+        phev_metrics_write(writer, "%scommand=\"%02x\"", (first ? "" : ","), command);
+    }
+    phev_metrics_write(writer, "}");
+}
+static void phev_metrics_writeFrames(phevMetricsWriter_t * writer, const char * name, const char * help, const uint32_t * frames, const char * session)
+{
+    phev_metrics_write(writer, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+
+    for(int i = 0; i < PHEV_METRICS_COMMANDS; i++)
+    {
+        if(frames[i])
+        {
+            phev_metrics_write(writer, "%s", name);
+            phev_metrics_writeLabels(writer, session, i);
+            phev_metrics_write(writer, " %u\n", frames[i]);
+        }
+    }
+}
+size_t phev_metrics_formatPrometheus(const phevMetricsSnapshot_t * snapshot, const char * session, char * buffer, size_t size)
+{
+    phevMetricsWriter_t writer = {
+        .buffer = buffer,
+        .size = size,
+        .length = 0,
+    };
+
+    if(buffer && size)
+    {
+        buffer[0] = 0;
+    }
+    phev_metrics_writeFrames(&writer, "phev_frames_in_total", "Frames received by command", snapshot->framesIn, session);
+    phev_metrics_writeFrames(&writer, "phev_frames_out_total", "Frames sent by command", snapshot->framesOut, session);
+
+    for(int i = 0; i < PHEV_METRIC_MAX; i++)
+    {
+        const phevMetricsInfo_t * info = &phev_metrics_info[i];
+
+        phev_metrics_write(&writer, "# HELP %s %s\n# TYPE %s counter\n%s", info->name, info->help, info->name, info->name);
+        phev_metrics_writeLabels(&writer, session, -1);
+        phev_metrics_write(&writer, " %llu\n", (unsigned long long) snapshot->counters[i]);
+    }
+    return writer.length;
+}
@@ -1,40 +1,149 @@
 #include <stdlib.h>
 #include "phev_model.h"
-#include "logger.h"
+#include "phev_alloc.h"
+#include "phev_log.h"
 
 const static char * TAG = "PHEV_MODEL";
 
 phevModel_t * phev_model_create(void)
 {
     LOG_V(TAG, "START - create");
-    phevModel_t * model = malloc(sizeof(phevModel_t));
+    phevModel_t * model = phev_malloc(sizeof(phevModel_t));
 
     for(int i=0;i<256;i++)
     {
         model->registers[i] = NULL;
     }
+    for(int i=0;i<2;i++)
+    {
+        model->retired[i].registers = NULL;
+        model->retired[i].count = 0;
+        model->retired[i].size = 0;
+        atomic_init(&model->readers[i], 0);
+    }
+    atomic_init(&model->epoch, 0);
+    atomic_init(&model->version, 0);
+    model->numberOfListeners = 0;
     LOG_I(TAG,"Model created and initialised");
     LOG_V(TAG, "END - createModel");
     return model;
 }
+static void phev_model_freeRetired(phevModelRetired_t * retired)
+{
+    for(size_t i=0;i<retired->count;i++)
+    {
+        phev_free(retired->registers[i]);
+    }
+    retired->count = 0;
+}
+void phev_model_destroy(phevModel_t * model)
+{
+    if(model == NULL)
+    {
+        return;
+    }
+    for(int i=0;i<256;i++)
+    {
+        phev_free(model->registers[i]);
+    }
+    for(int i=0;i<2;i++)
+    {
+        phev_model_freeRetired(&model->retired[i]);
+        phev_free(model->retired[i].registers);
+    }
+    phev_free(model);
+}
+static void phev_model_retire(phevModel_t * model, phevRegister_t * old)
+{
+    unsigned epoch = atomic_load_explicit(&model->epoch, memory_order_relaxed);
+
+    // Pairs with the fence in enterRead, a reader not counted yet can only peek the new register
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if(atomic_load_explicit(&model->readers[0], memory_order_acquire) == 0 && atomic_load_explicit(&model->readers[1], memory_order_acquire) == 0)
+    {
+        phev_model_freeRetired(&model->retired[0]);
+        phev_model_freeRetired(&model->retired[1]);
+        phev_free(old);
+        return;
+    }
+    if(old)
+    {
+        phevModelRetired_t * retired = &model->retired[epoch];
+
+        if(retired->count == retired->size)
+        {
+            size_t size = retired->size ? retired->size * 2 : 16;
+            phevRegister_t ** registers = phev_realloc(retired->registers, size * sizeof(phevRegister_t *));
+
+            if(registers == NULL)
+            {
+                LOG_E(TAG,"Cannot retire register, a reader may still have it so it is not freed");
+                return;
+            }
+            retired->registers = registers;
+            retired->size = size;
+        }
+        retired->registers[retired->count++] = old;
+    }
+
+    // Readers of the other epoch entered before anything in its list was replaced, once they are gone move on to it
+    if(atomic_load_explicit(&model->readers[epoch ^ 1], memory_order_acquire) == 0)
+    {
+        atomic_store_explicit(&model->epoch, epoch ^ 1, memory_order_seq_cst);
+        phev_model_freeRetired(&model->retired[epoch ^ 1]);
+    }
+}
 
 int phev_model_setRegister(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length)
 {
     LOG_V(TAG, "START - setRegister");
-    phevRegister_t * out = malloc(sizeof(phevRegister_t) + length);
+    phevRegister_t * out = phev_malloc(sizeof(phevRegister_t) + length);
     out->length = length;
     memcpy(out->data,data,length);
+
+    phevRegister_t * old = model->registers[reg];
+
+    atomic_fetch_add_explicit(&model->version, 1, memory_order_acq_rel);
     model->registers[reg] = out;
+    atomic_fetch_add_explicit(&model->version, 1, memory_order_release);
+
+    phev_model_retire(model, old);
+
+    for(int i=0;i<model->numberOfListeners;i++)
+    {
+        model->listeners[i](model, reg, out->data, out->length, model->listenerCtx[i]);
+    }
     LOG_V(TAG, "END - setRegister");
     return 1;
 }
+int phev_model_clearRegister(phevModel_t * model, uint8_t reg)
+{
+    phevRegister_t * old = model->registers[reg];
+
+    if(old == NULL)
+    {
+        return 0;
+    }
+
+    atomic_fetch_add_explicit(&model->version, 1, memory_order_acq_rel);
+    model->registers[reg] = NULL;
+    atomic_fetch_add_explicit(&model->version, 1, memory_order_release);
+
+    phev_model_retire(model, old);
+
+    return 1;
+}
 phevRegister_t * phev_model_getRegister(phevModel_t * model, uint8_t reg)
 {
     phevRegister_t * ret = NULL;
+    uint32_t epoch = 0;
 
     LOG_V(TAG, "START - getRegister");
     if(model)
     {
+        epoch = phev_model_enterRead(model);
+
         phevRegister_t * out = model->registers[reg];
         if(out == NULL)
         {
@@ -46,7 +155,7 @@ phevRegister_t * phev_model_getRegister(phevModel_t * model, uint8_t reg)
                 LOG_D(TAG,"Register data length is zero");
                 goto phev_model_getRegister_end;
             } else {
-                ret = malloc(sizeof(phevRegister_t) + out->length);
+                ret = phev_malloc(sizeof(phevRegister_t) + out->length);
                 if(ret)
                 {
                     memcpy(ret, out, sizeof(phevRegister_t) + out->length);
@@ -63,20 +172,39 @@ phevRegister_t * phev_model_getRegister(phevModel_t * model, uint8_t reg)
         return NULL;
     }
 phev_model_getRegister_end:
+    phev_model_exitRead(model, epoch);
     LOG_V(TAG, "END - getRegister");
     
     return ret;
 }
+const phevRegister_t * phev_model_peekRegister(const phevModel_t * model, uint8_t reg)
+{
+    if(model == NULL)
+    {
+        LOG_E(TAG,"Model is not initialised");
+        return NULL;
+    }
+    const phevRegister_t * out = model->registers[reg];
+
+    if(out == NULL || out->length == 0)
+    {
+        return NULL;
+    }
+    return out;
+}
 int phev_model_compareRegister(phevModel_t * model, uint8_t reg , const uint8_t * data)
 {
     LOG_V(TAG, "START - compareRegister");
     if(model)
     {
-        phevRegister_t * out = phev_model_getRegister(model,reg);
+        int ret = -1;
+        uint32_t epoch = phev_model_enterRead(model);
+
+        const phevRegister_t * out = phev_model_peekRegister(model,reg);
         
         if(out && data)
         {
-            int ret = memcmp(data,out->data,out->length);
+            ret = memcmp(data,out->data,out->length);
 
             LOG_D(TAG,"Comparing register data result %d",ret);
             if(ret == 0)
@@ -86,11 +214,10 @@ int phev_model_compareRegister(phevModel_t * model, uint8_t reg , const uint8_t
                 LOG_BUFFER_HEXDUMP(TAG,data,out->length,LOG_DEBUG);
                 LOG_BUFFER_HEXDUMP(TAG,out->data,out->length,LOG_DEBUG);
             }
-            
-            
-            return ret;
         }
-        return -1;
+        phev_model_exitRead(model, epoch);
+
+        return ret;
     } else {
         LOG_E(TAG,"Model is not initialised");
         return -1;
@@ -98,3 +225,85 @@ int phev_model_compareRegister(phevModel_t * model, uint8_t reg , const uint8_t
     LOG_V(TAG, "END - compareRegister");
     
 }
+int phev_model_addListener(phevModel_t * model, phevModelListener_t listener, void * ctx)
+{
+    LOG_V(TAG, "START - addListener");
+
+    if(model->numberOfListeners >= PHEV_MODEL_MAX_LISTENERS)
+    {
+        LOG_E(TAG,"Cannot add listener max listeners %d reached",PHEV_MODEL_MAX_LISTENERS);
+        return 0;
+    }
+    model->listeners[model->numberOfListeners] = listener;
+    model->listenerCtx[model->numberOfListeners] = ctx;
+    model->numberOfListeners++;
+
+    LOG_V(TAG, "END - addListener");
+    return 1;
+}
+int phev_model_removeListener(phevModel_t * model, phevModelListener_t listener, void * ctx)
+{
+    LOG_V(TAG, "START - removeListener");
+
+    for(int i=0;i<model->numberOfListeners;i++)
+    {
+        if(model->listeners[i] == listener && model->listenerCtx[i] == ctx)
+        {
+            for(int j=i;j<model->numberOfListeners - 1;j++)
+            {
+                model->listeners[j] = model->listeners[j + 1];
+                model->listenerCtx[j] = model->listenerCtx[j + 1];
+            }
+            model->numberOfListeners--;
+
+            LOG_V(TAG, "END - removeListener");
+            return 1;
+        }
+    }
+    LOG_V(TAG, "END - removeListener");
+    return 0;
+}
+uint32_t phev_model_getVersion(const phevModel_t * model)
+{
+    return atomic_load_explicit((atomic_uint *) &model->version, memory_order_acquire);
+}
+uint32_t phev_model_beginRead(const phevModel_t * model)
+{
+    uint32_t version;
+
+    do
+    {
+        version = phev_model_getVersion(model);
+    } while(version & 1);
+
+    return version;
+}
+bool phev_model_endRead(const phevModel_t * model, uint32_t version)
+{
+    atomic_thread_fence(memory_order_acquire);
+
+    return phev_model_getVersion(model) == version;
+}
+uint32_t phev_model_enterRead(const phevModel_t * model)
+{
+    atomic_uint * readers = (atomic_uint *) model->readers;
+
+    for(;;)
+    {
+        uint32_t epoch = atomic_load_explicit((atomic_uint *) &model->epoch, memory_order_acquire);
+
+        atomic_fetch_add_explicit(&readers[epoch], 1, memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        // The writer moved on before it could see us, count against the new epoch
+        if(atomic_load_explicit((atomic_uint *) &model->epoch, memory_order_acquire) == epoch)
+        {
+            return epoch;
+        }
+        atomic_fetch_sub_explicit(&readers[epoch], 1, memory_order_release);
+    }
+}
+void phev_model_exitRead(const phevModel_t * model, uint32_t epoch)
+{
+    atomic_fetch_sub_explicit((atomic_uint *) &model->readers[epoch], 1, memory_order_release);
+}
\ No newline at end of file
@@ -1,7 +1,8 @@
 #include "phev_pipe.h"
 #include "phev_core.h"
+#include "phev_alloc.h"
 #include "msg_utils.h"
-#include "logger.h"
+#include "phev_log.h"
 
 //#define NO_PING
 //#define NO_CMD_RESP
@@ -9,6 +10,56 @@
 
 const static char *APP_TAG = "PHEV_PIPE";
 
+static uint64_t phev_pipe_nowUs(void)
+{
+    return phev_core_monotonicNs() / 1000;
+}
+// Records the time since a start mark and clears the mark, nothing when there is no mark.
+static void phev_pipe_recordSince(phev_pipe_ctx_t *ctx, phevPipeLatency_t latency, uint64_t * since)
+{
+    if (*since)
+    {
+        uint64_t now = phev_pipe_nowUs();
+
+        phev_histogram_record(ctx->latency[latency], now - *since);
+        *since = 0;
+    }
+}
+static void phev_pipe_countOut(phev_pipe_ctx_t *ctx, const message_t *message)
+{
+    if (message && message->length)
+    {
+        phev_metrics_frameOut(&ctx->metrics, message->data[0], message->length);
+    }
+}
+// One record per key that moved away from the value it had before.
+static void phev_pipe_traceXOR(phev_pipe_ctx_t *ctx, uint8_t command, uint8_t current, uint8_t ping, uint8_t commandXOR)
+{
+    if (ctx->currentXOR != current)
+    {
+        PHEV_TRACE(ctx->trace, PHEV_TRACE_XOR_CHANGED, command, 0, ctx->currentXOR, PHEV_TRACE_XOR_CURRENT);
+    }
+    if (ctx->pingXOR != ping)
+    {
+        PHEV_TRACE(ctx->trace, PHEV_TRACE_XOR_CHANGED, command, 0, ctx->pingXOR, PHEV_TRACE_XOR_PING);
+    }
+    if (ctx->commandXOR != commandXOR)
+    {
+        PHEV_TRACE(ctx->trace, PHEV_TRACE_XOR_CHANGED, command, 0, ctx->commandXOR, PHEV_TRACE_XOR_COMMAND);
+    }
+}
+// A frame that will not split out is put down to its checksum when one of the keys it could be under gives a known command.
+static void phev_pipe_countBadFrame(phev_pipe_ctx_t *ctx, const uint8_t *data, size_t length)
+{
+    if (length >= 3 && (phev_core_checkIncomingCommand(data[0]) || phev_core_checkIncomingCommand(data[0] ^ data[2]) || phev_core_checkIncomingCommand(data[0] ^ data[2] ^ 1)))
+    {
+        phev_metrics_add(&ctx->metrics, PHEV_METRIC_CHECKSUM_FAILURES, 1);
+    }
+    else
+    {
+        phev_metrics_add(&ctx->metrics, PHEV_METRIC_DECODE_FAILURES, 1);
+    }
+}
 
 void phev_pipe_resetPing(phev_pipe_ctx_t *ctx)
 {
@@ -27,9 +78,9 @@ void phev_pipe_destroyEvent(phevPipeEvent_t * event)
     {
         if(event->data != NULL)
         {
-            free(event->data);
+            phev_free(event->data);
         }
-        free(event);
+        phev_free(event);
         event = NULL;
     }
 
@@ -48,23 +99,75 @@ void phev_pipe_disconnectOutput(phev_pipe_ctx_t *ctx)
 
     msg_pipe_out_disconnect(ctx->pipe);
 
+    if (ctx->connected && ctx->disconnectedAt == 0)
+    {
+        ctx->disconnectedAt = phev_pipe_nowUs();
+    }
     ctx->connected = false;
 
     phev_pipe_resetPing(ctx);
 
+    uint8_t current = ctx->currentXOR;
+    uint8_t ping = ctx->pingXOR;
+    uint8_t command = ctx->commandXOR;
+
     ctx->currentXOR = 0;
     ctx->pingXOR = 0;
     ctx->commandXOR = 0;
+    ctx->inboundXOR = 0;
+    phev_pipe_traceXOR(ctx, 0, current, ping, command);
     ctx->encrypt = false;
     ctx->pingResponse = 0;
 
     LOG_V(APP_TAG,"END - disconnectOutput");
 }
-void phev_pipe_waitForConnection(phev_pipe_ctx_t *ctx)
+uint32_t phev_pipe_connectBackoff(uint32_t attempts, uint32_t min, uint32_t max, uint32_t random)
 {
-    LOG_V(APP_TAG, "START - waitForConnection");
-    ctx->connected = false;
-    int retries = 0;
+    uint32_t delay = min;
+
+    for (uint32_t i = 0; i < attempts && delay < max; i++)
+    {
+        delay *= 2;
+    }
+    if (delay > max)
+    {
+        delay = max;
+    }
+
+    // Half the delay is fixed and half random so clients that lost the car together do not retry together
+    return delay / 2 + random % (delay / 2 + 1);
+}
+// xorshift32, plenty for spreading retries
+static uint32_t phev_pipe_random(phev_pipe_ctx_t *ctx)
+{
+    uint32_t x = ctx->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ctx->random = x;
+
+    return x;
+}
+void phev_pipe_linkUp(phev_pipe_ctx_t *ctx)
+{
+    LOG_I(APP_TAG, "Link up, retrying connection now");
+    atomic_store(&ctx->linkUp, true);
+}
+bool phev_pipe_tryConnect(phev_pipe_ctx_t *ctx)
+{
+    uint64_t now = phev_core_monotonicMs();
+
+    if (atomic_exchange(&ctx->linkUp, false))
+    {
+        ctx->connectAttempts = 0;
+        ctx->nextConnectAttempt = now;
+    }
+
+    if (now < ctx->nextConnectAttempt)
+    {
+        return false;
+    }
 
     if (!ctx->pipe->in->connected)
     {
@@ -76,30 +179,75 @@ void phev_pipe_waitForConnection(phev_pipe_ctx_t *ctx)
         LOG_V(APP_TAG, "Calling out connect");
         msg_pipe_out_connect(ctx->pipe);
     }
-    while (!(ctx->pipe->in->connected && ctx->pipe->out->connected))
+
+    if (ctx->pipe->in->connected && ctx->pipe->out->connected)
     {
-        LOG_I(APP_TAG, "Not connected waiting...");
-        SLEEP(PHEV_CONNECT_WAIT_TIME);
-        if (retries > PHEV_CONNECT_MAX_RETRIES)
+        ctx->connected = true;
+        ctx->connectAttempts = 0;
+        ctx->nextConnectAttempt = 0;
+        ctx->connectStartedAt = 0;
+        if (ctx->disconnectedAt)
         {
-            LOG_E(APP_TAG, "Max retries reached");
-            return;
+            phev_metrics_add(&ctx->metrics, PHEV_METRIC_RECONNECTS, 1);
         }
+        phev_pipe_recordSince(ctx, PHEV_PIPE_LATENCY_RECONNECT, &ctx->disconnectedAt);
+        return true;
+    }
 
-        if (!ctx->pipe->in->connected)
+    if (ctx->outConnecting && !ctx->pipe->out->connected && ctx->outConnecting(ctx->pipe->out))
+    {
+        if (ctx->connectStartedAt == 0)
+        {
+            ctx->connectStartedAt = now;
+        }
+        // Polled again on the next loop, the connect call itself waits a little for the car
+        if (now - ctx->connectStartedAt < ctx->connectTimeout)
         {
-            LOG_V(APP_TAG, "Calling in connect");
-            msg_pipe_in_connect(ctx->pipe);
+            return false;
         }
-        if (!ctx->pipe->out->connected)
+        LOG_W(APP_TAG, "Connect timed out after %u ms", ctx->connectTimeout);
+        msg_pipe_out_disconnect(ctx->pipe);
+    }
+    ctx->connectStartedAt = 0;
+
+    uint32_t delay = phev_pipe_connectBackoff(ctx->connectAttempts, ctx->connectBackoffMin, ctx->connectBackoffMax, phev_pipe_random(ctx));
+
+    ctx->connectAttempts++;
+    ctx->nextConnectAttempt = phev_core_monotonicMs() + delay;
+
+    LOG_I(APP_TAG, "Not connected, attempt %u retrying in %u ms", ctx->connectAttempts, delay);
+
+    return false;
+}
+static void phev_pipe_idle(phev_pipe_ctx_t *ctx)
+{
+    uint64_t now = phev_core_monotonicMs();
+    uint64_t wait = (ctx->nextConnectAttempt > now ? ctx->nextConnectAttempt - now : 0);
+
+    if (wait > PHEV_CONNECT_IDLE_TIME)
+    {
+        wait = PHEV_CONNECT_IDLE_TIME;
+    }
+    if (wait > 0)
+    {
+        SLEEP(wait);
+    }
+}
+void phev_pipe_waitForConnection(phev_pipe_ctx_t *ctx)
+{
+    LOG_V(APP_TAG, "START - waitForConnection");
+    ctx->connected = false;
+
+    while (!phev_pipe_tryConnect(ctx))
+    {
+        if (ctx->connectAttempts > PHEV_CONNECT_MAX_RETRIES)
         {
-            LOG_V(APP_TAG, "Calling out connect");
-            msg_pipe_out_connect(ctx->pipe);
+            LOG_E(APP_TAG, "Max retries reached");
+            return;
         }
-        retries++;
+        phev_pipe_idle(ctx);
     }
 
-    ctx->connected = true;
     LOG_V(APP_TAG, "END - waitForConnection");
 }
 void phev_pipe_loop(phev_pipe_ctx_t *ctx)
@@ -113,7 +261,15 @@ void phev_pipe_loop(phev_pipe_ctx_t *ctx)
     }
     else
     {
-        phev_pipe_waitForConnection(ctx);
+        if (ctx->connected && ctx->disconnectedAt == 0)
+        {
+            ctx->disconnectedAt = phev_pipe_nowUs();
+        }
+        ctx->connected = false;
+        if (!phev_pipe_tryConnect(ctx))
+        {
+            phev_pipe_idle(ctx);
+        }
     }
 
     if (ctx->pipe->out->connected)
@@ -131,7 +287,7 @@ void phev_pipe_sendMac(phev_pipe_ctx_t *ctx, uint8_t *mac)
 {
     LOG_V(APP_TAG, "START - sendMac");
 
-    message_t *message = phev_core_startMessageEncoded(mac);
+    message_t *message = phev_core_profileStartMessageEncoded(ctx->profile, mac);
     phev_pipe_outboundPublish(ctx, message);
 
     LOG_V(APP_TAG, "END - sendMac");
@@ -150,8 +306,9 @@ phev_pipe_ctx_t *phev_pipe_createPipe(phev_pipe_settings_t settings)
 {
     LOG_V(APP_TAG, "START - createPipe");
 
-    phev_pipe_ctx_t *ctx = malloc(sizeof(phev_pipe_ctx_t));
+    phev_pipe_ctx_t *ctx = phev_malloc(sizeof(phev_pipe_ctx_t));
 
+    // The chains and bundles belong to msg_pipe, which uses plain malloc and free
     msg_pipe_chain_t *inputChain = malloc(sizeof(msg_pipe_chain_t));
     msg_pipe_chain_t *outputChain = malloc(sizeof(msg_pipe_chain_t));
 
@@ -192,7 +349,7 @@ phev_pipe_ctx_t *phev_pipe_createPipe(phev_pipe_settings_t settings)
         ctx->eventHandler[i] = NULL;
     }
 
-    ctx->updateRegisterCallbacks = malloc(sizeof(phev_pipe_updateRegisterCtx_t));
+    ctx->updateRegisterCallbacks = phev_malloc(sizeof(phev_pipe_updateRegisterCtx_t));
     ctx->updateRegisterCallbacks->numberOfCallbacks = 0;
 
     for (int i = 0; i < PHEV_PIPE_MAX_UPDATE_CALLBACKS; i++)
@@ -205,9 +362,36 @@ phev_pipe_ctx_t *phev_pipe_createPipe(phev_pipe_settings_t settings)
     ctx->currentXOR = 0;
     ctx->pingXOR = 0;
     ctx->commandXOR = 0;
+    ctx->inboundXOR = 0;
     ctx->encrypt = false;
     ctx->pingResponse = 0;
     ctx->registerDevice = settings.registerDevice;
+    ctx->nextConnectAttempt = 0;
+    ctx->connectAttempts = 0;
+    ctx->connectBackoffMin = (settings.connectBackoffMin ? settings.connectBackoffMin : PHEV_CONNECT_BACKOFF_MIN);
+    ctx->connectBackoffMax = (settings.connectBackoffMax ? settings.connectBackoffMax : PHEV_CONNECT_BACKOFF_MAX);
+    ctx->connectTimeout = (settings.connectTimeout ? settings.connectTimeout : PHEV_CONNECT_TIMEOUT);
+    ctx->connectStartedAt = 0;
+    ctx->outConnecting = settings.outConnecting;
+    // Seeded per pipe, sessions started together must not draw the same jitter
+    ctx->random = (uint32_t) phev_core_monotonicNs() ^ (uint32_t) (uintptr_t) ctx;
+    if (ctx->random == 0)
+    {
+        ctx->random = 1;
+    }
+    atomic_init(&ctx->linkUp, false);
+
+    for (int i = 0; i < PHEV_PIPE_LATENCY_MAX; i++)
+    {
+        ctx->latency[i] = phev_histogram_create();
+    }
+    memset(ctx->commandSentAt, 0, sizeof(ctx->commandSentAt));
+    memset(ctx->pingSentAt, 0, sizeof(ctx->pingSentAt));
+    ctx->readAt = 0;
+    ctx->disconnectedAt = 0;
+    phev_metrics_init(&ctx->metrics);
+    ctx->trace = NULL;
+    ctx->profile = phev_profile_get(settings.profile);
 
     phev_pipe_resetPing(ctx);
 
@@ -229,7 +413,7 @@ message_t *phev_pipe_outputChainInputTransformer(void *ctx, message_t *message)
     LOG_D(APP_TAG,"Incoming message");
     LOG_BUFFER_HEXDUMP(APP_TAG, message->data, message->length, LOG_DEBUG);
 
-    phevMessage_t *phevMessage = malloc(sizeof(phevMessage_t));
+    phevMessage_t *phevMessage = phev_malloc(sizeof(phevMessage_t));
     phev_pipe_ctx_t *pipeCtx = (phev_pipe_ctx_t *)ctx;
 
     int ret = phev_core_decodeMessage(message->data, message->length, phevMessage);
@@ -238,9 +422,16 @@ message_t *phev_pipe_outputChainInputTransformer(void *ctx, message_t *message)
     {
         LOG_E(APP_TAG, "Invalid message received");
 
+        phev_metrics_add(&pipeCtx->metrics, PHEV_METRIC_DECODE_FAILURES, 1);
         msg_utils_destroyMsg(message);
         return NULL;
     }
+    PHEV_TRACE(pipeCtx->trace, PHEV_TRACE_FRAME_DECODED, phevMessage->command, phevMessage->reg, phevMessage->XOR, phevMessage->type);
+
+    uint8_t currentXOR = pipeCtx->currentXOR;
+    uint8_t pingXOR = pipeCtx->pingXOR;
+    uint8_t commandXOR = pipeCtx->commandXOR;
+
     if(message->ctx != NULL)
     {
         uint8_t xor = phev_core_getMessageXOR(message);
@@ -250,6 +441,12 @@ message_t *phev_pipe_outputChainInputTransformer(void *ctx, message_t *message)
         pipeCtx->pingXOR = xor;
 
     }
+    const uint8_t incoming = pipeCtx->profile->incoming[phevMessage->command];
+
+    if(incoming & PHEV_PROFILE_KEY_CHANGE)
+    {
+        phev_metrics_add(&pipeCtx->metrics, PHEV_METRIC_XOR_RESYNCS, 1);
+    }
     if(phevMessage->command == 0xbb)
     {
         pipeCtx->commandXOR = phevMessage->data[0];
@@ -267,11 +464,19 @@ message_t *phev_pipe_outputChainInputTransformer(void *ctx, message_t *message)
         //LOG_I(APP_TAG,"%02X command recieved XOR changed to %02X",phevMessage->command, pipeCtx->pingXOR);
         // NOT WORKING HERE
     }
-    if(phevMessage->command == 0x3f)
+    phev_pipe_traceXOR(pipeCtx, phevMessage->command, currentXOR, pingXOR, commandXOR);
+
+    if(incoming & PHEV_PROFILE_PING_RESPONSE)
     {
         pipeCtx->pingResponse = phevMessage->reg;
         LOG_D(APP_TAG,"Server Ping %d\n",phevMessage->reg);
 
+        phev_pipe_recordSince(pipeCtx, PHEV_PIPE_LATENCY_PING_RTT, &pipeCtx->pingSentAt[phevMessage->reg]);
+    }
+    if(phevMessage->command == RESP_CMD && phevMessage->type == RESPONSE_TYPE)
+    {
+        PHEV_TRACE(pipeCtx->trace, PHEV_TRACE_COMMAND_ACKED, phevMessage->command, phevMessage->reg, phevMessage->XOR, 0);
+        phev_pipe_recordSince(pipeCtx, PHEV_PIPE_LATENCY_COMMAND_ACK, &pipeCtx->commandSentAt[phevMessage->reg]);
     }
 
     LOG_D(APP_TAG, "Command %02x Register %d Length %d Type %d XOR %02X", phevMessage->command, phevMessage->reg, phevMessage->length, phevMessage->type, phevMessage->XOR);
@@ -279,7 +484,7 @@ message_t *phev_pipe_outputChainInputTransformer(void *ctx, message_t *message)
 
     phev_core_destroyMessage(phevMessage);
 
-    //free(phevMessage);
+    //phev_free(phevMessage);
     return message;
 
 }
@@ -299,14 +504,14 @@ message_t *phev_pipe_commandResponder(void *ctx, message_t *message)
         phev_core_decodeMessage(message->data, message->length, &phevMsg);
 
         LOG_D(APP_TAG, "Decoded message XOR %02x", phevMsg.XOR);
-        if (phevMsg.command == PING_RESP_CMD || phevMsg.command == PING_RESP_CMD_MY18 || phevMsg.command == 0xbb || phevMsg.command == 0xcd || phevMsg.command == 0xcc)
+        if (PHEV_PROFILE_IS(pipeCtx->profile, phevMsg.command, PHEV_PROFILE_NO_ACK))
         {
             LOG_D(APP_TAG, "Ignoring ping");
             LOG_V(APP_TAG, "END - commandResponder");
-            free(phevMsg.data);
+            phev_free(phevMsg.data);
             return NULL;
         }
-        if(phevMsg.command == 0x4e || phevMsg.command == 0x5e)
+        if(PHEV_PROFILE_IS(pipeCtx->profile, phevMsg.command, PHEV_PROFILE_PLAIN_ACK))
         {
             LOG_D(APP_TAG, "%02X Command does not get encrypted response",phevMsg.command);
             LOG_BUFFER_HEXDUMP(APP_TAG,phevMsg.data,phevMsg.length,LOG_DEBUG);
@@ -314,14 +519,14 @@ message_t *phev_pipe_commandResponder(void *ctx, message_t *message)
             LOG_D(APP_TAG, "Responded with command %02X  type %d", phevMsg.command,phevMsg.type);
             out = phev_core_convertToMessage(msg);
             pipeCtx->encrypt = true;
-            free(phevMsg.data);
+            phev_free(phevMsg.data);
             return out;
         }
         if(pipeCtx->registerDevice == true)
         {
             //This is a hack to keep registration working
             LOG_I(APP_TAG,"Not responding to command for registration");
-            free(phevMsg.data);
+            phev_free(phevMsg.data);
             return NULL;
         }
 
@@ -332,17 +537,23 @@ message_t *phev_pipe_commandResponder(void *ctx, message_t *message)
             LOG_D(APP_TAG, "Responded with command %02X  type %d", phevMsg.command,phevMsg.type);
 
             out = phev_core_convertToMessage(msg);
-            free(phevMsg.data);
+            phev_free(phevMsg.data);
         }
     }
     if (out)
     {
         message_t * encoded = phev_core_XOROutboundMessage(out, phev_core_getMessageXOR(message));
 
+        phev_pipe_countOut(pipeCtx, out);
+        PHEV_TRACE(pipeCtx->trace, PHEV_TRACE_FRAME_ACKED, out->data[0], (out->length > 3 ? out->data[3] : 0), phev_core_getMessageXOR(message), 0);
         ret = msg_utils_copyMsg(encoded);
         msg_utils_destroyMsg(encoded);
         msg_utils_destroyMsg(out);
 
+        // Every request in the same read is timed from the read
+        uint64_t readAt = pipeCtx->readAt;
+
+        phev_pipe_recordSince(pipeCtx, PHEV_PIPE_LATENCY_REQUEST_ACK, &readAt);
     }
 
 #ifndef NO_CMD_RESP
@@ -355,12 +566,12 @@ message_t *phev_pipe_commandResponder(void *ctx, message_t *message)
 phevPipeEvent_t *phev_pipe_createVINEvent(uint8_t *data)
 {
     LOG_V(APP_TAG, "START - createVINEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
     LOG_BUFFER_HEXDUMP(APP_TAG,data,17,LOG_INFO);
 
     if (data[19] < 3)
     {
-        phevVinEvent_t *vinEvent = malloc(sizeof(phevVinEvent_t));
+        phevVinEvent_t *vinEvent = phev_malloc(sizeof(phevVinEvent_t));
         event->event = PHEV_PIPE_GOT_VIN,
         event->data = (uint8_t *)vinEvent;
         event->length = sizeof(phevVinEvent_t);
@@ -385,7 +596,7 @@ phevPipeEvent_t *phev_pipe_createVINEvent(uint8_t *data)
 phevPipeEvent_t *phev_pipe_AAResponseEvent(void)
 {
     LOG_V(APP_TAG, "START - AAResponseEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
 
     event->event = PHEV_PIPE_CONNECTED,
     event->data = NULL;
@@ -399,7 +610,7 @@ phevPipeEvent_t *phev_pipe_AAResponseEvent(void)
 phevPipeEvent_t *phev_pipe_startResponseEvent(void)
 {
     LOG_V(APP_TAG, "START - startResponseEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
 
     event->event = PHEV_PIPE_START_ACK,
     event->data = NULL;
@@ -414,7 +625,7 @@ phevPipeEvent_t *phev_pipe_startResponseEvent(void)
 phevPipeEvent_t *phev_pipe_registrationEvent(void)
 {
     LOG_V(APP_TAG, "START - registrationEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
 
     event->event = PHEV_PIPE_REGISTRATION,
     event->data = NULL;
@@ -428,10 +639,10 @@ phevPipeEvent_t *phev_pipe_registrationEvent(void)
 phevPipeEvent_t *phev_pipe_ecuVersion2Event(uint8_t *data)
 {
     LOG_V(APP_TAG, "START - ecuVersion2Event");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
 
     event->event = PHEV_PIPE_ECU_VERSION2;
-    event->data = malloc(PHEV_PIPE_ECU_VERSION_SIZE);
+    event->data = phev_malloc(PHEV_PIPE_ECU_VERSION_SIZE);
     memcpy(event->data, data, PHEV_PIPE_ECU_VERSION_SIZE);
     event->length = PHEV_PIPE_ECU_VERSION_SIZE;
     LOG_D(APP_TAG, "Created Event ID %d", event->event);
@@ -443,7 +654,7 @@ phevPipeEvent_t *phev_pipe_ecuVersion2Event(uint8_t *data)
 phevPipeEvent_t *phev_pipe_remoteSecurityPresentInfoEvent(void)
 {
     LOG_V(APP_TAG, "START - remoteSecurityPresentInfoEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
 
     event->event = PHEV_PIPE_REMOTE_SECURTY_PRSNT_INFO,
     event->data = NULL;
@@ -457,7 +668,7 @@ phevPipeEvent_t *phev_pipe_remoteSecurityPresentInfoEvent(void)
 phevPipeEvent_t *phev_pipe_regDispEvent(void)
 {
     LOG_V(APP_TAG, "START - regDispEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
 
     event->event = PHEV_PIPE_REG_DISP,
     event->data = NULL;
@@ -471,8 +682,8 @@ phevPipeEvent_t *phev_pipe_regDispEvent(void)
 phevPipeEvent_t *phev_pipe_dateInfoEvent(uint8_t *data)
 {
     LOG_V(APP_TAG, "START - dateInfoEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
-    event->data = malloc(PHEV_PIPE_DATE_INFO_SIZE);
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
+    event->data = phev_malloc(PHEV_PIPE_DATE_INFO_SIZE);
     memcpy(event->data, data, PHEV_PIPE_DATE_INFO_SIZE);
     event->event = PHEV_PIPE_DATE_INFO,
     event->length = PHEV_PIPE_DATE_INFO_SIZE;
@@ -485,7 +696,7 @@ phevPipeEvent_t *phev_pipe_dateInfoEvent(uint8_t *data)
 phevPipeEvent_t *phev_pipe_registrationCompleteEvent(phev_pipe_ctx_t * ctx)
 {
     LOG_V(APP_TAG, "START - registrationCompleteEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
     event->event = PHEV_PIPE_REGISTRATION_COMPLETE;
     event->data = NULL;
     LOG_D(APP_TAG, "Created Event ID %d", event->event);
@@ -507,8 +718,8 @@ void phev_pipe_sendRegister(phev_pipe_ctx_t * ctx)
 phevPipeEvent_t *phev_pipe_createBBEvent(const uint8_t * data)
 {
     LOG_V(APP_TAG, "START - BBEvent");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
-    event->data = malloc(1);
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
+    event->data = phev_malloc(1);
     memcpy(event->data, data, 1);
     event->event = PHEV_PIPE_BB,
     event->length = 1;
@@ -521,8 +732,8 @@ phevPipeEvent_t *phev_pipe_createBBEvent(const uint8_t * data)
 phevPipeEvent_t *phev_pipe_createPingEvent(const uint8_t reg)
 {
     LOG_V(APP_TAG, "START - Ping Event");
-    phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
-    event->data = malloc(1);
+    phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
+    event->data = phev_malloc(1);
     memcpy(event->data, &reg, 1);
     event->event = PHEV_PIPE_PING_RESP;
     event->length = 1;
@@ -539,12 +750,14 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     LOG_D(APP_TAG, "Message to Event Reg %d Len %d Type %d", phevMessage->reg, phevMessage->length, phevMessage->type);
     phevPipeEvent_t *event = NULL;
 
-    if(phevMessage->command == 0xbb || phevMessage->command == 0xcc)
+    const uint8_t incoming = ctx->profile->incoming[phevMessage->command];
+
+    if(incoming & PHEV_PROFILE_KEY_CHANGE)
     {
         event = phev_pipe_createBBEvent(phevMessage->data);
         return event;
     }
-    if (phevMessage->command == PING_RESP_CMD || phevMessage->command == PING_RESP_CMD_MY18)
+    if (incoming & PHEV_PROFILE_PING_RESPONSE)
     {
         event = phev_pipe_createPingEvent(phevMessage->reg);
         return event;
@@ -564,7 +777,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     case KO_WF_REG_DISP_SP:
     {
         LOG_D(APP_TAG, "KO_WF_REG_DISP_SP");
-        if (phevMessage->type == RESPONSE_TYPE && (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18))
+        if (phevMessage->type == RESPONSE_TYPE && (incoming & PHEV_PROFILE_RESPONSE))
         {
             LOG_I(APP_TAG,"Registration Acknowledged");
             event = phev_pipe_registrationCompleteEvent(ctx);
@@ -575,7 +788,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     }
     case KO_WF_CONNECT_INFO_GS_SP:
     {
-        if (phevMessage->type == RESPONSE_TYPE && (phevMessage->command == START_RESP || phevMessage->command == START_RESP_MY18))
+        if (phevMessage->type == RESPONSE_TYPE && (incoming & PHEV_PROFILE_START_RESPONSE))
         {
             LOG_D(APP_TAG, "KO_WF_CONNECT_INFO_GS_SP");
             event = phev_pipe_startResponseEvent();
@@ -584,7 +797,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     }
     case KO_WF_START_AA_EVR:
     {
-        if (phevMessage->type == RESPONSE_TYPE && (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18))
+        if (phevMessage->type == RESPONSE_TYPE && (incoming & PHEV_PROFILE_RESPONSE))
         {
             LOG_D(APP_TAG, "KO_WF_START_AA_EVR");
             event = phev_pipe_AAResponseEvent();
@@ -593,7 +806,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     }
     case KO_WF_REGISTRATION_EVR:
     {
-        if (phevMessage->type == REQUEST_TYPE && (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18))
+        if (phevMessage->type == REQUEST_TYPE && (incoming & PHEV_PROFILE_RESPONSE))
         {
             LOG_D(APP_TAG,"KO_WF_REGISTRATION_EVR");
             event = phev_pipe_registrationEvent();
@@ -602,7 +815,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     }
     case KO_WF_ECU_VERSION2_EVR:
     {
-        if (phevMessage->type == REQUEST_TYPE && (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18))
+        if (phevMessage->type == REQUEST_TYPE && (incoming & PHEV_PROFILE_RESPONSE))
         {
             LOG_D(APP_TAG,"KO_WF_ECU_VERSION2_EVR");
             event = phev_pipe_ecuVersion2Event(phevMessage->data);
@@ -612,7 +825,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     case KO_WF_REMOTE_SECURTY_PRSNT_INFO:
     {
 
-        if (phevMessage->type == REQUEST_TYPE && (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18))
+        if (phevMessage->type == REQUEST_TYPE && (incoming & PHEV_PROFILE_RESPONSE))
         {
             event = phev_pipe_remoteSecurityPresentInfoEvent();
         }
@@ -620,7 +833,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     }
     case KO_WF_DATE_INFO_SYNC_EVR:
     {
-        if (phevMessage->type == REQUEST_TYPE && (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18))
+        if (phevMessage->type == REQUEST_TYPE && (incoming & PHEV_PROFILE_RESPONSE))
         {
             event = phev_pipe_dateInfoEvent(phevMessage->data);
         }
@@ -628,7 +841,7 @@ phevPipeEvent_t *phev_pipe_messageToEvent(phev_pipe_ctx_t *ctx, phevMessage_t *p
     }
     case KO_WF_BATT_LEVEL_INFO_REP_EVR:
     {
-        if(phevMessage->type == REQUEST_TYPE && (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18))
+        if(phevMessage->type == REQUEST_TYPE && (incoming & PHEV_PROFILE_RESPONSE))
         {
             LOG_D(APP_TAG,"Battery level %d", phevMessage->data[0]);
         }
@@ -650,6 +863,7 @@ void phev_pipe_sendEventToHandlers(phev_pipe_ctx_t *ctx, phevPipeEvent_t *event)
     if (event != NULL)
     {
         LOG_D(APP_TAG, "Sending event ID %d", event->event);
+        PHEV_TRACE(ctx->trace, PHEV_TRACE_EVENT_DISPATCHED, 0, 0, 0, (uint32_t) event->event);
         if (ctx->eventHandlers > 0)
         {
             LOG_D(APP_TAG, "Event handers %d", ctx->eventHandlers);
@@ -676,9 +890,9 @@ phevPipeEvent_t *phev_pipe_createRegisterEvent(phev_pipe_ctx_t *phevCtx, phevMes
 {
     phevPipeEvent_t *event = NULL;
 
-    if (phevMessage->command == RESP_CMD || phevMessage->command == RESP_CMD_MY18)
+    if (PHEV_PROFILE_IS(phevCtx->profile, phevMessage->command, PHEV_PROFILE_RESPONSE))
     {
-        event = malloc(sizeof(phevPipeEvent_t));
+        event = phev_malloc(sizeof(phevPipeEvent_t));
         event->data = (void *)phev_core_copyMessage(phevMessage);
         event->length = sizeof(phevMessage_t);
         event->ctx = phevCtx;
@@ -727,7 +941,7 @@ message_t *phev_pipe_outputEventTransformer(void *ctx, message_t *message)
 {
     LOG_V(APP_TAG, "START - outputEventTransformer");
 
-    phevMessage_t *phevMessage = malloc(sizeof(phevMessage_t));
+    phevMessage_t *phevMessage = phev_malloc(sizeof(phevMessage_t));
 
     int length = phev_core_decodeMessage(message->data, message->length, phevMessage);
 
@@ -822,40 +1036,52 @@ messageBundle_t *phev_pipe_outputSplitter(void *ctx, message_t *message)
     }
     LOG_BUFFER_HEXDUMP(APP_TAG, message->data, message->length, LOG_DEBUG);
 
-    message_t * out = phev_core_extractIncomingMessageAndXOR(message->data);
+    pipeCtx->readAt = phev_pipe_nowUs();
+    phev_metrics_add(&pipeCtx->metrics, PHEV_METRIC_BYTES_IN, message->length);
+    PHEV_TRACE(pipeCtx->trace, PHEV_TRACE_FRAME_RECEIVED, 0, 0, 0, (uint32_t) message->length);
 
-    if (out == NULL)
+    // One pass finds every frame in the read, each then costs the one copy msg_pipe needs to own it
+    messageBundle_t *messages = malloc(sizeof(messageBundle_t));
+    const size_t maxMessages = sizeof(messages->messages) / sizeof(messages->messages[0]);
+    phevFrame_t frames[sizeof(messages->messages) / sizeof(messages->messages[0])];
+    size_t used = 0;
+    size_t fallbacks = 0;
+    size_t numberOfFrames = phev_core_scanIncomingFrames(message->data, message->length, &pipeCtx->inboundXOR, frames, maxMessages, &used, &fallbacks);
+
+    if (fallbacks)
+    {
+        phev_metrics_add(&pipeCtx->metrics, PHEV_METRIC_XOR_FALLBACKS, fallbacks);
+    }
+    if (numberOfFrames == 0)
     {
         LOG_E(APP_TAG,"Could not extract message");
+        phev_pipe_countBadFrame(pipeCtx, message->data, message->length);
+        free(messages);
         return NULL;
     }
-    LOG_D(APP_TAG,"Extract message output");
-    LOG_BUFFER_HEXDUMP(APP_TAG, out->data, out->length, LOG_DEBUG);
-
-    phev_pipe_checkXORChanged(pipeCtx, out);
-
-    messageBundle_t *messages = malloc(sizeof(messageBundle_t));
 
     messages->numMessages = 0;
-    messages->messages[messages->numMessages++] = msg_utils_copyMsg(out);
 
-    int total = out->length;
-
-    msg_utils_destroyMsg(out);
-
-    while (message->length > total)
+    for (size_t i = 0; i < numberOfFrames; i++)
     {
-        out = phev_core_extractIncomingMessageAndXOR(message->data + total);
-        if (out == NULL) {
-            break;
-        }
+        const phevFrame_t * frame = &frames[i];
+        const uint8_t * data = message->data + frame->offset;
+        message_t * out = (frame->xor ? phev_core_createMsgXOR(data, frame->length, frame->xor) : msg_utils_createMsg(data, frame->length));
 
         LOG_D(APP_TAG,"Extract message output");
         LOG_BUFFER_HEXDUMP(APP_TAG, out->data, out->length, LOG_DEBUG);
-        phev_pipe_checkXORChanged(pipeCtx,out);
-        total += out->length;
-        messages->messages[messages->numMessages++] = msg_utils_copyMsg(out);
-        msg_utils_destroyMsg(out);
+        phev_pipe_checkXORChanged(pipeCtx, out);
+        phev_metrics_frameIn(&pipeCtx->metrics, frame->command);
+        PHEV_TRACE(pipeCtx->trace, PHEV_TRACE_FRAME_SPLIT, frame->command, frame->reg, frame->xor, (uint32_t) frame->length);
+        messages->messages[messages->numMessages++] = out;
+    }
+    if (used < message->length)
+    {
+        if (numberOfFrames == maxMessages)
+        {
+            LOG_E(APP_TAG,"More than %zu frames in one read, dropping the rest", maxMessages);
+        }
+        phev_pipe_countBadFrame(pipeCtx, message->data + used, message->length - used);
     }
 
     //msg_utils_destroyMsg(message); // Cannot destroy until tests are fixed
@@ -913,7 +1139,9 @@ void phev_pipe_ping(phev_pipe_ctx_t *ctx)
             LOG_D(APP_TAG,"Not sending time sync in register device mode");
         }
     }
-    phevMessage_t *ping = phev_core_pingMessage(ctx->currentPing++);
+    ctx->pingSentAt[ctx->currentPing] = phev_pipe_nowUs();
+
+    phevMessage_t *ping = phev_core_profilePingMessage(ctx->profile, ctx->currentPing++);
     ctx->currentPing %= 0x30;
     LOG_D(APP_TAG,"Client Ping %d\n",ctx->currentPing);
     message_t *message = phev_core_convertToMessage(ping);
@@ -994,6 +1222,8 @@ int phev_pipe_updateRegisterEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *
         {
             if(ctx->updateRegisterCallbacks->used[i])
             {
+                phev_metrics_add(&ctx->metrics, PHEV_METRIC_RETRIES, 1);
+                PHEV_TRACE(ctx->trace, PHEV_TRACE_COMMAND_SENT, 0, ctx->updateRegisterCallbacks->registers[i], ctx->commandXOR, 1);
                 phev_pipe_updateRegisterNoRetry(ctx, ctx->updateRegisterCallbacks->registers[i], ctx->updateRegisterCallbacks->values[i],ctx->updateRegisterCallbacks->lengths[i]);
             }
         }
@@ -1011,7 +1241,7 @@ int phev_pipe_updateRegisterEventHandler(phev_pipe_ctx_t *ctx, phevPipeEvent_t *
                 }
                 ctx->updateRegisterCallbacks->callbacks[i] = NULL;
                 ctx->updateRegisterCallbacks->registers[i] = 0;
-                free(ctx->updateRegisterCallbacks->values[i]);
+                phev_free(ctx->updateRegisterCallbacks->values[i]);
                 ctx->updateRegisterCallbacks->values[i] = NULL;
                 ctx->updateRegisterCallbacks->lengths[i] = 0;
 
@@ -1029,7 +1259,7 @@ void phev_pipe_updateRegisterWithCallback(phev_pipe_ctx_t *ctx, const uint8_t re
 {
     LOG_V(APP_TAG, "START - updateRegisterWithCallback");
 
-    uint8_t * data = malloc(1);
+    uint8_t * data = phev_malloc(1);
     data[0] = value;
 
     phev_pipe_updateComplexRegisterWithCallback(ctx, reg, data, 1, callback, customCtx);
@@ -1045,7 +1275,7 @@ void phev_pipe_updateComplexRegisterWithCallback(phev_pipe_ctx_t *ctx, const uin
     {
         if (ctx->updateRegisterCallbacks->used[i] == false)
         {
-            uint8_t * dataCopy = malloc(length);
+            uint8_t * dataCopy = phev_malloc(length);
             memcpy(dataCopy, data, length);
             ctx->updateRegisterCallbacks->used[i] = true;
             ctx->updateRegisterCallbacks->callbacks[i] = callback;
@@ -1058,6 +1288,10 @@ void phev_pipe_updateComplexRegisterWithCallback(phev_pipe_ctx_t *ctx, const uin
 
             phev_pipe_registerEventHandler(ctx, (phevPipeEventHandler_t)phev_pipe_updateRegisterEventHandler);
 
+            PHEV_TRACE(ctx->trace, PHEV_TRACE_COMMAND_QUEUED, 0, reg, 0, (uint32_t) length);
+
+            ctx->commandSentAt[reg] = phev_pipe_nowUs();
+            PHEV_TRACE(ctx->trace, PHEV_TRACE_COMMAND_SENT, 0, reg, ctx->commandXOR, 0);
             phev_pipe_updateRegisterNoRetry(ctx, reg, data, length);
 
             LOG_V(APP_TAG, "END - updateRegisterWithCallback");
@@ -1066,6 +1300,7 @@ void phev_pipe_updateComplexRegisterWithCallback(phev_pipe_ctx_t *ctx, const uin
     }
 
     LOG_W(APP_TAG, "Cannot add update register handler too many allocated %d",ctx->updateRegisterCallbacks->numberOfCallbacks);
+    phev_metrics_add(&ctx->metrics, PHEV_METRIC_DROPPED_COMMANDS, 1);
 }
 
 void phev_pipe_pingOutboundPublish(phev_pipe_ctx_t * ctx, message_t * message)
@@ -1074,6 +1309,8 @@ void phev_pipe_pingOutboundPublish(phev_pipe_ctx_t * ctx, message_t * message)
 
     message_t * encoded = phev_core_XOROutboundMessage(message, ctx->pingXOR);
 
+    phev_pipe_countOut(ctx, message);
+
     msg_pipe_outboundPublish(ctx->pipe, encoded);
 
     msg_utils_destroyMsg(message);
@@ -1088,6 +1325,8 @@ void phev_pipe_commandOutboundPublish(phev_pipe_ctx_t * ctx, message_t * message
 
     message_t * encoded = phev_core_XOROutboundMessage(message, ctx->commandXOR);
 
+    phev_pipe_countOut(ctx, message);
+
     msg_pipe_outboundPublish(ctx->pipe, encoded);
 
     msg_utils_destroyMsg(message);
@@ -1102,6 +1341,8 @@ void phev_pipe_outboundPublish(phev_pipe_ctx_t * ctx, message_t * message)
 
     message_t * encoded = phev_core_XOROutboundMessage(message, ctx->currentXOR);
 
+    phev_pipe_countOut(ctx, message);
+
     msg_pipe_outboundPublish(ctx->pipe, encoded);
 
     msg_utils_destroyMsg(message);
@@ -1110,3 +1351,22 @@ void phev_pipe_outboundPublish(phev_pipe_ctx_t * ctx, message_t * message)
 
     return;
 }
+const phevHistogram_t * phev_pipe_getLatency(const phev_pipe_ctx_t *ctx, phevPipeLatency_t latency)
+{
+    if (ctx == NULL || latency >= PHEV_PIPE_LATENCY_MAX)
+    {
+        return NULL;
+    }
+    return ctx->latency[latency];
+}
+void phev_pipe_resetLatency(phev_pipe_ctx_t *ctx)
+{
+    for (int i = 0; i < PHEV_PIPE_LATENCY_MAX; i++)
+    {
+        phev_histogram_reset(ctx->latency[i]);
+    }
+}
+void phev_pipe_getMetrics(const phev_pipe_ctx_t *ctx, phevMetricsSnapshot_t *snapshot)
+{
+    phev_metrics_snapshot(&ctx->metrics, snapshot);
+}
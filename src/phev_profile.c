@@ -0,0 +1,66 @@
+#include <string.h>
+#include "phev_profile.h"
+#include "phev_core.h"
+#include "phev_schema.h"
+
+static const uint8_t phev_profile_incoming[256] = {
+    [RESP_CMD] = PHEV_PROFILE_RESPONSE,
+    [RESP_CMD_MY18] = PHEV_PROFILE_RESPONSE | PHEV_PROFILE_PLAIN_ACK,
+    [0x4e] = PHEV_PROFILE_PLAIN_ACK,
+    [PING_RESP_CMD] = PHEV_PROFILE_PING_RESPONSE | PHEV_PROFILE_NO_ACK,
+    [PING_RESP_CMD_MY18] = PHEV_PROFILE_PING_RESPONSE | PHEV_PROFILE_NO_ACK,
+    [START_RESP] = PHEV_PROFILE_START_RESPONSE,
+    [0xbb] = PHEV_PROFILE_KEY_CHANGE | PHEV_PROFILE_NO_ACK,
+    [0xcc] = PHEV_PROFILE_KEY_CHANGE | PHEV_PROFILE_NO_ACK,
+    [0xcd] = PHEV_PROFILE_NO_ACK,
+};
+
+static const phevProfile_t phev_profiles[PHEV_PROFILE_MAX] = {
+    [PHEV_PROFILE_PRE_MY18] = {
+        .id = PHEV_PROFILE_PRE_MY18,
+        .name = "pre-my18",
+        .models = PHEV_SCHEMA_MODEL_PRE_MY18,
+        .pingSend = PING_SEND_CMD,
+        .startSend = START_SEND,
+        .acScheduleReg = KO_WF_AC_SCH_SP,
+        .incoming = phev_profile_incoming,
+    },
+    [PHEV_PROFILE_MY18] = {
+        .id = PHEV_PROFILE_MY18,
+        .name = "my18",
+        .models = PHEV_SCHEMA_MODEL_MY18,
+        .pingSend = PING_SEND_CMD_MY18,
+        .startSend = START_SEND_MY18,
+        .acScheduleReg = KO_WF_AC_SCH_SP,
+        .incoming = phev_profile_incoming,
+    },
+    [PHEV_PROFILE_MY19] = {
+        .id = PHEV_PROFILE_MY19,
+        .name = "my19",
+        .models = PHEV_SCHEMA_MODEL_MY19,
+        .pingSend = PING_SEND_CMD_MY18,
+        .startSend = START_SEND_MY18,
+        .acScheduleReg = KO_WF_AC_SCH_SP_MY19,
+        .incoming = phev_profile_incoming,
+    },
+};
+
+const phevProfile_t * phev_profile_get(phevProfileId_t id)
+{
+    if(id <= PHEV_PROFILE_DEFAULT || id >= PHEV_PROFILE_MAX)
+    {
+        id = PHEV_PROFILE_MY18;
+    }
+    return &phev_profiles[id];
+}
+phevProfileId_t phev_profile_fromName(const char * name)
+{
+    for(int i = PHEV_PROFILE_DEFAULT + 1; name && i < PHEV_PROFILE_MAX; i++)
+    {
+        if(strcmp(name, phev_profiles[i].name) == 0)
+        {
+            return (phevProfileId_t) i;
+        }
+    }
+    return PHEV_PROFILE_MAX;
+}
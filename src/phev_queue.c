@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "phev_queue.h"
+#include "phev_alloc.h"
+#include "phev_core.h"
+#include "phev_log.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#include <pthread.h>
+#define PHEV_QUEUE_THREADS
+#endif
+
+const static char *TAG = "PHEV_QUEUE";
+
+#define PHEV_QUEUE_WAIT_MS 50
+
+typedef struct phevQueueEntry_t {
+    int type;
+    bool isRegister;
+    uint8_t reg;
+    uint32_t sequence;
+    size_t length;
+    uint8_t data[];
+} phevQueueEntry_t;
+
+struct phevQueue_t {
+    phevQueueSettings_t settings;
+    phevQueueDeliver_t deliver;
+    void * ctx;
+    phevQueueEntry_t ** entries;
+    // tail is the producer's, head the consumer's, as in the journal
+    atomic_uint head;
+    atomic_uint tail;
+    // Latest value of each register that did not go through entries
+    _Atomic(phevQueueEntry_t *) latest[256];
+    atomic_uint pending[256 / 32];
+    // Producer only
+    uint32_t sequence[256];
+    // Consumer only
+    uint32_t delivered[256];
+
+    atomic_uint queued;
+    atomic_uint deliveredCount;
+    atomic_uint dropped;
+    atomic_uint coalesced;
+    atomic_uint blocked;
+    atomic_uint highWater;
+#ifdef PHEV_QUEUE_THREADS
+    atomic_bool running;
+    atomic_bool waiting;
+    bool started;
+    pthread_t dispatcher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+#endif
+};
+
+static phevQueueEntry_t * phev_queue_createEntry(const phevQueueItem_t * item)
+{
+    phevQueueEntry_t * entry = phev_malloc(sizeof(phevQueueEntry_t) + item->length);
+
+    if(entry == NULL)
+    {
+        return NULL;
+    }
+    entry->type = item->type;
+    entry->isRegister = item->isRegister;
+    entry->reg = item->reg;
+    entry->sequence = 0;
+    entry->length = item->length;
+
+    if(item->length)
+    {
+        memcpy(entry->data, item->data, item->length);
+    }
+    return entry;
+}
+static bool phev_queue_full(const phevQueue_t * queue)
+{
+    unsigned int tail = atomic_load_explicit((atomic_uint *) &queue->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit((atomic_uint *) &queue->head, memory_order_acquire);
+
+    return tail - head >= queue->settings.depth;
+}
+static void phev_queue_wake(phevQueue_t * queue)
+{
+#ifdef PHEV_QUEUE_THREADS
+    if(atomic_load(&queue->waiting))
+    {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_signal(&queue->wake);
+        pthread_mutex_unlock(&queue->lock);
+    }
+#endif
+}
+static void phev_queue_enqueue(phevQueue_t * queue, phevQueueEntry_t * entry)
+{
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int depth = tail + 1 - atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    queue->entries[tail % queue->settings.depth] = entry;
+    atomic_store(&queue->tail, tail + 1);
+
+    if(depth > atomic_load_explicit(&queue->highWater, memory_order_relaxed))
+    {
+        atomic_store_explicit(&queue->highWater, depth, memory_order_relaxed);
+    }
+}
+// Replaces whatever value of the register is still waiting, the consumer picks it up after the queued entries.
+static void phev_queue_replaceLatest(phevQueue_t * queue, phevQueueEntry_t * entry)
+{
+    phevQueueEntry_t * old = atomic_exchange(&queue->latest[entry->reg], entry);
+
+    if(old)
+    {
+        phev_free(old);
+        atomic_fetch_add_explicit((queue->settings.policy == PHEV_QUEUE_COALESCE ? &queue->coalesced : &queue->dropped), 1, memory_order_relaxed);
+    }
+    atomic_fetch_or(&queue->pending[entry->reg / 32], 1U << (entry->reg % 32));
+}
+static bool phev_queue_waitForRoom(phevQueue_t * queue)
+{
+    uint64_t deadline = phev_core_monotonicMs() + queue->settings.blockTimeoutMs;
+
+    atomic_fetch_add_explicit(&queue->blocked, 1, memory_order_relaxed);
+
+    while(phev_queue_full(queue))
+    {
+        if(phev_core_monotonicMs() >= deadline)
+        {
+            return false;
+        }
+        phev_queue_wake(queue);
+#ifdef PHEV_QUEUE_THREADS
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000L };
+
+        nanosleep(&ts, NULL);
+#endif
+    }
+    return true;
+}
+bool phev_queue_push(phevQueue_t * queue, const phevQueueItem_t * item)
+{
+    if(queue == NULL || item == NULL)
+    {
+        return false;
+    }
+
+    phevQueueEntry_t * entry = phev_queue_createEntry(item);
+
+    if(entry == NULL)
+    {
+        atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    if(item->isRegister)
+    {
+        entry->sequence = ++queue->sequence[item->reg];
+    }
+    atomic_fetch_add_explicit(&queue->queued, 1, memory_order_relaxed);
+
+    if(item->isRegister && (queue->settings.policy == PHEV_QUEUE_COALESCE
+        || (queue->settings.policy == PHEV_QUEUE_COALESCE_OR_DROP_NEW && phev_queue_full(queue))))
+    {
+        phev_queue_replaceLatest(queue, entry);
+    }
+    else if(!phev_queue_full(queue) || (queue->settings.policy == PHEV_QUEUE_BLOCK && phev_queue_waitForRoom(queue)))
+    {
+        phev_queue_enqueue(queue, entry);
+    }
+    else
+    {
+        LOG_D(TAG,"Queue full, dropping event %d",item->type);
+        phev_free(entry);
+        atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    phev_queue_wake(queue);
+
+    return true;
+}
+static void phev_queue_deliver(phevQueue_t * queue, phevQueueEntry_t * entry)
+{
+    if(entry->isRegister)
+    {
+        if((int32_t) (entry->sequence - queue->delivered[entry->reg]) <= 0)
+        {
+            phev_free(entry);
+            atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        queue->delivered[entry->reg] = entry->sequence;
+    }
+
+    phevQueueItem_t item = {
+        .type = entry->type,
+        .isRegister = entry->isRegister,
+        .reg = entry->reg,
+        .data = entry->data,
+        .length = entry->length,
+    };
+    queue->deliver(&item, queue->ctx);
+    phev_free(entry);
+
+    atomic_fetch_add_explicit(&queue->deliveredCount, 1, memory_order_relaxed);
+}
+static bool phev_queue_hasPending(phevQueue_t * queue)
+{
+    if(atomic_load(&queue->head) != atomic_load(&queue->tail))
+    {
+        return true;
+    }
+    for(size_t i = 0; i < 256 / 32; i++)
+    {
+        if(atomic_load_explicit(&queue->pending[i], memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+size_t phev_queue_drain(phevQueue_t * queue)
+{
+    size_t num = 0;
+
+    if(queue == NULL)
+    {
+        return 0;
+    }
+
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    while(head != tail)
+    {
+        phevQueueEntry_t * entry = queue->entries[head % queue->settings.depth];
+
+        atomic_store_explicit(&queue->head, ++head, memory_order_release);
+        phev_queue_deliver(queue, entry);
+        num++;
+    }
+    for(size_t i = 0; i < 256 / 32; i++)
+    {
+        unsigned int bits = atomic_exchange(&queue->pending[i], 0);
+
+        while(bits)
+        {
+            int bit = __builtin_ctz(bits);
+            phevQueueEntry_t * entry = atomic_exchange(&queue->latest[i * 32 + bit], NULL);
+
+            bits &= bits - 1;
+
+            if(entry)
+            {
+                phev_queue_deliver(queue, entry);
+                num++;
+            }
+        }
+    }
+    return num;
+}
+phevQueue_t * phev_queue_create(phevQueueSettings_t settings, phevQueueDeliver_t deliver, void * ctx)
+{
+    LOG_V(TAG,"START - create");
+
+    if(settings.depth == 0 || deliver == NULL)
+    {
+        LOG_E(TAG,"Queue needs a depth and a consumer");
+        return NULL;
+    }
+    if(settings.blockTimeoutMs == 0)
+    {
+        settings.blockTimeoutMs = PHEV_QUEUE_DEFAULT_BLOCK_MS;
+    }
+
+    phevQueue_t * queue = phev_calloc(1, sizeof(phevQueue_t));
+
+    if(queue == NULL)
+    {
+        return NULL;
+    }
+    queue->entries = phev_calloc(settings.depth, sizeof(phevQueueEntry_t *));
+
+    if(queue->entries == NULL)
+    {
+        phev_free(queue);
+        return NULL;
+    }
+    queue->settings = settings;
+    queue->deliver = deliver;
+    queue->ctx = ctx;
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    for(size_t i = 0; i < 256; i++)
+    {
+        atomic_init(&queue->latest[i], NULL);
+    }
+    for(size_t i = 0; i < 256 / 32; i++)
+    {
+        atomic_init(&queue->pending[i], 0);
+    }
+#ifdef PHEV_QUEUE_THREADS
+    atomic_init(&queue->running, false);
+    atomic_init(&queue->waiting, false);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->wake, NULL);
+#endif
+
+    LOG_V(TAG,"END - create");
+
+    return queue;
+}
+#ifdef PHEV_QUEUE_THREADS
+static void * phev_queue_dispatcher(void * arg)
+{
+    phevQueue_t * queue = arg;
+
+    while(atomic_load(&queue->running))
+    {
+        if(phev_queue_drain(queue) > 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&queue->lock);
+        atomic_store(&queue->waiting, true);
+
+        // A push that missed the flag is picked up at the timeout
+        if(atomic_load(&queue->running) && !phev_queue_hasPending(queue))
+        {
+            struct timespec ts;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += PHEV_QUEUE_WAIT_MS * 1000000L;
+            if(ts.tv_nsec >= 1000000000L)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&queue->wake, &queue->lock, &ts);
+        }
+        atomic_store(&queue->waiting, false);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    phev_queue_drain(queue);
+
+    return NULL;
+}
+bool phev_queue_start(phevQueue_t * queue)
+{
+    if(queue == NULL || queue->started)
+    {
+        return false;
+    }
+    atomic_store(&queue->running, true);
+
+    if(pthread_create(&queue->dispatcher, NULL, phev_queue_dispatcher, queue) != 0)
+    {
+        LOG_E(TAG,"Cannot start dispatcher thread");
+        atomic_store(&queue->running, false);
+        return false;
+    }
+    queue->started = true;
+
+    return true;
+}
+void phev_queue_stop(phevQueue_t * queue)
+{
+    if(queue == NULL || !queue->started)
+    {
+        return;
+    }
+    pthread_mutex_lock(&queue->lock);
+    atomic_store(&queue->running, false);
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+
+    // Stopped from inside a consumer, the thread finishes on its own
+    if(pthread_equal(pthread_self(), queue->dispatcher))
+    {
+        pthread_detach(queue->dispatcher);
+    }
+    else
+    {
+        pthread_join(queue->dispatcher, NULL);
+    }
+    queue->started = false;
+}
+#else
+bool phev_queue_start(phevQueue_t * queue)
+{
+    LOG_W(TAG,"No dispatcher thread on this platform, call phev_queue_drain");
+    return false;
+}
+void phev_queue_stop(phevQueue_t * queue)
+{
+}
+#endif
+void phev_queue_destroy(phevQueue_t * queue)
+{
+    if(queue == NULL)
+    {
+        return;
+    }
+    phev_queue_stop(queue);
+
+    unsigned int head = atomic_load(&queue->head);
+    unsigned int tail = atomic_load(&queue->tail);
+
+    while(head != tail)
+    {
+        phev_free(queue->entries[head++ % queue->settings.depth]);
+    }
+    for(size_t i = 0; i < 256; i++)
+    {
+        phev_free(atomic_load(&queue->latest[i]));
+    }
+#ifdef PHEV_QUEUE_THREADS
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->wake);
+#endif
+    phev_free(queue->entries);
+    phev_free(queue);
+}
+phevQueueStats_t phev_queue_stats(const phevQueue_t * queue)
+{
+    phevQueueStats_t stats = {0};
+
+    if(queue == NULL)
+    {
+        return stats;
+    }
+    phevQueue_t * q = (phevQueue_t *) queue;
+
+    stats.queued = atomic_load_explicit(&q->queued, memory_order_relaxed);
+    stats.delivered = atomic_load_explicit(&q->deliveredCount, memory_order_relaxed);
+    stats.dropped = atomic_load_explicit(&q->dropped, memory_order_relaxed);
+    stats.coalesced = atomic_load_explicit(&q->coalesced, memory_order_relaxed);
+    stats.blocked = atomic_load_explicit(&q->blocked, memory_order_relaxed);
+    stats.depth = atomic_load_explicit(&q->tail, memory_order_relaxed) - atomic_load_explicit(&q->head, memory_order_relaxed);
+    stats.highWater = atomic_load_explicit(&q->highWater, memory_order_relaxed);
+
+    return stats;
+}
@@ -1,6 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
-#include "logger.h"
+#include "phev_log.h"
 #include "phev_core.h"
 #include "phev_pipe.h"
 #include "phev_register.h"
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include "phev_schema.h"
+#include "phev_log.h"
+
+const static char *TAG = "PHEV_SCHEMA";
+
+const char * const phev_schema_doorLockNames[] = { "unknown", "locked", "unlocked", NULL };
+
+#define PHEV_SCHEMA_TABLE_ENTRY(ID, accessor, jsonName, group_, reg_, offset_, width_, endian_, mask_, shift_, scale_, type_, enum_, models_, invalid_) \
+    [PHEV_FIELD_##ID] = { \
+        .id = PHEV_FIELD_##ID, \
+        .name = jsonName, \
+        .group = group_, \
+        .reg = reg_, \
+        .offset = offset_, \
+        .width = width_, \
+        .endian = endian_, \
+        .mask = mask_, \
+        .shift = shift_, \
+        .scale = scale_, \
+        .type = type_, \
+        .enumNames = enum_, \
+        .models = models_, \
+        .invalidMask = invalid_, \
+    },
+
+const phevSchemaField_t phev_schema_fields[PHEV_FIELD_MAX] = {
+    PHEV_SCHEMA_FIELDS(PHEV_SCHEMA_TABLE_ENTRY)
+};
+#undef PHEV_SCHEMA_TABLE_ENTRY
+
+#define PHEV_SCHEMA_ACCESSOR(ID, accessor, ...) \
+bool phev_schema_##accessor(const phevModel_t * model, uint8_t models, int32_t * value) \
+{ \
+    return phev_schema_getField(model, PHEV_FIELD_##ID, models, value); \
+}
+PHEV_SCHEMA_FIELDS(PHEV_SCHEMA_ACCESSOR)
+#undef PHEV_SCHEMA_ACCESSOR
+
+const phevSchemaField_t * phev_schema_getFieldSchema(phevSchemaFieldId_t id)
+{
+    if(id >= PHEV_FIELD_MAX)
+    {
+        LOG_E(TAG,"Unknown field id %d",id);
+        return NULL;
+    }
+    return &phev_schema_fields[id];
+}
+bool phev_schema_decodeField(const phevSchemaField_t * field, const uint8_t * data, size_t length, int32_t * value)
+{
+    if(field == NULL || data == NULL || value == NULL)
+    {
+        return false;
+    }
+    if(field->width == 0 || field->width > 4 || (size_t) field->offset + field->width > length)
+    {
+        LOG_D(TAG,"Field %s out of bounds for register %d length %zu",field->name,field->reg,length);
+        return false;
+    }
+
+    const uint8_t * p = data + field->offset;
+    uint32_t raw = 0;
+
+    for(int i = 0; i < field->width; i++)
+    {
+        int shift = (field->endian == PHEV_SCHEMA_LE ? i : field->width - 1 - i) * 8;
+        raw |= ((uint32_t) p[i]) << shift;
+    }
+
+    if(field->invalidMask != PHEV_SCHEMA_NO_INVALID && (raw & field->invalidMask) == field->invalidMask)
+    {
+        LOG_D(TAG,"Field %s not reported",field->name);
+        return false;
+    }
+
+    raw = (raw & field->mask) >> field->shift;
+
+    *value = (int32_t) raw * field->scale;
+
+    return true;
+}
+bool phev_schema_getField(const phevModel_t * model, phevSchemaFieldId_t id, uint8_t models, int32_t * value)
+{
+    const phevSchemaField_t * field = phev_schema_getFieldSchema(id);
+
+    if(field == NULL || (field->models & models) == 0)
+    {
+        return false;
+    }
+
+    uint32_t epoch = phev_model_enterRead(model);
+
+    const phevRegister_t * reg = phev_model_peekRegister(model, field->reg);
+    bool found = reg && phev_schema_decodeField(field, reg->data, reg->length, value);
+
+    phev_model_exitRead(model, epoch);
+
+    return found;
+}
+static const char * phev_schema_enumName(const phevSchemaField_t * field, int32_t value)
+{
+    if(field->enumNames == NULL || value < 0)
+    {
+        return NULL;
+    }
+    for(int32_t i = 0; field->enumNames[i] != NULL; i++)
+    {
+        if(i == value)
+        {
+            return field->enumNames[i];
+        }
+    }
+    return NULL;
+}
+// The object a field goes in, made the first time one of its fields is reported.
+static cJSON * phev_schema_groupJson(cJSON * json, const char * group)
+{
+    if(group == NULL)
+    {
+        return json;
+    }
+    cJSON * object = cJSON_GetObjectItemCaseSensitive(json, group);
+
+    if(object == NULL)
+    {
+        object = cJSON_CreateObject();
+        cJSON_AddItemToObject(json, group, object);
+    }
+    return object;
+}
+cJSON * phev_schema_toJson(const phevModel_t * model, uint8_t models)
+{
+    LOG_V(TAG,"START - toJson");
+
+    cJSON * json = cJSON_CreateObject();
+
+    if(json == NULL)
+    {
+        LOG_E(TAG,"Cannot create json object");
+        return NULL;
+    }
+
+    for(int i = 0; i < PHEV_FIELD_MAX; i++)
+    {
+        const phevSchemaField_t * field = &phev_schema_fields[i];
+        int32_t value;
+
+        if(!phev_schema_getField(model, field->id, models, &value))
+        {
+            continue;
+        }
+        cJSON * object = phev_schema_groupJson(json, field->group);
+
+        switch(field->type)
+        {
+            case PHEV_SCHEMA_BOOL:
+            {
+                cJSON_AddItemToObject(object, field->name, value ? cJSON_CreateTrue() : cJSON_CreateFalse());
+                break;
+            }
+            case PHEV_SCHEMA_ENUM:
+            {
+                const char * name = phev_schema_enumName(field, value);
+                if(name)
+                {
+                    cJSON_AddItemToObject(object, field->name, cJSON_CreateString(name));
+                    break;
+                }
+                cJSON_AddItemToObject(object, field->name, cJSON_CreateNumber((double) value));
+                break;
+            }
+            default:
+            {
+                cJSON_AddItemToObject(object, field->name, cJSON_CreateNumber((double) value));
+            }
+        }
+    }
+
+    LOG_V(TAG,"END - toJson");
+
+    return json;
+}
+size_t phev_schema_encode(const phevModel_t * model, uint8_t models, uint8_t * buffer, size_t length)
+{
+    LOG_V(TAG,"START - encode");
+
+    size_t pos = 0;
+
+    if(buffer == NULL)
+    {
+        return 0;
+    }
+
+    for(int i = 0; i < PHEV_FIELD_MAX; i++)
+    {
+        int32_t value;
+
+        if(!phev_schema_getField(model, (phevSchemaFieldId_t) i, models, &value))
+        {
+            continue;
+        }
+        if(pos + 5 > length)
+        {
+            LOG_W(TAG,"Encode buffer too small for all fields");
+            break;
+        }
+        uint32_t raw = (uint32_t) value;
+
+        buffer[pos++] = (uint8_t) i;
+        buffer[pos++] = raw & 0xff;
+        buffer[pos++] = (raw >> 8) & 0xff;
+        buffer[pos++] = (raw >> 16) & 0xff;
+        buffer[pos++] = (raw >> 24) & 0xff;
+    }
+
+    LOG_V(TAG,"END - encode");
+
+    return pos;
+}
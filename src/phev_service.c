@@ -4,8 +4,10 @@
 #include <stdint.h>
 #include "phev_pipe.h"
 #include "phev_service.h"
+#include "phev_schema.h"
+#include "phev_alloc.h"
 #include "msg_utils.h"
-#include "logger.h"
+#include "phev_log.h"
 #ifdef __XTENSA__
 #include "cJSON.h"
 #else
@@ -56,17 +58,32 @@ phevServiceCtx_t *phev_service_create(phevServiceSettings_t settings)
     LOG_V(TAG, "START - create");
     phevServiceCtx_t *ctx = NULL;
 
-    if(settings.my18)
-    {
-        phev_core_my18 = true;
-    }
-
     ctx = phev_service_init(settings.in, settings.out,settings.registerDevice);
 
     ctx->yieldHandler = settings.yieldHandler;
     ctx->exit = false;
     ctx->ctx = settings.ctx;
     ctx->registrationCompleteCallback = NULL;
+    if (settings.connectBackoffMin)
+    {
+        ctx->pipe->connectBackoffMin = settings.connectBackoffMin;
+    }
+    if (settings.connectBackoffMax)
+    {
+        ctx->pipe->connectBackoffMax = settings.connectBackoffMax;
+    }
+    if (settings.connectTimeout)
+    {
+        ctx->pipe->connectTimeout = settings.connectTimeout;
+    }
+    ctx->pipe->outConnecting = settings.outConnecting;
+    if (settings.traceDepth)
+    {
+        ctx->pipe->trace = phev_trace_create(settings.traceDepth);
+    }
+    // my18 only picks the profile it always meant, the default is already MY18
+    ctx->pipe->profile = phev_profile_get(settings.profile == PHEV_PROFILE_DEFAULT && settings.my18 ? PHEV_PROFILE_MY18 : settings.profile);
+    LOG_I(TAG, "Protocol profile %s", ctx->pipe->profile->name);
     if (settings.mac)
     {
         memcpy(ctx->mac, settings.mac, 6);
@@ -88,6 +105,56 @@ phevServiceCtx_t *phev_service_create(phevServiceSettings_t settings)
         phev_pipe_registerEventHandler(ctx->pipe, phev_service_eventHandler);
     }
 
+    if(settings.snapshotPath)
+    {
+        LOG_D(TAG,"Restoring model from snapshot %s",settings.snapshotPath);
+        ctx->snapshot = phev_snapshot_open(settings.snapshotPath, settings.snapshotVin);
+        if(ctx->snapshot)
+        {
+            phev_snapshot_load(ctx->snapshot, ctx->model);
+            if(!phev_model_addListener(ctx->model, phev_snapshot_modelListener, ctx->snapshot))
+            {
+                LOG_E(TAG,"No room for the snapshot model listener, not saving snapshots");
+                phev_snapshot_close(ctx->snapshot);
+                ctx->snapshot = NULL;
+            }
+        }
+        if(settings.snapshotMaxAge > 0)
+        {
+            ctx->snapshotMaxAge = settings.snapshotMaxAge;
+        }
+    }
+
+    if(settings.journal.path)
+    {
+        LOG_D(TAG,"Journaling register changes to %s",settings.journal.path);
+        ctx->journal = phev_journal_open(settings.journal);
+        if(ctx->journal && !phev_model_addListener(ctx->model, phev_journal_modelListener, ctx->journal))
+        {
+            LOG_E(TAG,"No room for the journal model listener, not journaling");
+            phev_journal_close(ctx->journal);
+            ctx->journal = NULL;
+        }
+    }
+
+    if(settings.broker.path)
+    {
+        LOG_D(TAG,"Sharing the connection on %s",settings.broker.path);
+        ctx->broker = phev_broker_create(ctx, settings.broker);
+    }
+
+    if(settings.history.depth > 0)
+    {
+        LOG_D(TAG,"Creating register history depth %zu",settings.history.depth);
+        ctx->history = phev_history_create(settings.history);
+        if(ctx->history && !phev_model_addListener(ctx->model, phev_history_modelListener, ctx->history))
+        {
+            LOG_E(TAG,"No room for the history model listener, not keeping history");
+            phev_history_destroy(ctx->history);
+            ctx->history = NULL;
+        }
+    }
+
     LOG_V(TAG, "END - create");
 
     return ctx;
@@ -102,6 +169,10 @@ void phev_service_start(phevServiceCtx_t *ctx)
     while (!ctx->exit)
     {
         phev_service_loop(ctx);
+        if (ctx->broker)
+        {
+            phev_broker_poll(ctx->broker);
+        }
         if (ctx->yieldHandler)
         {
             ctx->yieldHandler(ctx);
@@ -109,14 +180,43 @@ void phev_service_start(phevServiceCtx_t *ctx)
     }
     LOG_V(TAG, "END - start");
 }
+void phev_service_close(phevServiceCtx_t *ctx)
+{
+    LOG_V(TAG, "START - close");
+
+    // Stops the broker thread and removes its socket
+    if (ctx->broker)
+    {
+        phev_broker_destroy(ctx->broker);
+        ctx->broker = NULL;
+    }
+    if (ctx->snapshot)
+    {
+        phev_model_removeListener(ctx->model, phev_snapshot_modelListener, ctx->snapshot);
+        phev_snapshot_close(ctx->snapshot);
+        ctx->snapshot = NULL;
+    }
+    if (ctx->journal)
+    {
+        phev_model_removeListener(ctx->model, phev_journal_modelListener, ctx->journal);
+        phev_journal_close(ctx->journal);
+        ctx->journal = NULL;
+    }
+    LOG_V(TAG, "END - close");
+}
 phevServiceCtx_t *phev_service_init(messagingClient_t *in, messagingClient_t *out, bool registerDevice)
 {
     LOG_V(TAG, "START - init");
 
-    phevServiceCtx_t *ctx = malloc(sizeof(phevServiceCtx_t));
+    phevServiceCtx_t *ctx = phev_malloc(sizeof(phevServiceCtx_t));
 
     LOG_D(TAG, "Creating model and pipe");
     ctx->model = phev_model_create();
+    ctx->history = NULL;
+    ctx->snapshot = NULL;
+    ctx->journal = NULL;
+    ctx->broker = NULL;
+    ctx->snapshotMaxAge = PHEV_SERVICE_SNAPSHOT_MAX_AGE;
     ctx->registerDevice = registerDevice;
     ctx->pipe = phev_service_createPipe(ctx, in, out);
     ctx->pipe->ctx = ctx;
@@ -128,6 +228,7 @@ messageBundle_t *phev_service_inputSplitter(void *ctx, message_t *message)
 {
     LOG_V(TAG, "START - inputSplitter");
 
+    // Freed by msg_pipe with plain free, not through the allocator
     messageBundle_t *messages = malloc(sizeof(messageBundle_t));
     messages->numMessages = 0;
     cJSON *command = NULL;
@@ -137,6 +238,7 @@ messageBundle_t *phev_service_inputSplitter(void *ctx, message_t *message)
     if (!json)
     {
         LOG_W(TAG, "Not valid JSON");
+        free(messages);
         return NULL;
     }
 
@@ -145,14 +247,30 @@ messageBundle_t *phev_service_inputSplitter(void *ctx, message_t *message)
     if (!requests)
     {
         LOG_W(TAG, "Not valid JSON requests");
+        cJSON_Delete(json);
+        free(messages);
         return NULL;
     }
 
+    const size_t maxMessages = sizeof(messages->messages) / sizeof(messages->messages[0]);
+
     cJSON_ArrayForEach(command, requests)
     {
-        const char *out = cJSON_Print(command);
+        if (messages->numMessages >= maxMessages)
+        {
+            LOG_W(TAG, "More than %zu requests, dropping the rest", maxMessages);
+            break;
+        }
+        char *out = cJSON_Print(command);
+
+        if (out == NULL)
+        {
+            break;
+        }
         messages->messages[messages->numMessages++] = msg_utils_createMsg((uint8_t *)out, strlen(out) + 1);
+        phev_free(out);
     }
+    cJSON_Delete(json);
 
     LOG_V(TAG, "END - inputSplitter");
 
@@ -205,14 +323,14 @@ bool phev_service_outputFilter(void *ctx, message_t *message)
     if ((phevMessage.command == PING_RESP_CMD )|| (phevMessage.command == START_RESP))
     {
         LOG_D(TAG, "Not sending ping or start response");
-        free(phevMessage.data);
+        phev_free(phevMessage.data);
         return true;
     }
     LOG_D(TAG, "Reg %d", phevMessage.reg);
 
     if (phevMessage.command == RESP_CMD && phevMessage.type == REQUEST_TYPE)
     {
-        phevRegister_t *reg = phev_model_getRegister(serviceCtx->model, phevMessage.reg);
+        const phevRegister_t *reg = phev_model_peekRegister(serviceCtx->model, phevMessage.reg);
 
         if (reg)
         {
@@ -227,16 +345,22 @@ bool phev_service_outputFilter(void *ctx, message_t *message)
 
                 phev_model_setRegister(serviceCtx->model, phevMessage.reg, phevMessage.data, phevMessage.length);
 
-                free(phevMessage.data);
+                phev_free(phevMessage.data);
 
                 return true;
             }
             LOG_D(TAG, "Is same %d", same);
-            free(phevMessage.data);
-            phevPipeEvent_t *event = malloc(sizeof(phevPipeEvent_t));
+            phev_free(phevMessage.data);
+
+            // The car still reports it, so the value restored or stored earlier is current
+            phev_snapshot_touch(serviceCtx->snapshot, phevMessage.reg, time(NULL));
+
+            phevPipeEvent_t *event = phev_malloc(sizeof(phevPipeEvent_t));
             event->data = NULL;
             event->event = PHEV_PIPE_FILTERED_MESSAGE;
             event->length = 0;
+            phev_metrics_add(&((phev_pipe_ctx_t *) ctx)->metrics, PHEV_METRIC_FILTERED, 1);
+            PHEV_TRACE(((phev_pipe_ctx_t *) ctx)->trace, PHEV_TRACE_FRAME_FILTERED, phevMessage.command, phevMessage.reg, phevMessage.XOR, 0);
             phev_pipe_sendEventToHandlers((phev_pipe_ctx_t *) ctx, event);
 
             return false;
@@ -248,7 +372,7 @@ bool phev_service_outputFilter(void *ctx, message_t *message)
             phev_model_setRegister(serviceCtx->model, phevMessage.reg, phevMessage.data, phevMessage.length);
         }
     }
-    free(phevMessage.data);
+    phev_free(phevMessage.data);
 
     LOG_V(TAG, "END - outputFilter");
 
@@ -312,7 +436,7 @@ uint8_t *phev_service_getJsonByteArray(cJSON *json, char *option, uint8_t **data
             {
                 if (phev_service_checkByte(value->valueint))
                 {
-                    *data = malloc(1);
+                    *data = phev_malloc(1);
                     *data[0] = value->valueint;
                     return *data;
                 }
@@ -356,15 +480,8 @@ bool phev_service_validateCheckOnOrOff(const char *str)
 
     return false;
 }
-bool phev_service_validateCommand(const char *command)
+static bool phev_service_validateCommandJson(const cJSON *json)
 {
-    cJSON *json = cJSON_Parse(command);
-
-    if (json == NULL)
-    {
-        return false;
-    }
-
     cJSON *update = cJSON_GetObjectItemCaseSensitive(json, PHEV_SERVICE_UPDATE_REGISTER_JSON);
 
     cJSON *operation = cJSON_GetObjectItemCaseSensitive(json, PHEV_SERVICE_OPERATION_JSON);
@@ -383,6 +500,12 @@ bool phev_service_validateCommand(const char *command)
             }
             if (cJSON_IsArray(value))
             {
+                int size = cJSON_GetArraySize(value);
+
+                if (size == 0 || size > PHEV_CORE_MAX_DATA)
+                {
+                    return false;
+                }
                 cJSON *val = NULL;
                 cJSON_ArrayForEach(val, value)
                 {
@@ -425,6 +548,20 @@ bool phev_service_validateCommand(const char *command)
 
     return false;
 }
+bool phev_service_validateCommand(const char *command)
+{
+    cJSON *json = cJSON_Parse(command);
+
+    if (json == NULL)
+    {
+        return false;
+    }
+    bool valid = phev_service_validateCommandJson(json);
+
+    cJSON_Delete(json);
+
+    return valid;
+}
 phevMessage_t *phev_service_updateRegisterHandler(cJSON *update)
 {
     if (update == NULL)
@@ -450,7 +587,13 @@ phevMessage_t *phev_service_updateRegisterHandler(cJSON *update)
         //printf("Is array");
         cJSON *val = NULL;
         size_t size = cJSON_GetArraySize(value);
-        uint8_t *data = malloc(size);
+
+        if (size == 0 || size > PHEV_CORE_MAX_DATA)
+        {
+            LOG_W(TAG, "Update register has %zu values", size);
+            return NULL;
+        }
+        uint8_t *data = phev_malloc(size);
         int i = 0;
         cJSON_ArrayForEach(val, value)
         {
@@ -464,11 +607,15 @@ phevMessage_t *phev_service_updateRegisterHandler(cJSON *update)
             else
             {
                 LOG_W(TAG, "Update register has invalid value");
+                phev_free(data);
                 return NULL;
             }
         }
+        phevMessage_t *message = phev_core_commandMessage(reg->valueint, data, size);
 
-        return phev_core_commandMessage(reg->valueint, data, size);
+        phev_free(data);
+
+        return message;
     }
     else
     {
@@ -539,6 +686,7 @@ phevMessage_t *phev_service_jsonCommandToPhevMessage(const char *command)
     if (phev_service_validateCommand(command))
     {
         cJSON *json = cJSON_Parse(command);
+        phevMessage_t *message = NULL;
 
         cJSON *update = cJSON_GetObjectItemCaseSensitive(json, PHEV_SERVICE_UPDATE_REGISTER_JSON);
 
@@ -546,12 +694,15 @@ phevMessage_t *phev_service_jsonCommandToPhevMessage(const char *command)
 
         if (update)
         {
-            return phev_service_updateRegisterHandler(update);
+            message = phev_service_updateRegisterHandler(update);
         }
-        if (operation)
+        else if (operation)
         {
-            return phev_service_operationHandler(operation);
+            message = phev_service_operationHandler(operation);
         }
+        cJSON_Delete(json);
+
+        return message;
     }
     else
     {
@@ -725,7 +876,7 @@ message_t *phev_service_jsonOutputTransformer(void *ctx, message_t *message)
         message_t * ret = phev_pipe_outputEventTransformer(ctx, message);
         msg_utils_destroyMsg(ret);
     }
-    phevMessage_t *phevMessage = malloc(sizeof(phevMessage_t));
+    phevMessage_t *phevMessage = phev_malloc(sizeof(phevMessage_t));
 
     phev_core_decodeMessage(message->data, message->length, phevMessage);
     char *output;
@@ -792,109 +943,97 @@ message_t *phev_service_jsonOutputTransformer(void *ctx, message_t *message)
     LOG_BUFFER_HEXDUMP(TAG, outputMessage->data, outputMessage->length, LOG_DEBUG);
     cJSON_Delete(response);
     phev_core_destroyMessage(phevMessage);
-    free(output);
+    phev_free(output);
     LOG_V(TAG, "END - jsonOutputTransformer");
 
     return outputMessage;
 }
+// Schema model bits for the session's profile, every field when there is no pipe yet.
+static uint8_t phev_service_models(const phevServiceCtx_t *ctx)
+{
+    return (ctx->pipe && ctx->pipe->profile ? ctx->pipe->profile->models : PHEV_SCHEMA_MODEL_ANY);
+}
 int phev_service_getBatteryLevel(phevServiceCtx_t *ctx)
 {
     LOG_V(TAG, "START - getBatteryLevel");
 
-    phevRegister_t *reg = phev_model_getRegister(ctx->model, KO_WF_BATT_LEVEL_INFO_REP_EVR);
+    int32_t level;
+
+    bool found = phev_schema_batterySoc(ctx->model, phev_service_models(ctx), &level);
 
     LOG_V(TAG, "END - getBatteryLevel");
-    return (reg ? (int )reg->data[0] : -1);
+    return (found ? (int) level : -1);
 }
 
 int phev_service_getBatteryWarning(phevServiceCtx_t *ctx)
 {
     LOG_V(TAG, "START - getBatteryWarning");
 
-    phevRegister_t *reg = phev_model_getRegister(ctx->model, KO_WF_CHG_GUN_STATUS_EVR);
+    int32_t warning;
+
+    bool found = phev_schema_batteryWarning(ctx->model, phev_service_models(ctx), &warning);
 
     LOG_V(TAG, "END - getBatteryWarning");
-    return (reg ? (int )reg->data[2] : -1);
+    return (found ? (int) warning : -1);
 }
 
 int phev_service_getACError(phevServiceCtx_t *ctx)
 {
     LOG_V(TAG, "START - getAccWarning");
 
-    phevRegister_t *reg = phev_model_getRegister(ctx->model, 16);
+    int32_t error;
+
+    bool found = phev_schema_acError(ctx->model, phev_service_models(ctx), &error);
 
     LOG_V(TAG, "END - getAccWarning");
-    return (reg ? (int )reg->data[0] : -1);
+    return (found ? (int) error : -1);
 }
 
 int phev_service_doorIsLocked(phevServiceCtx_t *ctx)
 {
     LOG_V(TAG, "START - doorIsLocked");
 
-    phevRegister_t *reg = phev_model_getRegister(ctx->model, KO_WF_DOOR_STATUS_INFO_REP_EVR);
+    int32_t locked;
+
+    bool found = phev_schema_doorLock(ctx->model, phev_service_models(ctx), &locked);
 
     LOG_V(TAG, "END - doorIsLocked");
-    return (reg ? (int )reg->data[0] : -1);
+    return (found ? (int) locked : -1);
 }
 char *phev_service_statusAsJson(phevServiceCtx_t *ctx)
 {
 
     LOG_V(TAG, "START - statusAsJson");
     cJSON *json = cJSON_CreateObject();
-    cJSON *status = cJSON_CreateObject();
-    cJSON *battery = cJSON_CreateObject();
-    cJSON *date = cJSON_CreateObject();
+    cJSON *status = phev_schema_toJson(ctx->model, phev_service_models(ctx));
 
-    if (json && status && battery)
+    if (json && status)
     {
-        LOG_I(TAG, "Battery Request");
-
-        int battLevel = phev_service_getBatteryLevel(ctx);
-
-        LOG_I(TAG, "Battery level %d", battLevel);
+        cJSON *battery = cJSON_GetObjectItemCaseSensitive(status, PHEV_SERVICE_BATTERY_JSON);
 
-        if (battLevel >= 0)
+        if (battery == NULL)
         {
-            cJSON *level = cJSON_CreateNumber((double)battLevel);
-            cJSON_AddItemToObject(battery, PHEV_SERVICE_BATTERY_SOC_JSON, level);
+            battery = cJSON_CreateObject();
+            cJSON_AddItemToObject(status, PHEV_SERVICE_BATTERY_JSON, battery);
+        }
+        if (cJSON_GetObjectItemCaseSensitive(battery, PHEV_SERVICE_BATTERY_SOC_JSON) && phev_service_isStale(ctx, KO_WF_BATT_LEVEL_INFO_REP_EVR))
+        {
+            cJSON_AddItemToObject(battery, PHEV_SERVICE_STALE_JSON, cJSON_CreateTrue());
         }
-        cJSON_AddItemToObject(status, PHEV_SERVICE_BATTERY_JSON, battery);
         cJSON_AddItemToObject(json, PHEV_SERVICE_STATUS_JSON, status);
 
+        // Not a field, the date is formatted from the whole register
         char * dateStr = phev_service_getDateSync(ctx);
 
         if(dateStr)
         {
-            date->valuestring = dateStr;
             cJSON_AddStringToObject(status, PHEV_SERVICE_DATE_SYNC_JSON, dateStr);
-        }
-
-        if(phev_service_getChargingStatus(ctx))
-        {
-            cJSON * chargingRemain = cJSON_CreateNumber((double) phev_service_getRemainingChargeTime(ctx));
-            cJSON * charging = phev_service_getChargingStatus(ctx) ? cJSON_CreateTrue() : cJSON_CreateFalse();
-            cJSON_AddItemToObject(battery,PHEV_SERVICE_CHARGE_REMAIN_JSON, chargingRemain);
-            cJSON_AddItemToObject(battery,PHEV_SERVICE_CHARGING_STATUS_JSON,charging);
-        }
-
-        phevServiceHVAC_t * hvac = phev_service_getHVACStatus(ctx);
-
-        if(hvac)
-        {
-            cJSON * hvacStatus = cJSON_CreateObject();
-            cJSON_AddItemToObject(hvacStatus, PHEV_SERVICE_HVAC_OPERATING_JSON, hvac->operating ? cJSON_CreateTrue() : cJSON_CreateFalse());
-            cJSON * mode = cJSON_CreateNumber((double) ((uint8_t) hvac->mode & 0x0f));
-            cJSON * time = cJSON_CreateNumber((double) ((uint8_t) (hvac->mode & 0xf0) >> 4));
-            cJSON_AddItemToObject(hvacStatus, PHEV_SERVICE_HVAC_MODE_JSON, mode);
-            cJSON_AddItemToObject(hvacStatus, PHEV_SERVICE_HVAC_TIME_JSON, time);
-            cJSON_AddItemToObject(status,PHEV_SERVICE_HVAC_STATUS_JSON,hvacStatus);
-
+            phev_free(dateStr);
         }
 
         char *out = cJSON_Print(json);
 
         cJSON_Delete(json);
-        //LOG_I(TAG, "Return json %s", out);
         LOG_V(TAG, "END - statusAsJson");
 
         return out;
@@ -902,11 +1041,89 @@ char *phev_service_statusAsJson(phevServiceCtx_t *ctx)
     else
     {
         LOG_E(TAG, "Error creating status json obejcts");
+        cJSON_Delete(json);
+        cJSON_Delete(status);
         LOG_V(TAG, "END - statusAsJson");
 
         return NULL;
     }
 }
+static cJSON * phev_service_histogramAsJson(const phevHistogram_t * histogram)
+{
+    cJSON * json = cJSON_CreateObject();
+    cJSON * buckets = cJSON_CreateArray();
+    uint64_t highest = 0;
+    uint32_t count = 0;
+
+    cJSON_AddNumberToObject(json, "count", (double) phev_histogram_count(histogram));
+    cJSON_AddNumberToObject(json, "min", (double) phev_histogram_min(histogram));
+    cJSON_AddNumberToObject(json, "mean", phev_histogram_mean(histogram));
+    cJSON_AddNumberToObject(json, "p50", (double) phev_histogram_percentile(histogram, 50));
+    cJSON_AddNumberToObject(json, "p90", (double) phev_histogram_percentile(histogram, 90));
+    cJSON_AddNumberToObject(json, "p99", (double) phev_histogram_percentile(histogram, 99));
+    cJSON_AddNumberToObject(json, "p999", (double) phev_histogram_percentile(histogram, 99.9));
+    cJSON_AddNumberToObject(json, "max", (double) phev_histogram_max(histogram));
+
+    // Highest value of each bucket with its count, enough to merge sessions or work out other percentiles
+    for (int i = 0; (i = phev_histogram_nextBucket(histogram, i, &highest, &count)) >= 0; )
+    {
+        cJSON * bucket = cJSON_CreateArray();
+
+        cJSON_AddItemToArray(bucket, cJSON_CreateNumber((double) highest));
+        cJSON_AddItemToArray(bucket, cJSON_CreateNumber((double) count));
+        cJSON_AddItemToArray(buckets, bucket);
+    }
+    cJSON_AddItemToObject(json, "buckets", buckets);
+
+    return json;
+}
+static void * phev_service_jsonMalloc(size_t size)
+{
+    return phev_alloc_malloc(size, "cJSON");
+}
+static void phev_service_jsonFree(void *ptr)
+{
+    phev_alloc_free(ptr);
+}
+void phev_service_useAllocator(void)
+{
+    cJSON_Hooks hooks = {
+        .malloc_fn = phev_service_jsonMalloc,
+        .free_fn = phev_service_jsonFree,
+    };
+    cJSON_InitHooks(&hooks);
+}
+char *phev_service_latencyAsJson(phevServiceCtx_t *ctx)
+{
+    LOG_V(TAG, "START - latencyAsJson");
+
+    const char * names[PHEV_PIPE_LATENCY_MAX] = {
+        [PHEV_PIPE_LATENCY_COMMAND_ACK] = PHEV_SERVICE_LATENCY_COMMAND_ACK_JSON,
+        [PHEV_PIPE_LATENCY_REQUEST_ACK] = PHEV_SERVICE_LATENCY_REQUEST_ACK_JSON,
+        [PHEV_PIPE_LATENCY_PING_RTT] = PHEV_SERVICE_LATENCY_PING_RTT_JSON,
+        [PHEV_PIPE_LATENCY_RECONNECT] = PHEV_SERVICE_LATENCY_RECONNECT_JSON,
+    };
+    cJSON *json = cJSON_CreateObject();
+
+    if (json == NULL)
+    {
+        LOG_E(TAG, "Error creating latency json object");
+        return NULL;
+    }
+    cJSON_AddStringToObject(json, "unit", "us");
+
+    for (int i = 0; i < PHEV_PIPE_LATENCY_MAX; i++)
+    {
+        cJSON_AddItemToObject(json, names[i], phev_service_histogramAsJson(phev_pipe_getLatency(ctx->pipe, (phevPipeLatency_t) i)));
+    }
+
+    char *out = cJSON_Print(json);
+
+    cJSON_Delete(json);
+    LOG_V(TAG, "END - latencyAsJson");
+
+    return out;
+}
 
 void phev_service_loop(phevServiceCtx_t *ctx)
 {
@@ -1015,6 +1232,7 @@ char *phev_service_getRegisterJson(const phevServiceCtx_t *ctx, const uint8_t re
 
         cJSON_AddItemToObject(json, PHEV_SERVICE_REGISTER_JSON, regJson);
         cJSON_AddItemToObject(json, PHEV_SERVICE_REGISTER_DATA_JSON, data);
+        phev_free(out);
 
         char *ret = cJSON_PrintUnformatted(json);
         cJSON_Delete(json);
@@ -1040,70 +1258,191 @@ void phev_service_setRegister(const phevServiceCtx_t *ctx, const uint8_t reg, co
 char * phev_service_getDateSync(const phevServiceCtx_t * ctx)
 {
     LOG_V(TAG,"START - getDateSync");
-    phevRegister_t * reg = phev_model_getRegister(ctx->model,KO_WF_DATE_INFO_SYNC_EVR);
+    char * date = NULL;
+    uint32_t epoch = phev_model_enterRead(ctx->model);
+
+    const phevRegister_t * reg = phev_model_peekRegister(ctx->model,KO_WF_DATE_INFO_SYNC_EVR);
     if(reg)
     {
-        char * date;
-        asprintf(&date,"20%02d-%02d-%02dT%02d:%02d:%02dZ",reg->data[0],reg->data[1],reg->data[2],reg->data[3],reg->data[4],reg->data[5]);
-        return date;
+        date = phev_asprintf("20%02d-%02d-%02dT%02d:%02d:%02dZ",reg->data[0],reg->data[1],reg->data[2],reg->data[3],reg->data[4],reg->data[5]);
     }
-    return NULL;
+    phev_model_exitRead(ctx->model, epoch);
+
+    return date;
 }
 bool phev_service_getChargingStatus(const phevServiceCtx_t * ctx)
 {
     LOG_V(TAG,"START - getChargingStatus");
-    phevRegister_t * reg = phev_model_getRegister(ctx->model,KO_WF_OBCHG_OK_ON_INFO_REP_EVR);
-    if(reg)
-    {
-        LOG_V(TAG,"END- getChargingStatus");
 
-        return reg->data[0] == 1;
-    }
+    int32_t charging;
+
+    bool found = phev_schema_charging(ctx->model, phev_service_models(ctx), &charging);
+
     LOG_V(TAG,"END - getChargingStatus");
 
-    return false;
+    return found && charging == 1;
 }
 int phev_service_getRemainingChargeTime(const phevServiceCtx_t * ctx)
 {
     LOG_V(TAG,"START - getRemainingChargingTime");
-    phevRegister_t * reg = phev_model_getRegister(ctx->model, KO_WF_OBCHG_OK_ON_INFO_REP_EVR);
-    if(reg && reg->data[2] != 255)
-    {
-        uint8_t high = reg->data[1];
-        uint8_t low = reg->data[2];
 
-        return ((low < 0 ? low + 0x100 : low) * 0x100) + (high < 0 ? high + 0x100 : high);
-    }
+    int32_t remaining;
 
-    return 0;
+    bool found = phev_schema_chargeRemaining(ctx->model, phev_service_models(ctx), &remaining);
+
+    LOG_V(TAG,"END - getRemainingChargingTime");
+
+    return (found ? (int) remaining : 0);
 }
 
 phevServiceHVAC_t * phev_service_getHVACStatus(const phevServiceCtx_t * ctx)
 {
-    phevRegister_t * acOperatingReg = phev_model_getRegister(ctx->model, KO_AC_MANUAL_SW_EVR);
+    int32_t operating = 0;
+    int32_t mode = 0;
+    int32_t time = 0;
+    uint8_t models = phev_service_models(ctx);
 
-    phevRegister_t * acModeReg = phev_model_getRegister(ctx->model, KO_WF_TM_AC_STAT_INFO_REP_EVR);
+    bool hasOperating = phev_schema_hvacOperating(ctx->model, models, &operating);
+    bool hasMode = phev_schema_hvacMode(ctx->model, models, &mode);
 
-    if(acOperatingReg || acModeReg)
+    if(hasOperating || hasMode)
     {
-        phevServiceHVAC_t * hvac = malloc(sizeof(phevServiceHVAC_t));
-        if(acOperatingReg)
-        {
-            hvac->operating = acOperatingReg->data[1] == true;
-            hvac->operating = acOperatingReg->data[1] == true;
-        } else {
-            hvac->operating = false;
-        }
-        if(acModeReg)
-        {
-            hvac->mode = acModeReg->data[0];
-        } else {
-            hvac->mode = 0;
-        }
+        phevServiceHVAC_t * hvac = phev_malloc(sizeof(phevServiceHVAC_t));
+
+        phev_schema_hvacTime(ctx->model, models, &time);
+
+        hvac->operating = operating == 1;
+        hvac->mode = (uint8_t) (mode | (time << 4));
+
         return hvac;
     }
     return NULL;
 }
+static void phev_service_readVehicleState(const phevModel_t * model, uint8_t models, phevVehicleState_t * state)
+{
+    int32_t value;
+
+    state->present = 0;
+
+    state->batteryLevel = -1;
+    if(phev_schema_batterySoc(model, models, &value))
+    {
+        state->batteryLevel = value;
+        state->present |= PHEV_STATE_BATTERY_LEVEL;
+    }
+    state->batteryWarning = -1;
+    if(phev_schema_batteryWarning(model, models, &value))
+    {
+        state->batteryWarning = value;
+        state->present |= PHEV_STATE_BATTERY_WARNING;
+    }
+    state->charging = false;
+    if(phev_schema_charging(model, models, &value))
+    {
+        state->charging = value == 1;
+        state->present |= PHEV_STATE_CHARGING;
+    }
+    state->remainingChargeTime = 0;
+    if(phev_schema_chargeRemaining(model, models, &value))
+    {
+        state->remainingChargeTime = value;
+        state->present |= PHEV_STATE_CHARGE_REMAINING;
+    }
+    state->locked = -1;
+    if(phev_schema_doorLock(model, models, &value))
+    {
+        state->locked = value;
+        state->present |= PHEV_STATE_LOCKED;
+    }
+    state->hvacOperating = false;
+    if(phev_schema_hvacOperating(model, models, &value))
+    {
+        state->hvacOperating = value == 1;
+        state->present |= PHEV_STATE_HVAC_OPERATING;
+    }
+    state->hvacMode = 0;
+    if(phev_schema_hvacMode(model, models, &value))
+    {
+        state->hvacMode = (uint8_t) value;
+        state->present |= PHEV_STATE_HVAC_MODE;
+    }
+    state->hvacTime = 0;
+    if(phev_schema_hvacTime(model, models, &value))
+    {
+        state->hvacTime = (uint8_t) value;
+        state->present |= PHEV_STATE_HVAC_TIME;
+    }
+    state->acError = -1;
+    if(phev_schema_acError(model, models, &value))
+    {
+        state->acError = value;
+        state->present |= PHEV_STATE_AC_ERROR;
+    }
+}
+void phev_service_getVehicleState(const phevServiceCtx_t * ctx, phevVehicleState_t * state)
+{
+    LOG_V(TAG,"START - getVehicleState");
+
+    uint32_t version;
+    uint8_t models = phev_service_models(ctx);
+
+    // The registers stay put for the whole read, the version tells whether they all came from one write
+    uint32_t epoch = phev_model_enterRead(ctx->model);
+    do
+    {
+        version = phev_model_beginRead(ctx->model);
+        phev_service_readVehicleState(ctx->model, models, state);
+    } while(!phev_model_endRead(ctx->model, version));
+    phev_model_exitRead(ctx->model, epoch);
+
+    state->structVersion = PHEV_VEHICLE_STATE_VERSION;
+    state->modelVersion = version;
+
+    LOG_V(TAG,"END - getVehicleState");
+}
+uint32_t phev_service_compareVehicleState(const phevVehicleState_t * previous, const phevVehicleState_t * current)
+{
+    uint32_t changed = 0;
+
+    if(previous == NULL || current == NULL || previous->structVersion != current->structVersion)
+    {
+        return PHEV_STATE_ALL;
+    }
+    if(previous->modelVersion == current->modelVersion)
+    {
+        return 0;
+    }
+
+    changed |= (previous->present ^ current->present);
+
+    if(previous->batteryLevel != current->batteryLevel) changed |= PHEV_STATE_BATTERY_LEVEL;
+    if(previous->batteryWarning != current->batteryWarning) changed |= PHEV_STATE_BATTERY_WARNING;
+    if(previous->charging != current->charging) changed |= PHEV_STATE_CHARGING;
+    if(previous->remainingChargeTime != current->remainingChargeTime) changed |= PHEV_STATE_CHARGE_REMAINING;
+    if(previous->locked != current->locked) changed |= PHEV_STATE_LOCKED;
+    if(previous->hvacOperating != current->hvacOperating) changed |= PHEV_STATE_HVAC_OPERATING;
+    if(previous->hvacMode != current->hvacMode) changed |= PHEV_STATE_HVAC_MODE;
+    if(previous->hvacTime != current->hvacTime) changed |= PHEV_STATE_HVAC_TIME;
+    if(previous->acError != current->acError) changed |= PHEV_STATE_AC_ERROR;
+
+    return changed;
+}
+const phevHistory_t * phev_service_getHistory(const phevServiceCtx_t * ctx)
+{
+    return ctx->history;
+}
+int64_t phev_service_getRegisterAge(const phevServiceCtx_t * ctx, uint8_t reg)
+{
+    return phev_snapshot_age(ctx->snapshot, reg, time(NULL));
+}
+bool phev_service_isStale(const phevServiceCtx_t * ctx, uint8_t reg)
+{
+    if(ctx->snapshot == NULL)
+    {
+        return false;
+    }
+    return phev_snapshot_isStale(ctx->snapshot, reg, time(NULL), ctx->snapshotMaxAge);
+}
 void phev_service_disconnectInput(phevServiceCtx_t * ctx)
 {
     LOG_V(TAG,"START - disconnectInput");
@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include "phev_snapshot.h"
+#include "phev_alloc.h"
+#include "phev_log.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define PHEV_SNAPSHOT_MMAP
+#endif
+
+const static char *TAG = "PHEV_SNAPSHOT";
+
+static uint32_t phev_snapshot_hash(uint32_t hash, const void * data, size_t length)
+{
+    const uint8_t * p = data;
+
+    for(size_t i = 0; i < length; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+static uint32_t phev_snapshot_headerChecksum(const phevSnapshotHeader_t * header)
+{
+    uint32_t hash = 2166136261u;
+
+    hash = phev_snapshot_hash(hash, &header->magic, sizeof(header->magic));
+    hash = phev_snapshot_hash(hash, &header->version, sizeof(header->version));
+    hash = phev_snapshot_hash(hash, &header->slotSize, sizeof(header->slotSize));
+    hash = phev_snapshot_hash(hash, header->vin, sizeof(header->vin));
+
+    return hash;
+}
+static uint32_t phev_snapshot_slotChecksum(const phevSnapshotSlot_t * slot)
+{
+    uint32_t hash = 2166136261u;
+
+    hash = phev_snapshot_hash(hash, &slot->updated, sizeof(slot->updated));
+    hash = phev_snapshot_hash(hash, &slot->length, sizeof(slot->length));
+    hash = phev_snapshot_hash(hash, slot->data, slot->length);
+
+    return hash;
+}
+static bool phev_snapshot_slotValid(const phevSnapshotSlot_t * slot)
+{
+    return slot->length > 0 && slot->length <= PHEV_SNAPSHOT_MAX_DATA && slot->checksum == phev_snapshot_slotChecksum(slot);
+}
+static bool phev_snapshot_headerValid(const phevSnapshotHeader_t * header)
+{
+    return header->magic == PHEV_SNAPSHOT_MAGIC
+        && header->version == PHEV_SNAPSHOT_VERSION
+        && header->slotSize == sizeof(phevSnapshotSlot_t)
+        && header->checksum == phev_snapshot_headerChecksum(header);
+}
+static void phev_snapshot_reset(phevSnapshot_t * snapshot, const char * vin)
+{
+    phevSnapshotHeader_t * header = &snapshot->file->header;
+
+    LOG_I(TAG,"Resetting snapshot for VIN %s",(vin ? vin : "unknown"));
+
+    memset(snapshot->file->slots, 0, sizeof(snapshot->file->slots));
+    memset(header, 0, sizeof(phevSnapshotHeader_t));
+
+    header->magic = PHEV_SNAPSHOT_MAGIC;
+    header->version = PHEV_SNAPSHOT_VERSION;
+    header->slotSize = sizeof(phevSnapshotSlot_t);
+    if(vin)
+    {
+        strncpy(header->vin, vin, VIN_LEN);
+    }
+    header->checksum = phev_snapshot_headerChecksum(header);
+}
+phevSnapshot_t * phev_snapshot_open(const char * path, const char * vin)
+{
+    LOG_V(TAG,"START - open");
+#ifdef PHEV_SNAPSHOT_MMAP
+    if(path == NULL)
+    {
+        LOG_E(TAG,"No snapshot path");
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+
+    if(fd < 0)
+    {
+        LOG_E(TAG,"Cannot open snapshot %s",path);
+        return NULL;
+    }
+
+    struct stat st;
+
+    if(fstat(fd, &st) < 0 || (st.st_size != sizeof(phevSnapshotFile_t) && ftruncate(fd, sizeof(phevSnapshotFile_t)) < 0))
+    {
+        LOG_E(TAG,"Cannot size snapshot %s",path);
+        close(fd);
+        return NULL;
+    }
+
+    void * map = mmap(NULL, sizeof(phevSnapshotFile_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(map == MAP_FAILED)
+    {
+        LOG_E(TAG,"Cannot map snapshot %s",path);
+        close(fd);
+        return NULL;
+    }
+
+    phevSnapshot_t * snapshot = phev_malloc(sizeof(phevSnapshot_t));
+
+    snapshot->fd = fd;
+    snapshot->file = map;
+    memset(snapshot->restored, 0, sizeof(snapshot->restored));
+
+    if(!phev_snapshot_headerValid(&snapshot->file->header))
+    {
+        LOG_W(TAG,"Snapshot %s has no valid header",path);
+        phev_snapshot_reset(snapshot, vin);
+    }
+    else
+    {
+        phev_snapshot_setVin(snapshot, vin);
+    }
+
+    LOG_V(TAG,"END - open");
+
+    return snapshot;
+#else
+    LOG_W(TAG,"Snapshots are not supported on this platform");
+    return NULL;
+#endif
+}
+void phev_snapshot_close(phevSnapshot_t * snapshot)
+{
+#ifdef PHEV_SNAPSHOT_MMAP
+    if(snapshot)
+    {
+        msync(snapshot->file, sizeof(phevSnapshotFile_t), MS_SYNC);
+        munmap(snapshot->file, sizeof(phevSnapshotFile_t));
+        close(snapshot->fd);
+        phev_free(snapshot);
+    }
+#endif
+}
+bool phev_snapshot_setVin(phevSnapshot_t * snapshot, const char * vin)
+{
+    if(snapshot == NULL || vin == NULL)
+    {
+        return false;
+    }
+    phevSnapshotHeader_t * header = &snapshot->file->header;
+
+    if(strncmp(header->vin, vin, VIN_LEN) == 0)
+    {
+        return false;
+    }
+    if(header->vin[0] == '\0')
+    {
+        LOG_I(TAG,"Snapshot taken as VIN %s",vin);
+        strncpy(header->vin, vin, VIN_LEN);
+        header->checksum = phev_snapshot_headerChecksum(header);
+        return false;
+    }
+    LOG_W(TAG,"Snapshot VIN %s does not match %s",snapshot->file->header.vin,vin);
+    phev_snapshot_reset(snapshot, vin);
+
+    return true;
+}
+int phev_snapshot_load(phevSnapshot_t * snapshot, phevModel_t * model)
+{
+    LOG_V(TAG,"START - load");
+
+    int loaded = 0;
+
+    if(snapshot == NULL || model == NULL)
+    {
+        return 0;
+    }
+
+    for(int reg = 0; reg < PHEV_SNAPSHOT_REGISTERS; reg++)
+    {
+        const phevSnapshotSlot_t * slot = &snapshot->file->slots[reg];
+
+        if(slot->length == 0)
+        {
+            continue;
+        }
+        if(!phev_snapshot_slotValid(slot))
+        {
+            LOG_W(TAG,"Snapshot slot for register %d is corrupt",reg);
+            continue;
+        }
+        phev_model_setRegister(model, (uint8_t) reg, slot->data, slot->length);
+        snapshot->restored[reg] = true;
+        loaded++;
+    }
+
+    LOG_I(TAG,"Restored %d registers from snapshot",loaded);
+    LOG_V(TAG,"END - load");
+
+    return loaded;
+}
+int phev_snapshot_unload(phevSnapshot_t * snapshot, phevModel_t * model)
+{
+    int cleared = 0;
+
+    if(snapshot == NULL || model == NULL)
+    {
+        return 0;
+    }
+
+    for(int reg = 0; reg < PHEV_SNAPSHOT_REGISTERS; reg++)
+    {
+        if(!snapshot->restored[reg])
+        {
+            continue;
+        }
+        snapshot->restored[reg] = false;
+        cleared += phev_model_clearRegister(model, (uint8_t) reg);
+    }
+
+    LOG_I(TAG,"Cleared %d restored registers from the model",cleared);
+
+    return cleared;
+}
+bool phev_snapshot_store(phevSnapshot_t * snapshot, uint8_t reg, const uint8_t * data, size_t length, time_t now)
+{
+    if(snapshot == NULL || data == NULL || length == 0)
+    {
+        return false;
+    }
+    if(length > PHEV_SNAPSHOT_MAX_DATA)
+    {
+        LOG_W(TAG,"Register %d length %zu too long for snapshot",reg,length);
+        return false;
+    }
+
+    phevSnapshotSlot_t * slot = &snapshot->file->slots[reg];
+
+    snapshot->restored[reg] = false;
+    slot->updated = (int64_t) now;
+    slot->length = (uint8_t) length;
+    memcpy(slot->data, data, length);
+    slot->checksum = phev_snapshot_slotChecksum(slot);
+
+    return true;
+}
+bool phev_snapshot_touch(phevSnapshot_t * snapshot, uint8_t reg, time_t now)
+{
+    if(snapshot == NULL)
+    {
+        return false;
+    }
+
+    phevSnapshotSlot_t * slot = &snapshot->file->slots[reg];
+
+    snapshot->restored[reg] = false;
+
+    if(!phev_snapshot_slotValid(slot))
+    {
+        return false;
+    }
+    slot->updated = (int64_t) now;
+    slot->checksum = phev_snapshot_slotChecksum(slot);
+
+    return true;
+}
+int64_t phev_snapshot_age(const phevSnapshot_t * snapshot, uint8_t reg, time_t now)
+{
+    if(snapshot == NULL)
+    {
+        return -1;
+    }
+
+    const phevSnapshotSlot_t * slot = &snapshot->file->slots[reg];
+
+    if(!phev_snapshot_slotValid(slot))
+    {
+        return -1;
+    }
+    return (int64_t) now - slot->updated;
+}
+bool phev_snapshot_isStale(const phevSnapshot_t * snapshot, uint8_t reg, time_t now, int64_t maxAge)
+{
+    int64_t age = phev_snapshot_age(snapshot, reg, now);
+
+    return age < 0 || age > maxAge;
+}
+void phev_snapshot_modelListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx)
+{
+    phev_snapshot_store((phevSnapshot_t *) ctx, reg, data, length, time(NULL));
+}
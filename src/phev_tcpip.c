@@ -5,12 +5,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdatomic.h>
 #if defined(__linux__) || defined(__unix__)
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #endif
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -36,9 +41,10 @@
 
 #endif
 #include "phev_tcpip.h"
+#include "phev_alloc.h"
 #include "phev_core.h"
 #include "msg_utils.h"
-#include "logger.h"
+#include "phev_log.h"
 #ifdef _WIN32
 #define TCP_READ recv
 #define TCP_WRITE send
@@ -59,86 +65,81 @@
 
 const static char *APP_TAG = "PHEV_TCPIP";
 
-const static int loglvl = LOG_DEBUG;
+static _Atomic(phevTcpRxBuffer_t *) rxBuffers[PHEV_TCP_MAX_SOCKETS];
 
-static uint8_t decoded[1024];
 
-uint8_t *xorDataWithValue(const uint8_t *data, uint8_t xor)
+static int tcp_setOption(int soc, int level, int name, int value)
 {
-
-    uint8_t length = (data[1] ^ xor) + 2;
-
-    //  TODO: FIXME: if(length > 1023) return NULL;
-
-    for (int i = 0; i < length; i++)
+#ifdef _WIN32
+    int ret = setsockopt(soc, level, name, (const char *)&value, sizeof(value));
+#else
+    int ret = setsockopt(soc, level, name, &value, sizeof(value));
+#endif
+    if (ret != 0)
     {
-        decoded[i] = data[i] ^ xor;
+        LOG_W(APP_TAG, "Cannot set socket option %d to %d", name, value);
+        return 1;
     }
-    return (uint8_t *) decoded;
+    return 0;
 }
-static uint8_t *decode(const uint8_t *message)
+
+int phev_tcpClientApplyOptions(int soc, const phevTcpOptions_t *options)
 {
-    uint8_t *data = NULL;
-    uint8_t xor = message[2];
-    uint8_t mask = ((message[0] ^ xor) & 0x01);
-    //printf("LEN %d\n",(message[1] ^ xor) + 2);
-    if (xor < 2)
+    int failed = 0;
+
+    if (options == NULL)
     {
-        data = (uint8_t *) message;
+        return 0;
     }
-    else
+    if (options->noDelay)
     {
-        if ((message[0] ^ xor) > 0xe0)
+        failed += tcp_setOption(soc, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+#ifdef TCP_QUICKACK
+    if (options->quickAck)
+    {
+        failed += tcp_setOption(soc, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+#endif
+    if (options->keepAliveIdle > 0)
+    {
+        failed += tcp_setOption(soc, SOL_SOCKET, SO_KEEPALIVE, 1);
+#if defined(TCP_KEEPIDLE)
+        failed += tcp_setOption(soc, IPPROTO_TCP, TCP_KEEPIDLE, options->keepAliveIdle);
+#elif defined(TCP_KEEPALIVE)
+        failed += tcp_setOption(soc, IPPROTO_TCP, TCP_KEEPALIVE, options->keepAliveIdle);
+#endif
+#ifdef TCP_KEEPINTVL
+        if (options->keepAliveInterval > 0)
         {
-            if ((message[0] ^ xor) != 0xf3)
-            {
-                xor ^= mask;
-            }
-            data = xorDataWithValue(message, xor);
+            failed += tcp_setOption(soc, IPPROTO_TCP, TCP_KEEPINTVL, options->keepAliveInterval);
         }
-        else
+#endif
+#ifdef TCP_KEEPCNT
+        if (options->keepAliveCount > 0)
         {
-            xor = (message[2] & 0xfe) ^ ((message[0] & 0x01) ^ 1);
-            data = xorDataWithValue(message, xor);
+            failed += tcp_setOption(soc, IPPROTO_TCP, TCP_KEEPCNT, options->keepAliveCount);
         }
+#endif
     }
-    return data;
-}
-static void phexdump(const char *tag, const unsigned char *buffer, const int length, const int level)
-{
-    if(level == LOG_INFO || level == LOG_NONE) return;
-    if (length <= 0 || buffer == NULL)
-        return;
-    //printf("Len %d\n",length);
-    char out[17];
-    memset(&out, '\0', 17);
-
-    printf("%s: ", tag);
-    int i = 0;
-    for (i = 0; i < length; i++)
-    {
-        printf("%02x ", buffer[i]);
-        out[i % 16] = (isprint(buffer[i]) ? buffer[i] : '.');
-        if ((i + 1) % 8 == 0)
-            printf(" ");
-        if ((i + 1) % 16 == 0)
-        {
-            out[16] = '\0';
-            printf(" | %s |\n%s: ", out, tag);
-        }
+    if (options->receiveBuffer > 0)
+    {
+        failed += tcp_setOption(soc, SOL_SOCKET, SO_RCVBUF, options->receiveBuffer);
+    }
+    if (options->sendBuffer > 0)
+    {
+        failed += tcp_setOption(soc, SOL_SOCKET, SO_SNDBUF, options->sendBuffer);
     }
-    if ((i % 16) + 1 != 0)
+#ifdef TCP_USER_TIMEOUT
+    if (options->userTimeoutMs > 0)
     {
-        int num = (16 - (i % 16)) * 3;
-        num = ((i % 16) < 8 ? num + 1 : num);
-        out[(i % 16)] = '\0';
-        char padding[(16 * 3) + 2];
-        memset(&padding, ' ', num + 1);
-        padding[(16 - i) * 3] = '\0';
-        printf("%s | %s |\n", padding, out);
+        failed += tcp_setOption(soc, IPPROTO_TCP, TCP_USER_TIMEOUT, options->userTimeoutMs);
     }
-    printf("\n");
+#endif
+    return failed;
 }
+
+#ifdef _WIN32
 static void my_ms_to_timeval(int timeout_ms, struct timeval *tv)
 {
     tv->tv_sec = timeout_ms / 1000;
@@ -156,7 +157,18 @@ static int tcp_poll_read(int soc, int timeout_ms)
     ret = select(soc + 1, &readset, NULL, NULL, &timeout);
     return ret;
 }
-static int tcp_read(int soc, uint8_t *buffer, int len, int timeout_ms)
+#else
+// poll rather than select, a gateway with hundreds of cars has descriptors past FD_SETSIZE
+static int tcp_poll_read(int soc, int timeout_ms)
+{
+    struct pollfd pfd = {
+        .fd = soc,
+        .events = POLLIN,
+    };
+    return poll(&pfd, 1, timeout_ms);
+}
+#endif
+static int tcp_read(int soc, uint8_t *buffer, int len, int timeout_ms, bool quickAck)
 {
     int poll = -1;
     if ((poll = tcp_poll_read(soc, timeout_ms)) <= 0)
@@ -172,14 +184,62 @@ static int tcp_read(int soc, uint8_t *buffer, int len, int timeout_ms)
     {
         return -1;
     }
+#ifdef TCP_QUICKACK
+    if (quickAck && read_len > 0)
+    {
+        int on = 1;
+        setsockopt(soc, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
+#endif
     
     return read_len;
 }
+static phevTcpRxBuffer_t *tcp_createRxBuffer(int soc)
+{
+    if (soc >= PHEV_TCP_MAX_SOCKETS)
+    {
+        LOG_E(APP_TAG, "Socket %d is past PHEV_TCP_MAX_SOCKETS, cannot give it a receive buffer", soc);
+        return NULL;
+    }
+
+    phevTcpRxBuffer_t *rx = phev_malloc(sizeof(phevTcpRxBuffer_t));
+
+    if (rx == NULL)
+    {
+        LOG_E(APP_TAG, "Cannot allocate receive buffer");
+        return NULL;
+    }
+    rx->soc = soc;
+    rx->quickAck = false;
+    rx->capture = NULL;
+    rx->start = 0;
+    rx->end = 0;
+
+    // A descriptor is only ever open once, a buffer left by a socket closed without disconnect is replaced
+    phev_free(atomic_exchange(&rxBuffers[soc], rx));
+
+    return rx;
+}
+static void tcp_destroyRxBuffer(int soc)
+{
+    if (soc >= 0 && soc < PHEV_TCP_MAX_SOCKETS)
+    {
+        phev_free(atomic_exchange(&rxBuffers[soc], NULL));
+    }
+}
+phevTcpRxBuffer_t *phev_tcpClientRxBuffer(int soc)
+{
+    if (soc < 0 || soc >= PHEV_TCP_MAX_SOCKETS)
+    {
+        return NULL;
+    }
+    return atomic_load(&rxBuffers[soc]);
+}
 #ifdef _WIN32
 
-int phev_tcpClientConnectSocket(const char *host, uint16_t port)
+static int tcp_openSocket(const char *host, uint16_t port, const phevTcpOptions_t *options)
 {
-    LOG_V(APP_TAG, "START - connectSocket");
+    LOG_V(APP_TAG, "START - openSocket");
     LOG_D(APP_TAG, "Host %s, Port %d", host, port);
 
     if (host == NULL)
@@ -228,6 +288,7 @@ int phev_tcpClientConnectSocket(const char *host, uint16_t port)
             WSACleanup();
             return 1;
         }
+        phev_tcpClientApplyOptions((int) ConnectSocket, options);
 
         // Connect to server.
         iResult = connect(ConnectSocket, ptr->ai_addr, (int)ptr->ai_addrlen);
@@ -249,15 +310,31 @@ int phev_tcpClientConnectSocket(const char *host, uint16_t port)
         return 1;
     }
 
-    LOG_V(APP_TAG, "END - connectSocket");
+    LOG_V(APP_TAG, "END - openSocket");
 
     return ConnectSocket;
 }
+int phev_tcpClientOpenSocket(const char *host, uint16_t port)
+{
+    return tcp_openSocket(host, port, NULL);
+}
+// The Windows connect still blocks, it is finished by the time it returns
+int phev_tcpClientConnectStart(const char *host, uint16_t port, const phevTcpOptions_t *options, bool *inProgress)
+{
+    *inProgress = false;
+
+    return tcp_openSocket(host, port, options);
+}
+int phev_tcpClientConnectPoll(int soc, int timeout_ms)
+{
+    return 1;
+}
 #else
-int phev_tcpClientConnectSocket(const char *host, uint16_t port)
+int phev_tcpClientConnectStart(const char *host, uint16_t port, const phevTcpOptions_t *options, bool *inProgress)
 {
-    LOG_V(APP_TAG, "START - connectSocket");
-    LOG_D(APP_TAG, "Host %s, Port %d", host, port);
+    LOG_V(APP_TAG, "START - connectStart");
+
+    *inProgress = false;
 
     if (host == NULL)
     {
@@ -282,45 +359,245 @@ int phev_tcpClientConnectSocket(const char *host, uint16_t port)
 
         return -1;
     }
-    int ret = TCP_CONNECT(sock, (struct sockaddr *)(&addr), sizeof(addr));
-    if (ret == -1)
+    // Before connect so the receive buffer size is reflected in the window scale
+    phev_tcpClientApplyOptions(sock, options);
+
+    int flags = fcntl(sock, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        LOG_E(APP_TAG, "Cannot make socket non blocking");
+        close(sock);
+
+        return -1;
+    }
+
+    if (TCP_CONNECT(sock, (struct sockaddr *)(&addr), sizeof(addr)) == 0)
+    {
+        fcntl(sock, F_SETFL, flags);
+    }
+    else if (errno == EINPROGRESS)
+    {
+        *inProgress = true;
+    }
+    else
     {
         LOG_E(APP_TAG, "Failed to connect");
+        close(sock);
 
         return -1;
     }
 
-    LOG_I(APP_TAG, "Connected to host %s port %d", host, port);
+    LOG_V(APP_TAG, "END - connectStart");
 
-    //global_sock = sock;
-    LOG_V(APP_TAG, "END - connectSocket");
+    return sock;
+}
+int phev_tcpClientConnectPoll(int soc, int timeout_ms)
+{
+    struct pollfd pfd = {
+        .fd = soc,
+        .events = POLLOUT,
+    };
+    int ret = poll(&pfd, 1, timeout_ms);
+
+    if (ret == 0 || (ret < 0 && errno == EINTR))
+    {
+        return 0;
+    }
+
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+
+    if (ret < 0 || getsockopt(soc, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0 || err != 0)
+    {
+        LOG_E(APP_TAG, "Failed to connect %d", err);
+        return -1;
+    }
+
+    // Connected, reads and writes from here on block as they always have
+    int flags = fcntl(soc, F_GETFL, 0);
+
+    if (flags >= 0)
+    {
+        fcntl(soc, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    return 1;
+}
+int phev_tcpClientOpenSocket(const char *host, uint16_t port)
+{
+    LOG_V(APP_TAG, "START - openSocket");
+
+    bool inProgress = false;
+    int sock = phev_tcpClientConnectStart(host, port, NULL, &inProgress);
+
+    if (sock >= 0 && inProgress)
+    {
+        int ret = phev_tcpClientConnectPoll(sock, PHEV_TCP_CONNECT_TIMEOUT);
+
+        if (ret != 1)
+        {
+            LOG_E(APP_TAG, "%s", (ret == 0 ? "Connect timed out" : "Failed to connect"));
+            close(sock);
+
+            return -1;
+        }
+    }
+    if (sock >= 0)
+    {
+        LOG_I(APP_TAG, "Connected to host %s port %d", host, port);
+    }
+
+    LOG_V(APP_TAG, "END - openSocket");
 
     return sock;
 }
 #endif
+int phev_tcpClientConnectSocket(const char *host, uint16_t port)
+{
+    int soc = phev_tcpClientOpenSocket(host, port);
 
-int phev_tcpClientRead(int soc, uint8_t *buf, size_t len)
+    if (soc >= 0 && tcp_createRxBuffer(soc) == NULL)
+    {
+        LOG_E(APP_TAG, "Closing socket %d, it would read without framing", soc);
+        close(soc);
+        return -1;
+    }
+    return soc;
+}
+static void tcp_compactRxBuffer(phevTcpRxBuffer_t *rx, size_t wanted)
 {
-    LOG_V(APP_TAG, "START - read");
+    if (rx->start == rx->end)
+    {
+        rx->start = 0;
+        rx->end = 0;
+    }
+    else if (PHEV_TCP_RX_BUFFER_SIZE - rx->end < wanted)
+    {
+        // Keep the unread bytes contiguous so frames are never split by a wrap
+        memmove(rx->data, rx->data + rx->start, rx->end - rx->start);
+        rx->end -= rx->start;
+        rx->start = 0;
+    }
+}
+int phev_tcpClientFill(phevTcpRxBuffer_t *rx, int timeout_ms)
+{
+    tcp_compactRxBuffer(rx, 1);
 
-    int num = tcp_read(soc, buf, len, TCP_READ_TIMEOUT);
+    int num = tcp_read(rx->soc, rx->data + rx->end, (int)(PHEV_TCP_RX_BUFFER_SIZE - rx->end), timeout_ms, rx->quickAck);
 
-    LOG_D(APP_TAG, "Read %d bytes from tcp stream", num);
-    
-    
+    if (num > 0)
+    {
+        if (rx->capture)
+        {
+            phev_capture_record(rx->capture, PHEV_CAPTURE_IN, rx->data + rx->end, (size_t) num);
+        }
+        rx->end += (size_t) num;
+    }
+    return num;
+}
+size_t phev_tcpClientAppend(phevTcpRxBuffer_t *rx, const uint8_t *data, size_t length)
+{
+    tcp_compactRxBuffer(rx, length);
+
+    if (length > PHEV_TCP_RX_BUFFER_SIZE - rx->end)
+    {
+        length = PHEV_TCP_RX_BUFFER_SIZE - rx->end;
+    }
+    memcpy(rx->data + rx->end, data, length);
+    rx->end += length;
+
+    return length;
+}
+int phev_tcpClientNextFrame(phevTcpRxBuffer_t *rx, const uint8_t **frame)
+{
+    while (rx->start < rx->end)
+    {
+        int length = phev_core_frameLength(rx->data + rx->start, rx->end - rx->start);
+
+        if (length > 0)
+        {
+            *frame = rx->data + rx->start;
+            return length;
+        }
+        if (length == 0)
+        {
+            return 0;
+        }
+        LOG_W(APP_TAG, "Dropping byte %02X that does not start a frame", rx->data[rx->start]);
+        rx->start++;
+    }
+    return 0;
+}
+void phev_tcpClientConsume(phevTcpRxBuffer_t *rx, size_t length)
+{
+    rx->start += length;
+    if (rx->start > rx->end)
+    {
+        rx->start = rx->end;
+    }
+}
+size_t phev_tcpClientTakeFrames(phevTcpRxBuffer_t *rx, uint8_t *buf, size_t len)
+{
+    const uint8_t *frame = NULL;
+    int length;
+    size_t num = 0;
+
+    // Hand over every complete frame that fits so a burst costs one recv
+    while ((length = phev_tcpClientNextFrame(rx, &frame)) > 0 && num + (size_t) length <= len)
+    {
+        size_t run = 0;
+
+        // Frames back to back go over in one copy, only a dropped byte between them starts another
+        do
+        {
+            PHEV_LOG_FRAME("READ", frame + run, (size_t) length);
+            run += (size_t) length;
+            length = phev_core_frameLength(frame + run, rx->end - rx->start - run);
+        } while (length > 0 && num + run + (size_t) length <= len);
+
+        memcpy(buf + num, frame, run);
+        phev_tcpClientConsume(rx, run);
+        num += run;
+    }
+    return num;
+}
+int phev_tcpClientReadFrames(phevTcpRxBuffer_t *rx, uint8_t *buf, size_t len)
+{
+    const uint8_t *frame = NULL;
 
-    if (num > 2 && num < 256)
+    if (phev_tcpClientNextFrame(rx, &frame) == 0)
     {
-        LOG_BUFFER_HEXDUMP("READ",buf,num,loglvl);
-        //phexdump("<< ", buf, num, LOG_INFO);
-        uint8_t * decoded = decode(buf);
-        if (decoded)
+        int read = phev_tcpClientFill(rx, TCP_READ_TIMEOUT);
+
+        if (read <= 0)
         {
-            //phexdump("<< DECODED3 ", decoded, num, LOG_INFO)
-            LOG_BUFFER_HEXDUMP("READ DECODED",decoded,num,loglvl);
+            return read;
         }
     }
 
+    size_t num = phev_tcpClientTakeFrames(rx, buf, len);
+
+    LOG_D(APP_TAG, "Read %zu bytes from stream", num);
+
+    return (int) num;
+}
+int phev_tcpClientRead(int soc, uint8_t *buf, size_t len)
+{
+    LOG_V(APP_TAG, "START - read");
+
+    phevTcpRxBuffer_t *rx = phev_tcpClientRxBuffer(soc);
+
+    if (rx == NULL)
+    {
+        int read = tcp_read(soc, buf, len, TCP_READ_TIMEOUT, false);
+
+        PHEV_LOG_FRAME("READ", buf, (read > 0 ? (size_t) read : 0));
+        LOG_V(APP_TAG, "END - read");
+        return read;
+    }
+
+    int num = phev_tcpClientReadFrames(rx, buf, len);
+
     LOG_V(APP_TAG, "END - read");
 
     return num;
@@ -334,23 +611,15 @@ int phev_tcpClientWrite(int soc, uint8_t *buf, size_t len)
     int num = TCP_WRITE(soc, buf, len);
 #endif
     LOG_D(APP_TAG, "Wriiten %d bytes from tcp stream", num);
-    
-        
-    if (num > 2 && num < 256)
-    {
-        LOG_BUFFER_HEXDUMP("WRITE",buf,num,loglvl);
-        uint8_t * decoded = decode(buf);
-        if (decoded)
-        {
-            LOG_BUFFER_HEXDUMP("WRITE DECODED",decoded,num,loglvl);
-        }
-    }
+
+    PHEV_LOG_FRAME("WRITE", buf, (num > 0 ? (size_t) num : 0));
     LOG_V(APP_TAG, "END - write");
 
     return num;
 }
 int phev_tcpClientDisconnectSocket(int soc)
 {
+    tcp_destroyRxBuffer(soc);
     close(soc);
     return 0;
 }
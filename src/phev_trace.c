@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "phev_trace.h"
+#include "phev_core.h"
+#include "phev_alloc.h"
+#include "phev_log.h"
+
+#define PHEV_TRACE_HEADER_SIZE 16
+#define PHEV_TRACE_RECORD_SIZE 16
+#define PHEV_TRACE_SAVE_BATCH 256
+
+const static char * TAG = "PHEV_TRACE";
+
+typedef struct phevTraceSlot_t {
+    _Atomic uint64_t sequence;
+    phevTraceRecord_t record;
+} phevTraceSlot_t;
+
+struct phevTrace_t {
+    _Atomic uint64_t head;
+    size_t mask;
+    phevTraceSlot_t * slots;
+};
+
+struct phevTraceReader_t {
+    FILE * file;
+    uint64_t remaining;
+};
+
+static const char * phev_trace_names[PHEV_TRACE_MAX] = {
+    [PHEV_TRACE_FRAME_RECEIVED] = "frame received",
+    [PHEV_TRACE_FRAME_SPLIT] = "frame split",
+    [PHEV_TRACE_FRAME_DECODED] = "frame decoded",
+    [PHEV_TRACE_FRAME_FILTERED] = "frame filtered",
+    [PHEV_TRACE_FRAME_ACKED] = "frame acked",
+    [PHEV_TRACE_EVENT_DISPATCHED] = "event dispatched",
+    [PHEV_TRACE_COMMAND_QUEUED] = "command queued",
+    [PHEV_TRACE_COMMAND_SENT] = "command sent",
+    [PHEV_TRACE_COMMAND_ACKED] = "command acked",
+    [PHEV_TRACE_XOR_CHANGED] = "xor changed",
+};
+
+static void phev_trace_putUint(uint8_t * out, uint64_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++)
+    {
+        out[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+static uint64_t phev_trace_getUint(const uint8_t * in, int bytes)
+{
+    uint64_t value = 0;
+
+    for(int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t) in[i] << (i * 8);
+    }
+    return value;
+}
+phevTrace_t * phev_trace_create(size_t depth)
+{
+    size_t size = 1;
+
+    while(size < depth)
+    {
+        size <<= 1;
+    }
+    phevTrace_t * trace = phev_malloc(sizeof(phevTrace_t));
+
+    if(trace == NULL)
+    {
+        return NULL;
+    }
+    trace->slots = phev_malloc(size * sizeof(phevTraceSlot_t));
+
+    if(trace->slots == NULL)
+    {
+        LOG_E(TAG,"Cannot allocate a trace of %zu records",size);
+        phev_free(trace);
+        return NULL;
+    }
+    for(size_t i = 0; i < size; i++)
+    {
+        atomic_init(&trace->slots[i].sequence, 0);
+    }
+    atomic_init(&trace->head, 0);
+    trace->mask = size - 1;
+
+    return trace;
+}
+void phev_trace_destroy(phevTrace_t * trace)
+{
+    if(trace)
+    {
+        phev_free(trace->slots);
+        phev_free(trace);
+    }
+}
+void phev_trace_record(phevTrace_t * trace, phevTracePoint_t point, uint8_t command, uint8_t reg, uint8_t xor, uint32_t arg)
+{
+    uint64_t index = atomic_fetch_add_explicit(&trace->head, 1, memory_order_relaxed);
+    phevTraceSlot_t * slot = &trace->slots[index & trace->mask];
+
+    // Zero while the record is written, index + 1 once it is whole
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->record.timestamp = phev_core_monotonicNs();
+    slot->record.point = (uint8_t) point;
+    slot->record.command = command;
+    slot->record.reg = reg;
+    slot->record.xor = xor;
+    slot->record.arg = arg;
+
+    atomic_store_explicit(&slot->sequence, index + 1, memory_order_release);
+}
+size_t phev_trace_snapshot(const phevTrace_t * trace, phevTraceRecord_t * records, size_t max)
+{
+    phevTrace_t * t = (phevTrace_t *) trace;
+    uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+    uint64_t depth = t->mask + 1;
+    uint64_t start = (head > depth ? head - depth : 0);
+    size_t count = 0;
+
+    if(head - start > max)
+    {
+        start = head - max;
+    }
+    for(uint64_t i = start; i < head; i++)
+    {
+        phevTraceSlot_t * slot = &t->slots[i & t->mask];
+
+        if(atomic_load_explicit(&slot->sequence, memory_order_acquire) != i + 1)
+        {
+            continue;
+        }
+        phevTraceRecord_t record = slot->record;
+
+        atomic_thread_fence(memory_order_acquire);
+
+        if(atomic_load_explicit(&slot->sequence, memory_order_relaxed) != i + 1)
+        {
+            continue;
+        }
+        records[count++] = record;
+    }
+    return count;
+}
+bool phev_trace_save(const phevTrace_t * trace, const char * path)
+{
+    if(trace == NULL)
+    {
+        return false;
+    }
+    size_t depth = trace->mask + 1;
+    phevTraceRecord_t * records = phev_malloc(depth * sizeof(phevTraceRecord_t));
+
+    if(records == NULL)
+    {
+        return false;
+    }
+    size_t count = phev_trace_snapshot(trace, records, depth);
+    FILE * file = fopen(path, "wb");
+    bool ok = (file != NULL);
+
+    if(!ok)
+    {
+        LOG_E(TAG,"Cannot open %s to save the trace",path);
+        phev_free(records);
+        return false;
+    }
+    uint8_t buffer[PHEV_TRACE_SAVE_BATCH * PHEV_TRACE_RECORD_SIZE];
+
+    phev_trace_putUint(buffer, PHEV_TRACE_MAGIC, 4);
+    phev_trace_putUint(buffer + 4, PHEV_TRACE_VERSION, 4);
+    phev_trace_putUint(buffer + 8, count, 8);
+
+    ok = (fwrite(buffer, 1, PHEV_TRACE_HEADER_SIZE, file) == PHEV_TRACE_HEADER_SIZE);
+
+    for(size_t i = 0; ok && i < count; i += PHEV_TRACE_SAVE_BATCH)
+    {
+        size_t batch = (count - i < PHEV_TRACE_SAVE_BATCH ? count - i : PHEV_TRACE_SAVE_BATCH);
+
+        for(size_t j = 0; j < batch; j++)
+        {
+            const phevTraceRecord_t * record = &records[i + j];
+            uint8_t * out = buffer + j * PHEV_TRACE_RECORD_SIZE;
+
+            phev_trace_putUint(out, record->timestamp, 8);
+            out[8] = record->point;
+            out[9] = record->command;
+            out[10] = record->reg;
+            out[11] = record->xor;
+            phev_trace_putUint(out + 12, record->arg, 4);
+        }
+        ok = (fwrite(buffer, PHEV_TRACE_RECORD_SIZE, batch, file) == batch);
+    }
+    if(fclose(file) != 0)
+    {
+        ok = false;
+    }
+    if(!ok)
+    {
+        LOG_E(TAG,"Cannot write the trace to %s",path);
+    }
+    phev_free(records);
+
+    return ok;
+}
+phevTraceReader_t * phev_trace_openReader(const char * path)
+{
+    uint8_t header[PHEV_TRACE_HEADER_SIZE];
+    phevTraceReader_t * reader = phev_malloc(sizeof(phevTraceReader_t));
+
+    if(reader == NULL)
+    {
+        return NULL;
+    }
+    reader->file = fopen(path, "rb");
+
+    if(reader->file == NULL)
+    {
+        LOG_E(TAG,"Cannot open trace %s",path);
+        phev_free(reader);
+        return NULL;
+    }
+    if(fread(header, 1, sizeof(header), reader->file) != sizeof(header)
+        || phev_trace_getUint(header, 4) != PHEV_TRACE_MAGIC
+        || phev_trace_getUint(header + 4, 4) != PHEV_TRACE_VERSION)
+    {
+        LOG_E(TAG,"%s is not a trace",path);
+        fclose(reader->file);
+        phev_free(reader);
+        return NULL;
+    }
+    reader->remaining = phev_trace_getUint(header + 8, 8);
+
+    return reader;
+}
+void phev_trace_closeReader(phevTraceReader_t * reader)
+{
+    if(reader == NULL)
+    {
+        return;
+    }
+    fclose(reader->file);
+    phev_free(reader);
+}
+bool phev_trace_next(phevTraceReader_t * reader, phevTraceRecord_t * record)
+{
+    uint8_t in[PHEV_TRACE_RECORD_SIZE];
+
+    if(reader->remaining == 0 || fread(in, 1, sizeof(in), reader->file) != sizeof(in))
+    {
+        return false;
+    }
+    reader->remaining--;
+
+    record->timestamp = phev_trace_getUint(in, 8);
+    record->point = in[8];
+    record->command = in[9];
+    record->reg = in[10];
+    record->xor = in[11];
+    record->arg = (uint32_t) phev_trace_getUint(in + 12, 4);
+
+    return true;
+}
+const char * phev_trace_pointName(uint8_t point)
+{
+    return (point < PHEV_TRACE_MAX ? phev_trace_names[point] : "unknown");
+}
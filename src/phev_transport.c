@@ -0,0 +1,709 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phev_transport.h"
+#include "phev_alloc.h"
+#include "phev_tcpip.h"
+#include "phev_uring.h"
+#include "phev_log.h"
+#include "msg_utils.h"
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#define PHEV_TRANSPORT_POSIX
+#endif
+
+const static char *TAG = "PHEV_TRANSPORT";
+
+#define PHEV_TRANSPORT_READ_SIZE 1024
+#define PHEV_TRANSPORT_MAX_BUFFERS 8
+
+typedef struct phevTransportTcp_t {
+    char * host;
+    uint16_t port;
+    bool ioUring;
+    bool uring;
+    phevTcpOptions_t options;
+    phevTcpRxBuffer_t rx;
+} phevTransportTcp_t;
+
+typedef struct phevTransportUnix_t {
+    char * path;
+    phevTcpRxBuffer_t rx;
+} phevTransportUnix_t;
+
+typedef struct phevTransportLoopback_t {
+    phevLoopbackResponder_t responder;
+    void * ctx;
+    phevTcpRxBuffer_t rx;
+    phevTcpRxBuffer_t tx;
+} phevTransportLoopback_t;
+
+static phevTransport_t * phev_transport_create(const phevTransportOps_t * ops, void * ctx)
+{
+    phevTransport_t * transport = phev_malloc(sizeof(phevTransport_t));
+
+    if(transport == NULL)
+    {
+        phev_free(ctx);
+        return NULL;
+    }
+    transport->ops = ops;
+    transport->connected = false;
+    transport->connecting = false;
+    transport->capture = NULL;
+    transport->ctx = ctx;
+
+    return transport;
+}
+static size_t phev_transport_totalLength(const phevTransportBuffer_t * buffers, size_t count)
+{
+    size_t total = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        total += buffers[i].length;
+    }
+    return total;
+}
+#ifdef PHEV_TRANSPORT_POSIX
+// Keeps going after a short write, a frame is never left half sent.
+static int phev_transport_writevFd(int fd, const phevTransportBuffer_t * buffers, size_t count)
+{
+    struct iovec iov[PHEV_TRANSPORT_MAX_BUFFERS];
+    size_t total = 0;
+    size_t sent = 0;
+    int iovcnt = 0;
+
+    if(count > PHEV_TRANSPORT_MAX_BUFFERS)
+    {
+        return -1;
+    }
+    for(size_t i = 0; i < count; i++)
+    {
+        iov[i].iov_base = (void *) buffers[i].data;
+        iov[i].iov_len = buffers[i].length;
+        total += buffers[i].length;
+    }
+    iovcnt = (int) count;
+
+    struct iovec * next = iov;
+
+    while(sent < total)
+    {
+        ssize_t num = writev(fd, next, iovcnt);
+
+        if(num < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(num <= 0)
+        {
+            return -1;
+        }
+        sent += (size_t) num;
+
+        while(iovcnt > 0 && (size_t) num >= next->iov_len)
+        {
+            num -= (ssize_t) next->iov_len;
+            next++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            next->iov_base = (uint8_t *) next->iov_base + num;
+            next->iov_len -= (size_t) num;
+        }
+    }
+    return (int) total;
+}
+#endif
+
+// TCP
+
+static void phev_transport_tcpClose(phevTransport_t * transport);
+
+static int phev_transport_tcpConnect(phevTransport_t * transport)
+{
+    phevTransportTcp_t * tcp = transport->ctx;
+
+    if(!transport->connecting)
+    {
+        bool inProgress = false;
+
+        tcp->rx.soc = phev_tcpClientConnectStart(tcp->host, tcp->port, &tcp->options, &inProgress);
+        tcp->rx.quickAck = tcp->options.quickAck;
+        tcp->rx.capture = transport->capture;
+        tcp->rx.start = 0;
+        tcp->rx.end = 0;
+
+        if(tcp->rx.soc < 0)
+        {
+            return -1;
+        }
+        if(inProgress)
+        {
+            transport->connecting = true;
+        }
+    }
+    if(transport->connecting)
+    {
+        int ret = phev_tcpClientConnectPoll(tcp->rx.soc, PHEV_TRANSPORT_CONNECT_POLL_TIME);
+
+        if(ret == 0)
+        {
+            return PHEV_TRANSPORT_CONNECTING;
+        }
+        if(ret < 0)
+        {
+            phev_transport_tcpClose(transport);
+            return -1;
+        }
+    }
+    tcp->uring = tcp->ioUring && phev_uringAttach(tcp->rx.soc, transport->capture);
+
+    LOG_I(TAG,"Connected to %s port %d%s",tcp->host,tcp->port,(tcp->uring ? " through io_uring" : ""));
+
+    return 0;
+}
+static int phev_transport_tcpRead(phevTransport_t * transport, uint8_t * buf, size_t len)
+{
+    phevTransportTcp_t * tcp = transport->ctx;
+
+    if(tcp->uring)
+    {
+        return phev_uringRead(tcp->rx.soc, buf, len);
+    }
+    return phev_tcpClientReadFrames(&tcp->rx, buf, len);
+}
+static int phev_transport_tcpWritev(phevTransport_t * transport, const phevTransportBuffer_t * buffers, size_t count)
+{
+    phevTransportTcp_t * tcp = transport->ctx;
+
+    if(tcp->uring)
+    {
+        uint8_t frame[PHEV_TCP_MAX_FRAME];
+        size_t total = 0;
+
+        for(size_t i = 0; i < count; i++)
+        {
+            total += buffers[i].length;
+        }
+
+        // phev_uringWrite queues all of a write or none of it, one write per frame so a frame never goes out in part
+        uint8_t * data = (total <= sizeof(frame) ? frame : phev_malloc(total));
+
+        if(data == NULL)
+        {
+            return -1;
+        }
+        size_t offset = 0;
+
+        for(size_t i = 0; i < count; i++)
+        {
+            memcpy(data + offset, buffers[i].data, buffers[i].length);
+            offset += buffers[i].length;
+        }
+        int ret = phev_uringWrite(tcp->rx.soc, data, total);
+
+        if(data != frame)
+        {
+            phev_free(data);
+        }
+        return ret;
+    }
+    if(count == 1)
+    {
+        return phev_tcpClientWrite(tcp->rx.soc, (uint8_t *) buffers[0].data, buffers[0].length);
+    }
+#ifdef PHEV_TRANSPORT_POSIX
+    return phev_transport_writevFd(tcp->rx.soc, buffers, count);
+#else
+    int total = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        int num = phev_tcpClientWrite(tcp->rx.soc, (uint8_t *) buffers[i].data, buffers[i].length);
+
+        if(num < 0)
+        {
+            return -1;
+        }
+        total += num;
+    }
+    return total;
+#endif
+}
+static void phev_transport_tcpClose(phevTransport_t * transport)
+{
+    phevTransportTcp_t * tcp = transport->ctx;
+
+    if(tcp->rx.soc >= 0)
+    {
+        if(tcp->uring)
+        {
+            phev_uringDisconnect(tcp->rx.soc);
+        }
+        else
+        {
+            phev_tcpClientDisconnectSocket(tcp->rx.soc);
+        }
+        tcp->rx.soc = -1;
+    }
+    tcp->uring = false;
+    transport->connecting = false;
+}
+static int phev_transport_tcpFd(const phevTransport_t * transport)
+{
+    return ((const phevTransportTcp_t *) transport->ctx)->rx.soc;
+}
+static void phev_transport_tcpDestroy(phevTransport_t * transport)
+{
+    phevTransportTcp_t * tcp = transport->ctx;
+
+    phev_free(tcp->host);
+}
+
+static const phevTransportOps_t tcpOps = {
+    .name = "tcp",
+    .connect = phev_transport_tcpConnect,
+    .read = phev_transport_tcpRead,
+    .writev = phev_transport_tcpWritev,
+    .close = phev_transport_tcpClose,
+    .fd = phev_transport_tcpFd,
+    .destroy = phev_transport_tcpDestroy,
+};
+
+phevTransport_t * phev_transport_tcp(const char * host, uint16_t port)
+{
+    phevTransportTcp_t * tcp = phev_malloc(sizeof(phevTransportTcp_t));
+
+    if(tcp == NULL || host == NULL)
+    {
+        phev_free(tcp);
+        return NULL;
+    }
+    tcp->host = phev_strdup(host);
+    tcp->port = port;
+    tcp->ioUring = false;
+    tcp->uring = false;
+    memset(&tcp->options, 0, sizeof(tcp->options));
+    tcp->rx.soc = -1;
+
+    return phev_transport_create(&tcpOps, tcp);
+}
+phevTransport_t * phev_transport_uring(const char * host, uint16_t port)
+{
+    phevTransport_t * transport = phev_transport_tcp(host, port);
+
+    if(transport)
+    {
+        ((phevTransportTcp_t *) transport->ctx)->ioUring = true;
+    }
+    return transport;
+}
+void phev_transport_tcpSetOptions(phevTransport_t * transport, const phevTcpOptions_t * options)
+{
+    if(transport == NULL || transport->ops != &tcpOps)
+    {
+        return;
+    }
+
+    phevTransportTcp_t * tcp = transport->ctx;
+
+    if(options)
+    {
+        tcp->options = *options;
+    }
+    else
+    {
+        memset(&tcp->options, 0, sizeof(tcp->options));
+    }
+}
+
+// Unix domain socket
+
+#ifdef PHEV_TRANSPORT_POSIX
+static int phev_transport_unixConnect(phevTransport_t * transport)
+{
+    phevTransportUnix_t * un = transport->ctx;
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(strlen(un->path) >= sizeof(addr.sun_path))
+    {
+        LOG_E(TAG,"Socket path too long %s",un->path);
+        return -1;
+    }
+    strcpy(addr.sun_path, un->path);
+
+    int soc = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(soc < 0)
+    {
+        LOG_E(TAG,"Cannot create socket");
+        return -1;
+    }
+    if(connect(soc, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        LOG_E(TAG,"Cannot connect to %s",un->path);
+        close(soc);
+        return -1;
+    }
+    un->rx.soc = soc;
+    un->rx.quickAck = false;
+    un->rx.capture = transport->capture;
+    un->rx.start = 0;
+    un->rx.end = 0;
+
+    LOG_I(TAG,"Connected to %s",un->path);
+
+    return 0;
+}
+static int phev_transport_unixRead(phevTransport_t * transport, uint8_t * buf, size_t len)
+{
+    phevTransportUnix_t * un = transport->ctx;
+
+    return phev_tcpClientReadFrames(&un->rx, buf, len);
+}
+static int phev_transport_unixWritev(phevTransport_t * transport, const phevTransportBuffer_t * buffers, size_t count)
+{
+    phevTransportUnix_t * un = transport->ctx;
+
+    return phev_transport_writevFd(un->rx.soc, buffers, count);
+}
+static void phev_transport_unixClose(phevTransport_t * transport)
+{
+    phevTransportUnix_t * un = transport->ctx;
+
+    if(un->rx.soc >= 0)
+    {
+        close(un->rx.soc);
+        un->rx.soc = -1;
+    }
+}
+static int phev_transport_unixFd(const phevTransport_t * transport)
+{
+    return ((const phevTransportUnix_t *) transport->ctx)->rx.soc;
+}
+static void phev_transport_unixDestroy(phevTransport_t * transport)
+{
+    phevTransportUnix_t * un = transport->ctx;
+
+    phev_free(un->path);
+}
+
+static const phevTransportOps_t unixOps = {
+    .name = "unix",
+    .connect = phev_transport_unixConnect,
+    .read = phev_transport_unixRead,
+    .writev = phev_transport_unixWritev,
+    .close = phev_transport_unixClose,
+    .fd = phev_transport_unixFd,
+    .destroy = phev_transport_unixDestroy,
+};
+
+phevTransport_t * phev_transport_unix(const char * path)
+{
+    phevTransportUnix_t * un = phev_malloc(sizeof(phevTransportUnix_t));
+
+    if(un == NULL || path == NULL)
+    {
+        phev_free(un);
+        return NULL;
+    }
+    un->path = phev_strdup(path);
+    un->rx.soc = -1;
+
+    return phev_transport_create(&unixOps, un);
+}
+#else
+phevTransport_t * phev_transport_unix(const char * path)
+{
+    LOG_W(TAG,"Unix domain sockets are not supported on this platform");
+    return NULL;
+}
+#endif
+
+// Loopback
+
+static int phev_transport_loopbackConnect(phevTransport_t * transport)
+{
+    phevTransportLoopback_t * loopback = transport->ctx;
+
+    loopback->rx.start = 0;
+    loopback->rx.end = 0;
+    loopback->tx.start = 0;
+    loopback->tx.end = 0;
+
+    return 0;
+}
+static int phev_transport_loopbackRead(phevTransport_t * transport, uint8_t * buf, size_t len)
+{
+    phevTransportLoopback_t * loopback = transport->ctx;
+    const uint8_t * frame = NULL;
+
+    if(phev_tcpClientNextFrame(&loopback->rx, &frame) == 0 && loopback->responder)
+    {
+        loopback->responder(transport, NULL, 0, loopback->ctx);
+    }
+    return (int) phev_tcpClientTakeFrames(&loopback->rx, buf, len);
+}
+static int phev_transport_loopbackWritev(phevTransport_t * transport, const phevTransportBuffer_t * buffers, size_t count)
+{
+    phevTransportLoopback_t * loopback = transport->ctx;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(loopback->responder)
+        {
+            loopback->responder(transport, buffers[i].data, buffers[i].length, loopback->ctx);
+        }
+        else if(phev_tcpClientAppend(&loopback->tx, buffers[i].data, buffers[i].length) < buffers[i].length)
+        {
+            LOG_W(TAG,"Loopback write buffer full");
+            return -1;
+        }
+    }
+    return (int) phev_transport_totalLength(buffers, count);
+}
+static void phev_transport_loopbackClose(phevTransport_t * transport)
+{
+}
+static int phev_transport_loopbackFd(const phevTransport_t * transport)
+{
+    return -1;
+}
+static void phev_transport_loopbackDestroy(phevTransport_t * transport)
+{
+}
+
+static const phevTransportOps_t loopbackOps = {
+    .name = "loopback",
+    .connect = phev_transport_loopbackConnect,
+    .read = phev_transport_loopbackRead,
+    .writev = phev_transport_loopbackWritev,
+    .close = phev_transport_loopbackClose,
+    .fd = phev_transport_loopbackFd,
+    .destroy = phev_transport_loopbackDestroy,
+};
+
+phevTransport_t * phev_transport_loopback(phevLoopbackResponder_t responder, void * ctx)
+{
+    phevTransportLoopback_t * loopback = phev_malloc(sizeof(phevTransportLoopback_t));
+
+    if(loopback == NULL)
+    {
+        return NULL;
+    }
+    loopback->responder = responder;
+    loopback->ctx = ctx;
+    loopback->rx.soc = -1;
+    loopback->rx.quickAck = false;
+    loopback->rx.capture = NULL;
+    loopback->tx.soc = -1;
+    loopback->tx.quickAck = false;
+    loopback->tx.capture = NULL;
+
+    phevTransport_t * transport = phev_transport_create(&loopbackOps, loopback);
+
+    if(transport)
+    {
+        phev_transport_loopbackConnect(transport);
+    }
+    return transport;
+}
+size_t phev_transport_loopbackInject(phevTransport_t * transport, const uint8_t * data, size_t length)
+{
+    if(transport == NULL || transport->ops != &loopbackOps)
+    {
+        return 0;
+    }
+    if(transport->capture)
+    {
+        phev_capture_record(transport->capture, PHEV_CAPTURE_IN, data, length);
+    }
+    return phev_tcpClientAppend(&((phevTransportLoopback_t *) transport->ctx)->rx, data, length);
+}
+size_t phev_transport_loopbackDrain(phevTransport_t * transport, uint8_t * buf, size_t len)
+{
+    if(transport == NULL || transport->ops != &loopbackOps)
+    {
+        return 0;
+    }
+
+    phevTcpRxBuffer_t * tx = &((phevTransportLoopback_t *) transport->ctx)->tx;
+    size_t num = tx->end - tx->start;
+
+    if(num > len)
+    {
+        num = len;
+    }
+    memcpy(buf, tx->data + tx->start, num);
+    phev_tcpClientConsume(tx, num);
+
+    return num;
+}
+
+// Generic
+
+int phev_transport_connect(phevTransport_t * transport)
+{
+    LOG_V(TAG,"START - connect");
+
+    int ret = transport->ops->connect(transport);
+
+    transport->connected = (ret == 0);
+    transport->connecting = (ret == PHEV_TRANSPORT_CONNECTING);
+
+    if(!transport->connecting)
+    {
+        LOG_D(TAG,"%s transport %s",transport->ops->name,(transport->connected ? "connected" : "failed to connect"));
+    }
+    LOG_V(TAG,"END - connect");
+
+    return ret;
+}
+int phev_transport_read(phevTransport_t * transport, uint8_t * buf, size_t len)
+{
+    int num = transport->ops->read(transport, buf, len);
+
+    if(num < 0)
+    {
+        transport->connected = false;
+    }
+    return num;
+}
+int phev_transport_writev(phevTransport_t * transport, const phevTransportBuffer_t * buffers, size_t count)
+{
+    int num = transport->ops->writev(transport, buffers, count);
+
+    if(num < 0)
+    {
+        transport->connected = false;
+    }
+    else if(transport->capture)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            phev_capture_record(transport->capture, PHEV_CAPTURE_OUT, buffers[i].data, buffers[i].length);
+        }
+    }
+    return num;
+}
+int phev_transport_write(phevTransport_t * transport, const uint8_t * data, size_t length)
+{
+    phevTransportBuffer_t buffer = {
+        .data = data,
+        .length = length,
+    };
+    return phev_transport_writev(transport, &buffer, 1);
+}
+void phev_transport_close(phevTransport_t * transport)
+{
+    transport->ops->close(transport);
+    transport->connected = false;
+    transport->connecting = false;
+}
+int phev_transport_fd(const phevTransport_t * transport)
+{
+    return transport->ops->fd(transport);
+}
+void phev_transport_destroy(phevTransport_t * transport)
+{
+    if(transport == NULL)
+    {
+        return;
+    }
+    phev_transport_close(transport);
+    transport->ops->destroy(transport);
+    phev_free(transport->ctx);
+    phev_free(transport);
+}
+void phev_transport_setCapture(phevTransport_t * transport, phevCapture_t * capture)
+{
+    transport->capture = capture;
+}
+
+// Messaging client
+
+static int phev_transport_clientConnect(messagingClient_t * client)
+{
+    phevTransport_t * transport = (phevTransport_t *) client->ctx;
+
+    phev_transport_connect(transport);
+
+    client->connected = transport->connected;
+
+    // msg-core only knows connected or not, phev_transport_clientConnecting tells the pipe the rest
+    return (client->connected ? 0 : -1);
+}
+static void phev_transport_clientDisconnect(messagingClient_t * client)
+{
+    phevTransport_t * transport = (phevTransport_t *) client->ctx;
+
+    phev_transport_close(transport);
+    client->connected = false;
+}
+static message_t * phev_transport_clientIncoming(messagingClient_t * client)
+{
+    phevTransport_t * transport = (phevTransport_t *) client->ctx;
+    uint8_t buf[PHEV_TRANSPORT_READ_SIZE];
+
+    int num = phev_transport_read(transport, buf, sizeof(buf));
+
+    if(num < 0)
+    {
+        LOG_W(TAG,"%s transport disconnected",transport->ops->name);
+        phev_transport_clientDisconnect(client);
+        return NULL;
+    }
+    if(num == 0)
+    {
+        return NULL;
+    }
+    return msg_utils_createMsg(buf, (size_t) num);
+}
+static void phev_transport_clientOutgoing(messagingClient_t * client, message_t * message)
+{
+    phevTransport_t * transport = (phevTransport_t *) client->ctx;
+
+    if(phev_transport_write(transport, message->data, message->length) < 0)
+    {
+        LOG_W(TAG,"%s transport write failed",transport->ops->name);
+        phev_transport_clientDisconnect(client);
+    }
+}
+messagingClient_t * phev_transport_createMessagingClient(phevTransport_t * transport)
+{
+    LOG_V(TAG,"START - createMessagingClient");
+
+    if(transport == NULL)
+    {
+        return NULL;
+    }
+
+    messagingSettings_t settings = {
+        .incomingHandler = phev_transport_clientIncoming,
+        .outgoingHandler = phev_transport_clientOutgoing,
+        .connect = phev_transport_clientConnect,
+        .disconnect = phev_transport_clientDisconnect,
+        .start = NULL,
+        .stop = NULL,
+        .ctx = transport,
+    };
+    messagingClient_t * client = msg_core_createMessagingClient(settings);
+
+    LOG_V(TAG,"END - createMessagingClient");
+
+    return client;
+}
+bool phev_transport_clientConnecting(messagingClient_t * client)
+{
+    return ((phevTransport_t *) client->ctx)->connecting;
+}
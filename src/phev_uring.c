@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "phev_uring.h"
+#include "phev_alloc.h"
+#include "phev_tcpip.h"
+#include "phev_log.h"
+
+const static char *APP_TAG = "PHEV_URING";
+
+#ifdef PHEV_IO_URING
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <liburing.h>
+
+#define PHEV_URING_RECV_TAG 1
+#define PHEV_URING_SEND_TAG 2
+#define PHEV_URING_BUFFER_GROUP 0
+
+typedef struct phevUringConn_t {
+    int soc;
+    struct io_uring ring;
+    struct io_uring_buf_ring *bufRing;
+    uint8_t *recvBuffers;
+    pthread_mutex_t lock;
+    atomic_bool closed;
+    bool sendInFlight;
+    int sendFill;
+    size_t sendLength[2];
+    size_t sendOffset;
+    uint8_t send[2][PHEV_URING_SEND_BUFFER_SIZE];
+    phevTcpRxBuffer_t rx;
+} phevUringConn_t;
+
+static _Atomic(phevUringConn_t *) uringConns[PHEV_URING_MAX_SOCKETS];
+static atomic_int uringAvailable = -1;
+
+static phevUringConn_t *uring_conn(int soc)
+{
+    if (soc < 0 || soc >= PHEV_URING_MAX_SOCKETS)
+    {
+        return NULL;
+    }
+    return atomic_load(&uringConns[soc]);
+}
+bool phev_uringAvailable(void)
+{
+    int available = atomic_load(&uringAvailable);
+
+    if (available < 0)
+    {
+        struct io_uring ring;
+        int ret = 0;
+
+        available = 0;
+        if (io_uring_queue_init(2, &ring, 0) == 0)
+        {
+            struct io_uring_buf_ring *bufRing = io_uring_setup_buf_ring(&ring, 1, PHEV_URING_BUFFER_GROUP, 0, &ret);
+
+            if (bufRing)
+            {
+                io_uring_free_buf_ring(&ring, bufRing, 1, PHEV_URING_BUFFER_GROUP);
+                available = 1;
+            }
+            io_uring_queue_exit(&ring);
+        }
+        LOG_I(APP_TAG, "io_uring %s", (available ? "available" : "not available, using read and write"));
+        atomic_store(&uringAvailable, available);
+    }
+    return available == 1;
+}
+// Called with the lock held
+static bool uring_armRecv(phevUringConn_t *conn)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&conn->ring);
+
+    if (sqe == NULL)
+    {
+        return false;
+    }
+    io_uring_prep_recv_multishot(sqe, conn->soc, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = PHEV_URING_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, PHEV_URING_RECV_TAG);
+
+    return true;
+}
+// Called with the lock held
+static void uring_prepSend(phevUringConn_t *conn, const uint8_t *data, size_t length)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&conn->ring);
+
+    if (sqe == NULL)
+    {
+        return;
+    }
+    io_uring_prep_send(sqe, conn->soc, data, length, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, PHEV_URING_SEND_TAG);
+    conn->sendInFlight = true;
+}
+// Called with the lock held
+static void uring_flushSend(phevUringConn_t *conn)
+{
+    int fill = conn->sendFill;
+
+    if (conn->sendInFlight || conn->sendLength[fill] == 0)
+    {
+        return;
+    }
+    uring_prepSend(conn, conn->send[fill], conn->sendLength[fill]);
+
+    if (conn->sendInFlight)
+    {
+        conn->sendOffset = 0;
+        conn->sendFill = fill ^ 1;
+    }
+}
+// Called with the lock held
+static void uring_submit(phevUringConn_t *conn)
+{
+    if (io_uring_sq_ready(&conn->ring) > 0)
+    {
+        io_uring_submit(&conn->ring);
+    }
+}
+// Called with the lock held
+static void uring_sendComplete(phevUringConn_t *conn, int res)
+{
+    int flight = conn->sendFill ^ 1;
+
+    conn->sendInFlight = false;
+
+    if (res < 0)
+    {
+        LOG_E(APP_TAG, "Send failed %d", res);
+        conn->sendLength[flight] = 0;
+        atomic_store(&conn->closed, true);
+        return;
+    }
+    conn->sendOffset += (size_t) res;
+
+    if (conn->sendOffset < conn->sendLength[flight])
+    {
+        uring_prepSend(conn, conn->send[flight] + conn->sendOffset, conn->sendLength[flight] - conn->sendOffset);
+        return;
+    }
+    conn->sendLength[flight] = 0;
+    uring_flushSend(conn);
+}
+static void uring_recvComplete(phevUringConn_t *conn, const struct io_uring_cqe *cqe)
+{
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+    {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t *data = conn->recvBuffers + bid * PHEV_URING_RECV_BUFFER_SIZE;
+
+        if (conn->rx.capture)
+        {
+            phev_capture_record(conn->rx.capture, PHEV_CAPTURE_IN, data, (size_t) cqe->res);
+        }
+        phev_tcpClientAppend(&conn->rx, data, (size_t) cqe->res);
+        io_uring_buf_ring_add(conn->bufRing, data, PHEV_URING_RECV_BUFFER_SIZE, bid, io_uring_buf_ring_mask(PHEV_URING_RECV_BUFFERS), 0);
+        io_uring_buf_ring_advance(conn->bufRing, 1);
+    }
+    if (cqe->flags & IORING_CQE_F_MORE)
+    {
+        return;
+    }
+    // The multishot receive ended, out of buffers rearms it, anything else is the end of the connection
+    if (cqe->res == -ENOBUFS || cqe->res > 0)
+    {
+        pthread_mutex_lock(&conn->lock);
+        uring_armRecv(conn);
+        pthread_mutex_unlock(&conn->lock);
+    }
+    else
+    {
+        LOG_I(APP_TAG, "Connection %d closed %d", conn->soc, cqe->res);
+        atomic_store(&conn->closed, true);
+    }
+}
+// Only the reading thread consumes completions
+static int uring_reap(phevUringConn_t *conn)
+{
+    struct io_uring_cqe *cqe;
+    int count = 0;
+
+    while (io_uring_peek_cqe(&conn->ring, &cqe) == 0)
+    {
+        size_t unread = conn->rx.end - conn->rx.start;
+
+        // Leave data that does not fit in the ring until the frames ahead of it are read
+        if (cqe->res > 0 && io_uring_cqe_get_data64(cqe) == PHEV_URING_RECV_TAG && (size_t) cqe->res > PHEV_TCP_RX_BUFFER_SIZE - unread)
+        {
+            break;
+        }
+        if (io_uring_cqe_get_data64(cqe) == PHEV_URING_SEND_TAG)
+        {
+            pthread_mutex_lock(&conn->lock);
+            uring_sendComplete(conn, cqe->res);
+            pthread_mutex_unlock(&conn->lock);
+        }
+        else
+        {
+            uring_recvComplete(conn, cqe);
+        }
+        io_uring_cqe_seen(&conn->ring, cqe);
+        count++;
+    }
+
+    pthread_mutex_lock(&conn->lock);
+    uring_flushSend(conn);
+    uring_submit(conn);
+    pthread_mutex_unlock(&conn->lock);
+
+    return count;
+}
+static void uring_destroy(phevUringConn_t *conn)
+{
+    if (conn->bufRing)
+    {
+        io_uring_free_buf_ring(&conn->ring, conn->bufRing, PHEV_URING_RECV_BUFFERS, PHEV_URING_BUFFER_GROUP);
+    }
+    io_uring_queue_exit(&conn->ring);
+    pthread_mutex_destroy(&conn->lock);
+    phev_free(conn->recvBuffers);
+    phev_free(conn);
+}
+static phevUringConn_t *uring_create(int soc, phevCapture_t *capture)
+{
+    phevUringConn_t *conn = phev_calloc(1, sizeof(phevUringConn_t));
+    int ret = 0;
+
+    if (conn == NULL)
+    {
+        return NULL;
+    }
+    conn->soc = soc;
+    conn->rx.soc = soc;
+    conn->rx.capture = capture;
+
+    if (io_uring_queue_init(PHEV_URING_ENTRIES, &conn->ring, 0) != 0)
+    {
+        phev_free(conn);
+        return NULL;
+    }
+    pthread_mutex_init(&conn->lock, NULL);
+
+    conn->recvBuffers = phev_malloc(PHEV_URING_RECV_BUFFERS * PHEV_URING_RECV_BUFFER_SIZE);
+    conn->bufRing = io_uring_setup_buf_ring(&conn->ring, PHEV_URING_RECV_BUFFERS, PHEV_URING_BUFFER_GROUP, 0, &ret);
+
+    if (conn->recvBuffers == NULL || conn->bufRing == NULL)
+    {
+        LOG_E(APP_TAG, "Cannot set up receive buffers %d", ret);
+        uring_destroy(conn);
+        return NULL;
+    }
+    for (int i = 0; i < PHEV_URING_RECV_BUFFERS; i++)
+    {
+        io_uring_buf_ring_add(conn->bufRing, conn->recvBuffers + i * PHEV_URING_RECV_BUFFER_SIZE, PHEV_URING_RECV_BUFFER_SIZE, i, io_uring_buf_ring_mask(PHEV_URING_RECV_BUFFERS), i);
+    }
+    io_uring_buf_ring_advance(conn->bufRing, PHEV_URING_RECV_BUFFERS);
+
+    uring_armRecv(conn);
+    if (io_uring_submit(&conn->ring) < 0)
+    {
+        uring_destroy(conn);
+        return NULL;
+    }
+    return conn;
+}
+int phev_uringConnect(const char *host, uint16_t port)
+{
+    LOG_V(APP_TAG, "START - connect");
+
+    if (!phev_uringAvailable())
+    {
+        return phev_tcpClientConnectSocket(host, port);
+    }
+
+    int soc = phev_tcpClientOpenSocket(host, port);
+
+    if (soc >= 0 && !phev_uringAttach(soc, NULL))
+    {
+        phev_tcpClientDisconnectSocket(soc);
+        return phev_tcpClientConnectSocket(host, port);
+    }
+
+    LOG_V(APP_TAG, "END - connect");
+
+    return soc;
+}
+bool phev_uringAttach(int soc, phevCapture_t *capture)
+{
+    phevUringConn_t *conn = (phev_uringAvailable() && soc >= 0 && soc < PHEV_URING_MAX_SOCKETS ? uring_create(soc, capture) : NULL);
+
+    if (conn == NULL)
+    {
+        LOG_W(APP_TAG, "Socket %d falls back to read and write", soc);
+        return false;
+    }
+    atomic_store(&uringConns[soc], conn);
+
+    return true;
+}
+int phev_uringDisconnect(int soc)
+{
+    if (soc >= 0 && soc < PHEV_URING_MAX_SOCKETS)
+    {
+        phevUringConn_t *conn = atomic_exchange(&uringConns[soc], NULL);
+
+        if (conn)
+        {
+            uring_destroy(conn);
+        }
+    }
+    return phev_tcpClientDisconnectSocket(soc);
+}
+int phev_uringRead(int soc, uint8_t *buf, size_t len)
+{
+    phevUringConn_t *conn = uring_conn(soc);
+    const uint8_t *frame = NULL;
+
+    if (conn == NULL)
+    {
+        return phev_tcpClientRead(soc, buf, len);
+    }
+
+    if (phev_tcpClientNextFrame(&conn->rx, &frame) == 0)
+    {
+        if (uring_reap(conn) == 0 && !atomic_load(&conn->closed))
+        {
+            struct io_uring_cqe *cqe;
+            struct __kernel_timespec timeout = {
+                .tv_sec = TCP_READ_TIMEOUT / 1000,
+                .tv_nsec = (TCP_READ_TIMEOUT % 1000) * 1000000L,
+            };
+
+            if (io_uring_wait_cqe_timeout(&conn->ring, &cqe, &timeout) == 0)
+            {
+                uring_reap(conn);
+            }
+        }
+        if (phev_tcpClientNextFrame(&conn->rx, &frame) == 0)
+        {
+            return (atomic_load(&conn->closed) ? -1 : 0);
+        }
+    }
+    return (int) phev_tcpClientTakeFrames(&conn->rx, buf, len);
+}
+int phev_uringWrite(int soc, uint8_t *buf, size_t len)
+{
+    phevUringConn_t *conn = uring_conn(soc);
+
+    if (conn == NULL)
+    {
+        return phev_tcpClientWrite(soc, buf, len);
+    }
+
+    pthread_mutex_lock(&conn->lock);
+
+    int fill = conn->sendFill;
+    size_t sent = 0;
+
+    if (atomic_load(&conn->closed))
+    {
+        pthread_mutex_unlock(&conn->lock);
+        return -1;
+    }
+
+    PHEV_LOG_FRAME("WRITE", buf, len);
+
+    // A send SQE costs more than send on an idle socket, the ring only carries what has to wait
+    if (!conn->sendInFlight && conn->sendLength[fill] == 0)
+    {
+        ssize_t num = send(soc, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (num < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            pthread_mutex_unlock(&conn->lock);
+            return -1;
+        }
+        sent = (num > 0 ? (size_t) num : 0);
+    }
+
+    if (len - sent > PHEV_URING_SEND_BUFFER_SIZE - conn->sendLength[fill])
+    {
+        pthread_mutex_unlock(&conn->lock);
+        LOG_E(APP_TAG, "Cannot queue %zu bytes on socket %d", len - sent, soc);
+        return -1;
+    }
+    if (sent < len)
+    {
+        memcpy(conn->send[fill] + conn->sendLength[fill], buf + sent, len - sent);
+        conn->sendLength[fill] += len - sent;
+        uring_flushSend(conn);
+        uring_submit(conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    return (int) len;
+}
+#else
+bool phev_uringAvailable(void)
+{
+    return false;
+}
+int phev_uringConnect(const char *host, uint16_t port)
+{
+    return phev_tcpClientConnectSocket(host, port);
+}
+bool phev_uringAttach(int soc, phevCapture_t *capture)
+{
+    return false;
+}
+int phev_uringDisconnect(int soc)
+{
+    return phev_tcpClientDisconnectSocket(soc);
+}
+int phev_uringRead(int soc, uint8_t *buf, size_t len)
+{
+    return phev_tcpClientRead(soc, buf, len);
+}
+int phev_uringWrite(int soc, uint8_t *buf, size_t len)
+{
+    return phev_tcpClientWrite(soc, buf, len);
+}
+#endif
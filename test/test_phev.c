@@ -244,4 +244,32 @@ void test_phev_statusAsJson(void)
     cJSON * level = cJSON_GetObjectItemCaseSensitive(battery, "soc");
 
     TEST_ASSERT_EQUAL(50,level->valueint);
-}
\ No newline at end of file
+}
+static int test_phev_commandCallbacks = 0;
+
+static void test_phev_commandCallback(phevCtx_t * ctx, void * data)
+{
+    test_phev_commandCallbacks++;
+}
+void test_phev_command_waits_for_pipe_thread(void)
+{
+    phevSettings_t settings = {
+        .transport = phev_transport_loopback(NULL, NULL),
+    };
+    phevCtx_t * handle = phev_init(settings);
+    phevServiceCtx_t * service = handle->serviceCtx;
+
+    // Not on the pipe thread, so nothing touches the pipe yet
+    phev_headLights(handle, true, test_phev_commandCallback);
+    phev_updateAll(handle, NULL);
+
+    TEST_ASSERT_EQUAL(0, service->pipe->updateRegisterCallbacks->numberOfCallbacks);
+
+    // The pipe thread runs them between loops
+    service->yieldHandler(service);
+
+    TEST_ASSERT_EQUAL(2, service->pipe->updateRegisterCallbacks->numberOfCallbacks);
+    TEST_ASSERT_EQUAL(KO_WF_H_LAMP_CONT_SP, service->pipe->updateRegisterCallbacks->registers[0]);
+    TEST_ASSERT_EQUAL(KO_WF_EV_UPDATE_SP, service->pipe->updateRegisterCallbacks->registers[1]);
+    TEST_ASSERT_EQUAL(0, test_phev_commandCallbacks);
+}
@@ -0,0 +1,110 @@
+#include <string.h>
+#include "unity.h"
+#include "phev_alloc.h"
+#include "phev_model.h"
+#include "phev_service.h"
+#include "phev_core.h"
+
+void test_phev_alloc_tracker_counts(void)
+{
+    phevAllocTracker_t * tracker = phev_alloc_createTracker(NULL, 16);
+    phevAllocator_t allocator = phev_alloc_trackerAllocator(tracker);
+
+    phev_alloc_setAllocator(&allocator);
+
+    uint8_t * first = phev_malloc(10);
+    uint8_t * second = phev_malloc(20);
+    char * copy = phev_strdup("phev");
+
+    phev_free(first);
+    second = phev_realloc(second, 40);
+
+    phevAllocStats_t stats = phev_alloc_trackerStats(tracker);
+
+    TEST_ASSERT_EQUAL(4, stats.allocations);
+    TEST_ASSERT_EQUAL(2, stats.frees);
+    TEST_ASSERT_EQUAL(2, stats.liveBlocks);
+    TEST_ASSERT_EQUAL(45, stats.liveBytes);
+    TEST_ASSERT_EQUAL(45, stats.peakBytes);
+
+    phevAllocSite_t site;
+    int sites = 0;
+
+    for(int i = phev_alloc_nextSite(tracker, 0, &site); i > 0; i = phev_alloc_nextSite(tracker, i, &site))
+    {
+        TEST_ASSERT_NOT_NULL(strstr(site.site, "test_phev_alloc.c:"));
+        sites++;
+    }
+    TEST_ASSERT_EQUAL(4, sites);
+
+    phev_free(second);
+    phev_free(copy);
+
+    stats = phev_alloc_trackerStats(tracker);
+
+    TEST_ASSERT_EQUAL(0, stats.liveBlocks);
+    TEST_ASSERT_EQUAL(0, stats.liveBytes);
+
+    char report[2048];
+
+    size_t length = phev_alloc_formatReport(tracker, 2, report, sizeof(report));
+
+    TEST_ASSERT_EQUAL(length, strlen(report));
+    TEST_ASSERT_NOT_NULL(strstr(report, "allocations per frame 2.00\n"));
+
+    phev_alloc_setAllocator(NULL);
+    phev_alloc_destroyTracker(tracker);
+}
+void test_phev_alloc_model_replaced_registers_freed(void)
+{
+    const uint8_t data[] = {1,2,3,4};
+    phevAllocTracker_t * tracker = phev_alloc_createTracker(NULL, 0);
+    phevAllocator_t allocator = phev_alloc_trackerAllocator(tracker);
+
+    phev_alloc_setAllocator(&allocator);
+
+    phevModel_t * model = phev_model_create();
+
+    for(int i = 0; i < 10; i++)
+    {
+        phev_model_setRegister(model, 0x11, data, sizeof(data));
+    }
+    phevAllocStats_t stats = phev_alloc_trackerStats(tracker);
+
+    // The model and the current value, nobody was reading
+    TEST_ASSERT_EQUAL(2, stats.liveBlocks);
+
+    phev_free(phev_model_getRegister(model, 0x11));
+    TEST_ASSERT_EQUAL(0, phev_model_compareRegister(model, 0x11, data));
+    phev_model_destroy(model);
+
+    stats = phev_alloc_trackerStats(tracker);
+    TEST_ASSERT_EQUAL(0, stats.liveBytes);
+
+    phev_alloc_setAllocator(NULL);
+    phev_alloc_destroyTracker(tracker);
+}
+void test_phev_alloc_json_command_does_not_leak(void)
+{
+    const char * command = "{ \"updateRegister\" : { \"register\" : 1, \"value\" : [1,2,3] } }";
+    phevAllocTracker_t * tracker = phev_alloc_createTracker(NULL, 0);
+    phevAllocator_t allocator = phev_alloc_trackerAllocator(tracker);
+
+    phev_alloc_setAllocator(&allocator);
+    phev_service_useAllocator();
+
+    TEST_ASSERT_FALSE(phev_service_validateCommand("{ \"updateRegister\" : { \"register\" : 1 } }"));
+
+    phevMessage_t * message = phev_service_jsonCommandToPhevMessage(command);
+
+    TEST_ASSERT_NOT_NULL(message);
+    phev_core_destroyMessage(message);
+
+    phevAllocStats_t stats = phev_alloc_trackerStats(tracker);
+
+    TEST_ASSERT_TRUE(stats.allocations > 0);
+    TEST_ASSERT_EQUAL(0, stats.liveBytes);
+
+    phev_alloc_setAllocator(NULL);
+    phev_alloc_destroyTracker(tracker);
+}
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "unity.h"
+#include "phev_broker.h"
+#include "phev_service.h"
+
+#define TEST_BROKER_SOCKET "test_phev_broker.sock"
+
+static int test_broker_connect(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int soc = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    strcpy(addr.sun_path, TEST_BROKER_SOCKET);
+    TEST_ASSERT_EQUAL(0, connect(soc, (struct sockaddr *) &addr, sizeof(addr)));
+
+    return soc;
+}
+static void test_broker_send(int soc, const char * line)
+{
+    TEST_ASSERT_EQUAL(strlen(line), write(soc, line, strlen(line)));
+}
+// Reads one line, waiting up to a second for it.
+static char * test_broker_readLine(int soc, char * buf, size_t len)
+{
+    size_t num = 0;
+
+    while(num < len - 1)
+    {
+        struct pollfd fd = { .fd = soc, .events = POLLIN };
+
+        if(poll(&fd, 1, 1000) != 1 || read(soc, buf + num, 1) != 1)
+        {
+            break;
+        }
+        if(buf[num] == '\n')
+        {
+            buf[num] = '\0';
+            return buf;
+        }
+        num++;
+    }
+    buf[num] = '\0';
+    return NULL;
+}
+static phevServiceCtx_t * test_broker_service(void)
+{
+    phevServiceCtx_t * service = calloc(1, sizeof(phevServiceCtx_t));
+
+    service->model = phev_model_create();
+
+    return service;
+}
+void test_phev_broker_subscribe_update(void)
+{
+    const uint8_t data[] = {0x50};
+    const uint8_t other[] = {0x01};
+    char line[PHEV_BROKER_MAX_LINE];
+    phevServiceCtx_t * service = test_broker_service();
+    phevBrokerSettings_t settings = { .path = TEST_BROKER_SOCKET };
+
+    phevBroker_t * broker = phev_broker_create(service, settings);
+
+    TEST_ASSERT_NOT_NULL(broker);
+
+    int soc = test_broker_connect();
+
+    test_broker_send(soc, "subscribe 29\n");
+    TEST_ASSERT_EQUAL_STRING("ok", test_broker_readLine(soc, line, sizeof(line)));
+
+    phev_model_setRegister(service->model, 30, other, sizeof(other));
+    phev_model_setRegister(service->model, 29, data, sizeof(data));
+
+    TEST_ASSERT_EQUAL_STRING("update 29 50", test_broker_readLine(soc, line, sizeof(line)));
+
+    test_broker_send(soc, "bogus\n");
+    TEST_ASSERT_EQUAL_STRING("error unknown command", test_broker_readLine(soc, line, sizeof(line)));
+
+    phevBrokerStats_t stats = phev_broker_stats(broker);
+
+    TEST_ASSERT_EQUAL(1, stats.clients);
+    TEST_ASSERT_EQUAL(1, stats.published);
+    TEST_ASSERT_EQUAL(0, stats.dropped);
+
+    close(soc);
+    phev_broker_destroy(broker);
+    TEST_ASSERT_NOT_EQUAL(0, access(TEST_BROKER_SOCKET, F_OK));
+    phev_model_destroy(service->model);
+    free(service);
+}
+void test_phev_broker_subscribe_snapshot(void)
+{
+    const uint8_t data[] = {0x01, 0x02};
+    char line[PHEV_BROKER_MAX_LINE];
+    phevServiceCtx_t * service = test_broker_service();
+    phevBrokerSettings_t settings = { .path = TEST_BROKER_SOCKET };
+
+    phev_model_setRegister(service->model, 10, data, sizeof(data));
+
+    phevBroker_t * broker = phev_broker_create(service, settings);
+    int soc = test_broker_connect();
+
+    test_broker_send(soc, "subscribe all\n");
+    TEST_ASSERT_EQUAL_STRING("ok", test_broker_readLine(soc, line, sizeof(line)));
+
+    // Current values come from the service thread
+    phev_broker_poll(broker);
+
+    TEST_ASSERT_EQUAL_STRING("update 10 0102", test_broker_readLine(soc, line, sizeof(line)));
+    TEST_ASSERT_EQUAL(1, phev_broker_stats(broker).commands);
+
+    close(soc);
+    phev_broker_destroy(broker);
+    phev_model_destroy(service->model);
+    free(service);
+}
+void test_phev_broker_slow_client_drops(void)
+{
+    uint8_t data[UINT8_MAX] = {0};
+    char line[PHEV_BROKER_MAX_LINE];
+    phevServiceCtx_t * service = test_broker_service();
+    phevBrokerSettings_t settings = {
+        .path = TEST_BROKER_SOCKET,
+        .queueDepth = 4,
+    };
+    phevBroker_t * broker = phev_broker_create(service, settings);
+    int soc = test_broker_connect();
+
+    test_broker_send(soc, "subscribe 1\n");
+    TEST_ASSERT_EQUAL_STRING("ok", test_broker_readLine(soc, line, sizeof(line)));
+
+    // Nobody reads, once the socket is full the queue fills and updates are dropped
+    for(int i = 0; i < 100000 && phev_broker_stats(broker).dropped == 0; i++)
+    {
+        data[0] = (uint8_t) i;
+        phev_model_setRegister(service->model, 1, data, sizeof(data));
+    }
+    TEST_ASSERT_NOT_EQUAL(0, phev_broker_stats(broker).dropped);
+
+    bool told = false;
+
+    while(test_broker_readLine(soc, line, sizeof(line)))
+    {
+        if(strncmp(line, "dropped ", 8) == 0)
+        {
+            told = true;
+            break;
+        }
+    }
+    TEST_ASSERT_TRUE(told);
+
+    close(soc);
+    phev_broker_destroy(broker);
+    phev_model_destroy(service->model);
+    free(service);
+}
+void test_phev_broker_overlong_line_discarded(void)
+{
+    char overlong[PHEV_BROKER_MAX_LINE + 16];
+    char line[PHEV_BROKER_MAX_LINE];
+    phevServiceCtx_t * service = test_broker_service();
+    phevBrokerSettings_t settings = { .path = TEST_BROKER_SOCKET };
+    phevBroker_t * broker = phev_broker_create(service, settings);
+    int soc = test_broker_connect();
+
+    // The tail past the limit is a command of its own, it must not run
+    memset(overlong, 'x', PHEV_BROKER_MAX_LINE - 1);
+    strcpy(overlong + PHEV_BROKER_MAX_LINE - 1, "subscribe 29\n");
+
+    test_broker_send(soc, overlong);
+    TEST_ASSERT_EQUAL_STRING("error line too long", test_broker_readLine(soc, line, sizeof(line)));
+
+    test_broker_send(soc, "bogus\n");
+    TEST_ASSERT_EQUAL_STRING("error unknown command", test_broker_readLine(soc, line, sizeof(line)));
+
+    close(soc);
+    phev_broker_destroy(broker);
+    phev_model_destroy(service->model);
+    free(service);
+}
+static void test_broker_nullListener(phevModel_t * model, uint8_t reg, const uint8_t * data, size_t length, void * ctx)
+{
+}
+void test_phev_broker_no_room_for_listener(void)
+{
+    phevServiceCtx_t * service = test_broker_service();
+    phevBrokerSettings_t settings = { .path = TEST_BROKER_SOCKET };
+
+    for(int i = 0; i < PHEV_MODEL_MAX_LISTENERS; i++)
+    {
+        TEST_ASSERT_TRUE(phev_model_addListener(service->model, test_broker_nullListener, NULL));
+    }
+    TEST_ASSERT_NULL(phev_broker_create(service, settings));
+    TEST_ASSERT_NOT_EQUAL(0, access(TEST_BROKER_SOCKET, F_OK));
+
+    phev_model_destroy(service->model);
+    free(service);
+}
+void test_phev_broker_socket_owner_only(void)
+{
+    struct stat st;
+    phevServiceCtx_t * service = test_broker_service();
+    phevBrokerSettings_t settings = { .path = TEST_BROKER_SOCKET };
+
+    phevBroker_t * broker = phev_broker_create(service, settings);
+
+    TEST_ASSERT_NOT_NULL(broker);
+    TEST_ASSERT_EQUAL(0, lstat(TEST_BROKER_SOCKET, &st));
+    TEST_ASSERT_TRUE(S_ISSOCK(st.st_mode));
+    TEST_ASSERT_EQUAL(0600, st.st_mode & 0777);
+
+    phev_broker_destroy(broker);
+    phev_model_destroy(service->model);
+    free(service);
+}
+void test_phev_broker_keeps_other_file(void)
+{
+    phevServiceCtx_t * service = test_broker_service();
+    phevBrokerSettings_t settings = { .path = TEST_BROKER_SOCKET };
+    FILE * file = fopen(TEST_BROKER_SOCKET, "w");
+
+    fclose(file);
+
+    TEST_ASSERT_NULL(phev_broker_create(service, settings));
+    TEST_ASSERT_EQUAL(0, access(TEST_BROKER_SOCKET, F_OK));
+
+    remove(TEST_BROKER_SOCKET);
+    phev_model_destroy(service->model);
+    free(service);
+}
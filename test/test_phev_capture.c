@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "phev_capture.h"
+#include "phev_tcpip.h"
+#include "phev_transport.h"
+#if defined(__linux__) || defined(__unix__)
+#include <unistd.h>
+#endif
+
+#define TEST_CAPTURE_PATH "test_phev_capture.bin"
+#define TEST_CAPTURE_OTHER_PATH "test_phev_capture_other.bin"
+
+static const uint8_t captureFrame[] = {0x6f, 0x04, 0x00, 0x1d, 0x50, 0xe0};
+
+void test_phev_capture_records_and_reads_back(void)
+{
+    uint8_t big[PHEV_CAPTURE_MAX_RECORD + 10];
+    phevCaptureRecord_t record;
+
+    memset(big, 0x55, sizeof(big));
+    remove(TEST_CAPTURE_PATH);
+
+    phevCapture_t * capture = phev_capture_open(TEST_CAPTURE_PATH);
+
+    TEST_ASSERT_NOT_NULL(capture);
+    TEST_ASSERT_TRUE(phev_capture_record(capture, PHEV_CAPTURE_IN, captureFrame, sizeof(captureFrame)));
+    TEST_ASSERT_TRUE(phev_capture_record(capture, PHEV_CAPTURE_OUT, big, sizeof(big)));
+    phev_capture_close(capture);
+
+    phevCaptureReader_t * reader = phev_capture_openReader(TEST_CAPTURE_PATH);
+
+    TEST_ASSERT_NOT_NULL(reader);
+    TEST_ASSERT_TRUE(phev_capture_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_CAPTURE_IN, record.direction);
+    TEST_ASSERT_EQUAL(sizeof(captureFrame), record.length);
+    TEST_ASSERT_EQUAL_MEMORY(captureFrame, record.data, sizeof(captureFrame));
+
+    uint64_t first = record.timestamp;
+
+    // Split at the record limit
+    TEST_ASSERT_TRUE(phev_capture_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_CAPTURE_OUT, record.direction);
+    TEST_ASSERT_EQUAL(PHEV_CAPTURE_MAX_RECORD, record.length);
+    TEST_ASSERT_TRUE(record.timestamp >= first);
+    TEST_ASSERT_TRUE(phev_capture_next(reader, &record));
+    TEST_ASSERT_EQUAL(10, record.length);
+    TEST_ASSERT_FALSE(phev_capture_next(reader, &record));
+
+    phev_capture_closeReader(reader);
+    remove(TEST_CAPTURE_PATH);
+}
+void test_phev_capture_per_transport(void)
+{
+    uint8_t buf[32];
+    uint8_t noisy[] = {0x55, 0x6f, 0x04, 0x00, 0x1d, 0x50, 0xe0};
+    uint8_t ack[] = {0xf6, 0x04, 0x01, 0x1d, 0x00, 0x18};
+    phevCaptureRecord_t record;
+
+    remove(TEST_CAPTURE_PATH);
+    remove(TEST_CAPTURE_OTHER_PATH);
+
+    phevCapture_t * capture = phev_capture_open(TEST_CAPTURE_PATH);
+    phevCapture_t * other = phev_capture_open(TEST_CAPTURE_OTHER_PATH);
+    phevTransport_t * transport = phev_transport_loopback(NULL, NULL);
+    phevTransport_t * second = phev_transport_loopback(NULL, NULL);
+
+    phev_transport_setCapture(transport, capture);
+    phev_transport_setCapture(second, other);
+
+    TEST_ASSERT_EQUAL(sizeof(ack), phev_transport_write(transport, ack, sizeof(ack)));
+    TEST_ASSERT_EQUAL(sizeof(noisy), phev_transport_loopbackInject(transport, noisy, sizeof(noisy)));
+    TEST_ASSERT_EQUAL(sizeof(captureFrame), phev_transport_read(transport, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(sizeof(ack), phev_transport_write(second, ack, sizeof(ack)));
+
+    phev_transport_destroy(transport);
+    phev_transport_destroy(second);
+    phev_capture_close(capture);
+    phev_capture_close(other);
+
+    phevCaptureReader_t * reader = phev_capture_openReader(TEST_CAPTURE_PATH);
+
+    TEST_ASSERT_TRUE(phev_capture_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_CAPTURE_OUT, record.direction);
+    TEST_ASSERT_EQUAL_MEMORY(ack, record.data, sizeof(ack));
+
+    // What the car sent, the byte the framer drops included
+    TEST_ASSERT_TRUE(phev_capture_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_CAPTURE_IN, record.direction);
+    TEST_ASSERT_EQUAL(sizeof(noisy), record.length);
+    TEST_ASSERT_EQUAL_MEMORY(noisy, record.data, sizeof(noisy));
+    TEST_ASSERT_FALSE(phev_capture_next(reader, &record));
+    phev_capture_closeReader(reader);
+
+    // The second session's capture has only its own write
+    reader = phev_capture_openReader(TEST_CAPTURE_OTHER_PATH);
+
+    TEST_ASSERT_TRUE(phev_capture_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_CAPTURE_OUT, record.direction);
+    TEST_ASSERT_FALSE(phev_capture_next(reader, &record));
+    phev_capture_closeReader(reader);
+
+    remove(TEST_CAPTURE_PATH);
+    remove(TEST_CAPTURE_OTHER_PATH);
+}
+void test_phev_capture_records_fill_before_framing(void)
+{
+#if defined(__linux__) || defined(__unix__)
+    static phevTcpRxBuffer_t rx;
+    uint8_t noisy[] = {0x55, 0x6f, 0x04, 0x00, 0x1d, 0x50, 0xe0};
+    uint8_t buf[32];
+    phevCaptureRecord_t record;
+    int fds[2];
+
+    remove(TEST_CAPTURE_PATH);
+    TEST_ASSERT_EQUAL(0, pipe(fds));
+
+    rx.soc = fds[0];
+    rx.quickAck = false;
+    rx.capture = phev_capture_open(TEST_CAPTURE_PATH);
+    rx.start = 0;
+    rx.end = 0;
+
+    TEST_ASSERT_EQUAL(sizeof(noisy), write(fds[1], noisy, sizeof(noisy)));
+    TEST_ASSERT_EQUAL(sizeof(captureFrame), phev_tcpClientReadFrames(&rx, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(captureFrame, buf, sizeof(captureFrame));
+    phev_capture_close(rx.capture);
+
+    phevCaptureReader_t * reader = phev_capture_openReader(TEST_CAPTURE_PATH);
+
+    TEST_ASSERT_TRUE(phev_capture_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_CAPTURE_IN, record.direction);
+    TEST_ASSERT_EQUAL(sizeof(noisy), record.length);
+    TEST_ASSERT_EQUAL_MEMORY(noisy, record.data, sizeof(noisy));
+
+    phev_capture_closeReader(reader);
+    close(fds[0]);
+    close(fds[1]);
+    remove(TEST_CAPTURE_PATH);
+#else
+    TEST_IGNORE_MESSAGE("Needs POSIX pipes");
+#endif
+}
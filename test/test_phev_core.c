@@ -32,7 +32,7 @@ void test_phev_core_extractAndDecodeIncomingMessageAndXOR(void)
     uint8_t input[] = { 0x4f,0x26,0x20,0x23,0x21,0x31,0x43,0xcd };
     uint8_t expected[] = { 0x6f,0x06,0x00,0x03,0x01,0x11,0x63,0xed};
 
-    message_t * message = phev_core_extractAndDecodeIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractAndDecodeIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_MEMORY(expected,message->data,sizeof(expected));
@@ -792,7 +792,7 @@ void test_phev_core_decodeMessage_command_response(void)
 void test_core_phev_core_extractIncomingMessageAndXOR_valid_ping_in_clear(void)
 {
     uint8_t input[] = { 0x3f,0x04,0x01,0x00,0x00,0x44 };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -801,7 +801,7 @@ void test_core_phev_core_extractIncomingMessageAndXOR_valid_ping_in_clear(void)
 void test_core_phev_core_extractIncomingMessageAndXOR_valid_ping_encoded(void)
 {
     uint8_t input[] = { 0xa1,0x9a,0x9f,0x96,0x9e,0xd2 };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -811,7 +811,7 @@ void test_core_phev_core_extractIncomingMessageAndXOR_valid_ping_encoded(void)
 void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_response_in_clear(void)
 {
     uint8_t input[] = { 0x6F,0x04,0x01,0x07,0x00,0x7B };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -820,7 +820,7 @@ void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_response_in_
 void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_response_encoded(void)
 {
     uint8_t input[] = { 0x5F,0x34,0x31,0x35,0x30,0x49 }; // 6F 04 01 05 00 79
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -830,7 +830,7 @@ void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_response_enc
 void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_request_in_clear(void)
 {
     uint8_t input[] = { 0x6F,0x04,0x00,0x1B,0x01,0x8F };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -839,7 +839,7 @@ void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_request_in_c
 void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_request_encoded(void)
 {
     uint8_t input[] = {  0xF1,0x9A,0x9E,0x85,0x9F,0x11 }; // 6F 04 00 1B 01 8F
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -849,7 +849,7 @@ void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_request_enco
 void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_start_in_clear(void)
 {
     uint8_t input[] = {  0x4E,0x0C,0x00,0x01,0x04,0x69,0x1D,0x04,0x61,0x94,0xF2,0x3F,0x02,0x11 };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -859,14 +859,14 @@ void test_core_phev_core_extractIncomingMessageAndXOR_valid_command_start_in_cle
 void test_core_phev_core_extractIncomingMessageAndXOR_invalid_command(void)
 {
     uint8_t input[] = {  0x4F,0x0C,0x00,0x01,0x04,0x69,0x1D,0x04,0x61,0x94,0xF2,0x3F,0x02,0x11 };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NULL(message);
 }
 void test_core_phev_core_extractIncomingMessageAndXOR_BB_command(void)
 {
     uint8_t input[] = { 0xB1,0x0E,0x0B,0x91,0x00,0x6F };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -875,7 +875,7 @@ void test_core_phev_core_extractIncomingMessageAndXOR_BB_command(void)
 void test_core_phev_core_extractIncomingMessageAndXOR_CC_command(void)
 {
     uint8_t input[] = {0xDE,0x16,0x13,0xC4,0x3B,0xC2 };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
@@ -884,22 +884,167 @@ void test_core_phev_core_extractIncomingMessageAndXOR_CC_command(void)
 void test_core_phev_core_extractIncomingMessageAndXOR_2F_command(void)
 {
     uint8_t input[] = {0x3A,0x16,0x15,0x14,0x26 };
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(input,message->data,sizeof(input));
     TEST_ASSERT_EQUAL(0x15,phev_core_getMessageXOR(message)); 
 }
+void test_core_phev_core_extractIncomingMessageExpectXOR(void)
+{
+    uint8_t encoded[] = { 0x5F,0x34,0x31,0x35,0x30,0x49 }; // 6F 04 01 05 00 79
+    uint8_t clear[] = { 0x6F,0x04,0x01,0x07,0x00,0x7B };
+    bool fallback = true;
+
+    message_t * message = phev_core_extractIncomingMessageExpectXOR(encoded, sizeof(encoded), 0x30, &fallback);
+
+    TEST_ASSERT_NOT_NULL(message);
+    TEST_ASSERT_FALSE(fallback);
+    TEST_ASSERT_EQUAL(0x30,phev_core_getMessageXOR(message));
+    msg_utils_destroyMsg(message);
+
+    message = phev_core_extractIncomingMessageExpectXOR(encoded, sizeof(encoded), 0x42, &fallback);
+
+    TEST_ASSERT_NOT_NULL(message);
+    TEST_ASSERT_TRUE(fallback);
+    TEST_ASSERT_EQUAL(0x30,phev_core_getMessageXOR(message));
+    msg_utils_destroyMsg(message);
+
+    message = phev_core_extractIncomingMessageExpectXOR(clear, sizeof(clear), 0, &fallback);
+
+    TEST_ASSERT_NOT_NULL(message);
+    TEST_ASSERT_FALSE(fallback);
+    TEST_ASSERT_NULL(message->ctx);
+    msg_utils_destroyMsg(message);
+
+    TEST_ASSERT_NULL(phev_core_extractIncomingMessageExpectXOR(encoded, sizeof(encoded) - 1, 0x30, &fallback));
+}
+void test_core_phev_core_scanIncomingFrames(void)
+{
+    const uint8_t input[] = {
+        0x5F,0x34,0x31,0x35,0x30,0x49, // 6F 04 01 05 00 79 under 30
+        0x5F,0x34,0x31,0x35,0x30,0x49,
+        0x6F,0x04,0x01,0x07,0x00,0x7B,
+        0x00,0x01,0x02,
+    };
+    phevFrame_t frames[4];
+    uint8_t xor = 0;
+    size_t used = 0;
+    size_t fallbacks = 0;
+
+    size_t numberOfFrames = phev_core_scanIncomingFrames(input, sizeof(input), &xor, frames, 4, &used, &fallbacks);
+
+    TEST_ASSERT_EQUAL(3, numberOfFrames);
+    TEST_ASSERT_EQUAL(18, used);
+    // The first frame, before the key was known, and the one in the clear
+    TEST_ASSERT_EQUAL(2, fallbacks);
+    TEST_ASSERT_EQUAL(0, xor);
+
+    TEST_ASSERT_EQUAL(6, frames[1].offset);
+    TEST_ASSERT_EQUAL(6, frames[1].length);
+    TEST_ASSERT_EQUAL_HEX8(0x30, frames[1].xor);
+    TEST_ASSERT_EQUAL_HEX8(0x6f, frames[1].command);
+    TEST_ASSERT_EQUAL(RESPONSE_TYPE, frames[1].type);
+    TEST_ASSERT_EQUAL(0x05, frames[1].reg);
+    TEST_ASSERT_EQUAL_HEX8(0x00, frames[2].xor);
+    TEST_ASSERT_EQUAL(0x07, frames[2].reg);
+
+    xor = 0x30;
+    numberOfFrames = phev_core_scanIncomingFrames(input, sizeof(input), &xor, frames, 1, &used, NULL);
+
+    TEST_ASSERT_EQUAL(1, numberOfFrames);
+    TEST_ASSERT_EQUAL(6, used);
+    TEST_ASSERT_EQUAL(0, phev_core_scanIncomingFrames(input + 18, 3, &xor, frames, 4, &used, NULL));
+    TEST_ASSERT_EQUAL(0, used);
+}
+void test_core_phev_core_scan_and_extract_agree(void)
+{
+    // Every command in the clear under both types, 9F, CD and E4 among them
+    for(int command = 0; command <= 0xff; command++)
+    {
+        for(uint8_t type = 0; type < 2; type++)
+        {
+            uint8_t input[] = {(uint8_t) command, 0x04, type, 0x05, 0x00, 0x00};
+            phevFrame_t frame;
+            uint8_t xor = 0;
+            size_t used = 0;
+
+            input[5] = phev_core_checksum(input);
+
+            size_t found = phev_core_scanIncomingFrames(input, sizeof(input), &xor, &frame, 1, &used, NULL);
+            message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
+
+            TEST_ASSERT_EQUAL_MESSAGE(found == 1, message != NULL, "scan and extract disagree");
+            if(message)
+            {
+                TEST_ASSERT_EQUAL(frame.xor, phev_core_getMessageXOR(message));
+                msg_utils_destroyMsg(message);
+            }
+        }
+    }
+}
 void test_core_phev_core_extractIncomingMessageValidFirstByteCommand(void)
 {
     uint8_t input[]= {0x6f,0xa7,0xa2,0x8b,0x62,0x19};
     uint8_t expected[] = {0xcc,0x04,0x28,0x8b,0xba};
-    message_t * message = phev_core_extractIncomingMessageAndXOR(input);
+    message_t * message = phev_core_extractIncomingMessageAndXOR(input, sizeof(input));
 
     TEST_ASSERT_NOT_NULL(message);
     TEST_ASSERT_EQUAL_HEX8_ARRAY(expected,message->data,sizeof(expected));
     
 }
+void test_core_phev_core_extractIncomingMessage_truncated(void)
+{
+    TEST_ASSERT_NULL(phev_core_extractIncomingMessageAndXOR(singleMessage, sizeof(singleMessage) - 1));
+    TEST_ASSERT_NULL(phev_core_extractIncomingMessageAndXOR(singleMessage, 3));
+    TEST_ASSERT_NULL(phev_core_extractIncomingMessageAndXOR(singleMessage, 0));
+}
+void test_core_phev_core_extractIncomingMessage_too_short(void)
+{
+    // Length byte too small to cover a type and register
+    uint8_t input[] = { 0x6f,0x01,0x00,0x00,0x00 };
+    
+    TEST_ASSERT_NULL(phev_core_extractIncomingMessageAndXOR(input, sizeof(input)));
+    TEST_ASSERT_EQUAL(-1, phev_core_frameLength(input, sizeof(input)));
+}
+void test_phev_core_getData_no_data(void)
+{
+    uint8_t input[] = { 0x6f,0x01,0x00,0x00,0x70 };
+
+    TEST_ASSERT_NULL(phev_core_getData(input));
+}
+void test_phev_core_frameLength_unencoded(void)
+{
+    uint8_t twoMessages[sizeof(singleMessage) * 2];
+
+    memcpy(twoMessages, singleMessage, sizeof(singleMessage));
+    memcpy(twoMessages + sizeof(singleMessage), singleMessage, sizeof(singleMessage));
+
+    TEST_ASSERT_EQUAL(sizeof(singleMessage), phev_core_frameLength(singleMessage, sizeof(singleMessage)));
+    TEST_ASSERT_EQUAL(sizeof(singleMessage), phev_core_frameLength(twoMessages, sizeof(twoMessages)));
+}
+void test_phev_core_frameLength_encoded(void)
+{
+    uint8_t encoded[sizeof(singleMessage)];
+
+    for(size_t i = 0; i < sizeof(singleMessage); i++)
+    {
+        encoded[i] = singleMessage[i] ^ 0x5a;
+    }
+
+    TEST_ASSERT_EQUAL(sizeof(singleMessage), phev_core_frameLength(encoded, sizeof(encoded)));
+}
+void test_phev_core_frameLength_incomplete(void)
+{
+    TEST_ASSERT_EQUAL(0, phev_core_frameLength(singleMessage, 2));
+    TEST_ASSERT_EQUAL(0, phev_core_frameLength(singleMessage, sizeof(singleMessage) - 1));
+}
+void test_phev_core_frameLength_not_a_frame(void)
+{
+    const uint8_t garbage[] = {0x01, 0x02, 0x03, 0x04};
+
+    TEST_ASSERT_EQUAL(-1, phev_core_frameLength(garbage, sizeof(garbage)));
+}
 /*
 void test_phev_core_decode_encode(void)
 {
@@ -0,0 +1,85 @@
+#include "unity.h"
+#include "phev_histogram.h"
+
+void test_phev_histogram_percentiles(void)
+{
+    phevHistogram_t * histogram = phev_histogram_create();
+
+    TEST_ASSERT_NOT_NULL(histogram);
+    TEST_ASSERT_EQUAL(0, phev_histogram_count(histogram));
+    TEST_ASSERT_EQUAL(0, phev_histogram_percentile(histogram, 50));
+
+    for(uint64_t i = 1; i <= 10000; i++)
+    {
+        phev_histogram_record(histogram, i * 10);
+    }
+
+    TEST_ASSERT_EQUAL(10000, phev_histogram_count(histogram));
+    TEST_ASSERT_EQUAL(10, phev_histogram_min(histogram));
+    TEST_ASSERT_EQUAL(100000, phev_histogram_max(histogram));
+    TEST_ASSERT_EQUAL(50005, (uint64_t) phev_histogram_mean(histogram));
+
+    uint64_t p50 = phev_histogram_percentile(histogram, 50);
+    uint64_t p99 = phev_histogram_percentile(histogram, 99);
+
+    TEST_ASSERT_TRUE(p50 >= 50000 && p50 <= 51500);
+    TEST_ASSERT_TRUE(p99 >= 99000 && p99 <= 100000);
+    TEST_ASSERT_EQUAL(100000, phev_histogram_percentile(histogram, 100));
+
+    phev_histogram_destroy(histogram);
+}
+void test_phev_histogram_buckets_and_reset(void)
+{
+    phevHistogram_t * histogram = phev_histogram_create();
+
+    phev_histogram_record(histogram, 3);
+    phev_histogram_record(histogram, 3);
+    phev_histogram_record(histogram, 1000);
+
+    uint64_t highest = 0;
+    uint32_t count = 0;
+    int index = phev_histogram_nextBucket(histogram, 0, &highest, &count);
+
+    TEST_ASSERT_TRUE(index > 0);
+    TEST_ASSERT_EQUAL(3, highest);
+    TEST_ASSERT_EQUAL(2, count);
+
+    index = phev_histogram_nextBucket(histogram, index, &highest, &count);
+
+    TEST_ASSERT_TRUE(index > 0);
+    TEST_ASSERT_TRUE(highest >= 1000 && highest < 1032);
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL(-1, phev_histogram_nextBucket(histogram, index, &highest, &count));
+
+    phev_histogram_reset(histogram);
+
+    TEST_ASSERT_EQUAL(0, phev_histogram_count(histogram));
+    TEST_ASSERT_EQUAL(0, phev_histogram_max(histogram));
+    TEST_ASSERT_EQUAL(-1, phev_histogram_nextBucket(histogram, 0, &highest, &count));
+
+    phev_histogram_destroy(histogram);
+}
+void test_phev_histogram_merge(void)
+{
+    phevHistogram_t * total = phev_histogram_create();
+    phevHistogram_t * first = phev_histogram_create();
+    phevHistogram_t * second = phev_histogram_create();
+
+    phev_histogram_record(first, 10);
+    phev_histogram_record(first, 20);
+    phev_histogram_record(second, 5000);
+
+    phev_histogram_merge(total, first);
+    phev_histogram_merge(total, second);
+    phev_histogram_merge(total, NULL);
+
+    TEST_ASSERT_EQUAL(3, phev_histogram_count(total));
+    TEST_ASSERT_EQUAL(10, phev_histogram_min(total));
+    TEST_ASSERT_EQUAL(5000, phev_histogram_max(total));
+    TEST_ASSERT_EQUAL(20, phev_histogram_percentile(total, 50));
+    TEST_ASSERT_TRUE(phev_histogram_mean(total) > 1676 && phev_histogram_mean(total) < 1677);
+
+    phev_histogram_destroy(total);
+    phev_histogram_destroy(first);
+    phev_histogram_destroy(second);
+}
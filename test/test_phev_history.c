@@ -0,0 +1,110 @@
+#include "unity.h"
+#include "phev_history.h"
+
+static phevHistory_t * test_phev_history_create(size_t depth)
+{
+    const uint8_t registers[] = {KO_WF_BATT_LEVEL_INFO_REP_EVR};
+    phevHistorySettings_t settings = {
+        .depth = depth,
+        .registers = registers,
+        .numberOfRegisters = sizeof(registers),
+    };
+
+    return phev_history_create(settings);
+}
+void test_phev_history_create_only_tracks_selected(void)
+{
+    phevHistory_t * history = test_phev_history_create(4);
+
+    TEST_ASSERT_NOT_NULL(history);
+    TEST_ASSERT_TRUE(phev_history_isTracked(history, KO_WF_BATT_LEVEL_INFO_REP_EVR));
+    TEST_ASSERT_FALSE(phev_history_isTracked(history, KO_WF_DOOR_STATUS_INFO_REP_EVR));
+
+    phev_history_destroy(history);
+}
+void test_phev_history_record_dedups_same_value(void)
+{
+    const uint8_t data[] = {0x50};
+    phevHistory_t * history = test_phev_history_create(4);
+
+    TEST_ASSERT_TRUE(phev_history_record(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data), 10));
+    TEST_ASSERT_FALSE(phev_history_record(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data), 20));
+    TEST_ASSERT_EQUAL(1, phev_history_count(history, KO_WF_BATT_LEVEL_INFO_REP_EVR));
+
+    phev_history_destroy(history);
+}
+void test_phev_history_latest_wraps(void)
+{
+    phevHistory_t * history = test_phev_history_create(3);
+    phevHistoryEntry_t out[3];
+
+    for(uint8_t i = 0; i < 5; i++)
+    {
+        phev_history_record(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, &i, 1, i * 10);
+    }
+
+    size_t num = phev_history_latest(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, 2, out);
+
+    TEST_ASSERT_EQUAL(3, phev_history_count(history, KO_WF_BATT_LEVEL_INFO_REP_EVR));
+    TEST_ASSERT_EQUAL(2, num);
+    TEST_ASSERT_EQUAL(3, out[0].data[0]);
+    TEST_ASSERT_EQUAL(4, out[1].data[0]);
+    TEST_ASSERT_EQUAL(40, out[1].timestamp);
+
+    phev_history_destroy(history);
+}
+void test_phev_history_range(void)
+{
+    phevHistory_t * history = test_phev_history_create(8);
+    phevHistoryEntry_t out[8];
+
+    for(uint8_t i = 0; i < 6; i++)
+    {
+        phev_history_record(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, &i, 1, i * 10);
+    }
+
+    size_t num = phev_history_range(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, 15, 40, out, 8);
+
+    TEST_ASSERT_EQUAL(3, num);
+    TEST_ASSERT_EQUAL(20, out[0].timestamp);
+    TEST_ASSERT_EQUAL(40, out[2].timestamp);
+
+    phev_history_destroy(history);
+}
+void test_phev_history_downsample(void)
+{
+    phevHistory_t * history = test_phev_history_create(8);
+    phevHistoryEntry_t out[8];
+
+    for(uint8_t i = 0; i < 6; i++)
+    {
+        phev_history_record(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, &i, 1, i * 10);
+    }
+
+    size_t num = phev_history_downsample(history, KO_WF_BATT_LEVEL_INFO_REP_EVR, 0, 100, 30, out, 8);
+
+    TEST_ASSERT_EQUAL(2, num);
+    TEST_ASSERT_EQUAL(2, out[0].data[0]);
+    TEST_ASSERT_EQUAL(5, out[1].data[0]);
+
+    phev_history_destroy(history);
+}
+void test_phev_history_records_from_model(void)
+{
+    const uint8_t first[] = {0x50};
+    const uint8_t second[] = {0x51};
+    phevHistory_t * history = test_phev_history_create(4);
+    phevModel_t * model = phev_model_create();
+
+    phev_model_addListener(model, phev_history_modelListener, history);
+
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, first, sizeof(first));
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, first, sizeof(first));
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, second, sizeof(second));
+    phev_model_setRegister(model, KO_WF_DOOR_STATUS_INFO_REP_EVR, first, sizeof(first));
+
+    TEST_ASSERT_EQUAL(2, phev_history_count(history, KO_WF_BATT_LEVEL_INFO_REP_EVR));
+    TEST_ASSERT_EQUAL(0, phev_history_count(history, KO_WF_DOOR_STATUS_INFO_REP_EVR));
+
+    phev_history_destroy(history);
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include "unity.h"
+#include "phev_journal.h"
+
+#define TEST_JOURNAL_PATH "test_phev_journal.bin"
+
+void test_phev_journal_replay_until(void)
+{
+    remove(TEST_JOURNAL_PATH);
+
+    phevJournalSettings_t settings = {
+        .path = TEST_JOURNAL_PATH,
+        .flushIntervalMs = 1,
+    };
+    phevJournal_t * journal = phev_journal_open(settings);
+
+    TEST_ASSERT_NOT_NULL(journal);
+
+    for(uint8_t i = 1; i <= 3; i++)
+    {
+        TEST_ASSERT_TRUE(phev_journal_append(journal, KO_WF_BATT_LEVEL_INFO_REP_EVR, &i, 1, i * 100));
+    }
+    phev_journal_close(journal);
+
+    phevModel_t * model = phev_model_create();
+
+    TEST_ASSERT_EQUAL(2, phev_journal_replay(TEST_JOURNAL_PATH, 200, model));
+    TEST_ASSERT_EQUAL(2, phev_model_peekRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR)->data[0]);
+
+    remove(TEST_JOURNAL_PATH);
+}
+void test_phev_journal_records_from_model(void)
+{
+    const uint8_t data[] = {0x50};
+
+    remove(TEST_JOURNAL_PATH);
+
+    phevJournalSettings_t settings = {
+        .path = TEST_JOURNAL_PATH,
+        .flushIntervalMs = 1,
+    };
+    phevJournal_t * journal = phev_journal_open(settings);
+    phevModel_t * model = phev_model_create();
+
+    phev_model_addListener(model, phev_journal_modelListener, journal);
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data));
+    phev_journal_flush(journal);
+
+    phevModel_t * replayed = phev_model_create();
+
+    TEST_ASSERT_EQUAL(1, phev_journal_replay(TEST_JOURNAL_PATH, UINT64_MAX, replayed));
+    TEST_ASSERT_EQUAL(0x50, phev_model_peekRegister(replayed, KO_WF_BATT_LEVEL_INFO_REP_EVR)->data[0]);
+
+    phev_journal_close(journal);
+    remove(TEST_JOURNAL_PATH);
+}
+void test_phev_journal_compacts_to_latest(void)
+{
+    remove(TEST_JOURNAL_PATH);
+
+    phevJournalSettings_t settings = {
+        .path = TEST_JOURNAL_PATH,
+        .flushIntervalMs = 1,
+        .compactBytes = 64,
+    };
+    phevJournal_t * journal = phev_journal_open(settings);
+
+    for(uint8_t i = 1; i <= 10; i++)
+    {
+        phev_journal_append(journal, KO_WF_BATT_LEVEL_INFO_REP_EVR, &i, 1, i);
+        phev_journal_flush(journal);
+    }
+
+    TEST_ASSERT_TRUE(phev_journal_compactions(journal) > 0);
+
+    phev_journal_close(journal);
+
+    phevModel_t * model = phev_model_create();
+
+    TEST_ASSERT_TRUE(phev_journal_replay(TEST_JOURNAL_PATH, UINT64_MAX, model) < 10);
+    TEST_ASSERT_EQUAL(10, phev_model_peekRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR)->data[0]);
+
+    remove(TEST_JOURNAL_PATH);
+}
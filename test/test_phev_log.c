@@ -0,0 +1,56 @@
+#include "unity.h"
+#include "phev_log.h"
+
+static size_t test_phev_log_length = 0;
+static uint8_t test_phev_log_decoded[PHEV_LOG_MAX_FRAME];
+
+static void test_phev_log_sink(const char * tag, const uint8_t * data, const uint8_t * decoded, size_t length)
+{
+    test_phev_log_length = length;
+    if(decoded)
+    {
+        memcpy(test_phev_log_decoded, decoded, length);
+    }
+}
+void test_phev_log_frame_without_sink(void)
+{
+    const uint8_t frame[] = {0x6f, 0x04, 0x00, 0x21, 0x00, 0x94};
+
+    test_phev_log_length = 0;
+    phev_log_setSink(NULL);
+    phev_log_frame("TEST", frame, sizeof(frame));
+
+    TEST_ASSERT_FALSE(phev_log_hasSink());
+    TEST_ASSERT_EQUAL(0, test_phev_log_length);
+}
+void test_phev_log_frame_decoded_inline(void)
+{
+    const uint8_t expected[] = {0x6f, 0x04, 0x00, 0x21, 0x00, 0x94};
+    uint8_t frame[sizeof(expected)];
+
+    for(size_t i = 0; i < sizeof(expected); i++)
+    {
+        frame[i] = expected[i] ^ 0x5a;
+    }
+
+    test_phev_log_length = 0;
+    phev_log_setSink(test_phev_log_sink);
+    phev_log_frame("TEST", frame, sizeof(frame));
+    phev_log_setSink(NULL);
+
+    TEST_ASSERT_EQUAL(sizeof(expected), test_phev_log_length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, test_phev_log_decoded, sizeof(expected));
+}
+void test_phev_log_frame_through_ring(void)
+{
+    const uint8_t frame[] = {0x6f, 0x04, 0x00, 0x21, 0x00, 0x94};
+
+    test_phev_log_length = 0;
+    phev_log_setSink(test_phev_log_sink);
+    TEST_ASSERT_TRUE(phev_log_start());
+    phev_log_frame("TEST", frame, sizeof(frame));
+    phev_log_stop();
+    phev_log_setSink(NULL);
+
+    TEST_ASSERT_EQUAL(sizeof(frame), test_phev_log_length);
+}
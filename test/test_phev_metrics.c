@@ -0,0 +1,57 @@
+#include <string.h>
+#include "unity.h"
+#include "phev_metrics.h"
+
+void test_phev_metrics_snapshot(void)
+{
+    phevMetrics_t metrics;
+    phevMetricsSnapshot_t snapshot;
+
+    phev_metrics_init(&metrics);
+
+    phev_metrics_frameIn(&metrics, 0x6f);
+    phev_metrics_frameIn(&metrics, 0x6f);
+    phev_metrics_frameIn(&metrics, 0x3f);
+    phev_metrics_frameOut(&metrics, 0xf6, 10);
+    phev_metrics_add(&metrics, PHEV_METRIC_BYTES_IN, 24);
+    phev_metrics_add(&metrics, PHEV_METRIC_XOR_RESYNCS, 1);
+
+    phev_metrics_snapshot(&metrics, &snapshot);
+
+    TEST_ASSERT_EQUAL(2, snapshot.framesIn[0x6f]);
+    TEST_ASSERT_EQUAL(1, snapshot.framesIn[0x3f]);
+    TEST_ASSERT_EQUAL(0, snapshot.framesIn[0xf6]);
+    TEST_ASSERT_EQUAL(1, snapshot.framesOut[0xf6]);
+    TEST_ASSERT_EQUAL(24, snapshot.counters[PHEV_METRIC_BYTES_IN]);
+    TEST_ASSERT_EQUAL(10, snapshot.counters[PHEV_METRIC_BYTES_OUT]);
+    TEST_ASSERT_EQUAL(1, snapshot.counters[PHEV_METRIC_XOR_RESYNCS]);
+    TEST_ASSERT_EQUAL(0, snapshot.counters[PHEV_METRIC_RECONNECTS]);
+}
+void test_phev_metrics_prometheus(void)
+{
+    phevMetrics_t metrics;
+    phevMetricsSnapshot_t snapshot;
+    char out[4096];
+
+    phev_metrics_init(&metrics);
+    phev_metrics_frameIn(&metrics, 0x6f);
+    phev_metrics_add(&metrics, PHEV_METRIC_RECONNECTS, 3);
+    phev_metrics_snapshot(&metrics, &snapshot);
+
+    size_t length = phev_metrics_formatPrometheus(&snapshot, "car\"1", NULL, 0);
+    
+    TEST_ASSERT_EQUAL(length, phev_metrics_formatPrometheus(&snapshot, "car\"1", out, sizeof(out)));
+    TEST_ASSERT_EQUAL(length, strlen(out));
+    TEST_ASSERT_NOT_NULL(strstr(out, "# TYPE phev_frames_in_total counter\n"));
+    TEST_ASSERT_NOT_NULL(strstr(out, "phev_frames_in_total{session=\"car\\\"1\",command=\"6f\"} 1\n"));
+    TEST_ASSERT_NOT_NULL(strstr(out, "phev_reconnects_total{session=\"car\\\"1\"} 3\n"));
+    TEST_ASSERT_NULL(strstr(out, "command=\"3f\""));
+
+    phev_metrics_formatPrometheus(&snapshot, NULL, out, sizeof(out));
+    TEST_ASSERT_NOT_NULL(strstr(out, "phev_reconnects_total 3\n"));
+
+    // Cut short it still terminates and reports the full length
+    length = strlen(out);
+    TEST_ASSERT_EQUAL(length, phev_metrics_formatPrometheus(&snapshot, NULL, out, 16));
+    TEST_ASSERT_EQUAL(15, strlen(out));
+}
@@ -109,4 +109,51 @@ void test_phev_model_compare_not_set(void)
 
     TEST_ASSERT_NOT_EQUAL(0,ret);
 
-}
\ No newline at end of file
+}
+void test_phev_model_version_changes_on_set(void)
+{
+    const uint8_t data[] = {1,2,3,4};
+
+    phevModel_t * model = phev_model_create();
+
+    uint32_t version = phev_model_beginRead(model);
+
+    TEST_ASSERT_TRUE(phev_model_endRead(model, version));
+
+    phev_model_setRegister(model,0x11,data,4);
+
+    TEST_ASSERT_FALSE(phev_model_endRead(model, version));
+    TEST_ASSERT_EQUAL(version + 2, phev_model_getVersion(model));
+}
+void test_phev_model_replaced_register_kept_for_reader(void)
+{
+    const uint8_t data[] = {1,2,3,4};
+    const uint8_t newData[] = {5,6,7,8};
+
+    phevModel_t * model = phev_model_create();
+
+    phev_model_setRegister(model,0x11,data,4);
+
+    uint32_t epoch = phev_model_enterRead(model);
+
+    const phevRegister_t * reg = phev_model_peekRegister(model,0x11);
+
+    // Moves on to the next epoch, then cannot move back while the reader is in
+    phev_model_setRegister(model,0x11,newData,4);
+    phev_model_setRegister(model,0x11,newData,4);
+    phev_model_setRegister(model,0x11,newData,4);
+
+    TEST_ASSERT_EQUAL(1, model->retired[epoch].count);
+    TEST_ASSERT_EQUAL(2, model->retired[epoch ^ 1].count);
+    TEST_ASSERT_EQUAL_MEMORY(data, reg->data, 4);
+
+    phev_model_exitRead(model, epoch);
+
+    phev_model_setRegister(model,0x11,data,4);
+
+    TEST_ASSERT_EQUAL(0, model->retired[0].count);
+    TEST_ASSERT_EQUAL(0, model->retired[1].count);
+    TEST_ASSERT_EQUAL(0, phev_model_compareRegister(model,0x11,data));
+
+    phev_model_destroy(model);
+}
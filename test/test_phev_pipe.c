@@ -1443,3 +1443,154 @@ void test_phev_pipe_default_event_handler(void)
     TEST_ASSERT_EQUAL_MEMORY(message->data,((phevMessage_t *) event->data)->data,message->length);
 
 } */
+void test_phev_pipe_connectBackoff_doubles_to_max(void)
+{
+    TEST_ASSERT_EQUAL(125, phev_pipe_connectBackoff(0, 250, 30000, 0));
+    TEST_ASSERT_EQUAL(250, phev_pipe_connectBackoff(1, 250, 30000, 0));
+    TEST_ASSERT_EQUAL(500, phev_pipe_connectBackoff(2, 250, 30000, 0));
+    TEST_ASSERT_EQUAL(15000, phev_pipe_connectBackoff(20, 250, 30000, 0));
+}
+void test_phev_pipe_connectBackoff_jitter_in_range(void)
+{
+    TEST_ASSERT_EQUAL(250, phev_pipe_connectBackoff(1, 250, 30000, 251));
+    TEST_ASSERT_EQUAL(500, phev_pipe_connectBackoff(1, 250, 30000, 250 + 251 * 3));
+    TEST_ASSERT_EQUAL(30000, phev_pipe_connectBackoff(100, 250, 30000, 15000));
+}
+static int test_phev_pipe_connectPending(messagingClient_t * client)
+{
+    client->connected = false;
+    return -1;
+}
+static bool test_phev_pipe_connecting(messagingClient_t * client)
+{
+    return true;
+}
+void test_phev_pipe_tryConnect_polls_connect_in_flight(void)
+{
+    messagingSettings_t inSettings = {
+        .incomingHandler = test_phev_pipe_inHandlerIn,
+        .outgoingHandler = test_phev_pipe_outHandlerIn,
+    };
+    messagingSettings_t outSettings = {
+        .incomingHandler = test_phev_pipe_inHandlerOut,
+        .outgoingHandler = test_phev_pipe_outHandlerOut,
+        .connect = test_phev_pipe_connectPending,
+    };
+    phev_pipe_settings_t settings = {
+        .in = msg_core_createMessagingClient(inSettings),
+        .out = msg_core_createMessagingClient(outSettings),
+        .connectTimeout = 20,
+        .outConnecting = test_phev_pipe_connecting,
+    };
+    phev_pipe_ctx_t * ctx = phev_pipe_createPipe(settings);
+
+    // In flight, no backoff, the next loop polls again straight away
+    TEST_ASSERT_FALSE(phev_pipe_tryConnect(ctx));
+    TEST_ASSERT_FALSE(phev_pipe_tryConnect(ctx));
+    TEST_ASSERT_EQUAL(0, ctx->connectAttempts);
+    TEST_ASSERT_TRUE(ctx->nextConnectAttempt <= phev_core_monotonicMs());
+
+    SLEEP(30);
+
+    // Past the pipe's timeout the attempt fails and backs off
+    TEST_ASSERT_FALSE(phev_pipe_tryConnect(ctx));
+    TEST_ASSERT_EQUAL(1, ctx->connectAttempts);
+    TEST_ASSERT_EQUAL(0, ctx->connectStartedAt);
+    TEST_ASSERT_TRUE(ctx->nextConnectAttempt > phev_core_monotonicMs());
+}
+void test_phev_pipe_latency_command_ack(void)
+{
+    messagingSettings_t inSettings = {
+        .incomingHandler = test_phev_pipe_inHandlerIn,
+        .outgoingHandler = test_phev_pipe_outHandlerIn,
+    };
+    messagingSettings_t outSettings = {
+        .incomingHandler = test_phev_pipe_inHandlerOut,
+        .outgoingHandler = test_phev_pipe_outHandlerOut,
+    };
+    
+    messagingClient_t * in = msg_core_createMessagingClient(inSettings);
+    messagingClient_t * out = msg_core_createMessagingClient(outSettings);
+
+    phev_pipe_settings_t settings = {
+        .in = in,
+        .out = out,
+        .inputSplitter = NULL,
+        .outputSplitter = NULL,
+        .inputResponder = NULL,
+        .outputResponder = (msg_pipe_responder_t) phev_pipe_commandResponder,
+        .outputOutputTransformer = (msg_pipe_transformer_t) phev_pipe_outputEventTransformer,
+        .preConnectHook = NULL,
+        .outputInputTransformer = (msg_pipe_transformer_t) phev_pipe_outputChainInputTransformer,
+    };
+
+    phev_pipe_ctx_t * ctx =  phev_pipe_createPipe(settings);
+
+    const uint8_t ack[] = {0x6f,0x04,0x01,0x10,0x00,0x84};
+
+    ctx->commandSentAt[0x10] = phev_core_monotonicNs() / 1000 - 1500;
+
+    phev_pipe_outputChainInputTransformer(ctx, msg_utils_createMsg(ack, sizeof(ack)));
+    
+    const phevHistogram_t * latency = phev_pipe_getLatency(ctx, PHEV_PIPE_LATENCY_COMMAND_ACK);
+
+    TEST_ASSERT_EQUAL(1, phev_histogram_count(latency));
+    TEST_ASSERT_TRUE(phev_histogram_min(latency) >= 1500);
+    TEST_ASSERT_EQUAL(0, ctx->commandSentAt[0x10]);
+
+    // A second ack for the same register has nothing to time against
+    phev_pipe_outputChainInputTransformer(ctx, msg_utils_createMsg(ack, sizeof(ack)));
+    TEST_ASSERT_EQUAL(1, phev_histogram_count(latency));
+
+    phev_pipe_resetLatency(ctx);
+    TEST_ASSERT_EQUAL(0, phev_histogram_count(latency));
+}
+static size_t test_phev_pipe_frame(uint8_t * out, uint8_t command, uint8_t reg, uint8_t value, uint8_t xor)
+{
+    const uint8_t frame[] = {command, 0x04, 0x00, reg, value, 0x00};
+
+    memcpy(out, frame, sizeof(frame));
+    out[5] = phev_core_checksum(out);
+
+    for(size_t i = 0; i < sizeof(frame); i++)
+    {
+        out[i] ^= xor;
+    }
+    return sizeof(frame);
+}
+void test_phev_pipe_outputSplitter_tracks_inbound_key(void)
+{
+    static phev_pipe_ctx_t ctx;
+    uint8_t data[64];
+    size_t length = 0;
+    phevMetricsSnapshot_t snapshot;
+
+    memset(&ctx, 0, sizeof(ctx));
+    phev_metrics_init(&ctx.metrics);
+
+    // Two frames under 0x30, a bb announcing 0x42 under 0x30, then a frame under 0x42
+    length += test_phev_pipe_frame(data + length, 0x6f, 0x1d, 0x50, 0x30);
+    length += test_phev_pipe_frame(data + length, 0x6f, 0x1f, 0x01, 0x30);
+    length += test_phev_pipe_frame(data + length, 0xbb, 0x01, 0x42, 0x30);
+    length += test_phev_pipe_frame(data + length, 0x6f, 0x18, 0x01, 0x42);
+
+    message_t * message = msg_utils_createMsg(data, length);
+    messageBundle_t * messages = phev_pipe_outputSplitter(&ctx, message);
+
+    TEST_ASSERT_NOT_NULL(messages);
+    TEST_ASSERT_EQUAL(4, messages->numMessages);
+    TEST_ASSERT_EQUAL(0x42, phev_core_getMessageXOR(messages->messages[3]));
+    TEST_ASSERT_EQUAL(0x42, ctx.inboundXOR);
+
+    phev_metrics_snapshot(&ctx.metrics, &snapshot);
+
+    // Only the first frame, before any key was known, needed guessing
+    TEST_ASSERT_EQUAL(1, snapshot.counters[PHEV_METRIC_XOR_FALLBACKS]);
+
+    for(int i = 0; i < messages->numMessages; i++)
+    {
+        msg_utils_destroyMsg(messages->messages[i]);
+    }
+    free(messages);
+    msg_utils_destroyMsg(message);
+}
@@ -0,0 +1,52 @@
+#include <string.h>
+#include "unity.h"
+#include "phev_profile.h"
+#include "phev_core.h"
+
+void test_phev_profile_get_defaults_to_my18(void)
+{
+    TEST_ASSERT_EQUAL(PHEV_PROFILE_MY18, phev_profile_get(PHEV_PROFILE_DEFAULT)->id);
+    TEST_ASSERT_EQUAL(PHEV_PROFILE_MY18, phev_profile_get(PHEV_PROFILE_MAX)->id);
+    TEST_ASSERT_EQUAL(PHEV_PROFILE_MY19, phev_profile_get(PHEV_PROFILE_MY19)->id);
+    TEST_ASSERT_EQUAL(0xf9, phev_profile_get(PHEV_PROFILE_PRE_MY18)->pingSend);
+    TEST_ASSERT_EQUAL(0xf3, phev_profile_get(PHEV_PROFILE_MY18)->pingSend);
+    TEST_ASSERT_EQUAL(27, phev_profile_get(PHEV_PROFILE_MY19)->acScheduleReg);
+}
+void test_phev_profile_fromName(void)
+{
+    for(int id = PHEV_PROFILE_PRE_MY18; id < PHEV_PROFILE_MAX; id++)
+    {
+        const phevProfile_t * profile = phev_profile_get((phevProfileId_t) id);
+
+        TEST_ASSERT_EQUAL(id, phev_profile_fromName(profile->name));
+    }
+    TEST_ASSERT_EQUAL(PHEV_PROFILE_MAX, phev_profile_fromName("my20"));
+    TEST_ASSERT_EQUAL(PHEV_PROFILE_MAX, phev_profile_fromName(NULL));
+}
+void test_phev_profile_incoming(void)
+{
+    const phevProfile_t * profile = phev_profile_get(PHEV_PROFILE_DEFAULT);
+
+    TEST_ASSERT_TRUE(PHEV_PROFILE_IS(profile, 0x6f, PHEV_PROFILE_RESPONSE));
+    TEST_ASSERT_TRUE(PHEV_PROFILE_IS(profile, 0x5e, PHEV_PROFILE_PLAIN_ACK));
+    TEST_ASSERT_TRUE(PHEV_PROFILE_IS(profile, 0x9f, PHEV_PROFILE_PING_RESPONSE));
+    TEST_ASSERT_TRUE(PHEV_PROFILE_IS(profile, 0x3f, PHEV_PROFILE_PING_RESPONSE | PHEV_PROFILE_NO_ACK));
+    TEST_ASSERT_TRUE(PHEV_PROFILE_IS(profile, 0xbb, PHEV_PROFILE_KEY_CHANGE));
+    TEST_ASSERT_FALSE(PHEV_PROFILE_IS(profile, 0x6f, PHEV_PROFILE_NO_ACK));
+    TEST_ASSERT_FALSE(PHEV_PROFILE_IS(profile, 0xf6, PHEV_PROFILE_RESPONSE | PHEV_PROFILE_NO_ACK));
+}
+void test_phev_profile_pingMessage(void)
+{
+    phevMessage_t * ping = phev_core_profilePingMessage(phev_profile_get(PHEV_PROFILE_PRE_MY18), 3);
+
+    TEST_ASSERT_EQUAL(0xf9, ping->command);
+    TEST_ASSERT_EQUAL(3, ping->reg);
+
+    phev_core_destroyMessage(ping);
+
+    ping = phev_core_pingMessage(3);
+
+    TEST_ASSERT_EQUAL(0xf3, ping->command);
+
+    phev_core_destroyMessage(ping);
+}
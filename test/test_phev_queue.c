@@ -0,0 +1,161 @@
+#include <string.h>
+#include <time.h>
+#include "unity.h"
+#include "phev_queue.h"
+
+typedef struct test_queue_consumer_t {
+    int count;
+    int types[16];
+    uint8_t values[16];
+} test_queue_consumer_t;
+
+static void test_queue_deliver(const phevQueueItem_t * item, void * ctx)
+{
+    test_queue_consumer_t * consumer = ctx;
+
+    if(consumer->count < 16)
+    {
+        consumer->types[consumer->count] = item->type;
+        consumer->values[consumer->count] = (item->length ? item->data[0] : 0);
+    }
+    consumer->count++;
+}
+static void test_queue_pushRegister(phevQueue_t * queue, uint8_t reg, uint8_t value)
+{
+    phevQueueItem_t item = {
+        .type = 1,
+        .isRegister = true,
+        .reg = reg,
+        .data = &value,
+        .length = 1,
+    };
+    TEST_ASSERT_TRUE(phev_queue_push(queue, &item));
+}
+void test_phev_queue_coalesce_or_drop_new(void)
+{
+    test_queue_consumer_t consumer = {0};
+    phevQueueSettings_t settings = {
+        .depth = 2,
+        .policy = PHEV_QUEUE_COALESCE_OR_DROP_NEW,
+    };
+    phevQueue_t * queue = phev_queue_create(settings, test_queue_deliver, &consumer);
+    phevQueueItem_t connected = { .type = 0 };
+
+    test_queue_pushRegister(queue, 29, 10);
+    test_queue_pushRegister(queue, 29, 11);
+
+    // Full, the waiting value of 29 is replaced and other events go
+    test_queue_pushRegister(queue, 29, 12);
+    test_queue_pushRegister(queue, 29, 13);
+    TEST_ASSERT_FALSE(phev_queue_push(queue, &connected));
+
+    TEST_ASSERT_EQUAL(3, phev_queue_drain(queue));
+    TEST_ASSERT_EQUAL(3, consumer.count);
+    TEST_ASSERT_EQUAL(10, consumer.values[0]);
+    TEST_ASSERT_EQUAL(11, consumer.values[1]);
+    TEST_ASSERT_EQUAL(13, consumer.values[2]);
+
+    phevQueueStats_t stats = phev_queue_stats(queue);
+
+    TEST_ASSERT_EQUAL(5, stats.queued);
+    TEST_ASSERT_EQUAL(3, stats.delivered);
+    TEST_ASSERT_EQUAL(2, stats.dropped);
+    TEST_ASSERT_EQUAL(2, stats.highWater);
+    TEST_ASSERT_EQUAL(0, stats.depth);
+
+    phev_queue_destroy(queue);
+}
+void test_phev_queue_coalesce_or_drop_new_keeps_queued_events(void)
+{
+    test_queue_consumer_t consumer = {0};
+    phevQueueSettings_t settings = {
+        .depth = 2,
+        .policy = PHEV_QUEUE_COALESCE_OR_DROP_NEW,
+    };
+    phevQueue_t * queue = phev_queue_create(settings, test_queue_deliver, &consumer);
+    phevQueueItem_t first = { .type = 2 };
+    phevQueueItem_t second = { .type = 3 };
+    phevQueueItem_t third = { .type = 4 };
+
+    TEST_ASSERT_TRUE(phev_queue_push(queue, &first));
+    TEST_ASSERT_TRUE(phev_queue_push(queue, &second));
+    TEST_ASSERT_FALSE(phev_queue_push(queue, &third));
+
+    TEST_ASSERT_EQUAL(2, phev_queue_drain(queue));
+    TEST_ASSERT_EQUAL(2, consumer.types[0]);
+    TEST_ASSERT_EQUAL(3, consumer.types[1]);
+    TEST_ASSERT_EQUAL(1, phev_queue_stats(queue).dropped);
+
+    phev_queue_destroy(queue);
+}
+void test_phev_queue_coalesce(void)
+{
+    test_queue_consumer_t consumer = {0};
+    phevQueueSettings_t settings = {
+        .depth = 8,
+        .policy = PHEV_QUEUE_COALESCE,
+    };
+    phevQueue_t * queue = phev_queue_create(settings, test_queue_deliver, &consumer);
+
+    test_queue_pushRegister(queue, 1, 1);
+    test_queue_pushRegister(queue, 2, 20);
+    test_queue_pushRegister(queue, 1, 2);
+    test_queue_pushRegister(queue, 1, 3);
+
+    phev_queue_drain(queue);
+
+    TEST_ASSERT_EQUAL(2, consumer.count);
+    TEST_ASSERT_EQUAL(3, consumer.values[0]);
+    TEST_ASSERT_EQUAL(20, consumer.values[1]);
+    TEST_ASSERT_EQUAL(2, phev_queue_stats(queue).coalesced);
+    TEST_ASSERT_EQUAL(0, phev_queue_stats(queue).dropped);
+
+    phev_queue_destroy(queue);
+}
+void test_phev_queue_block_times_out(void)
+{
+    test_queue_consumer_t consumer = {0};
+    phevQueueSettings_t settings = {
+        .depth = 1,
+        .policy = PHEV_QUEUE_BLOCK,
+        .blockTimeoutMs = 5,
+    };
+    phevQueue_t * queue = phev_queue_create(settings, test_queue_deliver, &consumer);
+    phevQueueItem_t item = { .type = 3 };
+
+    TEST_ASSERT_TRUE(phev_queue_push(queue, &item));
+
+    // Nobody drains, so the second push gives up
+    TEST_ASSERT_FALSE(phev_queue_push(queue, &item));
+
+    phevQueueStats_t stats = phev_queue_stats(queue);
+
+    TEST_ASSERT_EQUAL(1, stats.blocked);
+    TEST_ASSERT_EQUAL(1, stats.dropped);
+
+    phev_queue_destroy(queue);
+}
+void test_phev_queue_dispatcher(void)
+{
+    test_queue_consumer_t consumer = {0};
+    phevQueueSettings_t settings = {
+        .depth = 16,
+        .policy = PHEV_QUEUE_BLOCK,
+    };
+    phevQueue_t * queue = phev_queue_create(settings, test_queue_deliver, &consumer);
+
+    TEST_ASSERT_TRUE(phev_queue_start(queue));
+
+    for(int i = 0; i < 100; i++)
+    {
+        test_queue_pushRegister(queue, (uint8_t) i, (uint8_t) i);
+    }
+
+    // Stopping delivers what is still queued
+    phev_queue_stop(queue);
+
+    TEST_ASSERT_EQUAL(100, consumer.count);
+    TEST_ASSERT_EQUAL(100, phev_queue_stats(queue).delivered);
+
+    phev_queue_destroy(queue);
+}
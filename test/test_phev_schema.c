@@ -0,0 +1,155 @@
+#include "unity.h"
+#include "phev_schema.h"
+#include "cjson/cJSON.h"
+
+void test_phev_schema_decodeField_single_byte(void)
+{
+    const uint8_t data[] = {0x50};
+    int32_t value = 0;
+
+    bool ret = phev_schema_decodeField(phev_schema_getFieldSchema(PHEV_FIELD_BATTERY_SOC), data, sizeof(data), &value);
+
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL(80, value);
+}
+void test_phev_schema_decodeField_little_endian(void)
+{
+    const uint8_t data[] = {1, 0x2c, 0x01};
+    int32_t value = 0;
+
+    bool ret = phev_schema_decodeField(phev_schema_getFieldSchema(PHEV_FIELD_CHARGE_REMAINING), data, sizeof(data), &value);
+
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL(300, value);
+}
+void test_phev_schema_decodeField_big_endian(void)
+{
+    const uint8_t data[] = {0x01, 0x2c};
+    const phevSchemaField_t field = {
+        .name = "test",
+        .offset = 0,
+        .width = 2,
+        .endian = PHEV_SCHEMA_BE,
+        .mask = 0xffffffff,
+        .shift = 0,
+        .scale = 1,
+        .type = PHEV_SCHEMA_INT,
+        .models = PHEV_SCHEMA_MODEL_ANY,
+        .invalidMask = PHEV_SCHEMA_NO_INVALID,
+    };
+    int32_t value = 0;
+
+    bool ret = phev_schema_decodeField(&field, data, sizeof(data), &value);
+
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL(300, value);
+}
+void test_phev_schema_decodeField_out_of_bounds(void)
+{
+    const uint8_t data[] = {1};
+    int32_t value = 0;
+
+    bool ret = phev_schema_decodeField(phev_schema_getFieldSchema(PHEV_FIELD_CHARGE_REMAINING), data, sizeof(data), &value);
+
+    TEST_ASSERT_FALSE(ret);
+}
+void test_phev_schema_decodeField_not_reported(void)
+{
+    const uint8_t data[] = {1, 0x10, 0xff};
+    int32_t value = 0;
+
+    bool ret = phev_schema_decodeField(phev_schema_getFieldSchema(PHEV_FIELD_CHARGE_REMAINING), data, sizeof(data), &value);
+
+    TEST_ASSERT_FALSE(ret);
+}
+void test_phev_schema_decodeField_nibbles(void)
+{
+    const uint8_t data[] = {0x13};
+    int32_t mode = 0;
+    int32_t time = 0;
+
+    phev_schema_decodeField(phev_schema_getFieldSchema(PHEV_FIELD_HVAC_MODE), data, sizeof(data), &mode);
+    phev_schema_decodeField(phev_schema_getFieldSchema(PHEV_FIELD_HVAC_TIME), data, sizeof(data), &time);
+
+    TEST_ASSERT_EQUAL(3, mode);
+    TEST_ASSERT_EQUAL(1, time);
+}
+void test_phev_schema_accessor(void)
+{
+    const uint8_t data[] = {0x50};
+    int32_t value = 0;
+
+    phevModel_t * model = phev_model_create();
+
+    TEST_ASSERT_FALSE(phev_schema_batterySoc(model, PHEV_SCHEMA_MODEL_ANY, &value));
+
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data));
+
+    TEST_ASSERT_TRUE(phev_schema_batterySoc(model, PHEV_SCHEMA_MODEL_ANY, &value));
+    TEST_ASSERT_EQUAL(80, value);
+}
+void test_phev_schema_toJson(void)
+{
+    const uint8_t battery[] = {0x50};
+    const uint8_t door[] = {1};
+
+    phevModel_t * model = phev_model_create();
+
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, battery, sizeof(battery));
+    phev_model_setRegister(model, KO_WF_DOOR_STATUS_INFO_REP_EVR, door, sizeof(door));
+
+    cJSON * json = phev_schema_toJson(model, PHEV_SCHEMA_MODEL_ANY);
+
+    TEST_ASSERT_NOT_NULL(json);
+
+    cJSON * soc = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(json, "battery"), "soc");
+    cJSON * doorLock = cJSON_GetObjectItemCaseSensitive(json, "doorLock");
+    cJSON * charging = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(json, "battery"), "charging");
+
+    TEST_ASSERT_NOT_NULL(soc);
+    TEST_ASSERT_EQUAL(80, soc->valueint);
+    TEST_ASSERT_NOT_NULL(doorLock);
+    TEST_ASSERT_EQUAL_STRING("locked", doorLock->valuestring);
+    TEST_ASSERT_NULL(charging);
+    TEST_ASSERT_NULL(cJSON_GetObjectItemCaseSensitive(json, "hvac"));
+
+    cJSON_Delete(json);
+}
+void test_phev_schema_toJson_model_years(void)
+{
+    const uint8_t schedule[] = {0x13};
+
+    phevModel_t * model = phev_model_create();
+
+    phev_model_setRegister(model, KO_WF_TM_AC_STAT_INFO_REP_EVR, schedule, sizeof(schedule));
+
+    cJSON * json = phev_schema_toJson(model, PHEV_SCHEMA_MODEL_MY18);
+    cJSON * hvac = cJSON_GetObjectItemCaseSensitive(json, "hvac");
+
+    TEST_ASSERT_NOT_NULL(hvac);
+    TEST_ASSERT_EQUAL(3, cJSON_GetObjectItemCaseSensitive(hvac, "mode")->valueint);
+    TEST_ASSERT_EQUAL(1, cJSON_GetObjectItemCaseSensitive(hvac, "time")->valueint);
+    cJSON_Delete(json);
+
+    // MY19 keeps its schedule elsewhere, the nibbles mean nothing there
+    json = phev_schema_toJson(model, PHEV_SCHEMA_MODEL_MY19);
+
+    TEST_ASSERT_NULL(cJSON_GetObjectItemCaseSensitive(json, "hvac"));
+    cJSON_Delete(json);
+    phev_model_destroy(model);
+}
+void test_phev_schema_encode(void)
+{
+    const uint8_t battery[] = {0x50};
+    uint8_t buffer[PHEV_FIELD_MAX * 5];
+    const uint8_t expected[] = {PHEV_FIELD_BATTERY_SOC, 0x50, 0, 0, 0};
+
+    phevModel_t * model = phev_model_create();
+
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, battery, sizeof(battery));
+
+    size_t length = phev_schema_encode(model, PHEV_SCHEMA_MODEL_ANY, buffer, sizeof(buffer));
+
+    TEST_ASSERT_EQUAL(sizeof(expected), length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, buffer, sizeof(expected));
+}
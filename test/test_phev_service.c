@@ -122,6 +122,14 @@ void test_phev_service_validateCommand_updateRegister_value_out_of_range(void)
 
     TEST_ASSERT_FALSE(ret);
 }
+void test_phev_service_validateCommand_updateRegister_data_array_empty(void)
+{
+    const char * command = "{ \"updateRegister\" :  { \"register\" : 1, \"value\" : [] } }";
+
+    bool ret = phev_service_validateCommand(command);
+
+    TEST_ASSERT_FALSE(ret);
+}
 void test_phev_service_jsonCommandToPhevMessage_updateRegister(void)
 {
     const char * command = "{ \"updateRegister\" :  { \"register\" : 1, \"value\" : 255 } }";
@@ -738,7 +746,9 @@ void test_phev_service_statusAsJson_not_charging()
 
     cJSON * charging = cJSON_GetObjectItemCaseSensitive(battery, "charging");
 
-    TEST_ASSERT_NULL(charging);
+    TEST_ASSERT_NOT_NULL(charging);
+    TEST_ASSERT_TRUE(cJSON_IsFalse(charging));
+    TEST_ASSERT_NULL(cJSON_GetObjectItemCaseSensitive(battery, "chargeTimeRemaining"));
 }
 void test_phev_service_statusAsJson_is_charging()
 {
@@ -1653,6 +1663,116 @@ void test_phev_service_status(void)
 }
 
 
+void test_phev_service_getVehicleState(void)
+{
+    const uint8_t charging[] = {1,1,1};
+    messagingSettings_t inSettings = {
+        .incomingHandler = test_phev_service_inHandlerIn,
+        .outgoingHandler = test_phev_service_outHandlerIn,
+    };
+    messagingSettings_t outSettings = {
+        .incomingHandler = test_phev_service_inHandlerOut,
+        .outgoingHandler = test_phev_service_outHandlerOut,
+    };
+
+    messagingClient_t * in = msg_core_createMessagingClient(inSettings);
+    messagingClient_t * out = msg_core_createMessagingClient(outSettings);
+
+    phevServiceCtx_t * ctx = phev_service_init(in,out,false);
+
+    test_phev_service_createTestModel(ctx->model);
+    phev_model_setRegister(ctx->model,KO_WF_OBCHG_OK_ON_INFO_REP_EVR,charging,sizeof(charging));
+
+    phevVehicleState_t state;
+
+    phev_service_getVehicleState(ctx, &state);
+
+    TEST_ASSERT_EQUAL(PHEV_VEHICLE_STATE_VERSION, state.structVersion);
+    TEST_ASSERT_EQUAL(phev_model_getVersion(ctx->model), state.modelVersion);
+    TEST_ASSERT_EQUAL(80, state.batteryLevel);
+    TEST_ASSERT_TRUE(state.charging);
+    TEST_ASSERT_EQUAL(257, state.remainingChargeTime);
+    TEST_ASSERT_TRUE(state.hvacOperating);
+    TEST_ASSERT_EQUAL(3, state.hvacMode);
+    TEST_ASSERT_EQUAL(1, state.hvacTime);
+    TEST_ASSERT_EQUAL(-1, state.locked);
+    TEST_ASSERT_TRUE(state.present & PHEV_STATE_BATTERY_LEVEL);
+    TEST_ASSERT_FALSE(state.present & PHEV_STATE_LOCKED);
+}
+void test_phev_service_getVehicleState_profile_models(void)
+{
+    messagingSettings_t inSettings = {
+        .incomingHandler = test_phev_service_inHandlerIn,
+        .outgoingHandler = test_phev_service_outHandlerIn,
+    };
+    messagingSettings_t outSettings = {
+        .incomingHandler = test_phev_service_inHandlerOut,
+        .outgoingHandler = test_phev_service_outHandlerOut,
+    };
+
+    messagingClient_t * in = msg_core_createMessagingClient(inSettings);
+    messagingClient_t * out = msg_core_createMessagingClient(outSettings);
+
+    phevServiceCtx_t * ctx = phev_service_init(in,out,false);
+
+    test_phev_service_createTestModel(ctx->model);
+
+    // The air con schedule nibbles are not where an MY19 keeps its schedule
+    ctx->pipe->profile = phev_profile_get(PHEV_PROFILE_MY19);
+
+    phevVehicleState_t state;
+
+    phev_service_getVehicleState(ctx, &state);
+
+    TEST_ASSERT_EQUAL(80, state.batteryLevel);
+    TEST_ASSERT_TRUE(state.present & PHEV_STATE_HVAC_OPERATING);
+    TEST_ASSERT_FALSE(state.present & PHEV_STATE_HVAC_MODE);
+    TEST_ASSERT_FALSE(state.present & PHEV_STATE_HVAC_TIME);
+
+    phevServiceHVAC_t * hvac = phev_service_getHVACStatus(ctx);
+
+    TEST_ASSERT_NOT_NULL(hvac);
+    TEST_ASSERT_EQUAL(0, hvac->mode);
+
+    ctx->pipe->profile = phev_profile_get(PHEV_PROFILE_MY18);
+    phev_service_getVehicleState(ctx, &state);
+
+    TEST_ASSERT_TRUE(state.present & PHEV_STATE_HVAC_MODE);
+    TEST_ASSERT_EQUAL(3, state.hvacMode);
+}
+void test_phev_service_compareVehicleState(void)
+{
+    const uint8_t battery[] = {0x51};
+    messagingSettings_t inSettings = {
+        .incomingHandler = test_phev_service_inHandlerIn,
+        .outgoingHandler = test_phev_service_outHandlerIn,
+    };
+    messagingSettings_t outSettings = {
+        .incomingHandler = test_phev_service_inHandlerOut,
+        .outgoingHandler = test_phev_service_outHandlerOut,
+    };
+
+    messagingClient_t * in = msg_core_createMessagingClient(inSettings);
+    messagingClient_t * out = msg_core_createMessagingClient(outSettings);
+
+    phevServiceCtx_t * ctx = phev_service_init(in,out,false);
+
+    test_phev_service_createTestModel(ctx->model);
+
+    phevVehicleState_t previous;
+    phevVehicleState_t current;
+
+    phev_service_getVehicleState(ctx, &previous);
+    phev_service_getVehicleState(ctx, &current);
+
+    TEST_ASSERT_EQUAL(0, phev_service_compareVehicleState(&previous, &current));
+
+    phev_model_setRegister(ctx->model,KO_WF_BATT_LEVEL_INFO_REP_EVR,battery,sizeof(battery));
+    phev_service_getVehicleState(ctx, &current);
+
+    TEST_ASSERT_EQUAL(PHEV_STATE_BATTERY_LEVEL, phev_service_compareVehicleState(&previous, &current));
+}
+
 /*
 const timeRemain = remain => {
     const data = Int16Array.from(remain)
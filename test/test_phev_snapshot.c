@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include "unity.h"
+#include "phev_snapshot.h"
+
+#define TEST_SNAPSHOT_PATH "test_phev_snapshot.bin"
+#define TEST_SNAPSHOT_VIN "JMAXDGG2WGZ002035"
+
+void test_phev_snapshot_open_creates_file(void)
+{
+    remove(TEST_SNAPSHOT_PATH);
+
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+
+    TEST_ASSERT_NOT_NULL(snapshot);
+    TEST_ASSERT_EQUAL_STRING(TEST_SNAPSHOT_VIN, snapshot->file->header.vin);
+    TEST_ASSERT_EQUAL(-1, phev_snapshot_age(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 100));
+
+    phev_snapshot_close(snapshot);
+    remove(TEST_SNAPSHOT_PATH);
+}
+void test_phev_snapshot_restores_model(void)
+{
+    const uint8_t data[] = {0x50};
+
+    remove(TEST_SNAPSHOT_PATH);
+
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+    phevModel_t * model = phev_model_create();
+
+    phev_model_addListener(model, phev_snapshot_modelListener, snapshot);
+    phev_model_setRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data));
+    phev_snapshot_close(snapshot);
+
+    snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+    phevModel_t * restored = phev_model_create();
+
+    TEST_ASSERT_EQUAL(1, phev_snapshot_load(snapshot, restored));
+
+    const phevRegister_t * reg = phev_model_peekRegister(restored, KO_WF_BATT_LEVEL_INFO_REP_EVR);
+
+    TEST_ASSERT_NOT_NULL(reg);
+    TEST_ASSERT_EQUAL(1, reg->length);
+    TEST_ASSERT_EQUAL(0x50, reg->data[0]);
+
+    phev_snapshot_close(snapshot);
+    remove(TEST_SNAPSHOT_PATH);
+}
+void test_phev_snapshot_different_vin_resets(void)
+{
+    const uint8_t data[] = {0x50};
+
+    remove(TEST_SNAPSHOT_PATH);
+
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+    phev_snapshot_store(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data), 100);
+    phev_snapshot_close(snapshot);
+
+    snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, "JMAXDGG2WGZ009999");
+    phevModel_t * model = phev_model_create();
+
+    TEST_ASSERT_EQUAL(0, phev_snapshot_load(snapshot, model));
+
+    phev_snapshot_close(snapshot);
+    remove(TEST_SNAPSHOT_PATH);
+}
+void test_phev_snapshot_ignores_corrupt_slot(void)
+{
+    const uint8_t data[] = {0x50};
+
+    remove(TEST_SNAPSHOT_PATH);
+
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+    phev_snapshot_store(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data), 100);
+    snapshot->file->slots[KO_WF_BATT_LEVEL_INFO_REP_EVR].data[0] = 0x51;
+
+    phevModel_t * model = phev_model_create();
+
+    TEST_ASSERT_EQUAL(0, phev_snapshot_load(snapshot, model));
+
+    phev_snapshot_close(snapshot);
+    remove(TEST_SNAPSHOT_PATH);
+}
+void test_phev_snapshot_stale_by_age(void)
+{
+    const uint8_t data[] = {0x50};
+
+    remove(TEST_SNAPSHOT_PATH);
+
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+    phev_snapshot_store(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data), 100);
+
+    TEST_ASSERT_EQUAL(50, phev_snapshot_age(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 150));
+    TEST_ASSERT_FALSE(phev_snapshot_isStale(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 150, 60));
+    TEST_ASSERT_TRUE(phev_snapshot_isStale(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 200, 60));
+
+    phev_snapshot_close(snapshot);
+    remove(TEST_SNAPSHOT_PATH);
+}
+void test_phev_snapshot_touch_refreshes_age(void)
+{
+    const uint8_t data[] = {0x50};
+
+    remove(TEST_SNAPSHOT_PATH);
+
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+
+    TEST_ASSERT_FALSE(phev_snapshot_touch(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 150));
+
+    phev_snapshot_store(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data), 100);
+
+    TEST_ASSERT_TRUE(phev_snapshot_touch(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 190));
+    TEST_ASSERT_EQUAL(10, phev_snapshot_age(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 200));
+    TEST_ASSERT_FALSE(phev_snapshot_isStale(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 200, 60));
+
+    phev_snapshot_close(snapshot);
+    remove(TEST_SNAPSHOT_PATH);
+}
+void test_phev_snapshot_adopts_first_vin(void)
+{
+    const uint8_t data[] = {0x50};
+    phevModel_t * model = phev_model_create();
+
+    remove(TEST_SNAPSHOT_PATH);
+
+    // No VIN configured, the values are kept once the car reports one
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, NULL);
+    phev_snapshot_store(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, data, sizeof(data), 100);
+
+    TEST_ASSERT_FALSE(phev_snapshot_setVin(snapshot, TEST_SNAPSHOT_VIN));
+    TEST_ASSERT_EQUAL(1, phev_snapshot_load(snapshot, model));
+
+    // Bound to that VIN from then on
+    TEST_ASSERT_TRUE(phev_snapshot_setVin(snapshot, "JMAXDGG2WGZ009999"));
+    TEST_ASSERT_EQUAL(-1, phev_snapshot_age(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, 100));
+
+    phev_snapshot_close(snapshot);
+    phev_model_destroy(model);
+    remove(TEST_SNAPSHOT_PATH);
+}
+void test_phev_snapshot_other_vin_unloads_model(void)
+{
+    const uint8_t battery[] = {0x50};
+    const uint8_t door[] = {1};
+    const uint8_t lamp[] = {2};
+    phevModel_t * model = phev_model_create();
+
+    remove(TEST_SNAPSHOT_PATH);
+
+    phevSnapshot_t * snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, TEST_SNAPSHOT_VIN);
+    phev_snapshot_store(snapshot, KO_WF_BATT_LEVEL_INFO_REP_EVR, battery, sizeof(battery), 100);
+    phev_snapshot_store(snapshot, KO_WF_DOOR_STATUS_INFO_REP_EVR, door, sizeof(door), 100);
+    phev_snapshot_close(snapshot);
+
+    // No VIN configured, restored before the car says which one it is
+    snapshot = phev_snapshot_open(TEST_SNAPSHOT_PATH, NULL);
+    TEST_ASSERT_EQUAL(2, phev_snapshot_load(snapshot, model));
+    phev_model_addListener(model, phev_snapshot_modelListener, snapshot);
+
+    // Reported by this car before its VIN, kept
+    phev_model_setRegister(model, KO_WF_DOOR_STATUS_INFO_REP_EVR, lamp, sizeof(lamp));
+
+    TEST_ASSERT_TRUE(phev_snapshot_setVin(snapshot, "JMAXDGG2WGZ009999"));
+    TEST_ASSERT_EQUAL(1, phev_snapshot_unload(snapshot, model));
+
+    TEST_ASSERT_NULL(phev_model_peekRegister(model, KO_WF_BATT_LEVEL_INFO_REP_EVR));
+    TEST_ASSERT_NOT_NULL(phev_model_peekRegister(model, KO_WF_DOOR_STATUS_INFO_REP_EVR));
+    TEST_ASSERT_EQUAL(0, phev_snapshot_unload(snapshot, model));
+
+    phev_model_removeListener(model, phev_snapshot_modelListener, snapshot);
+    phev_snapshot_close(snapshot);
+    phev_model_destroy(model);
+    remove(TEST_SNAPSHOT_PATH);
+}
@@ -0,0 +1,92 @@
+#include "unity.h"
+#include "phev_tcpip.h"
+#if defined(__linux__) || defined(__unix__)
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static int test_phev_tcpip_option(int soc, int level, int name)
+{
+    int value = 0;
+    socklen_t length = sizeof(value);
+
+    getsockopt(soc, level, name, &value, &length);
+
+    return value;
+}
+void test_phev_tcpip_apply_options(void)
+{
+    const phevTcpOptions_t options = {
+        .noDelay = true,
+        .keepAliveIdle = 30,
+        .keepAliveInterval = 10,
+        .keepAliveCount = 3,
+    };
+    int soc = socket(AF_INET, SOCK_STREAM, 0);
+
+    TEST_ASSERT_EQUAL(0, phev_tcpClientApplyOptions(soc, &options));
+    TEST_ASSERT_NOT_EQUAL(0, test_phev_tcpip_option(soc, IPPROTO_TCP, TCP_NODELAY));
+    TEST_ASSERT_NOT_EQUAL(0, test_phev_tcpip_option(soc, SOL_SOCKET, SO_KEEPALIVE));
+#ifdef TCP_KEEPCNT
+    TEST_ASSERT_EQUAL(3, test_phev_tcpip_option(soc, IPPROTO_TCP, TCP_KEEPCNT));
+#endif
+
+    close(soc);
+}
+void test_phev_tcpip_default_options_untouched(void)
+{
+    const phevTcpOptions_t options = { 0 };
+    int soc = socket(AF_INET, SOCK_STREAM, 0);
+
+    TEST_ASSERT_EQUAL(0, phev_tcpClientApplyOptions(soc, &options));
+    TEST_ASSERT_EQUAL(0, test_phev_tcpip_option(soc, IPPROTO_TCP, TCP_NODELAY));
+    TEST_ASSERT_EQUAL(0, test_phev_tcpip_option(soc, SOL_SOCKET, SO_KEEPALIVE));
+
+    close(soc);
+}
+void test_phev_tcpip_rx_buffer_per_socket(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int socs[8];
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    TEST_ASSERT_EQUAL(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL(0, listen(listener, 8));
+    getsockname(listener, (struct sockaddr *) &addr, &addrLength);
+
+    // More connections than there used to be buffer slots, each still gets its own
+    for (int i = 0; i < 8; i++)
+    {
+        socs[i] = phev_tcpClientConnectSocket("127.0.0.1", ntohs(addr.sin_port));
+
+        TEST_ASSERT_TRUE(socs[i] >= 0);
+        TEST_ASSERT_NOT_NULL(phev_tcpClientRxBuffer(socs[i]));
+        TEST_ASSERT_EQUAL(socs[i], phev_tcpClientRxBuffer(socs[i])->soc);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        phev_tcpClientDisconnectSocket(socs[i]);
+        TEST_ASSERT_NULL(phev_tcpClientRxBuffer(socs[i]));
+    }
+    close(listener);
+}
+#else
+void test_phev_tcpip_apply_options(void)
+{
+    TEST_IGNORE_MESSAGE("Needs POSIX sockets");
+}
+void test_phev_tcpip_default_options_untouched(void)
+{
+    TEST_IGNORE_MESSAGE("Needs POSIX sockets");
+}
+void test_phev_tcpip_rx_buffer_per_socket(void)
+{
+    TEST_IGNORE_MESSAGE("Needs POSIX sockets");
+}
+#endif
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include "unity.h"
+#include "phev_trace.h"
+
+#define TEST_TRACE_PATH "test_phev_trace.bin"
+
+void test_phev_trace_ring_keeps_latest(void)
+{
+    phevTrace_t * trace = phev_trace_create(6);
+    phevTraceRecord_t records[16];
+
+    TEST_ASSERT_NOT_NULL(trace);
+
+    for(uint32_t i = 0; i < 11; i++)
+    {
+        phev_trace_record(trace, PHEV_TRACE_FRAME_SPLIT, 0x6f, (uint8_t) i, 0, i);
+    }
+    // Rounded up to 8, the first 3 are overwritten
+    size_t count = phev_trace_snapshot(trace, records, 16);
+
+    TEST_ASSERT_EQUAL(8, count);
+    TEST_ASSERT_EQUAL(3, records[0].arg);
+    TEST_ASSERT_EQUAL(10, records[7].arg);
+    TEST_ASSERT_TRUE(records[0].timestamp <= records[7].timestamp);
+
+    count = phev_trace_snapshot(trace, records, 2);
+
+    TEST_ASSERT_EQUAL(2, count);
+    TEST_ASSERT_EQUAL(9, records[0].arg);
+    TEST_ASSERT_EQUAL(10, records[1].arg);
+
+    phev_trace_destroy(trace);
+}
+void test_phev_trace_save_and_read(void)
+{
+    phevTrace_t * trace = phev_trace_create(16);
+    phevTraceRecord_t record;
+
+    phev_trace_record(trace, PHEV_TRACE_COMMAND_SENT, 0xf6, 0x1b, 0x23, 0);
+    phev_trace_record(trace, PHEV_TRACE_XOR_CHANGED, 0xcc, 0, 0x45, PHEV_TRACE_XOR_PING | PHEV_TRACE_XOR_COMMAND);
+    phev_trace_record(trace, PHEV_TRACE_COMMAND_ACKED, 0x6f, 0x1b, 0x45, 0x12345678);
+
+    TEST_ASSERT_TRUE(phev_trace_save(trace, TEST_TRACE_PATH));
+
+    phevTraceReader_t * reader = phev_trace_openReader(TEST_TRACE_PATH);
+
+    TEST_ASSERT_NOT_NULL(reader);
+    TEST_ASSERT_TRUE(phev_trace_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_TRACE_COMMAND_SENT, record.point);
+    TEST_ASSERT_EQUAL_HEX8(0xf6, record.command);
+    TEST_ASSERT_EQUAL_HEX8(0x1b, record.reg);
+    TEST_ASSERT_EQUAL_HEX8(0x23, record.xor);
+    TEST_ASSERT_TRUE(phev_trace_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_TRACE_XOR_CHANGED, record.point);
+    TEST_ASSERT_EQUAL(PHEV_TRACE_XOR_PING | PHEV_TRACE_XOR_COMMAND, record.arg);
+    TEST_ASSERT_TRUE(phev_trace_next(reader, &record));
+    TEST_ASSERT_EQUAL(PHEV_TRACE_COMMAND_ACKED, record.point);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678, record.arg);
+    TEST_ASSERT_FALSE(phev_trace_next(reader, &record));
+    TEST_ASSERT_EQUAL_STRING("command acked", phev_trace_pointName(record.point));
+
+    phev_trace_closeReader(reader);
+    phev_trace_destroy(trace);
+    remove(TEST_TRACE_PATH);
+}
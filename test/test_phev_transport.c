@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "unity.h"
+#include "phev_transport.h"
+
+#define TEST_TRANSPORT_SOCKET "test_phev_transport.sock"
+
+static const uint8_t transportFrame[] = {0x6f, 0x04, 0x00, 0x1d, 0x50, 0xe0};
+
+static void test_transport_responder(phevTransport_t * transport, const uint8_t * data, size_t length, void * ctx)
+{
+    int * writes = (int *) ctx;
+
+    if(data)
+    {
+        (*writes)++;
+        phev_transport_loopbackInject(transport, transportFrame, sizeof(transportFrame));
+    }
+}
+void test_phev_transport_loopback_drain(void)
+{
+    const uint8_t ack[] = {0xf6, 0x04, 0x01, 0x1d, 0x00, 0x18};
+    uint8_t buf[32];
+
+    phevTransport_t * transport = phev_transport_loopback(NULL, NULL);
+
+    TEST_ASSERT_EQUAL(0, phev_transport_connect(transport));
+    TEST_ASSERT_EQUAL(-1, phev_transport_fd(transport));
+    TEST_ASSERT_EQUAL(sizeof(ack), phev_transport_write(transport, ack, sizeof(ack)));
+    TEST_ASSERT_EQUAL(sizeof(ack), phev_transport_loopbackDrain(transport, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(ack, buf, sizeof(ack));
+    TEST_ASSERT_EQUAL(0, phev_transport_loopbackDrain(transport, buf, sizeof(buf)));
+
+    phev_transport_destroy(transport);
+}
+void test_phev_transport_loopback_whole_frames(void)
+{
+    uint8_t buf[32];
+    int writes = 0;
+    phevTransport_t * transport = phev_transport_loopback(test_transport_responder, &writes);
+
+    phev_transport_connect(transport);
+
+    // Half a frame is held back until the rest arrives
+    phev_transport_loopbackInject(transport, transportFrame, 3);
+    TEST_ASSERT_EQUAL(0, phev_transport_read(transport, buf, sizeof(buf)));
+    phev_transport_loopbackInject(transport, transportFrame + 3, sizeof(transportFrame) - 3);
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), phev_transport_read(transport, buf, sizeof(buf)));
+
+    phevTransportBuffer_t buffers[] = {
+        { .data = transportFrame, .length = 2 },
+        { .data = transportFrame + 2, .length = sizeof(transportFrame) - 2 },
+    };
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), phev_transport_writev(transport, buffers, 2));
+    TEST_ASSERT_EQUAL(2, writes);
+    TEST_ASSERT_EQUAL(2 * sizeof(transportFrame), phev_transport_read(transport, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(transportFrame, buf + sizeof(transportFrame), sizeof(transportFrame));
+
+    phev_transport_destroy(transport);
+}
+void test_phev_transport_unix_socket(void)
+{
+    struct sockaddr_un addr;
+    uint8_t buf[32];
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    unlink(TEST_TRANSPORT_SOCKET);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, TEST_TRANSPORT_SOCKET);
+
+    TEST_ASSERT_EQUAL(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL(0, listen(listener, 1));
+
+    phevTransport_t * transport = phev_transport_unix(TEST_TRANSPORT_SOCKET);
+
+    TEST_ASSERT_EQUAL(0, phev_transport_connect(transport));
+    TEST_ASSERT_TRUE(phev_transport_fd(transport) >= 0);
+
+    int relay = accept(listener, NULL, NULL);
+
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), write(relay, transportFrame, sizeof(transportFrame)));
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), phev_transport_read(transport, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(transportFrame, buf, sizeof(transportFrame));
+
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), phev_transport_write(transport, transportFrame, sizeof(transportFrame)));
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), read(relay, buf, sizeof(buf)));
+
+    close(relay);
+    TEST_ASSERT_EQUAL(-1, phev_transport_read(transport, buf, sizeof(buf)));
+    TEST_ASSERT_FALSE(transport->connected);
+
+    phev_transport_destroy(transport);
+    close(listener);
+    unlink(TEST_TRANSPORT_SOCKET);
+}
+void test_phev_transport_tcp_connect_in_flight(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    uint8_t buf[32];
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int ret = PHEV_TRANSPORT_CONNECTING;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    TEST_ASSERT_EQUAL(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL(0, listen(listener, 1));
+    getsockname(listener, (struct sockaddr *) &addr, &addrLength);
+
+    phevTransport_t * transport = phev_transport_tcp("127.0.0.1", ntohs(addr.sin_port));
+
+    // Each call waits a little, the caller keeps asking until there is an answer
+    for(int i = 0; i < 100 && ret == PHEV_TRANSPORT_CONNECTING; i++)
+    {
+        ret = phev_transport_connect(transport);
+        TEST_ASSERT_EQUAL(ret == PHEV_TRANSPORT_CONNECTING, transport->connecting);
+    }
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_TRUE(transport->connected);
+    TEST_ASSERT_FALSE(transport->connecting);
+
+    int car = accept(listener, NULL, NULL);
+
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), write(car, transportFrame, sizeof(transportFrame)));
+    TEST_ASSERT_EQUAL(sizeof(transportFrame), phev_transport_read(transport, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(transportFrame, buf, sizeof(transportFrame));
+
+    phev_transport_destroy(transport);
+    close(car);
+    close(listener);
+}
+void test_phev_transport_tcp_connect_refused(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int ret = PHEV_TRANSPORT_CONNECTING;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // A port that was free a moment ago and is not listening
+    TEST_ASSERT_EQUAL(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    getsockname(listener, (struct sockaddr *) &addr, &addrLength);
+    close(listener);
+
+    phevTransport_t * transport = phev_transport_tcp("127.0.0.1", ntohs(addr.sin_port));
+
+    for(int i = 0; i < 100 && ret == PHEV_TRANSPORT_CONNECTING; i++)
+    {
+        ret = phev_transport_connect(transport);
+    }
+    TEST_ASSERT_EQUAL(-1, ret);
+    TEST_ASSERT_FALSE(transport->connected);
+    TEST_ASSERT_FALSE(transport->connecting);
+    TEST_ASSERT_EQUAL(-1, phev_transport_fd(transport));
+
+    phev_transport_destroy(transport);
+}
+void test_phev_transport_tcp_options_per_transport(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    const phevTcpOptions_t tuned = { .noDelay = true };
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    TEST_ASSERT_EQUAL(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL(0, listen(listener, 2));
+    getsockname(listener, (struct sockaddr *) &addr, &addrLength);
+
+    phevTransport_t * first = phev_transport_tcp("127.0.0.1", ntohs(addr.sin_port));
+    phevTransport_t * second = phev_transport_tcp("127.0.0.1", ntohs(addr.sin_port));
+
+    // Options set on the second transport do not leak into the first one
+    phev_transport_tcpSetOptions(second, &tuned);
+
+    while(phev_transport_connect(first) == PHEV_TRANSPORT_CONNECTING)
+    {
+    }
+    while(phev_transport_connect(second) == PHEV_TRANSPORT_CONNECTING)
+    {
+    }
+    TEST_ASSERT_TRUE(first->connected);
+    TEST_ASSERT_TRUE(second->connected);
+
+    int value = 0;
+    socklen_t length = sizeof(value);
+
+    getsockopt(phev_transport_fd(first), IPPROTO_TCP, TCP_NODELAY, &value, &length);
+    TEST_ASSERT_EQUAL(0, value);
+    getsockopt(phev_transport_fd(second), IPPROTO_TCP, TCP_NODELAY, &value, &length);
+    TEST_ASSERT_NOT_EQUAL(0, value);
+
+    phev_transport_destroy(first);
+    phev_transport_destroy(second);
+    close(listener);
+}
@@ -0,0 +1,40 @@
+#include "unity.h"
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "phev_uring.h"
+
+void test_phev_uring_reads_frames_over_loopback(void)
+{
+    const uint8_t frames[] = {0x6f, 0x04, 0x00, 0x21, 0x00, 0x94, 0x6f, 0x04, 0x00, 0x21, 0x00, 0x94};
+    uint8_t ack[] = {0xf6, 0x04, 0x01, 0x21, 0x00, 0x1c};
+    uint8_t buf[64];
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    TEST_ASSERT_EQUAL(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL(0, listen(listener, 1));
+    getsockname(listener, (struct sockaddr *) &addr, &addrLength);
+
+    int soc = phev_uringConnect("127.0.0.1", ntohs(addr.sin_port));
+    int car = accept(listener, NULL, NULL);
+
+    TEST_ASSERT_TRUE(soc >= 0);
+    TEST_ASSERT_EQUAL(sizeof(frames), write(car, frames, sizeof(frames)));
+    TEST_ASSERT_EQUAL(sizeof(frames), phev_uringRead(soc, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(frames, buf, sizeof(frames));
+
+    TEST_ASSERT_EQUAL(sizeof(ack), phev_uringWrite(soc, ack, sizeof(ack)));
+    TEST_ASSERT_EQUAL(sizeof(ack), read(car, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(ack, buf, sizeof(ack));
+
+    phev_uringDisconnect(soc);
+    close(car);
+    close(listener);
+}
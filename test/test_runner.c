@@ -10,6 +10,22 @@
 #include "test_phev_pipe.c"
 #include "test_phev_service.c"
 #include "test_phev_model.c"
+#include "test_phev_schema.c"
+#include "test_phev_history.c"
+#include "test_phev_snapshot.c"
+#include "test_phev_journal.c"
+#include "test_phev_log.c"
+#include "test_phev_tcpip.c"
+#include "test_phev_uring.c"
+#include "test_phev_capture.c"
+#include "test_phev_transport.c"
+#include "test_phev_broker.c"
+#include "test_phev_queue.c"
+#include "test_phev_histogram.c"
+#include "test_phev_metrics.c"
+#include "test_phev_alloc.c"
+#include "test_phev_trace.c"
+#include "test_phev_profile.c"
 #include "test_phev.c"
 
 void setUp(void) 
@@ -78,8 +94,18 @@ int main()
     RUN_TEST(test_core_phev_core_extractIncomingMessageAndXOR_BB_command);
     RUN_TEST(test_core_phev_core_extractIncomingMessageAndXOR_CC_command);
     RUN_TEST(test_core_phev_core_extractIncomingMessageAndXOR_2F_command);
+    RUN_TEST(test_core_phev_core_extractIncomingMessageExpectXOR);
+    RUN_TEST(test_core_phev_core_scanIncomingFrames);
+    RUN_TEST(test_core_phev_core_scan_and_extract_agree);
     RUN_TEST(test_phev_core_getMessageXOR);
     RUN_TEST(test_core_phev_core_extractIncomingMessageValidFirstByteCommand);
+    RUN_TEST(test_core_phev_core_extractIncomingMessage_truncated);
+    RUN_TEST(test_core_phev_core_extractIncomingMessage_too_short);
+    RUN_TEST(test_phev_core_getData_no_data);
+    RUN_TEST(test_phev_core_frameLength_unencoded);
+    RUN_TEST(test_phev_core_frameLength_encoded);
+    RUN_TEST(test_phev_core_frameLength_incomplete);
+    RUN_TEST(test_phev_core_frameLength_not_a_frame);
 
 //  PHEV PIPE
     
@@ -118,6 +144,11 @@ int main()
     RUN_TEST(test_phev_pipe_register_multiple_registerEventHandlers);
     RUN_TEST(test_phev_pipe_createRegisterEvent_ack);
     RUN_TEST(test_phev_pipe_createRegisterEvent_update);    
+    RUN_TEST(test_phev_pipe_connectBackoff_doubles_to_max);
+    RUN_TEST(test_phev_pipe_connectBackoff_jitter_in_range);
+    RUN_TEST(test_phev_pipe_tryConnect_polls_connect_in_flight);
+    RUN_TEST(test_phev_pipe_latency_command_ack);
+    RUN_TEST(test_phev_pipe_outputSplitter_tracks_inbound_key);
 
 // PHEV SERVICE
 
@@ -131,6 +162,7 @@ int main()
     RUN_TEST(test_phev_service_validateCommand_updateRegister_data_array_invalid);
     RUN_TEST(test_phev_service_validateCommand_updateRegister_reg_out_of_range);
     RUN_TEST(test_phev_service_validateCommand_updateRegister_value_out_of_range);
+    RUN_TEST(test_phev_service_validateCommand_updateRegister_data_array_empty);
     RUN_TEST(test_phev_service_jsonCommandToPhevMessage_updateRegister);
     RUN_TEST(test_phev_service_jsonCommandToPhevMessage_updateRegister_data_array);
     RUN_TEST(test_phev_service_jsonCommandToPhevMessage_updateRegister_data_array_invalid);
@@ -190,6 +222,9 @@ int main()
     RUN_TEST(test_phev_service_hvacStatus_off);
     RUN_TEST(test_phev_service_statusAsJson_hvac_operating);
     RUN_TEST(test_phev_service_status);
+    RUN_TEST(test_phev_service_getVehicleState);
+    RUN_TEST(test_phev_service_getVehicleState_profile_models);
+    RUN_TEST(test_phev_service_compareVehicleState);
     
 //  PHEV_MODEL
 
@@ -201,11 +236,131 @@ int main()
     RUN_TEST(test_phev_model_register_compare);
     RUN_TEST(test_phev_model_register_compare_not_same);
     RUN_TEST(test_phev_model_compare_not_set);
+    RUN_TEST(test_phev_model_version_changes_on_set);
+    RUN_TEST(test_phev_model_replaced_register_kept_for_reader);
+
+//  PHEV_SCHEMA
+
+    RUN_TEST(test_phev_schema_decodeField_single_byte);
+    RUN_TEST(test_phev_schema_decodeField_little_endian);
+    RUN_TEST(test_phev_schema_decodeField_big_endian);
+    RUN_TEST(test_phev_schema_decodeField_out_of_bounds);
+    RUN_TEST(test_phev_schema_decodeField_not_reported);
+    RUN_TEST(test_phev_schema_decodeField_nibbles);
+    RUN_TEST(test_phev_schema_accessor);
+    RUN_TEST(test_phev_schema_toJson);
+    RUN_TEST(test_phev_schema_toJson_model_years);
+    RUN_TEST(test_phev_schema_encode);
+
+//  PHEV_HISTORY
+
+    RUN_TEST(test_phev_history_create_only_tracks_selected);
+    RUN_TEST(test_phev_history_record_dedups_same_value);
+    RUN_TEST(test_phev_history_latest_wraps);
+    RUN_TEST(test_phev_history_range);
+    RUN_TEST(test_phev_history_downsample);
+    RUN_TEST(test_phev_history_records_from_model);
+
+//  PHEV_SNAPSHOT
+
+    RUN_TEST(test_phev_snapshot_open_creates_file);
+    RUN_TEST(test_phev_snapshot_restores_model);
+    RUN_TEST(test_phev_snapshot_different_vin_resets);
+    RUN_TEST(test_phev_snapshot_ignores_corrupt_slot);
+    RUN_TEST(test_phev_snapshot_stale_by_age);
+    RUN_TEST(test_phev_snapshot_touch_refreshes_age);
+    RUN_TEST(test_phev_snapshot_adopts_first_vin);
+    RUN_TEST(test_phev_snapshot_other_vin_unloads_model);
+
+//  PHEV_JOURNAL
+
+    RUN_TEST(test_phev_journal_replay_until);
+    RUN_TEST(test_phev_journal_records_from_model);
+    RUN_TEST(test_phev_journal_compacts_to_latest);
+
+//  PHEV_LOG
+
+    RUN_TEST(test_phev_log_frame_without_sink);
+    RUN_TEST(test_phev_log_frame_decoded_inline);
+    RUN_TEST(test_phev_log_frame_through_ring);
+
+//  PHEV_TCPIP
+
+    RUN_TEST(test_phev_tcpip_apply_options);
+    RUN_TEST(test_phev_tcpip_default_options_untouched);
+    RUN_TEST(test_phev_tcpip_rx_buffer_per_socket);
+
+//  PHEV_URING
+
+    RUN_TEST(test_phev_uring_reads_frames_over_loopback);
+
+//  PHEV_CAPTURE
+
+    RUN_TEST(test_phev_capture_records_and_reads_back);
+    RUN_TEST(test_phev_capture_per_transport);
+    RUN_TEST(test_phev_capture_records_fill_before_framing);
+
+//  PHEV_TRANSPORT
+
+    RUN_TEST(test_phev_transport_loopback_drain);
+    RUN_TEST(test_phev_transport_loopback_whole_frames);
+    RUN_TEST(test_phev_transport_unix_socket);
+    RUN_TEST(test_phev_transport_tcp_connect_in_flight);
+    RUN_TEST(test_phev_transport_tcp_connect_refused);
+    RUN_TEST(test_phev_transport_tcp_options_per_transport);
+
+//  PHEV_BROKER
+
+    RUN_TEST(test_phev_broker_subscribe_update);
+    RUN_TEST(test_phev_broker_subscribe_snapshot);
+    RUN_TEST(test_phev_broker_slow_client_drops);
+    RUN_TEST(test_phev_broker_overlong_line_discarded);
+    RUN_TEST(test_phev_broker_no_room_for_listener);
+    RUN_TEST(test_phev_broker_socket_owner_only);
+    RUN_TEST(test_phev_broker_keeps_other_file);
+
+//  PHEV_QUEUE
+
+    RUN_TEST(test_phev_queue_coalesce_or_drop_new);
+    RUN_TEST(test_phev_queue_coalesce_or_drop_new_keeps_queued_events);
+    RUN_TEST(test_phev_queue_coalesce);
+    RUN_TEST(test_phev_queue_block_times_out);
+    RUN_TEST(test_phev_queue_dispatcher);
+
+//  PHEV_HISTOGRAM
+
+    RUN_TEST(test_phev_histogram_percentiles);
+    RUN_TEST(test_phev_histogram_buckets_and_reset);
+    RUN_TEST(test_phev_histogram_merge);
+
+//  PHEV_METRICS
+
+    RUN_TEST(test_phev_metrics_snapshot);
+    RUN_TEST(test_phev_metrics_prometheus);
+
+//  PHEV_ALLOC
+
+    RUN_TEST(test_phev_alloc_tracker_counts);
+    RUN_TEST(test_phev_alloc_model_replaced_registers_freed);
+    RUN_TEST(test_phev_alloc_json_command_does_not_leak);
+
+//  PHEV_TRACE
+
+    RUN_TEST(test_phev_trace_ring_keeps_latest);
+    RUN_TEST(test_phev_trace_save_and_read);
+
+//  PHEV_PROFILE
+
+    RUN_TEST(test_phev_profile_get_defaults_to_my18);
+    RUN_TEST(test_phev_profile_fromName);
+    RUN_TEST(test_phev_profile_incoming);
+    RUN_TEST(test_phev_profile_pingMessage);
 
 // PHEV
 
     RUN_TEST(test_phev_init_returns_context);
     RUN_TEST(test_phev_statusAsJson);
+    RUN_TEST(test_phev_command_waits_for_pipe_thread);
    // RUN_TEST(test_phev_calls_connect_event);
    // RUN_TEST(test_phev_registrationEndToEnd);
 
@@ -0,0 +1,218 @@
+/*
+    Capture replay.
+
+    Usage: phev_replay [-r] [-m] [-p profile] [-n passes] capture
+
+    Feeds the car's side of a capture made with capturePath through the whole
+    stack, phev_init to the event handler, through a transport that reads
+    from the file. Writes go nowhere. By default the capture is fed as fast as
+    the pipe takes it and the run reports the decode throughput, -r plays it
+    with the original timing. -m sets my18, -p picks the protocol profile
+    (pre-my18, my18 or my19), -n feeds the capture more than once.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "phev.h"
+#include "phev_capture.h"
+#include "msg_tcpip.h"
+
+#define REPLAY_SOCKET 1
+
+typedef struct replayCtx_t {
+    const char * path;
+    bool realTime;
+    int passes;
+    int pass;
+    phevCaptureReader_t * reader;
+    phevCaptureRecord_t record;
+    size_t offset;
+    bool pending;
+    uint64_t passStart;
+    phevCtx_t * phev;
+    uint64_t records;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t events;
+    uint64_t updates;
+} replayCtx_t;
+
+static replayCtx_t replay;
+
+static void replay_sleepUntil(uint64_t due)
+{
+    uint64_t now = phev_core_monotonicNs();
+
+    if(due > now)
+    {
+        struct timespec ts = {
+            .tv_sec = (time_t) ((due - now) / 1000000000ULL),
+            .tv_nsec = (long) ((due - now) % 1000000000ULL),
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+// Next inbound record, going round again while there are passes left.
+static bool replay_nextRecord(void)
+{
+    while(replay.pass < replay.passes)
+    {
+        if(replay.reader == NULL)
+        {
+            replay.reader = phev_capture_openReader(replay.path);
+            replay.passStart = phev_core_monotonicNs();
+
+            if(replay.reader == NULL)
+            {
+                return false;
+            }
+        }
+        while(phev_capture_next(replay.reader, &replay.record))
+        {
+            if(replay.record.direction == PHEV_CAPTURE_IN)
+            {
+                replay.offset = 0;
+                replay.records++;
+                return true;
+            }
+        }
+        phev_capture_closeReader(replay.reader);
+        replay.reader = NULL;
+        replay.pass++;
+    }
+    return false;
+}
+static int replay_connect(const char * host, uint16_t port)
+{
+    return REPLAY_SOCKET;
+}
+static int replay_disconnect(int soc)
+{
+    return 0;
+}
+static int replay_read(int soc, uint8_t * buf, size_t len)
+{
+    if(!replay.pending)
+    {
+        if(!replay_nextRecord())
+        {
+            phev_exit(replay.phev);
+            return 0;
+        }
+        replay.pending = true;
+
+        if(replay.realTime)
+        {
+            replay_sleepUntil(replay.passStart + replay.record.timestamp);
+        }
+    }
+
+    size_t num = replay.record.length - replay.offset;
+
+    if(num > len)
+    {
+        num = len;
+    }
+    memcpy(buf, replay.record.data + replay.offset, num);
+    replay.offset += num;
+    replay.bytesIn += num;
+    replay.pending = (replay.offset < replay.record.length);
+
+    return (int) num;
+}
+static int replay_write(int soc, uint8_t * buf, size_t len)
+{
+    replay.bytesOut += len;
+
+    return (int) len;
+}
+static int replay_eventHandler(phevEvent_t * event)
+{
+    replay.events++;
+
+    if(event->type == PHEV_REGISTER_UPDATE)
+    {
+        replay.updates++;
+    }
+    return 0;
+}
+int main(int argc, char * argv[])
+{
+    uint8_t mac[MAC_ADDR_SIZE] = {0};
+    bool my18 = false;
+    phevProfileId_t profile = PHEV_PROFILE_DEFAULT;
+
+    replay.passes = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-r") == 0)
+        {
+            replay.realTime = true;
+        }
+        else if(strcmp(argv[i], "-m") == 0)
+        {
+            my18 = true;
+        }
+        else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            profile = phev_profile_fromName(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            replay.passes = atoi(argv[++i]);
+        }
+        else if(replay.path == NULL && argv[i][0] != '-')
+        {
+            replay.path = argv[i];
+        }
+        else
+        {
+            replay.path = NULL;
+            break;
+        }
+    }
+    if(replay.path == NULL || replay.passes < 1 || profile == PHEV_PROFILE_MAX)
+    {
+        fprintf(stderr, "Usage: %s [-r] [-m] [-p profile] [-n passes] capture\n", argv[0]);
+        return 1;
+    }
+
+    tcpIpSettings_t transport = {
+        .connect = replay_connect,
+        .disconnect = replay_disconnect,
+        .read = replay_read,
+        .write = replay_write,
+        .host = "replay",
+        .port = 0,
+    };
+    phevSettings_t settings = {
+        .host = "replay",
+        .mac = mac,
+        .my18 = my18,
+        .profile = profile,
+        .handler = replay_eventHandler,
+        .out = msg_tcpip_createTcpIpClient(transport),
+    };
+
+    replay.phev = phev_init(settings);
+
+    uint64_t start = phev_core_monotonicNs();
+
+    phev_start(replay.phev);
+
+    double seconds = (double) (phev_core_monotonicNs() - start) / 1e9;
+
+    printf("%d passes, %llu records, %llu bytes in, %llu bytes out\n", replay.pass,
+        (unsigned long long) replay.records, (unsigned long long) replay.bytesIn, (unsigned long long) replay.bytesOut);
+    printf("%llu events, %llu register updates in %.3f s\n",
+        (unsigned long long) replay.events, (unsigned long long) replay.updates, seconds);
+
+    if(!replay.realTime && seconds > 0)
+    {
+        printf("%.1f MB/s, %.0f records/s, %.0f updates/s\n",
+            replay.bytesIn / seconds / 1e6, replay.records / seconds, replay.updates / seconds);
+    }
+    return 0;
+}
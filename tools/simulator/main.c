@@ -0,0 +1,84 @@
+/*
+    Local car simulator.
+
+    Usage: phev_simulator [-p port] [scenario]
+
+    Listens on 127.0.0.1:8080 unless the scenario or -p says otherwise, and
+    plays the car until interrupted, then prints what it saw.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "phev_sim.h"
+
+static phevSim_t * sim = NULL;
+
+static void sim_interrupt(int signal)
+{
+    (void) signal;
+
+    if (sim)
+    {
+        phev_sim_stop(sim);
+    }
+}
+int main(int argc, char * argv[])
+{
+    static phevSimScenario_t scenario;
+    long port = -1;
+    const char * path = NULL;
+
+    phev_sim_defaultScenario(&scenario);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            port = strtol(argv[++i], NULL, 0);
+        }
+        else if (path == NULL && argv[i][0] != '-')
+        {
+            path = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-p port] [scenario]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (path && !phev_sim_loadScenario(path, &scenario))
+    {
+        fprintf(stderr, "Cannot load scenario %s\n", path);
+        return 1;
+    }
+    if (port >= 0 && port <= 0xffff)
+    {
+        scenario.port = (uint16_t) port;
+    }
+
+    sim = phev_sim_create(&scenario);
+
+    if (sim == NULL)
+    {
+        fprintf(stderr, "Cannot listen on %s:%d\n", scenario.address, scenario.port);
+        return 1;
+    }
+    signal(SIGINT, sim_interrupt);
+    signal(SIGTERM, sim_interrupt);
+
+    printf("Simulating %s on %s:%d\n", scenario.vin, scenario.address, phev_sim_port(sim));
+    fflush(stdout);
+
+    phev_sim_run(sim);
+
+    phevSimStats_t stats = phev_sim_stats(sim);
+
+    printf("connections %u frames in %u out %u dropped %u invalid %u pings %u writes %u acks %u xor changes %u\n",
+        stats.connections, stats.framesIn, stats.framesOut, stats.dropped, stats.invalid,
+        stats.pings, stats.writes, stats.acks, stats.xorChanges);
+
+    phev_sim_destroy(sim);
+
+    return 0;
+}
@@ -0,0 +1,638 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "phev_sim.h"
+#include "phev_log.h"
+
+const static char *APP_TAG = "PHEV_SIM";
+
+#define PHEV_SIM_POLL_MS 100
+#define PHEV_SIM_SECURITY_LENGTH 9
+#define PHEV_SIM_VIN_LENGTH 20
+
+typedef struct phevSimFrame_t {
+    uint64_t due;
+    uint8_t length;
+    uint8_t data[PHEV_SIM_MAX_FRAME];
+} phevSimFrame_t;
+
+struct phevSim_t {
+    phevSimScenario_t scenario;
+    int listener;
+    uint16_t port;
+    atomic_bool running;
+    bool threaded;
+    pthread_t thread;
+    pthread_mutex_t statsLock;
+    phevSimStats_t stats;
+
+    int client;
+    bool encrypted;
+    uint8_t xor;
+    uint8_t pingXor;
+    uint32_t random;
+    uint64_t connectedAt;
+    size_t nextAction;
+    uint64_t nextXorRoll;
+    uint32_t latencyMs;
+    uint32_t lossPercent;
+    phevSimRegister_t registers[256];
+
+    uint8_t rx[PHEV_SIM_RX_BUFFER_SIZE];
+    size_t rxLength;
+
+    phevSimFrame_t queue[PHEV_SIM_QUEUE_SIZE];
+    size_t queueHead;
+    size_t queueCount;
+};
+
+static void sim_count(phevSim_t * sim, uint32_t * counter)
+{
+    pthread_mutex_lock(&sim->statsLock);
+    (*counter)++;
+    pthread_mutex_unlock(&sim->statsLock);
+}
+static uint32_t sim_random(phevSim_t * sim)
+{
+    uint32_t x = sim->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->random = x;
+
+    return x;
+}
+size_t phev_sim_encode(uint8_t * out, uint8_t command, uint8_t type, uint8_t reg, const uint8_t * data, size_t length, uint8_t xor)
+{
+    uint8_t checksum = 0;
+
+    if (length > PHEV_SIM_MAX_DATA)
+    {
+        return 0;
+    }
+    out[0] = command;
+    out[1] = (uint8_t) (length + 3);
+    out[2] = type;
+    out[3] = reg;
+    memcpy(out + 4, data, length);
+
+    for (size_t i = 0; i < length + 4; i++)
+    {
+        checksum = (uint8_t) (checksum + out[i]);
+    }
+    out[length + 4] = checksum;
+
+    for (size_t i = 0; i < length + 5; i++)
+    {
+        out[i] ^= xor;
+    }
+    return length + 5;
+}
+static void sim_closeClient(phevSim_t * sim)
+{
+    if (sim->client >= 0)
+    {
+        LOG_I(APP_TAG, "Client disconnected");
+        close(sim->client);
+    }
+    sim->client = -1;
+    sim->rxLength = 0;
+    sim->queueHead = 0;
+    sim->queueCount = 0;
+}
+static void sim_write(phevSim_t * sim, const uint8_t * data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t num = send(sim->client, data, length, MSG_NOSIGNAL);
+
+        if (num < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (num <= 0)
+        {
+            LOG_W(APP_TAG, "Write to client failed");
+            sim_closeClient(sim);
+            return;
+        }
+        data += num;
+        length -= (size_t) num;
+    }
+    sim_count(sim, &sim->stats.framesOut);
+}
+static void sim_flush(phevSim_t * sim, uint64_t now)
+{
+    while (sim->client >= 0 && sim->queueCount > 0 && sim->queue[sim->queueHead].due <= now)
+    {
+        phevSimFrame_t * frame = &sim->queue[sim->queueHead];
+
+        sim->queueHead = (sim->queueHead + 1) % PHEV_SIM_QUEUE_SIZE;
+        sim->queueCount--;
+        sim_write(sim, frame->data, frame->length);
+    }
+}
+// Frames keep their order, each one goes out the latency after it was sent.
+static void sim_send(phevSim_t * sim, uint8_t command, uint8_t type, uint8_t reg, const uint8_t * data, size_t length, uint8_t xor)
+{
+    uint64_t now = phev_core_monotonicMs();
+
+    if (sim->client < 0)
+    {
+        return;
+    }
+    if (sim->lossPercent > 0 && (sim_random(sim) % 100) < sim->lossPercent)
+    {
+        LOG_D(APP_TAG, "Dropped %02X reg %d", command, reg);
+        sim_count(sim, &sim->stats.dropped);
+        return;
+    }
+    if (sim->queueCount == PHEV_SIM_QUEUE_SIZE)
+    {
+        LOG_W(APP_TAG, "Outgoing queue full, dropped %02X reg %d", command, reg);
+        sim_count(sim, &sim->stats.dropped);
+        return;
+    }
+
+    phevSimFrame_t * frame = &sim->queue[(sim->queueHead + sim->queueCount) % PHEV_SIM_QUEUE_SIZE];
+
+    frame->length = (uint8_t) phev_sim_encode(frame->data, command, type, reg, data, length, xor);
+    frame->due = now + sim->latencyMs;
+    sim->queueCount++;
+
+    sim_flush(sim, now);
+}
+static void sim_sendRegister(phevSim_t * sim, uint8_t reg)
+{
+    const phevSimRegister_t * value = &sim->registers[reg];
+
+    if (value->length > 0)
+    {
+        sim_send(sim, RESP_CMD, REQUEST_TYPE, reg, value->data, value->length, sim->xor);
+    }
+}
+static void sim_broadcast(phevSim_t * sim)
+{
+    LOG_I(APP_TAG, "Sending all registers");
+
+    for (int reg = 0; reg < 256; reg++)
+    {
+        if (reg != KO_WF_EV_UPDATE_SP)
+        {
+            sim_sendRegister(sim, (uint8_t) reg);
+        }
+    }
+}
+// The new key goes out under the old one, the client switches when it sees it.
+static void sim_changeXor(phevSim_t * sim, uint8_t xor)
+{
+    LOG_I(APP_TAG, "XOR changed from %02X to %02X", sim->xor, xor);
+
+    sim_send(sim, 0xbb, REQUEST_TYPE, 0x01, &xor, 1, sim->xor);
+    sim->xor = xor;
+    sim->pingXor = xor;
+    sim_count(sim, &sim->stats.xorChanges);
+}
+static void sim_changePingXor(phevSim_t * sim, uint8_t xor)
+{
+    LOG_I(APP_TAG, "Ping XOR changed from %02X to %02X", sim->pingXor, xor);
+
+    sim_send(sim, 0xcc, REQUEST_TYPE, 0x01, &xor, 1, sim->pingXor);
+    sim->pingXor = xor;
+    sim_count(sim, &sim->stats.xorChanges);
+}
+static void sim_resetRegisters(phevSim_t * sim)
+{
+    phevSimRegister_t * vin = &sim->registers[KO_WF_VIN_INFO_EVR];
+
+    memcpy(sim->registers, sim->scenario.registers, sizeof(sim->registers));
+
+    if (vin->length == 0)
+    {
+        memset(vin, 0, sizeof(phevSimRegister_t));
+        vin->length = PHEV_SIM_VIN_LENGTH;
+        memcpy(vin->data + 1, sim->scenario.vin, VIN_LEN);
+        vin->data[19] = sim->scenario.registrations;
+    }
+}
+static void sim_accept(phevSim_t * sim, int client)
+{
+    int one = 1;
+
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    sim->client = client;
+    sim->encrypted = false;
+    sim->xor = 0;
+    sim->pingXor = 0;
+    sim->connectedAt = phev_core_monotonicMs();
+    sim->nextAction = 0;
+    sim->nextXorRoll = 0;
+    sim->latencyMs = sim->scenario.latencyMs;
+    sim->lossPercent = sim->scenario.lossPercent;
+    sim->rxLength = 0;
+    sim->queueHead = 0;
+    sim->queueCount = 0;
+    sim_resetRegisters(sim);
+
+    sim_count(sim, &sim->stats.connections);
+    LOG_I(APP_TAG, "Client connected");
+}
+static void sim_handleStart(phevSim_t * sim, uint8_t reg)
+{
+    uint8_t zero = 0;
+    uint8_t security[PHEV_SIM_SECURITY_LENGTH];
+
+    for (int i = 0; i < PHEV_SIM_SECURITY_LENGTH; i++)
+    {
+        security[i] = (uint8_t) sim_random(sim);
+    }
+
+    // A reconnecting client starts again from unencoded frames
+    sim->encrypted = false;
+    sim->xor = 0;
+    sim->pingXor = 0;
+
+    sim_send(sim, START_RESP, RESPONSE_TYPE, reg, &zero, 1, 0);
+    sim_send(sim, (sim->scenario.my18 ? 0x4e : RESP_CMD_MY18), REQUEST_TYPE, KO_WF_REMOTE_SECURTY_PRSNT_INFO, security, sizeof(security), 0);
+}
+static void sim_handleSecurity(phevSim_t * sim)
+{
+    if (sim->encrypted)
+    {
+        return;
+    }
+    sim->encrypted = true;
+    sim_changeXor(sim, sim->scenario.xor);
+
+    if (sim->scenario.xorIntervalMs > 0)
+    {
+        sim->nextXorRoll = phev_core_monotonicMs() + sim->scenario.xorIntervalMs;
+    }
+}
+static void sim_handleCommand(phevSim_t * sim, const uint8_t * frame, uint8_t xor)
+{
+    uint8_t zero = 0;
+    uint8_t reg = frame[3];
+    size_t length = (size_t) frame[1] - 3;
+
+    if (frame[2] == RESPONSE_TYPE)
+    {
+        sim_count(sim, &sim->stats.acks);
+        return;
+    }
+    sim_count(sim, &sim->stats.writes);
+    sim_send(sim, RESP_CMD, RESPONSE_TYPE, reg, &zero, 1, xor);
+
+    if (reg == KO_WF_EV_UPDATE_SP)
+    {
+        sim_broadcast(sim);
+        return;
+    }
+    if (reg != KO_WF_START_AA_EVR && length > 0 && length <= PHEV_SIM_MAX_DATA)
+    {
+        sim->registers[reg].length = (uint8_t) length;
+        memcpy(sim->registers[reg].data, frame + 4, length);
+    }
+}
+static void sim_handleFrame(phevSim_t * sim, const uint8_t * frame, uint8_t xor)
+{
+    uint8_t zero = 0;
+
+    sim_count(sim, &sim->stats.framesIn);
+    LOG_D(APP_TAG, "Received %02X type %d reg %d XOR %02X", frame[0], frame[2], frame[3], xor);
+
+    switch (frame[0])
+    {
+    case START_SEND:
+        sim_handleStart(sim, frame[3]);
+        break;
+    case 0xe4:
+    case SEND_CMD_MY18:
+        sim_handleSecurity(sim);
+        break;
+    case PING_SEND_CMD_MY18:
+        sim_count(sim, &sim->stats.pings);
+        sim_send(sim, PING_RESP_CMD_MY18, RESPONSE_TYPE, frame[3], &zero, 1, sim->pingXor);
+        break;
+    case PING_SEND_CMD:
+        sim_count(sim, &sim->stats.pings);
+        sim_send(sim, PING_RESP_CMD, RESPONSE_TYPE, frame[3], &zero, 1, sim->pingXor);
+        break;
+    case SEND_CMD:
+        sim_handleCommand(sim, frame, xor);
+        break;
+    default:
+        break;
+    }
+}
+static bool sim_isClientCommand(uint8_t command)
+{
+    switch (command)
+    {
+    case START_SEND:
+    case SEND_CMD:
+    case PING_SEND_CMD:
+    case PING_SEND_CMD_MY18:
+    case 0xe4:
+    case SEND_CMD_MY18:
+        return true;
+    default:
+        return false;
+    }
+}
+// Finds the key the client used, the checksum has to match with it.
+static bool sim_decode(const uint8_t * data, size_t length, uint8_t * frame, uint8_t * key)
+{
+    const uint8_t candidates[] = {0, data[2], data[2] ^ 1};
+
+    for (int i = 0; i < 3; i++)
+    {
+        uint8_t xor = candidates[i];
+        uint8_t checksum = 0;
+
+        for (size_t j = 0; j < length; j++)
+        {
+            frame[j] = data[j] ^ xor;
+        }
+        if (!sim_isClientCommand(frame[0]) || (size_t) frame[1] + 2 != length)
+        {
+            continue;
+        }
+        for (size_t j = 0; j < length - 1; j++)
+        {
+            checksum = (uint8_t) (checksum + frame[j]);
+        }
+        if (checksum == frame[length - 1])
+        {
+            *key = xor;
+            return true;
+        }
+    }
+    return false;
+}
+static void sim_receive(phevSim_t * sim)
+{
+    size_t offset = 0;
+
+    while (sim->client >= 0 && offset < sim->rxLength)
+    {
+        uint8_t frame[256];
+        uint8_t xor = 0;
+        int length = phev_core_frameLength(sim->rx + offset, sim->rxLength - offset);
+
+        if (length == 0)
+        {
+            break;
+        }
+        if (length < 0 || !sim_decode(sim->rx + offset, (size_t) length, frame, &xor) || frame[1] < 3)
+        {
+            // Skip a byte and look for the next frame
+            sim_count(sim, &sim->stats.invalid);
+            offset++;
+            continue;
+        }
+        offset += (size_t) length;
+        sim_handleFrame(sim, frame, xor);
+    }
+    if (sim->client < 0)
+    {
+        return;
+    }
+    memmove(sim->rx, sim->rx + offset, sim->rxLength - offset);
+    sim->rxLength -= offset;
+}
+static void sim_runAction(phevSim_t * sim, const phevSimAction_t * action)
+{
+    switch (action->type)
+    {
+    case PHEV_SIM_ACTION_REGISTER:
+        sim->registers[action->reg] = action->data;
+        sim_sendRegister(sim, action->reg);
+        break;
+    case PHEV_SIM_ACTION_XOR:
+        sim_changeXor(sim, (uint8_t) action->value);
+        break;
+    case PHEV_SIM_ACTION_PING_XOR:
+        sim_changePingXor(sim, (uint8_t) action->value);
+        break;
+    case PHEV_SIM_ACTION_LATENCY:
+        sim->latencyMs = action->value;
+        break;
+    case PHEV_SIM_ACTION_LOSS:
+        sim->lossPercent = action->value;
+        break;
+    case PHEV_SIM_ACTION_DISCONNECT:
+        sim_closeClient(sim);
+        break;
+    }
+}
+static void sim_runTimeline(phevSim_t * sim, uint64_t now)
+{
+    while (sim->client >= 0 && sim->nextAction < sim->scenario.numberOfActions)
+    {
+        const phevSimAction_t * action = &sim->scenario.actions[sim->nextAction];
+
+        if (sim->connectedAt + action->at > now)
+        {
+            break;
+        }
+        sim->nextAction++;
+        LOG_I(APP_TAG, "Timeline %u ms action %d", action->at, action->type);
+        sim_runAction(sim, action);
+    }
+    if (sim->client >= 0 && sim->encrypted && sim->nextXorRoll > 0 && sim->nextXorRoll <= now)
+    {
+        // Keys below 2 read as unencoded
+        sim_changeXor(sim, (uint8_t) (2 + sim_random(sim) % 254));
+        sim->nextXorRoll = now + sim->scenario.xorIntervalMs;
+    }
+}
+static int sim_timeout(const phevSim_t * sim, uint64_t now)
+{
+    uint64_t next = now + PHEV_SIM_POLL_MS;
+
+    if (sim->nextAction < sim->scenario.numberOfActions && sim->connectedAt + sim->scenario.actions[sim->nextAction].at < next)
+    {
+        next = sim->connectedAt + sim->scenario.actions[sim->nextAction].at;
+    }
+    if (sim->encrypted && sim->nextXorRoll > 0 && sim->nextXorRoll < next)
+    {
+        next = sim->nextXorRoll;
+    }
+    if (sim->queueCount > 0 && sim->queue[sim->queueHead].due < next)
+    {
+        next = sim->queue[sim->queueHead].due;
+    }
+    return (next > now ? (int) (next - now) : 0);
+}
+static void sim_serve(phevSim_t * sim)
+{
+    uint64_t now = phev_core_monotonicMs();
+    struct pollfd fds = {.fd = sim->client, .events = POLLIN};
+    int ret = poll(&fds, 1, sim_timeout(sim, now));
+
+    if (ret < 0 && errno != EINTR)
+    {
+        sim_closeClient(sim);
+        return;
+    }
+    if (ret > 0)
+    {
+        ssize_t num = recv(sim->client, sim->rx + sim->rxLength, sizeof(sim->rx) - sim->rxLength, 0);
+
+        if (num <= 0)
+        {
+            sim_closeClient(sim);
+            return;
+        }
+        sim->rxLength += (size_t) num;
+        sim_receive(sim);
+
+        if (sim->rxLength == sizeof(sim->rx))
+        {
+            LOG_W(APP_TAG, "Receive buffer full of garbage, dropping it");
+            sim->rxLength = 0;
+        }
+    }
+    now = phev_core_monotonicMs();
+    sim_runTimeline(sim, now);
+    sim_flush(sim, now);
+}
+phevSim_t * phev_sim_create(const phevSimScenario_t * scenario)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int one = 1;
+    phevSim_t * sim = calloc(1, sizeof(phevSim_t));
+
+    if (sim == NULL)
+    {
+        return NULL;
+    }
+    sim->scenario = *scenario;
+    sim->client = -1;
+    sim->random = (scenario->seed ? scenario->seed : 1);
+    atomic_init(&sim->running, true);
+    pthread_mutex_init(&sim->statsLock, NULL);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(scenario->port);
+
+    sim->listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sim->listener < 0 || inet_pton(AF_INET, scenario->address, &addr.sin_addr) != 1)
+    {
+        LOG_E(APP_TAG, "Cannot listen on %s", scenario->address);
+        phev_sim_destroy(sim);
+        return NULL;
+    }
+    setsockopt(sim->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(sim->listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(sim->listener, 4) != 0)
+    {
+        LOG_E(APP_TAG, "Cannot listen on %s:%d", scenario->address, scenario->port);
+        phev_sim_destroy(sim);
+        return NULL;
+    }
+    getsockname(sim->listener, (struct sockaddr *) &addr, &addrLength);
+    sim->port = ntohs(addr.sin_port);
+
+    LOG_I(APP_TAG, "Listening on %s:%d", scenario->address, sim->port);
+
+    return sim;
+}
+void phev_sim_destroy(phevSim_t * sim)
+{
+    if (sim == NULL)
+    {
+        return;
+    }
+    phev_sim_stop(sim);
+    sim_closeClient(sim);
+
+    if (sim->listener >= 0)
+    {
+        close(sim->listener);
+    }
+    pthread_mutex_destroy(&sim->statsLock);
+    free(sim);
+}
+uint16_t phev_sim_port(const phevSim_t * sim)
+{
+    return sim->port;
+}
+void phev_sim_run(phevSim_t * sim)
+{
+    while (atomic_load(&sim->running))
+    {
+        if (sim->client >= 0)
+        {
+            sim_serve(sim);
+            continue;
+        }
+
+        struct pollfd fds = {.fd = sim->listener, .events = POLLIN};
+
+        if (poll(&fds, 1, PHEV_SIM_POLL_MS) > 0)
+        {
+            int client = accept(sim->listener, NULL, NULL);
+
+            if (client >= 0)
+            {
+                sim_accept(sim, client);
+            }
+        }
+    }
+    sim_closeClient(sim);
+}
+static void * sim_thread(void * arg)
+{
+    phev_sim_run((phevSim_t *) arg);
+
+    return NULL;
+}
+bool phev_sim_start(phevSim_t * sim)
+{
+    atomic_store(&sim->running, true);
+
+    if (pthread_create(&sim->thread, NULL, sim_thread, sim) != 0)
+    {
+        atomic_store(&sim->running, false);
+        return false;
+    }
+    sim->threaded = true;
+
+    return true;
+}
+void phev_sim_stop(phevSim_t * sim)
+{
+    atomic_store(&sim->running, false);
+
+    if (sim->threaded)
+    {
+        pthread_join(sim->thread, NULL);
+        sim->threaded = false;
+    }
+}
+phevSimStats_t phev_sim_stats(const phevSim_t * sim)
+{
+    phevSimStats_t stats;
+
+    pthread_mutex_lock((pthread_mutex_t *) &sim->statsLock);
+    stats = sim->stats;
+    pthread_mutex_unlock((pthread_mutex_t *) &sim->statsLock);
+
+    return stats;
+}
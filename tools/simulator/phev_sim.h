@@ -0,0 +1,113 @@
+#ifndef _PHEV_SIM_H_
+#define _PHEV_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "phev_core.h"
+
+#define PHEV_SIM_DEFAULT_PORT 8080
+#define PHEV_SIM_MAX_DATA 64
+#define PHEV_SIM_MAX_FRAME (PHEV_SIM_MAX_DATA + 5)
+#define PHEV_SIM_MAX_ACTIONS 256
+#define PHEV_SIM_QUEUE_SIZE 512
+#define PHEV_SIM_RX_BUFFER_SIZE 4096
+
+/*
+    Local car simulator.
+
+    Listens on a TCP port and plays the car's side of the protocol for one
+    client at a time:
+
+        f2 start            acked with 2f, then a 4E (MY18) or 5E security
+                            request sent unencoded
+        e4 / e5             encryption on, the key is announced with BB
+        f3 ping             answered with 3f carrying the ping number
+        f6 request          acked with 6f, the value is stored, a write to
+                            KO_WF_EV_UPDATE_SP broadcasts every register
+        f6 response         the client's ack of an update, counted
+
+    Everything the car sends after the handshake is XORed with its current
+    key. The key rolls on a timer or from the scenario timeline with a BB
+    carrying the next key, CC changes the ping key the same way.
+
+    Outgoing frames can be delayed by a fixed latency and dropped with a
+    given probability, both drawn from a seeded generator so a scenario
+    replays the same way every time. The timeline runs from when the client
+    connects.
+*/
+typedef enum phevSimActionType_t {
+    PHEV_SIM_ACTION_REGISTER,
+    PHEV_SIM_ACTION_XOR,
+    PHEV_SIM_ACTION_PING_XOR,
+    PHEV_SIM_ACTION_LATENCY,
+    PHEV_SIM_ACTION_LOSS,
+    PHEV_SIM_ACTION_DISCONNECT,
+} phevSimActionType_t;
+
+typedef struct phevSimRegister_t {
+    uint8_t length;
+    uint8_t data[PHEV_SIM_MAX_DATA];
+} phevSimRegister_t;
+
+typedef struct phevSimAction_t {
+    uint32_t at;
+    phevSimActionType_t type;
+    uint8_t reg;
+    uint32_t value;
+    phevSimRegister_t data;
+} phevSimAction_t;
+
+typedef struct phevSimScenario_t {
+    char address[64];
+    uint16_t port;
+    char vin[VIN_LEN + 1];
+    uint8_t registrations;
+    bool my18;
+    uint8_t xor;
+    uint32_t xorIntervalMs;
+    uint32_t latencyMs;
+    uint32_t lossPercent;
+    uint32_t seed;
+    phevSimRegister_t registers[256];
+    size_t numberOfActions;
+    phevSimAction_t actions[PHEV_SIM_MAX_ACTIONS];
+} phevSimScenario_t;
+
+typedef struct phevSimStats_t {
+    uint32_t connections;
+    uint32_t framesIn;
+    uint32_t framesOut;
+    uint32_t dropped;
+    uint32_t invalid;
+    uint32_t pings;
+    uint32_t writes;
+    uint32_t acks;
+    uint32_t xorChanges;
+} phevSimStats_t;
+
+typedef struct phevSim_t phevSim_t;
+
+void phev_sim_defaultScenario(phevSimScenario_t * scenario);
+
+// Parses on top of whatever is already in the scenario, returns false and logs the line that failed.
+bool phev_sim_parseScenario(const char * text, phevSimScenario_t * scenario);
+
+bool phev_sim_loadScenario(const char * path, phevSimScenario_t * scenario);
+
+// Port 0 binds an ephemeral port, phev_sim_port says which.
+phevSim_t * phev_sim_create(const phevSimScenario_t * scenario);
+void phev_sim_destroy(phevSim_t * sim);
+uint16_t phev_sim_port(const phevSim_t * sim);
+
+// Serves clients until phev_sim_stop, which also ends a phev_sim_run on another thread.
+void phev_sim_run(phevSim_t * sim);
+bool phev_sim_start(phevSim_t * sim);
+void phev_sim_stop(phevSim_t * sim);
+
+phevSimStats_t phev_sim_stats(const phevSim_t * sim);
+
+// Encodes one frame with the key, returns its length.
+size_t phev_sim_encode(uint8_t * out, uint8_t command, uint8_t type, uint8_t reg, const uint8_t * data, size_t length, uint8_t xor);
+
+#endif
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "phev_sim.h"
+#include "phev_log.h"
+
+const static char *APP_TAG = "PHEV_SIM";
+
+#define PHEV_SIM_MAX_LINE 512
+
+void phev_sim_defaultScenario(phevSimScenario_t * scenario)
+{
+    memset(scenario, 0, sizeof(phevSimScenario_t));
+
+    strcpy(scenario->address, "127.0.0.1");
+    scenario->port = PHEV_SIM_DEFAULT_PORT;
+    strcpy(scenario->vin, "JMAXDGG2WJZ000001");
+    scenario->registrations = 1;
+    scenario->my18 = true;
+    scenario->xor = 0x5a;
+    scenario->seed = 1;
+}
+static bool sim_parseNumber(const char * token, uint32_t * value)
+{
+    char * end = NULL;
+
+    if (token == NULL)
+    {
+        return false;
+    }
+    *value = (uint32_t) strtoul(token, &end, 0);
+
+    return end != token && *end == '\0';
+}
+// Data bytes are always hex, with or without a space between them
+static bool sim_parseData(char * rest, phevSimRegister_t * reg)
+{
+    reg->length = 0;
+
+    for (char * p = rest; p && *p; p++)
+    {
+        if (isspace((unsigned char) *p))
+        {
+            continue;
+        }
+        if (*p == '#')
+        {
+            break;
+        }
+        if (!isxdigit((unsigned char) p[0]) || !isxdigit((unsigned char) p[1]) || reg->length == PHEV_SIM_MAX_DATA)
+        {
+            return false;
+        }
+
+        char byte[3] = { p[0], p[1], '\0' };
+
+        reg->data[reg->length++] = (uint8_t) strtoul(byte, NULL, 16);
+        p++;
+    }
+    return reg->length > 0;
+}
+static bool sim_parseAction(char * rest, phevSimAction_t * action)
+{
+    char * saveptr = NULL;
+    char * keyword = strtok_r(rest, " \t", &saveptr);
+    uint32_t value = 0;
+
+    if (keyword == NULL)
+    {
+        return false;
+    }
+    if (strcmp(keyword, "register") == 0)
+    {
+        action->type = PHEV_SIM_ACTION_REGISTER;
+        if (!sim_parseNumber(strtok_r(NULL, " \t", &saveptr), &value) || value > 0xff)
+        {
+            return false;
+        }
+        action->reg = (uint8_t) value;
+        return sim_parseData(saveptr, &action->data);
+    }
+    if (strcmp(keyword, "disconnect") == 0)
+    {
+        action->type = PHEV_SIM_ACTION_DISCONNECT;
+        return true;
+    }
+    if (strcmp(keyword, "xor") == 0)
+    {
+        action->type = PHEV_SIM_ACTION_XOR;
+    }
+    else if (strcmp(keyword, "pingxor") == 0)
+    {
+        action->type = PHEV_SIM_ACTION_PING_XOR;
+    }
+    else if (strcmp(keyword, "latency") == 0)
+    {
+        action->type = PHEV_SIM_ACTION_LATENCY;
+    }
+    else if (strcmp(keyword, "loss") == 0)
+    {
+        action->type = PHEV_SIM_ACTION_LOSS;
+    }
+    else
+    {
+        return false;
+    }
+    if (!sim_parseNumber(strtok_r(NULL, " \t", &saveptr), &action->value))
+    {
+        return false;
+    }
+    return action->type == PHEV_SIM_ACTION_LATENCY || action->value <= (action->type == PHEV_SIM_ACTION_LOSS ? 100 : 0xff);
+}
+static bool sim_parseLine(char * line, phevSimScenario_t * scenario)
+{
+    char * saveptr = NULL;
+    char * keyword = strtok_r(line, " \t", &saveptr);
+    char * argument = NULL;
+    uint32_t value = 0;
+
+    if (keyword == NULL || keyword[0] == '#')
+    {
+        return true;
+    }
+    if (strcmp(keyword, "register") == 0)
+    {
+        if (!sim_parseNumber(strtok_r(NULL, " \t", &saveptr), &value) || value > 0xff)
+        {
+            return false;
+        }
+        return sim_parseData(saveptr, &scenario->registers[value]);
+    }
+    if (strcmp(keyword, "at") == 0)
+    {
+        if (scenario->numberOfActions == PHEV_SIM_MAX_ACTIONS || !sim_parseNumber(strtok_r(NULL, " \t", &saveptr), &value))
+        {
+            return false;
+        }
+
+        phevSimAction_t * action = &scenario->actions[scenario->numberOfActions];
+
+        // The timeline is played in order
+        if (scenario->numberOfActions > 0 && value < scenario->actions[scenario->numberOfActions - 1].at)
+        {
+            return false;
+        }
+        memset(action, 0, sizeof(phevSimAction_t));
+        action->at = value;
+
+        if (!sim_parseAction(saveptr, action))
+        {
+            return false;
+        }
+        scenario->numberOfActions++;
+        return true;
+    }
+
+    argument = strtok_r(NULL, " \t", &saveptr);
+
+    if (strcmp(keyword, "address") == 0)
+    {
+        if (argument == NULL || strlen(argument) >= sizeof(scenario->address))
+        {
+            return false;
+        }
+        strcpy(scenario->address, argument);
+        return true;
+    }
+    if (strcmp(keyword, "vin") == 0)
+    {
+        if (argument == NULL || strlen(argument) != VIN_LEN)
+        {
+            return false;
+        }
+        strcpy(scenario->vin, argument);
+        return true;
+    }
+    if (!sim_parseNumber(argument, &value))
+    {
+        return false;
+    }
+    if (strcmp(keyword, "port") == 0 && value <= 0xffff)
+    {
+        scenario->port = (uint16_t) value;
+    }
+    else if (strcmp(keyword, "registrations") == 0 && value <= 0xff)
+    {
+        scenario->registrations = (uint8_t) value;
+    }
+    else if (strcmp(keyword, "my18") == 0)
+    {
+        scenario->my18 = (value != 0);
+    }
+    else if (strcmp(keyword, "xor") == 0 && value <= 0xff)
+    {
+        scenario->xor = (uint8_t) value;
+    }
+    else if (strcmp(keyword, "xor_interval") == 0)
+    {
+        scenario->xorIntervalMs = value;
+    }
+    else if (strcmp(keyword, "latency") == 0)
+    {
+        scenario->latencyMs = value;
+    }
+    else if (strcmp(keyword, "loss") == 0 && value <= 100)
+    {
+        scenario->lossPercent = value;
+    }
+    else if (strcmp(keyword, "seed") == 0)
+    {
+        scenario->seed = value;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+bool phev_sim_parseScenario(const char * text, phevSimScenario_t * scenario)
+{
+    char line[PHEV_SIM_MAX_LINE];
+    int lineNumber = 0;
+
+    while (text && *text)
+    {
+        size_t length = strcspn(text, "\r\n");
+
+        lineNumber++;
+        if (length >= sizeof(line))
+        {
+            LOG_E(APP_TAG, "Scenario line %d too long", lineNumber);
+            return false;
+        }
+        memcpy(line, text, length);
+        line[length] = '\0';
+
+        if (!sim_parseLine(line, scenario))
+        {
+            LOG_E(APP_TAG, "Scenario line %d not understood", lineNumber);
+            return false;
+        }
+        text += length;
+        text += strspn(text, "\r\n");
+    }
+    return true;
+}
+bool phev_sim_loadScenario(const char * path, phevSimScenario_t * scenario)
+{
+    FILE * file = fopen(path, "rb");
+
+    if (file == NULL)
+    {
+        LOG_E(APP_TAG, "Cannot open scenario %s", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+
+    long size = ftell(file);
+    char * text = (size >= 0 ? malloc((size_t) size + 1) : NULL);
+
+    fseek(file, 0, SEEK_SET);
+
+    if (text == NULL || fread(text, 1, (size_t) size, file) != (size_t) size)
+    {
+        LOG_E(APP_TAG, "Cannot read scenario %s", path);
+        free(text);
+        fclose(file);
+        return false;
+    }
+    text[size] = '\0';
+    fclose(file);
+
+    bool ok = phev_sim_parseScenario(text, scenario);
+
+    free(text);
+
+    return ok;
+}
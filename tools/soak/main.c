@@ -0,0 +1,677 @@
+/*
+    Soak and throughput harness.
+
+    Usage: phev_soak [-n sessions] [-d seconds] [-i seconds] [-w seconds]
+                     [-c ms] [-r KB/h] [-l KB/h] [-p profile|mixed] [scenario]
+
+    Starts a simulated car per session, each on a port of its own, and runs
+    the whole stack against it, phev_init to the event handler, for -d
+    seconds or until interrupted. A driver thread per session sends random
+    commands (lights, air conditioning, update all) every -c ms on average
+    through the session's broker socket, the way a local client would, and
+    reads the vehicle state and the broker's update stream in between.
+
+    Every -i seconds it prints frames per second, pipe CPU per session, RSS
+    and the bytes the library has live. At the end it prints the latency
+    percentiles across sessions and fits a line through RSS and live bytes
+    after the -w second warm up. A slope above -r (RSS) or -l (live bytes),
+    in KB per hour, is a leak and the exit code is 2. Live bytes come from
+    the tracking allocator, the sites still holding memory are printed when
+    they grow. Slopes need an hour or more to mean much, short runs are
+    noisy.
+
+    -p runs every session with one protocol profile (pre-my18, my18, my19),
+    mixed deals them out in turn so the fleet shares one process.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include "phev.h"
+#include "phev_sim.h"
+#include "phev_alloc.h"
+#include "phev_histogram.h"
+#include "phev_metrics.h"
+#include "phev_broker.h"
+
+#define SOAK_DEFAULT_SESSIONS 4
+#define SOAK_DEFAULT_DURATION 3600
+#define SOAK_DEFAULT_INTERVAL 60
+#define SOAK_DEFAULT_COMMAND_MS 500
+#define SOAK_STATUS_MS 50
+#define SOAK_DEFAULT_RSS_SLOPE 1024
+#define SOAK_DEFAULT_LIVE_SLOPE 64
+#define SOAK_MAX_SESSIONS 64
+#define SOAK_MAX_SAMPLES 4096
+#define SOAK_TRACKED_BLOCKS 65536
+#define SOAK_REPORT_SIZE 16384
+
+// Enough registers that update all is a burst worth timing.
+static const char * SOAK_REGISTERS =
+    "xor_interval 30000\n"
+    "register 2 00\n"
+    "register 26 00\n"
+    "register 28 00 00 00\n"
+    "register 29 50 00 00 00\n"
+    "register 31 00 00\n"
+    "register 36 00 00 00 00 00 00 00 00 00 00 00 00\n";
+
+typedef struct soakSession_t {
+    int index;
+    phevSim_t * sim;
+    phevCtx_t * phev;
+    char brokerPath[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    pthread_t thread;
+    pthread_t driver;
+    uint32_t random;
+    atomic_ullong commands;
+    atomic_ullong statusReads;
+    atomic_ullong brokerUpdates;
+    atomic_ullong events;
+} soakSession_t;
+
+typedef struct soakSample_t {
+    double seconds;
+    double rssKb;
+    double liveKb;
+} soakSample_t;
+
+typedef struct soak_t {
+    int sessions;
+    uint32_t duration;
+    uint32_t interval;
+    uint32_t warmup;
+    uint32_t commandMs;
+    double maxRssSlope;
+    double maxLiveSlope;
+    bool mixed;
+    phevProfileId_t profile;
+    atomic_bool running;
+    volatile sig_atomic_t interrupted;
+    phevAllocTracker_t * tracker;
+    phevAllocator_t allocator;
+    soakSession_t session[SOAK_MAX_SESSIONS];
+    soakSample_t samples[SOAK_MAX_SAMPLES];
+    size_t numberOfSamples;
+    size_t stride;
+    size_t skipped;
+} soak_t;
+
+static soak_t soak;
+
+static const char * soak_latencyNames[PHEV_PIPE_LATENCY_MAX] = {
+    [PHEV_PIPE_LATENCY_COMMAND_ACK] = "command ack",
+    [PHEV_PIPE_LATENCY_REQUEST_ACK] = "request ack",
+    [PHEV_PIPE_LATENCY_PING_RTT] = "ping rtt",
+    [PHEV_PIPE_LATENCY_RECONNECT] = "reconnect",
+};
+
+static void soak_interrupt(int signal)
+{
+    (void) signal;
+
+    soak.interrupted = 1;
+}
+static void soak_sleepMs(uint32_t ms)
+{
+    struct timespec ts = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (long) (ms % 1000) * 1000000L,
+    };
+    nanosleep(&ts, NULL);
+}
+static uint32_t soak_random(soakSession_t * session)
+{
+    uint32_t x = session->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    session->random = x;
+
+    return x;
+}
+static double soak_rssKb(void)
+{
+    long pages = 0;
+    long resident = 0;
+    FILE * file = fopen("/proc/self/statm", "r");
+
+    if(file == NULL)
+    {
+        return 0;
+    }
+    if(fscanf(file, "%ld %ld", &pages, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(file);
+
+    return (double) resident * (double) sysconf(_SC_PAGESIZE) / 1024.0;
+}
+static uint64_t soak_threadCpuNs(pthread_t thread)
+{
+    clockid_t clock;
+    struct timespec ts;
+
+    if(pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0)
+    {
+        return 0;
+    }
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+static uint64_t soak_processCpuNs(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return ((uint64_t) usage.ru_utime.tv_sec + (uint64_t) usage.ru_stime.tv_sec) * 1000000000ULL
+        + ((uint64_t) usage.ru_utime.tv_usec + (uint64_t) usage.ru_stime.tv_usec) * 1000ULL;
+}
+static uint64_t soak_frames(void)
+{
+    static phevMetricsSnapshot_t snapshot;
+    uint64_t frames = 0;
+
+    for(int i = 0; i < soak.sessions; i++)
+    {
+        phev_metricsSnapshot(soak.session[i].phev, &snapshot);
+
+        for(int cmd = 0; cmd < 256; cmd++)
+        {
+            frames += snapshot.framesIn[cmd] + snapshot.framesOut[cmd];
+        }
+    }
+    return frames;
+}
+// Every sample is kept until the buffer is full, then every other one, then every fourth, so any run length fits.
+static void soak_addSample(double seconds, double rssKb, double liveKb)
+{
+    if(soak.skipped++ % soak.stride != 0)
+    {
+        return;
+    }
+    if(soak.numberOfSamples == SOAK_MAX_SAMPLES)
+    {
+        for(size_t i = 0; i < SOAK_MAX_SAMPLES / 2; i++)
+        {
+            soak.samples[i] = soak.samples[i * 2];
+        }
+        soak.numberOfSamples = SOAK_MAX_SAMPLES / 2;
+        soak.stride *= 2;
+    }
+    soak.samples[soak.numberOfSamples++] = (soakSample_t) {
+        .seconds = seconds,
+        .rssKb = rssKb,
+        .liveKb = liveKb,
+    };
+}
+// Least squares slope in KB per hour of the samples after the warm up, false with fewer than three.
+static bool soak_slope(bool rss, double * slope)
+{
+    double n = 0;
+    double sumT = 0;
+    double sumY = 0;
+    double sumTT = 0;
+    double sumTY = 0;
+
+    for(size_t i = 0; i < soak.numberOfSamples; i++)
+    {
+        const soakSample_t * sample = &soak.samples[i];
+        double y = (rss ? sample->rssKb : sample->liveKb);
+
+        if(sample->seconds < soak.warmup)
+        {
+            continue;
+        }
+        n++;
+        sumT += sample->seconds;
+        sumY += y;
+        sumTT += sample->seconds * sample->seconds;
+        sumTY += sample->seconds * y;
+    }
+    double denominator = n * sumTT - sumT * sumT;
+
+    if(n < 3 || denominator <= 0)
+    {
+        return false;
+    }
+    *slope = (n * sumTY - sumT * sumY) / denominator * 3600.0;
+
+    return true;
+}
+static int soak_eventHandler(phevEvent_t * event)
+{
+    soakSession_t * session = (soakSession_t *) phev_getUserCtx(event->ctx);
+
+    atomic_fetch_add_explicit(&session->events, 1, memory_order_relaxed);
+
+    return 0;
+}
+static void * soak_sessionThread(void * arg)
+{
+    soakSession_t * session = (soakSession_t *) arg;
+
+    phev_start(session->phev);
+
+    return NULL;
+}
+static bool soak_send(int soc, const char * line)
+{
+    size_t length = strlen(line);
+
+    return send(soc, line, length, MSG_NOSIGNAL) == (ssize_t) length;
+}
+static int soak_connectBroker(const soakSession_t * session)
+{
+    struct sockaddr_un addr;
+    int soc = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(soc < 0)
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, session->brokerPath, sizeof(addr.sun_path) - 1);
+
+    if(connect(soc, (struct sockaddr *) &addr, sizeof(addr)) != 0 || !soak_send(soc, "subscribe all\n"))
+    {
+        close(soc);
+        return -1;
+    }
+    return soc;
+}
+static bool soak_command(soakSession_t * session, int soc)
+{
+    char line[32];
+    uint32_t pick = soak_random(session);
+    int value = (pick & 0x100 ? 1 : 2);
+
+    switch(pick % 4)
+    {
+        case 0:
+            snprintf(line, sizeof(line), "set %d %02x\n", KO_WF_H_LAMP_CONT_SP, value);
+            break;
+        case 1:
+            snprintf(line, sizeof(line), "set %d %02x\n", KO_WF_P_LAMP_CONT_SP, value);
+            break;
+        case 2:
+            snprintf(line, sizeof(line), "set %d %02x\n", KO_WF_MANUAL_AC_ON_RQ_SP, value);
+            break;
+        default:
+            snprintf(line, sizeof(line), "set %d 03\n", KO_WF_EV_UPDATE_SP);
+            break;
+    }
+    atomic_fetch_add_explicit(&session->commands, 1, memory_order_relaxed);
+
+    return soak_send(soc, line);
+}
+// Counts the update lines, keeping a partial line for the next read.
+static bool soak_readBroker(soakSession_t * session, int soc, char * buffer, size_t * length, size_t size)
+{
+    ssize_t num = recv(soc, buffer + *length, size - *length, 0);
+
+    if(num <= 0)
+    {
+        return false;
+    }
+    *length += (size_t) num;
+
+    size_t start = 0;
+
+    for(size_t i = 0; i < *length; i++)
+    {
+        if(buffer[i] == '\n')
+        {
+            if(i - start > 7 && memcmp(buffer + start, "update ", 7) == 0)
+            {
+                atomic_fetch_add_explicit(&session->brokerUpdates, 1, memory_order_relaxed);
+            }
+            start = i + 1;
+        }
+    }
+    if(start == 0 && *length == size)
+    {
+        // A line longer than the buffer, nothing the broker sends
+        start = *length;
+    }
+    memmove(buffer, buffer + start, *length - start);
+    *length -= start;
+
+    return true;
+}
+static void * soak_driverThread(void * arg)
+{
+    soakSession_t * session = (soakSession_t *) arg;
+    char buffer[PHEV_BROKER_MAX_LINE * 4];
+    size_t length = 0;
+    int soc = -1;
+    uint64_t nextCommand = phev_core_monotonicMs() + soak.commandMs;
+    uint64_t nextStatus = 0;
+    phevVehicleState_t state;
+
+    while(atomic_load(&soak.running))
+    {
+        if(soc < 0)
+        {
+            soc = soak_connectBroker(session);
+            length = 0;
+
+            if(soc < 0)
+            {
+                soak_sleepMs(100);
+                continue;
+            }
+        }
+        uint64_t now = phev_core_monotonicMs();
+
+        if(now >= nextCommand)
+        {
+            if(!soak_command(session, soc))
+            {
+                close(soc);
+                soc = -1;
+                continue;
+            }
+            // Anywhere from half to one and a half times the interval
+            nextCommand = now + soak.commandMs / 2 + soak_random(session) % (soak.commandMs + 1);
+        }
+        if(now >= nextStatus)
+        {
+            phev_vehicleState(session->phev, &state);
+            atomic_fetch_add_explicit(&session->statusReads, 1, memory_order_relaxed);
+            nextStatus = now + SOAK_STATUS_MS;
+        }
+
+        uint64_t next = (nextCommand < nextStatus ? nextCommand : nextStatus);
+        struct pollfd fds = {.fd = soc, .events = POLLIN};
+
+        if(poll(&fds, 1, (int) (next > now ? next - now : 0)) > 0 && !soak_readBroker(session, soc, buffer, &length, sizeof(buffer)))
+        {
+            close(soc);
+            soc = -1;
+        }
+    }
+    if(soc >= 0)
+    {
+        close(soc);
+    }
+    return NULL;
+}
+static bool soak_startSession(soakSession_t * session, int index, const phevSimScenario_t * scenario)
+{
+    uint8_t mac[MAC_ADDR_SIZE] = {0x02, 0x50, 0x48, 0x45, 0x56, (uint8_t) index};
+
+    session->index = index;
+    session->random = 0x9e3779b9u * (uint32_t) (index + 1);
+    session->sim = phev_sim_create(scenario);
+
+    if(session->sim == NULL || !phev_sim_start(session->sim))
+    {
+        fprintf(stderr, "Cannot start the simulator for session %d\n", index);
+        return false;
+    }
+    snprintf(session->brokerPath, sizeof(session->brokerPath), "/tmp/phev_soak_%d_%d.sock", (int) getpid(), index);
+
+    phevSettings_t settings = {
+        .host = "127.0.0.1",
+        .port = phev_sim_port(session->sim),
+        .mac = mac,
+        .my18 = scenario->my18,
+        .profile = (soak.mixed ? (phevProfileId_t) (PHEV_PROFILE_PRE_MY18 + index % (PHEV_PROFILE_MAX - PHEV_PROFILE_PRE_MY18)) : soak.profile),
+        .handler = soak_eventHandler,
+        .ctx = session,
+        .brokerPath = session->brokerPath,
+        .allocator = &soak.allocator,
+    };
+    session->phev = phev_init(settings);
+
+    if(session->phev == NULL)
+    {
+        fprintf(stderr, "Cannot create session %d\n", index);
+        return false;
+    }
+    return pthread_create(&session->thread, NULL, soak_sessionThread, session) == 0
+        && pthread_create(&session->driver, NULL, soak_driverThread, session) == 0;
+}
+static void soak_printLatency(void)
+{
+    for(int kind = 0; kind < PHEV_PIPE_LATENCY_MAX; kind++)
+    {
+        phevHistogram_t * total = phev_histogram_create();
+
+        for(int i = 0; i < soak.sessions; i++)
+        {
+            phev_histogram_merge(total, phev_pipe_getLatency(soak.session[i].phev->serviceCtx->pipe, (phevPipeLatency_t) kind));
+        }
+        printf("%-12s count %" PRIu64 " p50 %" PRIu64 "us p90 %" PRIu64 "us p99 %" PRIu64 "us p99.9 %" PRIu64 "us max %" PRIu64 "us\n",
+            soak_latencyNames[kind], phev_histogram_count(total),
+            phev_histogram_percentile(total, 50), phev_histogram_percentile(total, 90),
+            phev_histogram_percentile(total, 99), phev_histogram_percentile(total, 99.9),
+            phev_histogram_max(total));
+
+        phev_histogram_destroy(total);
+    }
+}
+static bool soak_checkSlope(const char * name, bool rss, double limit)
+{
+    double slope = 0;
+
+    if(!soak_slope(rss, &slope))
+    {
+        printf("%s slope: not enough samples after the warm up\n", name);
+        return true;
+    }
+    printf("%s slope %.1f KB/h, limit %.1f KB/h: %s\n", name, slope, limit, (slope > limit ? "FAIL" : "ok"));
+
+    return slope <= limit;
+}
+static void soak_usage(const char * name)
+{
+    fprintf(stderr, "Usage: %s [-n sessions] [-d seconds] [-i seconds] [-w seconds] [-c ms] [-r KB/h] [-l KB/h] [-p profile|mixed] [scenario]\n", name);
+}
+int main(int argc, char * argv[])
+{
+    static phevSimScenario_t scenario;
+    const char * path = NULL;
+    long warmup = -1;
+
+    soak.sessions = SOAK_DEFAULT_SESSIONS;
+    soak.duration = SOAK_DEFAULT_DURATION;
+    soak.interval = SOAK_DEFAULT_INTERVAL;
+    soak.commandMs = SOAK_DEFAULT_COMMAND_MS;
+    soak.maxRssSlope = SOAK_DEFAULT_RSS_SLOPE;
+    soak.maxLiveSlope = SOAK_DEFAULT_LIVE_SLOPE;
+    soak.stride = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        bool hasValue = (argv[i][0] == '-' && i + 1 < argc);
+
+        if(hasValue && strcmp(argv[i], "-n") == 0)
+        {
+            soak.sessions = atoi(argv[++i]);
+        }
+        else if(hasValue && strcmp(argv[i], "-d") == 0)
+        {
+            soak.duration = (uint32_t) strtoul(argv[++i], NULL, 0);
+        }
+        else if(hasValue && strcmp(argv[i], "-i") == 0)
+        {
+            soak.interval = (uint32_t) strtoul(argv[++i], NULL, 0);
+        }
+        else if(hasValue && strcmp(argv[i], "-w") == 0)
+        {
+            warmup = strtol(argv[++i], NULL, 0);
+        }
+        else if(hasValue && strcmp(argv[i], "-c") == 0)
+        {
+            soak.commandMs = (uint32_t) strtoul(argv[++i], NULL, 0);
+        }
+        else if(hasValue && strcmp(argv[i], "-r") == 0)
+        {
+            soak.maxRssSlope = strtod(argv[++i], NULL);
+        }
+        else if(hasValue && strcmp(argv[i], "-l") == 0)
+        {
+            soak.maxLiveSlope = strtod(argv[++i], NULL);
+        }
+        else if(hasValue && strcmp(argv[i], "-p") == 0)
+        {
+            soak.mixed = (strcmp(argv[++i], "mixed") == 0);
+            soak.profile = (soak.mixed ? PHEV_PROFILE_DEFAULT : phev_profile_fromName(argv[i]));
+        }
+        else if(path == NULL && argv[i][0] != '-')
+        {
+            path = argv[i];
+        }
+        else
+        {
+            soak_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(soak.sessions < 1 || soak.sessions > SOAK_MAX_SESSIONS || soak.interval == 0 || soak.commandMs == 0 || soak.profile == PHEV_PROFILE_MAX)
+    {
+        soak_usage(argv[0]);
+        return 1;
+    }
+    soak.warmup = (warmup >= 0 ? (uint32_t) warmup : soak.duration / 10);
+
+    phev_sim_defaultScenario(&scenario);
+
+    if(path ? !phev_sim_loadScenario(path, &scenario) : !phev_sim_parseScenario(SOAK_REGISTERS, &scenario))
+    {
+        fprintf(stderr, "Cannot load scenario %s\n", (path ? path : "(built in)"));
+        return 1;
+    }
+    scenario.port = 0;
+
+    soak.tracker = phev_alloc_createTracker(NULL, SOAK_TRACKED_BLOCKS);
+    soak.allocator = phev_alloc_trackerAllocator(soak.tracker);
+    atomic_init(&soak.running, true);
+
+    signal(SIGINT, soak_interrupt);
+    signal(SIGTERM, soak_interrupt);
+    signal(SIGPIPE, SIG_IGN);
+
+    for(int i = 0; i < soak.sessions; i++)
+    {
+        if(!soak_startSession(&soak.session[i], i, &scenario))
+        {
+            return 1;
+        }
+    }
+    printf("%d sessions for %u s, a command every %u ms per session, report every %u s, warm up %u s\n",
+        soak.sessions, soak.duration, soak.commandMs, soak.interval, soak.warmup);
+    fflush(stdout);
+
+    uint64_t start = phev_core_monotonicMs();
+    uint64_t last = start;
+    uint64_t lastFrames = 0;
+    uint64_t lastProcessCpu = soak_processCpuNs();
+    uint64_t lastCpu[SOAK_MAX_SESSIONS] = {0};
+    double firstRss = soak_rssKb();
+
+    while(!soak.interrupted && phev_core_monotonicMs() - start < (uint64_t) soak.duration * 1000)
+    {
+        uint64_t due = last + (uint64_t) soak.interval * 1000;
+
+        while(!soak.interrupted && phev_core_monotonicMs() < due && phev_core_monotonicMs() - start < (uint64_t) soak.duration * 1000)
+        {
+            soak_sleepMs(100);
+        }
+        uint64_t now = phev_core_monotonicMs();
+        double elapsed = (double) (now - last) / 1000.0;
+
+        if(elapsed <= 0)
+        {
+            break;
+        }
+        uint64_t frames = soak_frames();
+        uint64_t processCpu = soak_processCpuNs();
+        uint64_t sessionCpu = 0;
+
+        for(int i = 0; i < soak.sessions; i++)
+        {
+            uint64_t cpu = soak_threadCpuNs(soak.session[i].thread);
+
+            sessionCpu += cpu - lastCpu[i];
+            lastCpu[i] = cpu;
+        }
+        phevAllocStats_t alloc = phev_alloc_trackerStats(soak.tracker);
+        double seconds = (double) (now - start) / 1000.0;
+        double rss = soak_rssKb();
+
+        soak_addSample(seconds, rss, (double) alloc.liveBytes / 1024.0);
+
+        printf("%8.0f s  %9.0f frames/s  cpu %5.2f%% per session %5.1f%% process  rss %8.0f KB  live %7.1f KB in %zu blocks\n",
+            seconds, (double) (frames - lastFrames) / elapsed,
+            (double) sessionCpu / soak.sessions / (elapsed * 1e7), (double) (processCpu - lastProcessCpu) / (elapsed * 1e7),
+            rss, (double) alloc.liveBytes / 1024.0, alloc.liveBlocks);
+        fflush(stdout);
+
+        last = now;
+        lastFrames = frames;
+        lastProcessCpu = processCpu;
+    }
+    atomic_store(&soak.running, false);
+
+    for(int i = 0; i < soak.sessions; i++)
+    {
+        pthread_join(soak.session[i].driver, NULL);
+        phev_exit(soak.session[i].phev);
+        pthread_join(soak.session[i].thread, NULL);
+    }
+
+    double seconds = (double) (phev_core_monotonicMs() - start) / 1000.0;
+    uint64_t commands = 0;
+    uint64_t statusReads = 0;
+    uint64_t brokerUpdates = 0;
+    uint64_t events = 0;
+
+    for(int i = 0; i < soak.sessions; i++)
+    {
+        commands += atomic_load(&soak.session[i].commands);
+        statusReads += atomic_load(&soak.session[i].statusReads);
+        brokerUpdates += atomic_load(&soak.session[i].brokerUpdates);
+        events += atomic_load(&soak.session[i].events);
+    }
+    printf("\n%.0f s, %" PRIu64 " frames, %.0f frames/s\n", seconds, soak_frames(), (double) soak_frames() / seconds);
+    printf("%" PRIu64 " commands, %" PRIu64 " events, %" PRIu64 " state reads, %" PRIu64 " broker updates\n",
+        commands, events, statusReads, brokerUpdates);
+    soak_printLatency();
+    printf("rss %.0f KB at start, %.0f KB at the end\n", firstRss, soak_rssKb());
+
+    bool ok = soak_checkSlope("rss", true, soak.maxRssSlope);
+
+    if(!soak_checkSlope("live", false, soak.maxLiveSlope))
+    {
+        char * report = malloc(SOAK_REPORT_SIZE);
+
+        if(report)
+        {
+            phev_alloc_formatReport(soak.tracker, soak_frames(), report, SOAK_REPORT_SIZE);
+            printf("%s", report);
+            free(report);
+        }
+        ok = false;
+    }
+    for(int i = 0; i < soak.sessions; i++)
+    {
+        phev_sim_destroy(soak.session[i].sim);
+        remove(soak.session[i].brokerPath);
+    }
+    return (ok ? 0 : 2);
+}
@@ -0,0 +1,184 @@
+/*
+    Frame trace to Chrome trace JSON.
+
+    Usage: phev_trace trace [out.json]
+
+    Reads a trace written by phev_traceSave and writes it in the Chrome
+    trace event format, for chrome://tracing or Perfetto, to out.json or
+    stdout. Every record is an instant event on a lane for its stage, a
+    register update is a span from sent to the car's ack and the keys are
+    counters, so a stall or a key change shows against the frames around it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "phev_trace.h"
+
+#define TRACE_PID 1
+
+enum {
+    TRACE_LANE_RECEIVE = 1,
+    TRACE_LANE_ACK,
+    TRACE_LANE_EVENT,
+    TRACE_LANE_COMMAND,
+    TRACE_LANE_XOR,
+};
+
+static const char * trace_laneNames[] = {
+    [TRACE_LANE_RECEIVE] = "receive",
+    [TRACE_LANE_ACK] = "acks",
+    [TRACE_LANE_EVENT] = "events",
+    [TRACE_LANE_COMMAND] = "commands",
+    [TRACE_LANE_XOR] = "xor",
+};
+
+static int trace_lane(uint8_t point)
+{
+    switch(point)
+    {
+        case PHEV_TRACE_FRAME_ACKED: return TRACE_LANE_ACK;
+        case PHEV_TRACE_EVENT_DISPATCHED: return TRACE_LANE_EVENT;
+        case PHEV_TRACE_COMMAND_QUEUED:
+        case PHEV_TRACE_COMMAND_SENT:
+        case PHEV_TRACE_COMMAND_ACKED: return TRACE_LANE_COMMAND;
+        case PHEV_TRACE_XOR_CHANGED: return TRACE_LANE_XOR;
+        default: return TRACE_LANE_RECEIVE;
+    }
+}
+// Chrome wants microseconds, kept to the nanosecond.
+static void trace_timestamp(FILE * out, uint64_t ns)
+{
+    fprintf(out, "%" PRIu64 ".%03u", ns / 1000, (unsigned) (ns % 1000));
+}
+static void trace_separator(FILE * out, bool * first)
+{
+    fputs(*first ? "\n" : ",\n", out);
+    *first = false;
+}
+static void trace_instant(FILE * out, const phevTraceRecord_t * record, uint64_t ns, bool * first)
+{
+    trace_separator(out, first);
+    fprintf(out, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":",
+        phev_trace_pointName(record->point), TRACE_PID, trace_lane(record->point));
+    trace_timestamp(out, ns);
+    fprintf(out, ",\"args\":{\"command\":\"%02X\",\"reg\":\"%02X\",\"xor\":\"%02X\",\"arg\":%u}}",
+        record->command, record->reg, record->xor, (unsigned) record->arg);
+}
+static void trace_span(FILE * out, const char * phase, uint8_t reg, uint64_t ns, bool * first)
+{
+    trace_separator(out, first);
+    fprintf(out, "{\"name\":\"register %02X\",\"cat\":\"command\",\"ph\":\"%s\",\"id\":%u,\"pid\":%d,\"tid\":%d,\"ts\":",
+        reg, phase, reg, TRACE_PID, TRACE_LANE_COMMAND);
+    trace_timestamp(out, ns);
+    fputs("}", out);
+}
+static void trace_counter(FILE * out, const uint8_t keys[3], uint64_t ns, bool * first)
+{
+    trace_separator(out, first);
+    fprintf(out, "{\"name\":\"xor\",\"ph\":\"C\",\"pid\":%d,\"ts\":", TRACE_PID);
+    trace_timestamp(out, ns);
+    fprintf(out, ",\"args\":{\"current\":%u,\"ping\":%u,\"command\":%u}}", keys[0], keys[1], keys[2]);
+}
+int main(int argc, char * argv[])
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "Usage: %s trace [out.json]\n", argv[0]);
+        return 1;
+    }
+    phevTraceReader_t * reader = phev_trace_openReader(argv[1]);
+
+    if(reader == NULL)
+    {
+        fprintf(stderr, "Cannot read trace %s\n", argv[1]);
+        return 1;
+    }
+    FILE * out = (argc > 2 ? fopen(argv[2], "w") : stdout);
+
+    if(out == NULL)
+    {
+        fprintf(stderr, "Cannot open %s\n", argv[2]);
+        phev_trace_closeReader(reader);
+        return 1;
+    }
+    phevTraceRecord_t record;
+    bool open[256] = {false};
+    uint8_t keys[3] = {0, 0, 0};
+    uint64_t start = 0;
+    uint64_t last = 0;
+    uint64_t records = 0;
+    bool first = true;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+
+    for(size_t i = 1; i < sizeof(trace_laneNames) / sizeof(trace_laneNames[0]); i++)
+    {
+        trace_separator(out, &first);
+        fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+            TRACE_PID, i, trace_laneNames[i]);
+    }
+    while(phev_trace_next(reader, &record))
+    {
+        if(records++ == 0)
+        {
+            start = record.timestamp;
+        }
+        // Records from different threads can land slightly out of order
+        uint64_t ns = (record.timestamp > start ? record.timestamp - start : 0);
+
+        last = ns;
+        trace_instant(out, &record, ns, &first);
+
+        switch(record.point)
+        {
+            case PHEV_TRACE_COMMAND_SENT:
+                // A resend stays in the span of the first send
+                if(!open[record.reg])
+                {
+                    open[record.reg] = true;
+                    trace_span(out, "b", record.reg, ns, &first);
+                }
+                break;
+            case PHEV_TRACE_COMMAND_ACKED:
+                if(open[record.reg])
+                {
+                    open[record.reg] = false;
+                    trace_span(out, "e", record.reg, ns, &first);
+                }
+                break;
+            case PHEV_TRACE_XOR_CHANGED:
+                for(int key = 0; key < 3; key++)
+                {
+                    if(record.arg & (1u << key))
+                    {
+                        keys[key] = record.xor;
+                    }
+                }
+                trace_counter(out, keys, ns, &first);
+                break;
+            default:
+                break;
+        }
+    }
+    // Commands never acked run to the end of the trace
+    for(int reg = 0; reg < 256; reg++)
+    {
+        if(open[reg])
+        {
+            trace_span(out, "e", (uint8_t) reg, last, &first);
+        }
+    }
+    fputs("\n]}\n", out);
+
+    phev_trace_closeReader(reader);
+
+    if(out != stdout && fclose(out) != 0)
+    {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(stderr, "%" PRIu64 " records\n", records);
+
+    return 0;
+}